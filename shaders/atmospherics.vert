@@ -14,7 +14,8 @@ void main()
 {
 	outUV = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
 
-	vec4 position = vec4(outUV * 2.0f - 1.0f, 0.0f, 1.0f);
+	// On the far plane so the depth test rejects everything covered by geometry
+	vec4 position = vec4(outUV * 2.0f - 1.0f, 1.0f, 1.0f);
 	gl_Position = position;
 
 	mat4 invViewProj = SAtmosphericsVertexPushConstants.m_InvViewProjectionMatrix;
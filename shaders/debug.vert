@@ -1,9 +1,14 @@
 #version 450
 
-layout (binding = 0) uniform UniformBufferObject 
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Must match EBufferIndices in ResourceManager.hpp
+#define BINDLESS_DEBUG_LINES 4
+
+layout (set = 0, binding = 0) uniform UniformBufferObject 
 {
     mat4 m_ViewProjectionMatrix;
-} SDebugRenderConstants;
+} SDebugRenderConstants[];
 
 layout (location = 0) in vec3 inWorldPosition;
 layout (location = 1) in vec3 inColor;
@@ -12,6 +17,6 @@ layout (location = 1) out vec4 outColor;
 
 void main()
 {
-	gl_Position = SDebugRenderConstants.m_ViewProjectionMatrix * vec4(inWorldPosition, 1.0);
+	gl_Position = SDebugRenderConstants[BINDLESS_DEBUG_LINES].m_ViewProjectionMatrix * vec4(inWorldPosition, 1.0);
 	outColor = vec4(inColor, 1.0f);
 }
\ No newline at end of file
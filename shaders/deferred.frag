@@ -1,124 +1,369 @@
 #version 450
-#define NUM_LIGHTS 1
+
+// Must match LightingNode.cpp and lightculling.comp
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+// Must match ShadowNode.hpp
+#define MAX_SHADOW_CASCADES       4
+#define MAX_SHADOW_FILTER_SAMPLES 32
+
+// Must match EShadowFilterMode in ShadowNode.hpp
+#define SHADOW_FILTER_HARDWARE     0
+#define SHADOW_FILTER_POISSON      1
+#define SHADOW_FILTER_ROTATED_GRID 2
+#define SHADOW_FILTER_PCSS         3
+
+// Must match ESkyResolution in SkyNode.hpp
+#define SKY_RESOLUTION_PANORAMIC 3
+
+#define M_PI 3.1415926535897932384626433832795
 
 // Texture sampler G-Buffer
-layout (binding = 0) uniform sampler2D GBufferPositions;
-layout (binding = 1) uniform sampler2D GBufferNormals;
-layout (binding = 2) uniform sampler2D GBufferAlbedo;
-layout (binding = 3) uniform sampler2D GBufferDepth;
-layout (binding = 4) uniform sampler2D ShadowMapBuffer;
-layout (binding = 5) uniform sampler2D AtmosphericsBuffer;
-
-// Per Light data
-struct SLight
-{
-	mat4   m_LightMatrix;
-	vec3   m_Position;
-	float  m_Radius;
-	vec3   m_Color;
-	float  m_Intensity;
-};
+layout (binding = 0) uniform sampler2D GBufferNormals;
+layout (binding = 1) uniform sampler2D GBufferAlbedo;
+layout (binding = 2) uniform sampler2D GBufferDepth;
+layout (binding = 3) uniform sampler2DArrayShadow ShadowMapBuffer; // One layer per cascade. Comparison sampler
+layout (binding = 4) uniform sampler2D AtmosphericsBuffer;
 
 // Deferred lighting uniform buffer constants
-layout (binding = 6) uniform UBO
+layout (binding = 5) uniform UBO
 {
-	SLight m_Lights[NUM_LIGHTS];
-	vec3   m_ViewPos;
-	float  m_Pad1;
+	mat4  m_CascadeMatrices[MAX_SHADOW_CASCADES];
+	vec4  m_CascadeSplits;  // View space far distance of each cascade
+	vec4  m_SunDirection;   // Towards the sun
+	vec4  m_SunColor;       // Color premultiplied with intensity
+	vec3  m_ViewPos;
+	uint  m_NumCascades;
+	vec4  m_CascadeWorldSizes[MAX_SHADOW_CASCADES]; // x width, y depth range, z texel size in world units
+	uvec4 m_ShadowFilterMode;                       // x mode, y number of samples
+	vec4  m_ShadowFilterParams;                     // x radius in texels, y tan of half the sun angle, z normal offset in texels, w max penumbra in texels
+	mat4  m_InvViewProjection;
+	mat4  m_ViewMatrix;
+	uvec4 m_ClusterGridSize; // xyz number of clusters, w number of lights
+	vec2  m_TileSize;        // Size of a cluster in pixels
+	vec2  m_ScreenSize;
+	float m_Near;
+	float m_Far;
+	uint  m_VisualizeCascades;
+	uint  m_SkyResolution;
+	vec4  m_SkyUVScale;     // xy screen uv to sky box uv, zw max uv
 } SDeferredLightingConstants;
 
+struct SPointLight
+{
+	vec4 m_PositionRadius;
+	vec4 m_ColorIntensity;
+};
+
+// Written by lightculling.comp
+layout (std430, binding = 6) readonly buffer PointLights
+{
+	SPointLight m_PointLights[];
+};
+
+layout (std430, binding = 7) readonly buffer ClusterLightCounts
+{
+	uint m_ClusterLightCounts[];
+};
+
+layout (std430, binding = 8) readonly buffer ClusterLightIndices
+{
+	uint m_ClusterLightIndices[];
+};
+
+// Same image as ShadowMapBuffer without comparison. For the PCSS blocker search
+layout (binding = 9) uniform sampler2DArray ShadowMapDepth;
+
+// Best candidate points in the unit disk. Any prefix of the list is still well spread out so the sample count can be anything
+const vec2 PoissonDisk[MAX_SHADOW_FILTER_SAMPLES] = vec2[](
+	vec2(-0.0507f, 0.0055f), vec2(0.6404f, 0.0175f), vec2(0.3091f, 0.5839f), vec2(0.2890f, -0.5754f),
+	vec2(-0.3775f, -0.5472f), vec2(-0.3920f, 0.5267f), vec2(-0.6719f, 0.0709f), vec2(-0.7329f, -0.3225f),
+	vec2(0.7091f, -0.3575f), vec2(-0.0545f, -0.7628f), vec2(0.3160f, -0.1879f), vec2(0.6192f, 0.3910f),
+	vec2(-0.1395f, 0.7964f), vec2(-0.0550f, 0.3714f), vec2(0.2838f, 0.1894f), vec2(-0.2826f, -0.2235f),
+	vec2(-0.0177f, -0.4110f), vec2(-0.3158f, 0.2123f), vec2(-0.6728f, 0.4701f), vec2(0.2044f, 0.8467f),
+	vec2(-0.5539f, -0.1474f), vec2(0.2076f, -0.8220f), vec2(0.5870f, -0.6429f), vec2(0.8800f, -0.0347f),
+	vec2(-0.6242f, -0.5793f), vec2(0.5571f, 0.6638f), vec2(-0.7776f, 0.2657f), vec2(0.4561f, -0.3774f),
+	vec2(-0.3792f, -0.0057f), vec2(0.8327f, 0.2843f), vec2(-0.8751f, -0.0751f), vec2(-0.4061f, 0.7615f)
+);
+
 layout (location = 0) in  vec2 inUV;
 layout (location = 0) out vec4 outFragColor;
 
-float CalculateShadow(vec4 fragPosLightSpace)
+// See geometry.frag for the encoding
+vec3 DecodeOctahedral(vec2 encodedNormal)
+{
+	encodedNormal = encodedNormal * 2.0f - 1.0f;
+
+	vec3  normal = vec3(encodedNormal.xy, 1.0f - abs(encodedNormal.x) - abs(encodedNormal.y));
+	float fold   = clamp(-normal.z, 0.0f, 1.0f);
+	normal.x += normal.x >= 0.0f ? -fold : fold;
+	normal.y += normal.y >= 0.0f ? -fold : fold;
+
+	return normalize(normal);
+}
+
+vec2 UnpackMetalnessFresnel(float packedValue)
+{
+	uint packedBits = uint(round(packedValue * 255.0f));
+	return vec2(float(packedBits >> 4), float(packedBits & 15u)) / 15.0f;
+}
+
+// Screen uv and depth back to world space. Uv maps directly to NDC, see deferred.vert
+vec3 ReconstructWorldPosition(vec2 uv, float depth)
+{
+	vec4 worldPosition = SDeferredLightingConstants.m_InvViewProjection * vec4(uv * 2.0f - 1.0f, depth, 1.0f);
+	return worldPosition.xyz / worldPosition.w;
+}
+
+// Sky might only cover part of the sky box, see ESkyResolution in SkyNode.hpp
+vec2 GetSkyUV(vec2 uv)
+{
+	// Equirectangular. Inverse is in atmospherics.frag
+	if (SDeferredLightingConstants.m_SkyResolution == SKY_RESOLUTION_PANORAMIC)
+	{
+		vec3 rayDirection = normalize(ReconstructWorldPosition(uv, 1.0f) - SDeferredLightingConstants.m_ViewPos);
+		uv = vec2(atan(rayDirection.z, rayDirection.x) / (2.0f * M_PI) + 0.5f, 0.5f - asin(clamp(rayDirection.y, -1.0f, 1.0f)) / M_PI);
+	}
+
+	// Bilinear upsample. Clamped so it never reads outside of the part that was rendered
+	return min(uv * SDeferredLightingConstants.m_SkyUVScale.xy, SDeferredLightingConstants.m_SkyUVScale.zw);
+}
+
+// Distance along the camera forward axis
+float GetViewDepth(vec3 worldPosition)
+{
+	return -(SDeferredLightingConstants.m_ViewMatrix * vec4(worldPosition, 1.0f)).z;
+}
+
+// Closest cascade that covers the fragment
+uint GetShadowCascade(float viewDepth)
+{
+	uint cascade = 0;
+	for (uint i = 0; i < SDeferredLightingConstants.m_NumCascades - 1; i++)
+	{
+		if (viewDepth > SDeferredLightingConstants.m_CascadeSplits[i])
+			cascade = i + 1;
+	}
+	return cascade;
+}
+
+// Per pixel noise for rotating the filter kernels. Trades banding for noise
+float InterleavedGradientNoise(vec2 pixel)
+{
+	return fract(52.9829189f * fract(dot(pixel, vec2(0.06711056f, 0.00583715f))));
+}
+
+// Each sample is a bilinear 2x2 comparison thanks to the sampler
+float FilterPoisson(vec2 uv, float cascade, float receiverDepth, float radiusUV, mat2 rotation, uint numSamples)
+{
+	float shadow = 0.0f;
+	for (uint i = 0; i < numSamples; i++)
+	{
+		vec2 offset = rotation * PoissonDisk[i] * radiusUV;
+		shadow += texture(ShadowMapBuffer, vec4(uv + offset, cascade, receiverDepth));
+	}
+	return shadow / float(numSamples);
+}
+
+// Regular grid turned by the per pixel rotation. Uses the biggest square grid that fits in the sample count
+float FilterRotatedGrid(vec2 uv, float cascade, float receiverDepth, float radiusUV, mat2 rotation, uint numSamples)
+{
+	uint gridSize = max(uint(sqrt(float(numSamples))), 1u);
+
+	float shadow = 0.0f;
+	for (uint y = 0; y < gridSize; y++)
+	{
+		for (uint x = 0; x < gridSize; x++)
+		{
+			vec2 gridPosition = (vec2(x, y) + 0.5f) / float(gridSize) * 2.0f - 1.0f;
+			vec2 offset = rotation * gridPosition * radiusUV;
+			shadow += texture(ShadowMapBuffer, vec4(uv + offset, cascade, receiverDepth));
+		}
+	}
+	return shadow / float(gridSize * gridSize);
+}
+
+// Average depth of everything between the receiver and the sun inside the search region. Negative if there are no blockers
+float FindAverageBlockerDepth(vec2 uv, float cascade, float receiverDepth, float searchRadiusUV, mat2 rotation, uint numSamples)
+{
+	float blockerDepthSum = 0.0f;
+	uint  numBlockers     = 0;
+	for (uint i = 0; i < numSamples; i++)
+	{
+		vec2  offset = rotation * PoissonDisk[i] * searchRadiusUV;
+		float depth  = textureLod(ShadowMapDepth, vec3(uv + offset, cascade), 0.0f).r;
+		if (depth < receiverDepth)
+		{
+			blockerDepthSum += depth;
+			numBlockers++;
+		}
+	}
+	return numBlockers > 0 ? blockerDepthSum / float(numBlockers) : -1.0f;
+}
+
+float CalculateShadow(vec3 worldPosition, vec3 normal, uint cascade)
 {
-	// Perspective divide to get normalized device coordinates [-1,1]
-	vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-	
+	// Outside the last cascade nothing is shadowed
+	if (cascade == SDeferredLightingConstants.m_NumCascades - 1 && GetViewDepth(worldPosition) > SDeferredLightingConstants.m_CascadeSplits[cascade])
+		return 1.0f;
+
+	const vec4  cascadeWorldSize = SDeferredLightingConstants.m_CascadeWorldSizes[cascade];
+	const vec4  filterParams     = SDeferredLightingConstants.m_ShadowFilterParams;
+	const uint  filterMode       = SDeferredLightingConstants.m_ShadowFilterMode.x;
+	const uint  numSamples       = clamp(SDeferredLightingConstants.m_ShadowFilterMode.y, 1u, uint(MAX_SHADOW_FILTER_SAMPLES));
+
+	// Push the receiver along its normal by about a texel. Takes care of the acne the slope scaled bias in the shadow pass doesn't
+	vec3 offsetPosition = worldPosition + normal * cascadeWorldSize.z * filterParams.z;
+
+	// Move world space fragment to light view space. Orthographic so no perspective divide needed
+	vec3 projCoords = (SDeferredLightingConstants.m_CascadeMatrices[cascade] * vec4(offsetPosition, 1.0f)).xyz;
+
 	// NDC [-1,1] to UV space [0, 1] 
-	vec2 shadowMapUV = projCoords.xy * vec2(0.5f, 0.5f) + vec2(0.5f, 0.5f);
-	
-	float currentDepth   = clamp(projCoords.z, 0.0f, 1.0f);
-	float shadowMapDepth = texture(ShadowMapBuffer, shadowMapUV).r;
-
-	const float bias = 0.05f;
-	float shadow = ( currentDepth - bias ) < shadowMapDepth ? 1.0f : 0.0f;
-	
-	return shadow;
+	vec2  shadowMapUV   = projCoords.xy * vec2(0.5f, 0.5f) + vec2(0.5f, 0.5f);
+	float receiverDepth = clamp(projCoords.z, 0.0f, 1.0f);
+	float cascadeLayer  = float(cascade);
+
+	if (filterMode == SHADOW_FILTER_HARDWARE)
+		return texture(ShadowMapBuffer, vec4(shadowMapUV, cascadeLayer, receiverDepth));
+
+	const float texelSizeUV = 1.0f / float(textureSize(ShadowMapBuffer, 0).x);
+
+	float angle    = InterleavedGradientNoise(gl_FragCoord.xy) * 6.28318530f;
+	mat2  rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+
+	float radiusUV = filterParams.x * texelSizeUV;
+	if (filterMode == SHADOW_FILTER_ROTATED_GRID)
+		return FilterRotatedGrid(shadowMapUV, cascadeLayer, receiverDepth, radiusUV, rotation, numSamples);
+
+	if (filterMode == SHADOW_FILTER_PCSS)
+	{
+		// Depth is linear in an orthographic projection so differences scale straight to world units
+		const float tanHalfSunAngle = filterParams.y;
+		const float maxPenumbraUV   = filterParams.w * texelSizeUV;
+
+		// Blockers further away than this from the receiver can't reach it with a sun this size
+		float searchRadiusUV = min(receiverDepth * cascadeWorldSize.y * tanHalfSunAngle / cascadeWorldSize.x, maxPenumbraUV);
+		float blockerDepth   = FindAverageBlockerDepth(shadowMapUV, cascadeLayer, receiverDepth, max(searchRadiusUV, texelSizeUV), rotation, numSamples);
+		if (blockerDepth < 0.0f)
+			return 1.0f;
+
+		// Penumbra grows with the distance between blocker and receiver
+		float penumbraUV = (receiverDepth - blockerDepth) * cascadeWorldSize.y * tanHalfSunAngle / cascadeWorldSize.x;
+		radiusUV = clamp(penumbraUV, texelSizeUV, maxPenumbraUV);
+	}
+
+	return FilterPoisson(shadowMapUV, cascadeLayer, receiverDepth, radiusUV, rotation, numSamples);
+}
+
+// Same exponential slicing as lightculling.comp
+uint GetClusterIndex(vec2 fragCoord, vec3 worldPosition)
+{
+	const uvec3 gridSize = SDeferredLightingConstants.m_ClusterGridSize.xyz;
+	const float near     = SDeferredLightingConstants.m_Near;
+	const float far      = SDeferredLightingConstants.m_Far;
+
+	float viewDepth = GetViewDepth(worldPosition);
+	uint  slice     = uint(max(log(viewDepth / near) / log(far / near) * float(gridSize.z), 0.0f));
+	uvec2 tile      = uvec2(fragCoord / SDeferredLightingConstants.m_TileSize);
+
+	slice = min(slice, gridSize.z - 1);
+	tile  = min(tile, gridSize.xy - 1);
+
+	return tile.x + tile.y * gridSize.x + slice * gridSize.x * gridSize.y;
+}
+
+// Blinn-Phong for a single light. lightDir points from the fragment towards the light
+vec3 ShadeLight(vec3 lightDir, vec3 radiance, vec3 normal, vec3 viewDir, vec3 albedo, float metalness, float fresnel, float specularPower, vec3 specularColor)
+{
+	float NdotL = max(dot(normal, lightDir), 0.0f);
+
+	vec3 diffuse = albedo * (1.0f - metalness) * NdotL;
+
+	vec3  halfwayDir = normalize(viewDir + lightDir);
+	float rim        = pow(1.0f - max(dot(normal, viewDir), 0.0f), 5.0f);
+	float specular   = pow(max(dot(normal, halfwayDir), 0.0f), specularPower) * (1.0f + fresnel * rim) * NdotL;
+
+	return (diffuse + specularColor * specular) * radiance;
 }
 
 void main()
 {
 	// Get G-Buffer values
-	vec3  position  = texture(GBufferPositions, inUV).rgb;
-	float metalness = texture(GBufferPositions, inUV).a;
-	vec3  albedo    = texture(GBufferAlbedo,    inUV).rgb;
-	float fresnel   = texture(GBufferAlbedo,    inUV).a;
-	vec3  normal    = texture(GBufferNormals,   inUV).rgb;
-	float roughness = texture(GBufferNormals,   inUV).a;
-	float depth     = texture(GBufferDepth,     inUV).r;
+	const ivec2 pixel = ivec2(gl_FragCoord.xy);
+	const vec4  normalRoughness = texelFetch(GBufferNormals, pixel, 0);
+	const vec4  albedoPacked    = texelFetch(GBufferAlbedo,  pixel, 0);
+
+	float depth     = texelFetch(GBufferDepth, pixel, 0).r;
+	vec3  normal    = DecodeOctahedral(normalRoughness.rg);
+	float roughness = normalRoughness.b;
+	vec3  albedo    = albedoPacked.rgb;
+	vec2  metalnessFresnel = UnpackMetalnessFresnel(albedoPacked.a);
+	float metalness = metalnessFresnel.x;
+	float fresnel   = metalnessFresnel.y;
 
 	// Early out for skybox
 	if(depth == 1.0f)
 	{
-		vec4 atmosphericsColor = texture(AtmosphericsBuffer, inUV);
+		vec4 atmosphericsColor = texture(AtmosphericsBuffer, GetSkyUV(inUV));
 		outFragColor = vec4(atmosphericsColor.rgb, 1.0f);
 		return;
 	}
 
+	vec3 position  = ReconstructWorldPosition(inUV, depth);
 	vec3 viewPos   = SDeferredLightingConstants.m_ViewPos;
+	vec3 viewDir   = normalize(viewPos - position);
 	vec3 fragColor = vec3(0.0f, 0.0f ,0.0f);
 
-	for(int i = 0; i < NUM_LIGHTS; i++)
+	// Inverse of the exponent to roughness mapping in geometry.frag
+	float specularPower = max(2.0f / (roughness * roughness) - 2.0f, 1.0f);
+	vec3  specularColor = mix(vec3(1.0f, 1.0f, 1.0f), albedo, metalness);
+
+	// Sun. The only shadow casting light
 	{
-		vec3  lightPos       = SDeferredLightingConstants.m_Lights[i].m_Position;
-		vec3  lightColor     = SDeferredLightingConstants.m_Lights[i].m_Color; 
-		float lightRadius    = SDeferredLightingConstants.m_Lights[i].m_Radius;
-		float lightIntensity = SDeferredLightingConstants.m_Lights[i].m_Intensity;
+		vec3 sunDir   = normalize(SDeferredLightingConstants.m_SunDirection.xyz);
+		vec3 sunColor = SDeferredLightingConstants.m_SunColor.rgb;
+
+		uint  cascade = GetShadowCascade(GetViewDepth(position));
+		float shadow  = CalculateShadow(position, normal, cascade);
 
-		// Vector from fragment towards light
-		vec3 lightDir = lightPos - position;
-		float distToLight = length(lightDir);
+		fragColor += ShadeLight(sunDir, sunColor, normal, viewDir, albedo, metalness, fresnel, specularPower, specularColor) * shadow;
 
-		float specular = 0.0f;
-		vec3  diffuse  = vec3(0.0f, 0.0f, 0.0f);
+		if (SDeferredLightingConstants.m_VisualizeCascades != 0)
 		{
-			// Inverse square law
-			float attenuation = lightRadius / (distToLight * distToLight + 1.0f);
+			const vec3 cascadeColors[MAX_SHADOW_CASCADES] = vec3[](vec3(1.0f, 0.2f, 0.2f), vec3(0.2f, 1.0f, 0.2f), vec3(0.2f, 0.2f, 1.0f), vec3(1.0f, 1.0f, 0.2f));
+			albedo *= cascadeColors[cascade];
+			fragColor = mix(fragColor, albedo, 0.5f);
+		}
+	}
 
-			// Diffuse part
-			{
-				float NdotL = dot(normalize(normal), lightDir);
-				diffuse = lightColor * albedo * NdotL * attenuation;
-			}
+	// Point lights. Only loop over the ones binned into this fragment's cluster
+	{
+		uint clusterIndex   = GetClusterIndex(gl_FragCoord.xy, position);
+		uint numLights      = m_ClusterLightCounts[clusterIndex];
+		uint lightListStart = clusterIndex * MAX_LIGHTS_PER_CLUSTER;
 
-			// Specular part
-			{
-				// Vector from fragment to camera
-				vec3 viewDir = normalize(viewPos - position);
+		for(uint i = 0; i < numLights; i++)
+		{
+			SPointLight light = m_PointLights[m_ClusterLightIndices[lightListStart + i]];
 
-				vec3 halfwayDir  = normalize(viewDir + lightDir);
-				specular = pow(max(dot(normalize(normal), halfwayDir), 0.0f), 32.0f) * attenuation;
-			}
+			vec3  lightPos    = light.m_PositionRadius.xyz;
+			float lightRadius = light.m_PositionRadius.w;
 
-			// Shadow map lookup
-			float shadow = 0.0f;
-			{
-				mat4 lightMatrix = SDeferredLightingConstants.m_Lights[i].m_LightMatrix;
+			// Vector from fragment towards light
+			vec3  lightDir    = lightPos - position;
+			float distToLight = length(lightDir);
+			lightDir /= max(distToLight, 0.0001f);
 
-				// Move world space fragment to light view space
-				vec4 fragPosLightSpace = lightMatrix * vec4(position, 1.0f);
+			// Inverse square falloff windowed so it reaches zero at the light radius. Has to be zero there or the culling will show
+			float distanceRatio = distToLight / lightRadius;
+			float window        = clamp(1.0f - distanceRatio * distanceRatio * distanceRatio * distanceRatio, 0.0f, 1.0f);
+			float attenuation   = window * window / (1.0f + 16.0f * distanceRatio * distanceRatio);
 
-				shadow = CalculateShadow(fragPosLightSpace);
-			}
+			vec3 radiance = light.m_ColorIntensity.rgb * light.m_ColorIntensity.a * attenuation;
 
-			fragColor = diffuse + specular;
-			fragColor *= shadow;
+			fragColor += ShadeLight(lightDir, radiance, normal, viewDir, albedo, metalness, fresnel, specularPower, specularColor);
 		}
-		
-
 	}
 
 	outFragColor = vec4(fragColor, 1.0f);
-
-}
\ No newline at end of file
+}
@@ -1,19 +1,24 @@
 #version 450
 
-layout (binding = 1) uniform sampler2D samplerColor;
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Must match EStorageBufferIndices in ResourceManager.hpp
+#define BINDLESS_MATERIALS 1
+
+layout (set = 0, binding = 2) uniform sampler2D g_BindlessTextures[];
 
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec2 inUV;
 layout (location = 2) in vec3 inColor;
-layout (location = 3) in vec3 inWorldPosition;
 layout (location = 4) in vec3 inTangent;
+layout (location = 5) flat in uint inMaterialIndex; // Push constant in geometry.vert or draw data in geometrypull.vert
 
-layout (location = 0) out vec4 outPosition;
-layout (location = 1) out vec4 outNormal;
-layout (location = 2) out vec4 outAlbedo;
+// Position is reconstructed from depth in deferred.frag so no target for it
+layout (location = 0) out vec4 outNormal;
+layout (location = 1) out vec4 outAlbedo;
 
-//material push constants block
-layout( push_constant ) uniform constants
+// Must match SModelMaterial in Model.hpp
+struct SMaterial
 {
 	vec4  m_Diffuse;
 	//
@@ -24,26 +29,49 @@ layout( push_constant ) uniform constants
 	//
 	float m_Transparency;
 	float m_Reflectivity;
-	bool  m_UseAlbedoTexture;
-} SMaterialConstants;
+	int   m_AlbedoTextureIndex; // -1 when the material has no texture
+	float m_Padding;
+};
+
+layout (std430, set = 0, binding = 1) readonly buffer Materials
+{
+	SMaterial m_Materials[];
+} SMaterials[];
 
-float LinearizeDepth(float d,float zNear, float zFar)
+// Octahedral normal encoding. Unit vector folded into two [0,1] components
+vec2 OctWrap(vec2 v)
 {
-    return zNear * zFar / (zFar + d * (zNear - zFar));
+	return (1.0f - abs(v.yx)) * vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+vec2 EncodeOctahedral(vec3 normal)
+{
+	normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+	normal.xy = normal.z >= 0.0f ? normal.xy : OctWrap(normal.xy);
+	return normal.xy * 0.5f + 0.5f;
+}
+
+// 4 bits each for metalness and fresnel in a single unorm8 channel
+float PackMetalnessFresnel(float metalness, float fresnel)
+{
+	uint metalnessBits = uint(round(clamp(metalness, 0.0f, 1.0f) * 15.0f));
+	uint fresnelBits   = uint(round(clamp(fresnel,   0.0f, 1.0f) * 15.0f));
+	return float((metalnessBits << 4) | fresnelBits) / 255.0f;
 }
 
 void main() 
 {
-	const bool  useAlbedoTexture = SMaterialConstants.m_UseAlbedoTexture;
-	const float metalness        = SMaterialConstants.m_Metalness;
-	const float fresnel          = SMaterialConstants.m_Fresnel;
-	const float roughness        = SMaterialConstants.m_Shininess;
+	const SMaterial material     = SMaterials[BINDLESS_MATERIALS].m_Materials[inMaterialIndex];
+	const float metalness        = material.m_Metalness;
+	const float fresnel          = material.m_Fresnel;
 
-	outPosition = vec4(inWorldPosition, 1.0f);
-	
-	outNormal = vec4(inNormal, 1.0f);
+	// Phong exponent to roughness. Materials without shininess get the old default exponent of 32
+	const float shininess        = material.m_Shininess > 0.0f ? material.m_Shininess : 32.0f;
+	const float roughness        = sqrt(2.0f / (shininess + 2.0f));
 
-	outAlbedo = vec4(useAlbedoTexture ? texture(samplerColor, inUV).rgb : SMaterialConstants.m_Diffuse.rgb, 1.0f);
+	outNormal = vec4(EncodeOctahedral(normalize(inNormal)), roughness, 1.0f);
 
-	//gl_FragDepth = gl_FragCoord.z;
-}
\ No newline at end of file
+	// Texture index comes from the material so it is the same for the whole draw
+	vec3 albedo = material.m_AlbedoTextureIndex >= 0 ? texture(g_BindlessTextures[material.m_AlbedoTextureIndex], inUV).rgb : material.m_Diffuse.rgb;
+	outAlbedo = vec4(albedo, PackMetalnessFresnel(metalness, fresnel));
+}
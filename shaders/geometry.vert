@@ -1,39 +1,56 @@
 #version 450
 
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Must match EStorageBufferIndices in ResourceManager.hpp
+#define BINDLESS_OBJECT_TRANSFORMS 0
+
 layout (location = 0) in vec3 inPosition;
 layout (location = 1) in vec3 inColor;
 layout (location = 2) in vec2 inTexCoord;
 layout (location = 3) in vec3 inNormal;
 layout (location = 4) in vec3 inTangent;
 
-layout (binding = 0) uniform UniformBufferObject 
+// Must match SObjectTransform in ModelManager.hpp
+struct SObjectTransform
+{
+	mat4   m_ModelViewProjection;
+	mat4   m_World;
+	mat3x4 m_NormalMatrix;
+};
+
+// Transforms of every object. The draw picks one with firstInstance
+layout (std430, set = 0, binding = 1) readonly buffer ObjectTransforms
 {
-    mat4 m_ModelMat;
-    mat4 m_ViewMat;
-    mat4 m_ProjectionMat;
-} SGeometryUBO;
+	SObjectTransform m_Objects[];
+} SObjectTransforms[];
+
+// Which material in the buffer the draw uses
+layout (push_constant) uniform PushConstants
+{
+	uint m_MaterialIndex;
+} SGeometryConstants;
 
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec2 outUV;
 layout (location = 2) out vec3 outColor;
-layout (location = 3) out vec3 outWorldPosition;
 layout (location = 4) out vec3 outTangent;
+layout (location = 5) flat out uint outMaterialIndex;
 
 void main()
 {
-    gl_Position  = SGeometryUBO.m_ProjectionMat * SGeometryUBO.m_ViewMat * SGeometryUBO.m_ModelMat * vec4(inPosition, 1.0);
+	gl_Position = SObjectTransforms[BINDLESS_OBJECT_TRANSFORMS].m_Objects[gl_InstanceIndex].m_ModelViewProjection * vec4(inPosition, 1.0);
 	
 	outUV = inTexCoord;
 
-	// Vertex position in world space
-	outWorldPosition = (SGeometryUBO.m_ModelMat * vec4(inPosition, 1.0)).xyz;
-	
 	// Normal in world space
-	mat4 normalMatrix = transpose(inverse(SGeometryUBO.m_ModelMat));
+	mat3 normalMatrix = mat3(SObjectTransforms[BINDLESS_OBJECT_TRANSFORMS].m_Objects[gl_InstanceIndex].m_NormalMatrix);
 	
-	outNormal = (normalMatrix * vec4(inNormal, 1.0f)).xyz;
+	outNormal = normalMatrix * inNormal;
 	
 
 	// Currently just vertex color
 	outColor = inColor;
+
+	outMaterialIndex = SGeometryConstants.m_MaterialIndex;
 }
\ No newline at end of file
@@ -0,0 +1,94 @@
+#version 450
+
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_buffer_reference_uvec2 : require
+
+// Must match EStorageBufferIndices in ResourceManager.hpp
+#define BINDLESS_OBJECT_TRANSFORMS 0
+#define BINDLESS_DRAW_DATA         2
+
+// SModelVertex in Model.hpp is tightly packed. std430 would pad the vec3s so the vertices are read as floats instead
+#define VERTEX_NUM_FLOATS     14
+#define VERTEX_POSITION_FLOAT 0
+#define VERTEX_COLOR_FLOAT    3
+#define VERTEX_TEXCOORD_FLOAT 6
+#define VERTEX_NORMAL_FLOAT   8
+#define VERTEX_TANGENT_FLOAT  11
+
+layout (buffer_reference, std430, buffer_reference_align = 4) readonly buffer VertexBuffer
+{
+	float m_Floats[];
+};
+
+// Must match SObjectTransform in ModelManager.hpp
+struct SObjectTransform
+{
+	mat4   m_ModelViewProjection;
+	mat4   m_World;
+	mat3x4 m_NormalMatrix;
+};
+
+// Must match SDrawData in ModelManager.hpp
+struct SDrawData
+{
+	uvec2 m_VertexBufferAddress;
+	uint  m_ModelIndex;
+	uint  m_MaterialIndex;
+};
+
+layout (std430, set = 0, binding = 1) readonly buffer ObjectTransforms
+{
+	SObjectTransform m_Objects[];
+} SObjectTransforms[];
+
+// One entry per mesh. The indirect draw picks one with firstInstance
+layout (std430, set = 0, binding = 1) readonly buffer DrawData
+{
+	SDrawData m_Draws[];
+} SDrawDatas[];
+
+// Where the transforms of the view start. The model index of the draw is added to it
+layout (push_constant) uniform PushConstants
+{
+	uint m_ObjectTransformOffset;
+} SGeometryConstants;
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec2 outUV;
+layout (location = 2) out vec3 outColor;
+layout (location = 4) out vec3 outTangent;
+layout (location = 5) flat out uint outMaterialIndex;
+
+vec3 ReadVec3(VertexBuffer vertices, uint first)
+{
+	return vec3(vertices.m_Floats[first], vertices.m_Floats[first + 1], vertices.m_Floats[first + 2]);
+}
+
+void main()
+{
+	const SDrawData draw = SDrawDatas[BINDLESS_DRAW_DATA].m_Draws[gl_InstanceIndex];
+
+	// Indexed draw from the shared index buffer. gl_VertexIndex is the vertex of the model, already looked up through the indices
+	const uint firstFloat = uint(gl_VertexIndex) * VERTEX_NUM_FLOATS;
+
+	VertexBuffer vertices = VertexBuffer(draw.m_VertexBufferAddress);
+	const vec3 position   = ReadVec3(vertices, firstFloat + VERTEX_POSITION_FLOAT);
+	const vec3 color      = ReadVec3(vertices, firstFloat + VERTEX_COLOR_FLOAT);
+	const vec2 texCoord   = vec2(vertices.m_Floats[firstFloat + VERTEX_TEXCOORD_FLOAT], vertices.m_Floats[firstFloat + VERTEX_TEXCOORD_FLOAT + 1]);
+	const vec3 normal     = ReadVec3(vertices, firstFloat + VERTEX_NORMAL_FLOAT);
+
+	const uint objectIndex = SGeometryConstants.m_ObjectTransformOffset + draw.m_ModelIndex;
+	gl_Position = SObjectTransforms[BINDLESS_OBJECT_TRANSFORMS].m_Objects[objectIndex].m_ModelViewProjection * vec4(position, 1.0);
+
+	outUV = texCoord;
+
+	// Normal in world space
+	mat3 normalMatrix = mat3(SObjectTransforms[BINDLESS_OBJECT_TRANSFORMS].m_Objects[objectIndex].m_NormalMatrix);
+	outNormal = normalMatrix * normal;
+
+	// Currently just vertex color
+	outColor = color;
+
+	outMaterialIndex = draw.m_MaterialIndex;
+}
\ No newline at end of file
@@ -1,16 +1,27 @@
 #version 450
 
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Must match EStorageBufferIndices in ResourceManager.hpp
+#define BINDLESS_OBJECT_TRANSFORMS 0
+
 layout (location = 0) in vec3  inPosition;
 
-layout (binding = 0) uniform DepthUniformBuffer 
+// Must match SObjectTransform in ModelManager.hpp
+struct SObjectTransform
+{
+	mat4   m_ModelViewProjection; // Cascade view projection times the world matrix
+	mat4   m_World;
+	mat3x4 m_NormalMatrix;
+};
+
+// Transforms of every object. The draw picks one with firstInstance
+layout (std430, set = 0, binding = 1) readonly buffer ObjectTransforms
 {
-	mat4 m_ModelMatrix;
-	mat4 m_ViewMatrix;
-	mat4 m_ProjectionMatrix;
-} SShadowUBO;
+	SObjectTransform m_Objects[];
+} SObjectTransforms[];
 
 void main()
 {
-	vec4 shadowPos =  SShadowUBO.m_ProjectionMatrix * SShadowUBO.m_ViewMatrix * SShadowUBO.m_ModelMatrix * vec4(inPosition, 1.0);
-	gl_Position = shadowPos;
-}
\ No newline at end of file
+	gl_Position = SObjectTransforms[BINDLESS_OBJECT_TRANSFORMS].m_Objects[gl_InstanceIndex].m_ModelViewProjection * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,63 @@
+#version 450
+
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_buffer_reference_uvec2 : require
+
+// Must match EStorageBufferIndices in ResourceManager.hpp
+#define BINDLESS_OBJECT_TRANSFORMS 0
+#define BINDLESS_DRAW_DATA         2
+
+// Same vertex layout as geometrypull.vert. Only the position is needed
+#define VERTEX_NUM_FLOATS     14
+
+layout (buffer_reference, std430, buffer_reference_align = 4) readonly buffer VertexBuffer
+{
+	float m_Floats[];
+};
+
+// Must match SObjectTransform in ModelManager.hpp
+struct SObjectTransform
+{
+	mat4   m_ModelViewProjection; // Cascade view projection times the world matrix
+	mat4   m_World;
+	mat3x4 m_NormalMatrix;
+};
+
+// Must match SDrawData in ModelManager.hpp
+struct SDrawData
+{
+	uvec2 m_VertexBufferAddress;
+	uint  m_ModelIndex;
+	uint  m_MaterialIndex;
+};
+
+layout (std430, set = 0, binding = 1) readonly buffer ObjectTransforms
+{
+	SObjectTransform m_Objects[];
+} SObjectTransforms[];
+
+// One entry per mesh. The indirect draw picks one with firstInstance
+layout (std430, set = 0, binding = 1) readonly buffer DrawData
+{
+	SDrawData m_Draws[];
+} SDrawDatas[];
+
+// Where the transforms of the cascade start
+layout (push_constant) uniform PushConstants
+{
+	uint m_ObjectTransformOffset;
+} SShadowConstants;
+
+void main()
+{
+	const SDrawData draw = SDrawDatas[BINDLESS_DRAW_DATA].m_Draws[gl_InstanceIndex];
+
+	const uint firstFloat = uint(gl_VertexIndex) * VERTEX_NUM_FLOATS;
+
+	VertexBuffer vertices = VertexBuffer(draw.m_VertexBufferAddress);
+	const vec3 position   = vec3(vertices.m_Floats[firstFloat], vertices.m_Floats[firstFloat + 1], vertices.m_Floats[firstFloat + 2]);
+
+	const uint objectIndex = SShadowConstants.m_ObjectTransformOffset + draw.m_ModelIndex;
+	gl_Position = SObjectTransforms[BINDLESS_OBJECT_TRANSFORMS].m_Objects[objectIndex].m_ModelViewProjection * vec4(position, 1.0);
+}
\ No newline at end of file
@@ -1,13 +1,86 @@
 #version 450
 
-layout(location = 0) in  float fragHeight;
-layout(location = 1) in  vec3  fragColor;
+// Virtual heightmap lookup. Must match TerrainTileCache.hpp
+#define TERRAIN_TILE_PAGE_SIZE   128
+#define TERRAIN_TILE_PAGE_BORDER 1
+#define TERRAIN_TILE_SLOT_SIZE   (TERRAIN_TILE_PAGE_SIZE + TERRAIN_TILE_PAGE_BORDER * 2)
 
-layout(location = 0) out vec4  outColor;
+layout(location = 0) in  vec2  fragTerrainPosition;
+layout(location = 1) in  float fragHeight;
+layout(location = 2) flat in  int fragLodLevel;
 
-void main() 
+// Same targets as geometry.frag
+layout(location = 0) out vec4  outNormal;
+layout(location = 1) out vec4  outAlbedo;
+
+layout(binding = 3) uniform sampler2D  NormalCache;
+layout(binding = 4) uniform usampler2D TileIndirection;
+
+layout( push_constant ) uniform constants
 {
-    float greyscaleColor = (fragHeight + 16) / 32.0f;
+	mat4  m_ViewProjectionMatrix;
+	//
+	vec3  m_CameraPosition;
+	float m_TexelSize;
+	//
+	float m_HeightScale;
+	float m_HeightOffset;
+	float m_HeightMapWidth;
+	float m_HeightMapHeight;
+	//
+	uint  m_NumTileMips;
+} STerrainPushConstants;
+
+// Must match geometry.frag
+vec2 OctWrap(vec2 v)
+{
+	return (1.0f - abs(v.yx)) * vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+vec2 EncodeOctahedral(vec3 normal)
+{
+	normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+	normal.xy = normal.z >= 0.0f ? normal.xy : OctWrap(normal.xy);
+	return normal.xy * 0.5f + 0.5f;
+}
+
+float PackMetalnessFresnel(float metalness, float fresnel)
+{
+	uint metalnessBits = uint(round(clamp(metalness, 0.0f, 1.0f) * 15.0f));
+	uint fresnelBits   = uint(round(clamp(fresnel,   0.0f, 1.0f) * 15.0f));
+	return float((metalnessBits << 4) | fresnelBits) / 255.0f;
+}
+
+// Normal of a heightmap texel position at a mip. Falls back to the closest coarser mip if the page isn't streamed in yet. Must match SampleVirtualHeight() in terrain.vert
+vec3 SampleVirtualNormal(vec2 terrainPosition, int mip)
+{
+	mip = clamp(mip, 0, int(STerrainPushConstants.m_NumTileMips) - 1);
+
+	const ivec2 page  = clamp(ivec2(terrainPosition / float(1 << mip)) / TERRAIN_TILE_PAGE_SIZE, ivec2(0), textureSize(TileIndirection, mip) - 1);
+	const uvec4 entry = texelFetch(TileIndirection, page, mip);
+
+	const int   residentMip  = int(entry.z);
+	const ivec2 residentPage = page >> (residentMip - mip);
+	const vec2  pageTexel    = clamp(terrainPosition / float(1 << residentMip) - vec2(residentPage * TERRAIN_TILE_PAGE_SIZE), vec2(-TERRAIN_TILE_PAGE_BORDER), vec2(TERRAIN_TILE_PAGE_SIZE + TERRAIN_TILE_PAGE_BORDER - 1));
+
+	const vec2  cacheTexel   = vec2(entry.xy) * TERRAIN_TILE_SLOT_SIZE + TERRAIN_TILE_PAGE_BORDER + pageTexel + 0.5f;
+	return normalize(textureLod(NormalCache, cacheTexel / vec2(textureSize(NormalCache, 0)), 0.0f).rgb * 2.0f - 1.0f);
+}
+
+void main()
+{
+	// Per pixel normal from the mip the node was displaced with. Finer pages are only streamed in close to the camera
+	const vec3 normal = SampleVirtualNormal(fragTerrainPosition, fragLodLevel);
+
+	// Grass on flat low ground, rock on slopes and snow up high
+	const vec3 grassColor = vec3(0.22f, 0.32f, 0.12f);
+	const vec3 rockColor  = vec3(0.35f, 0.32f, 0.30f);
+	const vec3 snowColor  = vec3(0.90f, 0.92f, 0.95f);
+
+	const float slope  = 1.0f - normal.y;
+	vec3 albedo = mix(grassColor, rockColor, smoothstep(0.15f, 0.35f, slope));
+	albedo      = mix(albedo, snowColor, smoothstep(0.6f, 0.75f, fragHeight) * (1.0f - smoothstep(0.3f, 0.5f, slope)));
 
-    outColor = vec4(greyscaleColor, greyscaleColor, greyscaleColor, 1.0f);
-}
\ No newline at end of file
+	outNormal = vec4(EncodeOctahedral(normal), 0.9f, 1.0f);
+	outAlbedo = vec4(albedo, PackMetalnessFresnel(0.0f, 0.1f));
+}
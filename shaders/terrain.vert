@@ -1,21 +1,109 @@
 #version 450
 
-layout(location = 0) in  vec3  inPosition;
+// Must match TerrainNode.hpp
+#define TERRAIN_PATCH_RESOLUTION 32
 
-layout(location = 0) out float fragHeight;
-layout(location = 1) out vec3  fragColor;
+// Virtual heightmap lookup. Must match TerrainTileCache.hpp
+#define TERRAIN_TILE_PAGE_SIZE   128
+#define TERRAIN_TILE_PAGE_BORDER 1
+#define TERRAIN_TILE_SLOT_SIZE   (TERRAIN_TILE_PAGE_SIZE + TERRAIN_TILE_PAGE_BORDER * 2)
+
+layout(location = 0) in  vec2  inGridPosition; // Patch vertex in [0, TERRAIN_PATCH_RESOLUTION]
+
+layout(location = 0) out vec2  fragTerrainPosition; // Heightmap texels
+layout(location = 1) out float fragHeight;          // Normalized height
+layout(location = 2) flat out int fragLodLevel;
+
+struct STerrainNode
+{
+	vec4 m_OffsetSize; // xy offset and z size in heightmap texels, w LOD level
+	vec4 m_MorphRange; // x start and y end distance of the morph to the next LOD
+};
+
+layout(std430, binding = 0) readonly buffer TerrainNodes
+{
+	STerrainNode m_Nodes[];
+} STerrainNodes;
+
+layout(binding = 1) uniform sampler2D  TileCache;
+layout(binding = 2) uniform usampler2D TileIndirection;
 
 layout( push_constant ) uniform constants
 {
-    mat4 m_ModelViewProjectionMatrix;
+	mat4  m_ViewProjectionMatrix;
+	//
+	vec3  m_CameraPosition;
+	float m_TexelSize;
+	//
+	float m_HeightScale;
+	float m_HeightOffset;
+	float m_HeightMapWidth;
+	float m_HeightMapHeight;
+	//
+	uint  m_NumTileMips;
+} STerrainPushConstants;
 
-} STerrainVertexPushConstants;
+vec2 GetTerrainPosition(vec2 gridPosition, STerrainNode terrainNode)
+{
+	vec2 terrainPosition = terrainNode.m_OffsetSize.xy + gridPosition * (terrainNode.m_OffsetSize.z / TERRAIN_PATCH_RESOLUTION);
 
+	// Nodes along the far edges stick out of the heightmap. Clamping collapses those triangles to nothing
+	vec2 terrainSize = vec2(STerrainPushConstants.m_HeightMapWidth, STerrainPushConstants.m_HeightMapHeight) - 1.0f;
+	return min(terrainPosition, terrainSize);
+}
 
-void main() 
+// Height of a heightmap texel position at a mip. Falls back to the closest coarser mip if the page isn't streamed in yet
+float SampleVirtualHeight(vec2 terrainPosition, int mip)
 {
-    vec4 position = STerrainVertexPushConstants.m_ModelViewProjectionMatrix * vec4(inPosition, 1.0);
-    gl_Position  = vec4(position.x, -position.y, position.z, position.w);
-    fragHeight   = inPosition.y;
-    fragColor    = vec3(1.0f, 0.0f, 0.0f);
-}
\ No newline at end of file
+	mip = clamp(mip, 0, int(STerrainPushConstants.m_NumTileMips) - 1);
+
+	const ivec2 page  = clamp(ivec2(terrainPosition / float(1 << mip)) / TERRAIN_TILE_PAGE_SIZE, ivec2(0), textureSize(TileIndirection, mip) - 1);
+	const uvec4 entry = texelFetch(TileIndirection, page, mip);
+
+	const int   residentMip  = int(entry.z);
+	const ivec2 residentPage = page >> (residentMip - mip);
+	const vec2  pageTexel    = clamp(terrainPosition / float(1 << residentMip) - vec2(residentPage * TERRAIN_TILE_PAGE_SIZE), vec2(-TERRAIN_TILE_PAGE_BORDER), vec2(TERRAIN_TILE_PAGE_SIZE + TERRAIN_TILE_PAGE_BORDER - 1));
+
+	const vec2  cacheTexel   = vec2(entry.xy) * TERRAIN_TILE_SLOT_SIZE + TERRAIN_TILE_PAGE_BORDER + pageTexel + 0.5f;
+	return textureLod(TileCache, cacheTexel / vec2(textureSize(TileCache, 0)), 0.0f).r;
+}
+
+// Blends between the two mips around a fractional lod like trilinear filtering would
+float SampleHeight(vec2 terrainPosition, float lod)
+{
+	const int   mip      = int(lod);
+	const float lowerMip = SampleVirtualHeight(terrainPosition, mip);
+	return fract(lod) > 0.0f ? mix(lowerMip, SampleVirtualHeight(terrainPosition, mip + 1), fract(lod)) : lowerMip;
+}
+
+vec3 GetWorldPosition(vec2 terrainPosition, float height)
+{
+	vec2 terrainSize = vec2(STerrainPushConstants.m_HeightMapWidth, STerrainPushConstants.m_HeightMapHeight) - 1.0f;
+	vec2 worldXZ     = (terrainPosition - terrainSize * 0.5f) * STerrainPushConstants.m_TexelSize;
+
+	return vec3(worldXZ.x, height * STerrainPushConstants.m_HeightScale + STerrainPushConstants.m_HeightOffset, worldXZ.y);
+}
+
+void main()
+{
+	STerrainNode terrainNode = STerrainNodes.m_Nodes[gl_InstanceIndex];
+	const float lodLevel = terrainNode.m_OffsetSize.w;
+
+	vec2  terrainPosition = GetTerrainPosition(inGridPosition, terrainNode);
+	vec3  worldPosition   = GetWorldPosition(terrainPosition, SampleHeight(terrainPosition, lodLevel));
+
+	// Odd vertices slide onto their even neighbours as the camera moves away so the patch ends up matching the next LOD
+	float cameraDistance = distance(worldPosition, STerrainPushConstants.m_CameraPosition);
+	float morphK         = clamp((cameraDistance - terrainNode.m_MorphRange.x) / (terrainNode.m_MorphRange.y - terrainNode.m_MorphRange.x), 0.0f, 1.0f);
+	vec2  gridPosition   = inGridPosition - fract(inGridPosition * 0.5f) * 2.0f * morphK;
+
+	terrainPosition = GetTerrainPosition(gridPosition, terrainNode);
+
+	const float height = SampleHeight(terrainPosition, lodLevel + morphK);
+	worldPosition = GetWorldPosition(terrainPosition, height);
+
+	gl_Position         = STerrainPushConstants.m_ViewProjectionMatrix * vec4(worldPosition, 1.0f);
+	fragTerrainPosition = terrainPosition;
+	fragHeight          = height;
+	fragLodLevel        = int(lodLevel);
+}
@@ -9,9 +9,11 @@ int main()
 	SetupScene(graphicsEngine);
 	graphicsEngine.CreateScene();
 
+	// Rendering continues on its own thread. This one handles window events and input
+	graphicsEngine.StartRenderThread();
 	while (graphicsEngine.IsRunning())
 	{
-		graphicsEngine.DrawFrame();
+		graphicsEngine.PollEvents();
 	}
 
 	graphicsEngine.Cleanup();
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <random>
+
 void SetupModels(NVulkanEngine::CVulkanGraphicsEngine& graphicsEngine)
 {
 	graphicsEngine.AddModelByFilepath("models/Box.obj");
@@ -50,8 +52,26 @@ void SetupLights(NVulkanEngine::CVulkanGraphicsEngine& graphicsEngine)
 {
 	graphicsEngine.AddLightSource(NVulkanEngine::ELightType::SUN);
 	graphicsEngine.SetLightDirection(0.0f, -1.0f, 0.0f);
-	graphicsEngine.SetLightIntensity(10.0f);
+	graphicsEngine.SetLightIntensity(1.5f);
 	graphicsEngine.PushLight();
+
+	// Lots of small point lights scattered around the scene. Fixed seed so the scene looks the same every run
+	std::mt19937 randomGenerator(1337);
+	std::uniform_real_distribution<float> randomPositionXZ(-2000.0f, 2000.0f);
+	std::uniform_real_distribution<float> randomPositionY(0.0f, 400.0f);
+	std::uniform_real_distribution<float> randomColor(0.2f, 1.0f);
+	std::uniform_real_distribution<float> randomRadius(80.0f, 250.0f);
+
+	const uint32_t numPointLights = 2048;
+	for (uint32_t i = 0; i < numPointLights; i++)
+	{
+		graphicsEngine.AddLightSource(NVulkanEngine::ELightType::POINT);
+		graphicsEngine.SetLightPosition(randomPositionXZ(randomGenerator), randomPositionY(randomGenerator), randomPositionXZ(randomGenerator));
+		graphicsEngine.SetLightColor(randomColor(randomGenerator), randomColor(randomGenerator), randomColor(randomGenerator));
+		graphicsEngine.SetLightRadius(randomRadius(randomGenerator));
+		graphicsEngine.SetLightIntensity(4.0f);
+		graphicsEngine.PushLight();
+	}
 }
 
 void SetupScene(NVulkanEngine::CVulkanGraphicsEngine& graphicsEngine)
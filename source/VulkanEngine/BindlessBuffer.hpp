@@ -2,13 +2,31 @@
 
 #include <vulkan/vulkan.h>
 #include <VulkanGraphicsEngineUtils.hpp>
+#include <Managers/DescriptorManager.hpp>
 
+#include <array>
 #include <vector>
 
 /*
-	Simplifies shader resource binding.
+	One descriptor set that holds every shader resource. Uniform buffers, storage buffers and textures each go into
+	their own array and shaders pick the ones they need by index. Bound once per pass instead of once per draw.
+	Lives in the descriptor buffer instead of a descriptor set when the descriptor manager has one
 */
 
+// Size of each array in the table. Slots that are never written are left unbound
+static const uint32_t g_MaxBindlessUniformBuffers = 16;
+static const uint32_t g_MaxBindlessStorageBuffers = 16;
+static const uint32_t g_MaxBindlessTextures       = 4096;
+
+// Binding slot of each array. Must match the shaders that use the bindless table
+enum class EBindlessBufferType : uint32_t
+{
+	UNIFORMS        = 0,
+	STORAGE_BUFFERS = 1,
+	TEXTURES        = 2,
+	COUNT           = 3
+};
+
 namespace NVulkanEngine
 {
 	class CBindlessBuffer
@@ -17,16 +35,16 @@ namespace NVulkanEngine
 		CBindlessBuffer() = default;
 		~CBindlessBuffer() = default;
 
-		void  SetVertexDescription(VkVertexInputBindingDescription vertexBindingDescription);
-		void  AddUniformBufferBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, uint32_t bufferSize);
-		void  AddSampledImageBinding(VkDevice device, uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkImageView imageView, VkFormat format, VkSampler sampler);
 		void  CreateBindings(CGraphicsContext* context);
 
-		bool HasResourcesToBind() const { return ((m_NumImageDescriptors + m_NumBufferDescriptors) > 0); };
+		// Writes the resource into its array at the given index. Anything already in that slot is replaced
+		void  AddUniformBufferBinding(CGraphicsContext* context, uint32_t index, VkBuffer buffer, VkDeviceSize bufferSize);
+		void  AddStorageBufferBinding(CGraphicsContext* context, uint32_t index, VkBuffer buffer, VkDeviceSize bufferSize);
+		void  AddSampledImageBinding(CGraphicsContext* context, uint32_t index, VkImageView imageView, VkFormat format, VkSampler sampler);
 
 		VkDescriptorSetLayout GetDescriptorSetLayout() const { return m_DescriptorSetLayout; };
 
-		void BindTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout);
+		void BindTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS);
 
 		void Cleanup(CGraphicsContext* context);
 
@@ -34,29 +52,17 @@ namespace NVulkanEngine
 		void AllocateDescriptorPool(CGraphicsContext* context);
 		void AllocateDescriptorSetLayout(CGraphicsContext* context);
 		void AllocateDescriptorSets(CGraphicsContext* context);
+		void AllocateDescriptorBuffer(CGraphicsContext* context);
 
-		std::vector<VkVertexInputAttributeDescription> m_VertexInputAttributes = { };
-
-		struct SDescriptorInfo
-		{
-			VkDescriptorBufferInfo m_BufferInfo = { };
-			VkDescriptorImageInfo  m_ImageInfo = { };
-		};
-		
-		VkBuffer m_DynamicBuffer             = VK_NULL_HANDLE; // Stores all our data
-		VkDeviceMemory m_DynamicBufferMemory = VK_NULL_HANDLE;
-
-		// Descriptors 
-		std::vector<SDescriptorInfo>              m_DescriptorInfos = { }; // Holder for the current descriptors. Consumed in CreateBindings()
-		std::vector<VkDescriptorSetLayoutBinding> m_DescriptorSetLayoutBindings = {};
-
-		VkDescriptorPool                   m_DescriptorPool       =   VK_NULL_HANDLE;   // The pool from which we allocate descriptors
-		VkDescriptorSetLayout              m_DescriptorSetLayout  = { VK_NULL_HANDLE }; // The layout of the shader descriptor bindings
-		std::vector<VkDescriptorSet>       m_DescriptorSets       = { VK_NULL_HANDLE }; // The actual data to bind into each descriptor layout slot
+		VkDescriptorPool      m_DescriptorPool      = VK_NULL_HANDLE;
+		VkDescriptorSetLayout m_DescriptorSetLayout = VK_NULL_HANDLE;
 
-		uint32_t m_NumBufferDescriptors = 0;
-		uint32_t m_NumImageDescriptors  = 0;
+		// Per frame data lives in different parts of the same buffers so a single set is enough
+		VkDescriptorSet       m_DescriptorSet       = VK_NULL_HANDLE;
 
+		// Descriptor buffer backend. Offsets of each array from the start of the range
+		SDescriptorBufferRange                                           m_DescriptorBufferRange = {};
+		std::array<VkDeviceSize, (uint32_t)EBindlessBufferType::COUNT> m_BindingOffsets        = {};
 	};
 
 };
\ No newline at end of file
@@ -3,45 +3,34 @@
 #include <GraphicsContext.hpp>
 
 #include <array>
+#include <cstring>
 
-// Support uniforms and textures currently
-enum class EBindlessBufferType : uint32_t
-{
-	UNIFORMS = 0,
-	TEXTURES = 1,
-	COUNT    = 2
-};
-
-constexpr uint32_t g_MaxBindlessResources = 16536;
+// Scratch space for splitting combined image sampler descriptors. Larger than any device reports
+static const size_t g_MaxCombinedImageSamplerDescriptorSize = 256;
 
 namespace NVulkanEngine
 {
-	// From https://dev.to/gasim/implementing-bindless-design-in-vulkan-34no
-	uint32_t PadSizeToMinAlignment(uint32_t originalSize, uint32_t minAlignment) 
-	{
-		return (originalSize + minAlignment - 1) & ~(minAlignment - 1);
-	}
-
 	void CBindlessBuffer::AllocateDescriptorPool(CGraphicsContext* context)
 	{
-		std::array<VkDescriptorPoolSize, 1> poolSizeBindless[] =
-		{
-			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, g_MaxBindlessResources },
-			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, g_MaxBindlessResources }
-		};
+		std::array<VkDescriptorPoolSize, (uint32_t)EBindlessBufferType::COUNT> poolSizeBindless =
+		{{
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         g_MaxBindlessUniformBuffers },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         g_MaxBindlessStorageBuffers },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, g_MaxBindlessTextures       }
+		}};
 
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		poolInfo.flags         = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
-		poolInfo.poolSizeCount = (uint32_t)poolSizeBindless->size();
-		poolInfo.pPoolSizes    = poolSizeBindless->data();
-		poolInfo.maxSets       = g_MaxBindlessResources * (uint32_t)poolSizeBindless->size();
+		poolInfo.poolSizeCount = (uint32_t)poolSizeBindless.size();
+		poolInfo.pPoolSizes    = poolSizeBindless.data();
+		poolInfo.maxSets       = 1;
 
 		VkResult result = vkCreateDescriptorPool(context->GetLogicalDevice(), &poolInfo, nullptr, &m_DescriptorPool);
 
 		if (result != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to allocate descriptor sets!");
+			throw std::runtime_error("failed to create bindless descriptor pool!");
 		}
 	}
 
@@ -51,114 +40,245 @@ namespace NVulkanEngine
 		std::array<VkDescriptorType, (uint32_t)EBindlessBufferType::COUNT> descriptorBindingTypes =
 		{
 			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
 		};
 
-		std::array<VkDescriptorBindingFlags, (uint32_t) EBindlessBufferType::COUNT> descriptorBindingFlags
+		std::array<uint32_t, (uint32_t)EBindlessBufferType::COUNT> descriptorCounts =
+		{
+			g_MaxBindlessUniformBuffers,
+			g_MaxBindlessStorageBuffers,
+			g_MaxBindlessTextures
+		};
+
+		// Updating uniform buffers after bind is an optional feature that isn't enabled. They are only written while nothing is recorded.
+		// Textures can be streamed in while earlier frames are still in flight as long as those frames don't use the slots being written
+		std::array<VkDescriptorBindingFlags, (uint32_t)EBindlessBufferType::COUNT> descriptorBindingFlags =
 		{
-			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
-			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
 		};
 
+		// Descriptor buffers are plain memory. Any slot can be written at any time so the update after bind flags don't apply
+		const bool usesDescriptorBuffers = context->GetDescriptorManager()->UsesDescriptorBuffers();
+		if (usesDescriptorBuffers)
+		{
+			descriptorBindingFlags.fill(VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT);
+		}
+
 		// Create layout for descriptor set
 		std::array<VkDescriptorSetLayoutBinding, (uint32_t)EBindlessBufferType::COUNT> descriptorBindings{};
-		
+
 		for (uint32_t i = 0; i < (uint32_t) EBindlessBufferType::COUNT; i++)
 		{
-			descriptorBindings[i].binding = i;
-			descriptorBindings[i].descriptorType = descriptorBindingTypes[i]; // uniforms/textures in this descriptor
-			descriptorBindings[i].descriptorCount = g_MaxBindlessResources; // Up to 1000 uniforms/textures allowed
-			descriptorBindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+			descriptorBindings[i].binding         = i;
+			descriptorBindings[i].descriptorType  = descriptorBindingTypes[i];
+			descriptorBindings[i].descriptorCount = descriptorCounts[i];
+			descriptorBindings[i].stageFlags      = VK_SHADER_STAGE_ALL;
 		}
 
+		VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo{};
+		bindingFlagsCreateInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		bindingFlagsCreateInfo.bindingCount  = (uint32_t)descriptorBindingFlags.size();
+		bindingFlagsCreateInfo.pBindingFlags = descriptorBindingFlags.data();
+
 		VkDescriptorSetLayoutCreateInfo descriptorLayoutCreateInfo{};
 		descriptorLayoutCreateInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		descriptorLayoutCreateInfo.bindingCount = (uint32_t) EBindlessBufferType::COUNT;
 		descriptorLayoutCreateInfo.pBindings    = descriptorBindings.data();
-		descriptorLayoutCreateInfo.flags        = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
-		
+		descriptorLayoutCreateInfo.flags        = usesDescriptorBuffers ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		descriptorLayoutCreateInfo.pNext        = &bindingFlagsCreateInfo;
+
 		VkResult result = vkCreateDescriptorSetLayout(context->GetLogicalDevice(), &descriptorLayoutCreateInfo, nullptr, &m_DescriptorSetLayout);
 
 		if (result != VK_SUCCESS)
 		{
-			throw std::runtime_error("failed to create descriptor set layout!");
+			throw std::runtime_error("failed to create bindless descriptor set layout!");
 		}
 	}
 
 	void CBindlessBuffer::AllocateDescriptorSets(CGraphicsContext* context)
 	{
-		std::vector<VkDescriptorSetLayout> descritporSetLayouts(g_MaxFramesInFlight, m_DescriptorSetLayout);
-
 		VkDescriptorSetAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = m_DescriptorPool;
-		allocInfo.pSetLayouts = descritporSetLayouts.data();
+		allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool     = m_DescriptorPool;
+		allocInfo.pSetLayouts        = &m_DescriptorSetLayout;
+		allocInfo.descriptorSetCount = 1;
+
+		VkResult result = vkAllocateDescriptorSets(context->GetLogicalDevice(), &allocInfo, &m_DescriptorSet);
+
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate bindless descriptor set!");
+		}
+	}
 
-		allocInfo.descriptorSetCount = g_MaxFramesInFlight;
+	void CBindlessBuffer::AllocateDescriptorBuffer(CGraphicsContext* context)
+	{
+		CDescriptorManager* descriptorManager = context->GetDescriptorManager();
 
-		m_DescriptorSets.resize(g_MaxFramesInFlight);
+		if (descriptorManager->GetDescriptorSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) > g_MaxCombinedImageSamplerDescriptorSize)
+		{
+			throw std::runtime_error("combined image sampler descriptors are too large for the bindless table!");
+		}
 
-		VkResult result = vkAllocateDescriptorSets(context->GetLogicalDevice(), &allocInfo, m_DescriptorSets.data());
+		m_DescriptorBufferRange = descriptorManager->AllocateDescriptorBufferRange(context, descriptorManager->GetDescriptorSetLayoutSize(context, m_DescriptorSetLayout));
 
-		if (result != VK_SUCCESS)
+		for (uint32_t i = 0; i < (uint32_t)EBindlessBufferType::COUNT; i++)
 		{
-			throw std::runtime_error("failed to allocate descriptor sets!");
+			m_BindingOffsets[i] = descriptorManager->GetDescriptorBindingOffset(context, m_DescriptorSetLayout, i);
 		}
 	}
 
-	void CBindlessBuffer::AddSampledImageBinding(VkDevice device, uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkImageView imageView, VkFormat format, VkSampler sampler)
+	void CBindlessBuffer::CreateBindings(CGraphicsContext* context)
 	{
-		VkDescriptorSetLayoutBinding descriptorLayoutBinding = CreateDescriptorSetLayoutBinding(bindingSlot, shaderStage, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-		m_DescriptorSetLayoutBindings.push_back(descriptorLayoutBinding);
+		AllocateDescriptorSetLayout(context);
 
-		const bool isDepthFormat = format >= VK_FORMAT_D16_UNORM && format <= VK_FORMAT_D32_SFLOAT_S8_UINT;
+		if (context->GetDescriptorManager()->UsesDescriptorBuffers())
+		{
+			AllocateDescriptorBuffer(context);
+		}
+		else
+		{
+			AllocateDescriptorPool(context);
+			AllocateDescriptorSets(context);
+		}
+	}
 
-		SDescriptorInfo writeDescriptor{};
-		writeDescriptor.m_BufferInfo = { VK_NULL_HANDLE, 0, VK_WHOLE_SIZE };
-		writeDescriptor.m_ImageInfo = CreateDescriptorImageInfo(imageView, sampler, isDepthFormat ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-		
-		m_DescriptorInfos.push_back(writeDescriptor);
-		
-		VkWriteDescriptorSet write{};
-		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		write.dstBinding = (uint32_t)EBindlessBufferType::TEXTURES;
-		write.dstSet = m_DescriptorSets[0];
+	void CBindlessBuffer::AddUniformBufferBinding(CGraphicsContext* context, uint32_t index, VkBuffer buffer, VkDeviceSize bufferSize)
+	{
+		if (index >= g_MaxBindlessUniformBuffers)
+		{
+			throw std::runtime_error("bindless uniform buffer index out of range!");
+		}
 
-		// Write just the one texture that is being added
+		if (m_DescriptorBufferRange.m_MappedData != nullptr)
+		{
+			CDescriptorManager* descriptorManager = context->GetDescriptorManager();
+			uint8_t* descriptor = m_DescriptorBufferRange.m_MappedData + m_BindingOffsets[(uint32_t)EBindlessBufferType::UNIFORMS] + index * descriptorManager->GetDescriptorSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+
+			descriptorManager->GetBufferDescriptor(context, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, buffer, bufferSize, descriptor);
+			return;
+		}
+
+		VkDescriptorBufferInfo bufferInfo = CreateDescriptorBufferInfo(buffer, (uint32_t)bufferSize);
+
+		VkWriteDescriptorSet write{};
+		write.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		write.dstBinding      = (uint32_t)EBindlessBufferType::UNIFORMS;
+		write.dstSet          = m_DescriptorSet;
+		write.dstArrayElement = index;
 		write.descriptorCount = 1;
+		write.pBufferInfo     = &bufferInfo;
+
+		vkUpdateDescriptorSets(context->GetLogicalDevice(), 1, &write, 0, nullptr);
+	}
+
+	void CBindlessBuffer::AddStorageBufferBinding(CGraphicsContext* context, uint32_t index, VkBuffer buffer, VkDeviceSize bufferSize)
+	{
+		if (index >= g_MaxBindlessStorageBuffers)
+		{
+			throw std::runtime_error("bindless storage buffer index out of range!");
+		}
+
+		if (m_DescriptorBufferRange.m_MappedData != nullptr)
+		{
+			CDescriptorManager* descriptorManager = context->GetDescriptorManager();
+			uint8_t* descriptor = m_DescriptorBufferRange.m_MappedData + m_BindingOffsets[(uint32_t)EBindlessBufferType::STORAGE_BUFFERS] + index * descriptorManager->GetDescriptorSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+			descriptorManager->GetBufferDescriptor(context, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffer, bufferSize, descriptor);
+			return;
+		}
 
-		// The array element that we are going to write to
-		// is the index, which we refer to as our handles
-		write.dstArrayElement = bindingSlot;
-		write.pImageInfo = &writeDescriptor.m_ImageInfo;
+		VkDescriptorBufferInfo bufferInfo{};
+		bufferInfo.buffer = buffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range  = bufferSize;
 
-		vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
-		
-		m_NumImageDescriptors++;
+		VkWriteDescriptorSet write{};
+		write.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.dstBinding      = (uint32_t)EBindlessBufferType::STORAGE_BUFFERS;
+		write.dstSet          = m_DescriptorSet;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.pBufferInfo     = &bufferInfo;
+
+		vkUpdateDescriptorSets(context->GetLogicalDevice(), 1, &write, 0, nullptr);
 	}
 
-	void CBindlessBuffer::CreateBindings(CGraphicsContext* context)
+	void CBindlessBuffer::AddSampledImageBinding(CGraphicsContext* context, uint32_t index, VkImageView imageView, VkFormat format, VkSampler sampler)
 	{
-		AllocateDescriptorPool(context);
-		AllocateDescriptorSetLayout(context);
-		AllocateDescriptorSets(context);
+		if (index >= g_MaxBindlessTextures)
+		{
+			throw std::runtime_error("bindless texture index out of range!");
+		}
+
+		const bool isDepthFormat = format >= VK_FORMAT_D16_UNORM && format <= VK_FORMAT_D32_SFLOAT_S8_UINT;
+
+		VkDescriptorImageInfo imageInfo = CreateDescriptorImageInfo(imageView, sampler, isDepthFormat ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
+		if (m_DescriptorBufferRange.m_MappedData != nullptr)
+		{
+			CDescriptorManager* descriptorManager = context->GetDescriptorManager();
+			const VkPhysicalDeviceDescriptorBufferPropertiesEXT& properties = descriptorManager->GetDescriptorBufferProperties();
+			uint8_t* textures = m_DescriptorBufferRange.m_MappedData + m_BindingOffsets[(uint32_t)EBindlessBufferType::TEXTURES];
+
+			if (properties.combinedImageSamplerDescriptorSingleArray)
+			{
+				descriptorManager->GetImageDescriptor(context, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfo, textures + index * properties.combinedImageSamplerDescriptorSize);
+			}
+			else
+			{
+				// Some devices want the image half of every element first and all the sampler halves after them
+				std::array<uint8_t, g_MaxCombinedImageSamplerDescriptorSize> descriptor{};
+				descriptorManager->GetImageDescriptor(context, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfo, descriptor.data());
+
+				memcpy(textures + index * properties.sampledImageDescriptorSize, descriptor.data(), properties.sampledImageDescriptorSize);
+				memcpy(textures + g_MaxBindlessTextures * properties.sampledImageDescriptorSize + index * properties.samplerDescriptorSize, descriptor.data() + properties.sampledImageDescriptorSize, properties.samplerDescriptorSize);
+			}
+
+			return;
+		}
 
+		VkWriteDescriptorSet write{};
+		write.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.dstBinding      = (uint32_t)EBindlessBufferType::TEXTURES;
+		write.dstSet          = m_DescriptorSet;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.pImageInfo      = &imageInfo;
+
+		vkUpdateDescriptorSets(context->GetLogicalDevice(), 1, &write, 0, nullptr);
 	}
 
-	void CBindlessBuffer::BindTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)
+	void CBindlessBuffer::BindTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkPipelineBindPoint bindPoint)
 	{
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &m_DescriptorSets[context->GetFrameIndex()], 0, nullptr);
+		if (m_DescriptorBufferRange.m_MappedData != nullptr)
+		{
+			context->GetDescriptorManager()->BindDescriptorBuffer(commandBuffer, bindPoint, pipelineLayout, m_DescriptorBufferRange);
+			return;
+		}
+
+		vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, 0, 1, &m_DescriptorSet, 0, nullptr);
 	}
 
 	void CBindlessBuffer::Cleanup(CGraphicsContext* context)
 	{
+		if (m_DescriptorBufferRange.m_MappedData != nullptr)
+		{
+			context->GetDescriptorManager()->FreeDescriptorBufferRange(m_DescriptorBufferRange);
+		}
+
 		vkDestroyDescriptorPool(context->GetLogicalDevice(), m_DescriptorPool, nullptr);
 		vkDestroyDescriptorSetLayout(context->GetLogicalDevice(), m_DescriptorSetLayout, nullptr);
 
-		m_DescriptorSets.clear();
-		m_DescriptorInfos.clear();
-		m_DescriptorSetLayoutBindings.clear();
-		m_VertexInputAttributes.clear();
+		m_DescriptorBufferRange = {};
+		m_DescriptorPool      = VK_NULL_HANDLE;
+		m_DescriptorSetLayout = VK_NULL_HANDLE;
+		m_DescriptorSet       = VK_NULL_HANDLE;
 	}
 };
\ No newline at end of file
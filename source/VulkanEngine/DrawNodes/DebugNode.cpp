@@ -9,6 +9,14 @@ namespace NVulkanEngine
 		glm::mat4 m_ViewProjectionMatrix = glm::identity<glm::mat4>();
 	};
 
+	std::vector<EResourceIndices> CDebugNode::GetResourceUsage()
+	{
+		return
+		{
+			EResourceIndices::SceneColor
+		};
+	}
+
 	void CDebugNode::Init(CGraphicsContext* context, SGraphicsManagers* managers)
 	{
 		VkFormat sceneColorFormat = managers->m_ResourceManager->GetRenderResource(EResourceIndices::SceneColor).m_Format;
@@ -60,6 +68,7 @@ namespace NVulkanEngine
 		BeginRendering("Debug Rendering", context, commandBuffer, { sceneColorAttachment });
 
 		m_DebugPipeline->BindPipeline(commandBuffer);
+		resourceManager->BindBindlessTable(context, commandBuffer, m_DebugPipeline->GetPipelineLayout());
 
 		VkBuffer debugLinesVertexBuffers[] = { debugManager->GetDebugLinesVertexBuffer() };
 		VkDeviceSize vertexOffsets[] = { 0 };
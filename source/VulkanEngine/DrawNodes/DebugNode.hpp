@@ -18,6 +18,7 @@ namespace NVulkanEngine
 		~CDebugNode() = default;
 
 		virtual void Init(CGraphicsContext* context, SGraphicsManagers* managers)  override;
+		virtual std::vector<EResourceIndices> GetResourceUsage() override;
 		virtual void UpdateBeforeDraw(VkDevice logicalDevice, SGraphicsManagers* managers) override;
 		virtual void Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) override;
 		virtual void Cleanup(CGraphicsContext* context) override;
@@ -9,6 +9,9 @@ namespace NVulkanEngine
 	void CDrawNode::UpdateBeforeDraw(VkDevice logicalDevice, SGraphicsManagers* managers) {}
 	void CDrawNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) { }
 	void CDrawNode::Cleanup(CGraphicsContext* context) { }
+	std::vector<EResourceIndices> CDrawNode::GetResourceUsage() { return {}; }
+	bool CDrawNode::HasAsyncCompute() { return false; }
+	void CDrawNode::DispatchAsyncCompute(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) { }
 
 	void CDrawNode::GenerateMipmaps(CGraphicsContext* context, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
 	{
@@ -108,7 +111,19 @@ namespace NVulkanEngine
 		const std::string              markerName,
 		CGraphicsContext*              context,
 		VkCommandBuffer                commandBuffer,
-		std::vector<SRenderResource>   renderResourceInfos)
+		std::vector<SRenderResource>   renderResourceInfos,
+		VkRenderingFlags               renderingFlags)
+	{
+		BeginRendering(markerName, context, commandBuffer, context->GetRenderResolution(), renderResourceInfos, renderingFlags);
+	}
+
+	void CDrawNode::BeginRendering(
+		const std::string              markerName,
+		CGraphicsContext*              context,
+		VkCommandBuffer                commandBuffer,
+		VkExtent2D                     renderArea,
+		std::vector<SRenderResource>   renderResourceInfos,
+		VkRenderingFlags               renderingFlags)
 	{
 		std::vector<VkRenderingAttachmentInfo> colorAttachmentInfos = {};
 		VkRenderingAttachmentInfo depthAttachmentInfo = {};
@@ -128,7 +143,8 @@ namespace NVulkanEngine
 
 		VkRenderingInfo renderInfo{};
 		renderInfo.sType                = VK_STRUCTURE_TYPE_RENDERING_INFO;
-		renderInfo.renderArea.extent    = context->GetRenderResolution();
+		renderInfo.flags                = renderingFlags;
+		renderInfo.renderArea.extent    = renderArea;
 		renderInfo.renderArea.offset    = { 0, 0 };
 		renderInfo.layerCount           = 1;
 		renderInfo.colorAttachmentCount = static_cast<uint32_t>(colorAttachmentInfos.size());
@@ -137,14 +153,13 @@ namespace NVulkanEngine
 
 		const float drawNodeMarkerColor[4] = { 0.4f, 0.6f, 0.3f, 1.0f };
 		BeginMarker(context->GetVulkanInstance(), commandBuffer, markerName, drawNodeMarkerColor);
-		vkCmdBeginRendering(commandBuffer, &renderInfo);
-
 
+		// Set before rendering begins. Nothing but executing secondary command buffers is allowed inside when they hold the contents
 		VkViewport viewport{};
 		viewport.x = 0.0f;
 		viewport.y = 0.0f;
-		viewport.width = (float)context->GetRenderResolution().width;
-		viewport.height = (float)context->GetRenderResolution().height;
+		viewport.width = (float)renderArea.width;
+		viewport.height = (float)renderArea.height;
 		viewport.minDepth = 0.0f;
 		viewport.maxDepth = 1.0f;
 
@@ -152,9 +167,11 @@ namespace NVulkanEngine
 
 		VkRect2D scissor{};
 		scissor.offset = { 0, 0 };
-		scissor.extent = context->GetRenderResolution();
+		scissor.extent = renderArea;
 
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		vkCmdBeginRendering(commandBuffer, &renderInfo);
 	}
 
 	void CDrawNode::EndRendering(CGraphicsContext* context, VkCommandBuffer commandBuffer)
@@ -162,4 +179,76 @@ namespace NVulkanEngine
 		vkCmdEndRendering(commandBuffer);
 		EndMarker(context->GetVulkanInstance(), commandBuffer);
 	}
+
+	void CDrawNode::BeginCompute(
+		const std::string markerName,
+		CGraphicsContext* context,
+		VkCommandBuffer   commandBuffer,
+		CPipeline*        pipeline,
+		CBindingTable*    bindingTable)
+	{
+		const float computeMarkerColor[4] = { 0.4f, 0.6f, 0.9f, 1.0f };
+		BeginMarker(context->GetVulkanInstance(), commandBuffer, markerName, computeMarkerColor);
+
+		pipeline->BindPipeline(commandBuffer);
+		bindingTable->BindTable(context, commandBuffer, pipeline->GetPipelineLayout(), pipeline->GetBindPoint());
+	}
+
+	void CDrawNode::Dispatch(VkCommandBuffer commandBuffer, glm::uvec3 numThreads, glm::uvec3 groupSize)
+	{
+		const glm::uvec3 numWorkGroups = (numThreads + groupSize - 1u) / groupSize;
+		vkCmdDispatch(commandBuffer, numWorkGroups.x, numWorkGroups.y, numWorkGroups.z);
+	}
+
+	void CDrawNode::EndCompute(CGraphicsContext* context, VkCommandBuffer commandBuffer)
+	{
+		EndMarker(context->GetVulkanInstance(), commandBuffer);
+	}
+
+	VkPipelineStageFlags CDrawNode::GetComputeBarrierStages(CGraphicsContext* context, VkPipelineStageFlags graphicsStages)
+	{
+		return context->IsAsyncComputeEnabled() ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : (VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | graphicsStages);
+	}
+
+	void CDrawNode::GlobalBarrier(
+		VkCommandBuffer      commandBuffer,
+		VkPipelineStageFlags srcStage,
+		VkAccessFlags        srcAccess,
+		VkPipelineStageFlags dstStage,
+		VkAccessFlags        dstAccess)
+	{
+		VkMemoryBarrier memoryBarrier{};
+		memoryBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = srcAccess;
+		memoryBarrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	void CDrawNode::ImageBarrier(
+		VkCommandBuffer      commandBuffer,
+		VkImage              image,
+		VkImageLayout        oldLayout,
+		VkImageLayout        newLayout,
+		VkPipelineStageFlags srcStage,
+		VkAccessFlags        srcAccess,
+		VkPipelineStageFlags dstStage,
+		VkAccessFlags        dstAccess,
+		uint32_t             mipLevels)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout                       = oldLayout;
+		barrier.newLayout                       = newLayout;
+		barrier.srcAccessMask                   = srcAccess;
+		barrier.dstAccessMask                   = dstAccess;
+		barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image                           = image;
+		barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel   = 0;
+		barrier.subresourceRange.levelCount     = mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount     = 1;
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
 };
\ No newline at end of file
@@ -9,6 +9,12 @@
 #include <Managers/DebugManager.hpp>
 #include <Managers/ResourceManager.hpp>
 #include <Managers/PipelineManager.hpp>
+#include <Managers/ProfilerManager.hpp>
+#include <Managers/RecordingManager.hpp>
+#include <Managers/JobManager.hpp>
+
+#include <DrawNodes/Utils/Pipeline.hpp>
+#include <DrawNodes/Utils/BindingTable.hpp>
 
 /*
 	Draw nodes. Used for drawing everything in this engine.
@@ -44,6 +50,9 @@ namespace NVulkanEngine
 		CDebugManager*      m_DebugManager      = nullptr;
 		CPipelineManager*   m_PipelineManager   = nullptr;
 		CResourceManager*   m_ResourceManager   = nullptr;
+		CProfilerManager*   m_ProfilerManager   = nullptr;
+		CRecordingManager*  m_RecordingManager  = nullptr;
+		CJobManager*        m_JobManager        = nullptr;
 	};
 
 	class CDrawNode
@@ -54,6 +63,14 @@ namespace NVulkanEngine
 		virtual void Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer);
 		virtual void Cleanup(CGraphicsContext* context);
 
+		// Compute work that only depends on data uploaded by the CPU. Recorded before any draw node so it can overlap rasterization on the async compute queue.
+		// When async compute is disabled it is recorded at the start of the graphics command buffer instead
+		virtual bool HasAsyncCompute();
+		virtual void DispatchAsyncCompute(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer);
+
+		// Render resources read or written by this node. Used to figure out when resources are alive so their memory can be shared
+		virtual std::vector<EResourceIndices> GetResourceUsage();
+
 	protected:
 		void GenerateMipmaps(
 			CGraphicsContext* context, 
@@ -63,13 +80,59 @@ namespace NVulkanEngine
 			int32_t           texHeight, 
 			uint32_t          mipLevels);
 
-		// Begin rendering with attachments
+		// Begin rendering with attachments. Pass VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT when the draws are recorded by the recording manager
+		void BeginRendering(
+			const std::string              markerName,
+			CGraphicsContext*              context,
+			VkCommandBuffer                commandBuffer,
+			std::vector<SRenderResource> attachmentInfos,
+			VkRenderingFlags               renderingFlags = 0);
+
+		// Same as above but with an explicit render area. For attachments that are not render resolution sized
 		void BeginRendering(
 			const std::string              markerName,
 			CGraphicsContext*              context,
 			VkCommandBuffer                commandBuffer,
-			std::vector<SRenderResource> attachmentInfos);
+			VkExtent2D                     renderArea,
+			std::vector<SRenderResource> attachmentInfos,
+			VkRenderingFlags               renderingFlags = 0);
 
 		void EndRendering(CGraphicsContext* context, VkCommandBuffer commandBuffer);
+
+		// Begin recording compute work. Binds the compute pipeline and its binding table. Has to be outside of rendering
+		void BeginCompute(
+			const std::string markerName,
+			CGraphicsContext* context,
+			VkCommandBuffer   commandBuffer,
+			CPipeline*        pipeline,
+			CBindingTable*    bindingTable);
+
+		// Enough work groups to cover every thread. Group size has to match local_size in the shader
+		void Dispatch(VkCommandBuffer commandBuffer, glm::uvec3 numThreads, glm::uvec3 groupSize);
+
+		void EndCompute(CGraphicsContext* context, VkCommandBuffer commandBuffer);
+
+		// Graphics stages can't be used in barriers on the async compute queue. The semaphores between the queues synchronize with those instead
+		VkPipelineStageFlags GetComputeBarrierStages(CGraphicsContext* context, VkPipelineStageFlags graphicsStages);
+
+		// Barriers for node owned buffers and images, i.e. anything that isn't a render resource
+		void GlobalBarrier(
+			VkCommandBuffer      commandBuffer,
+			VkPipelineStageFlags srcStage,
+			VkAccessFlags        srcAccess,
+			VkPipelineStageFlags dstStage,
+			VkAccessFlags        dstAccess);
+
+		// Contents are kept unless oldLayout is undefined
+		void ImageBarrier(
+			VkCommandBuffer      commandBuffer,
+			VkImage              image,
+			VkImageLayout        oldLayout,
+			VkImageLayout        newLayout,
+			VkPipelineStageFlags srcStage,
+			VkAccessFlags        srcAccess,
+			VkPipelineStageFlags dstStage,
+			VkAccessFlags        dstAccess,
+			uint32_t             mipLevels = 1);
 	};
 };
@@ -1,32 +1,38 @@
 #include "GeometryNode.hpp"
 #include <imgui.h>
 
+#include <algorithm>
+#include <chrono>
+
+// Turn off to record the draws in the order the models were added
+static bool g_SortDraws = true;
+
+// Splits the draw list over the recording threads. Each chunk gets at least this many draws
+static bool g_ParallelRecording = true;
+#define GEOMETRY_MIN_DRAWS_PER_CHUNK 256
+
+// Only one pass and pipeline go through the draw list so far
+#define GEOMETRY_DRAW_PASS     0
+#define GEOMETRY_DRAW_PIPELINE 0
+
 namespace NVulkanEngine
 {
-	struct SGeometryUniformBuffer
+	std::vector<EResourceIndices> CGeometryNode::GetResourceUsage()
 	{
-		glm::mat4 m_ModelMat      = glm::identity<glm::mat4>();
-		glm::mat4 m_ViewMat       = glm::identity<glm::mat4>();
-		glm::mat4 m_ProjectionMat = glm::identity<glm::mat4>();
-	};
+		return
+		{
+			EResourceIndices::Normals,
+			EResourceIndices::Albedo,
+			EResourceIndices::Depth
+		};
+	}
 
 	void CGeometryNode::Init(CGraphicsContext* context, SGraphicsManagers* managers)
 	{
-		for (uint32_t i = 0; i < managers->m_Modelmanager->GetNumModels(); i++)
-		{
-			CModel* model = managers->m_Modelmanager->GetModel(i);
-			model->CreateGeometryMemoryBuffer(context, (VkDeviceSize)sizeof(SGeometryUniformBuffer));
-			model->CreateGeometryBindingTable(context);
-		}
-
-		VkFormat positionsFormat = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Positions).m_Format;
 		VkFormat normalsFormat   = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Normals).m_Format;
 		VkFormat albedoFormat    = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Albedo).m_Format;
 		VkFormat depthFormat     = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Depth).m_Format;
 
-		// Just get any descriptor set layout since they are the same for all the models atm
-		VkDescriptorSetLayout modelDescriptorSetLayout = managers->m_Modelmanager->GetModel(0)->GetModelDescriptorSetLayout();
-
 		m_GeometryPipeline = new CPipeline(EPipelineType::GRAPHICS);
 		m_GeometryPipeline->SetVertexShader("shaders/geometry.vert.spv");
 		m_GeometryPipeline->SetFragmentShader("shaders/geometry.frag.spv");
@@ -37,74 +43,226 @@ namespace NVulkanEngine
 		m_GeometryPipeline->AddVertexAttribute(2, VK_FORMAT_R32G32_SFLOAT,    offsetof(SModelVertex, m_TexCoord));
 		m_GeometryPipeline->AddVertexAttribute(3, VK_FORMAT_R32G32B32_SFLOAT, offsetof(SModelVertex, m_Normal));
 		m_GeometryPipeline->AddVertexAttribute(4, VK_FORMAT_R32G32B32_SFLOAT, offsetof(SModelVertex, m_Tangent));
-		m_GeometryPipeline->AddColorAttachment(positionsFormat);
 		m_GeometryPipeline->AddColorAttachment(normalsFormat);
 		m_GeometryPipeline->AddColorAttachment(albedoFormat);
 		m_GeometryPipeline->AddDepthAttachment(depthFormat);
-		m_GeometryPipeline->AddPushConstantSlot(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(SModelMaterial), 0);
-		m_GeometryPipeline->CreatePipeline(context, modelDescriptorSetLayout); 
+		m_GeometryPipeline->AddPushConstantSlot(VK_SHADER_STAGE_VERTEX_BIT, sizeof(uint32_t), 0); // Material index. Passed on to geometry.frag
+		m_GeometryPipeline->CreatePipeline(context, managers->m_ResourceManager->GetBindlessDescriptorLayout());
+
+		// No vertex input. Material comes from the draw data
+		m_GeometryPullPipeline = new CPipeline(EPipelineType::GRAPHICS);
+		m_GeometryPullPipeline->SetVertexShader("shaders/geometrypull.vert.spv");
+		m_GeometryPullPipeline->SetFragmentShader("shaders/geometry.frag.spv");
+		m_GeometryPullPipeline->SetCullingMode(VK_CULL_MODE_BACK_BIT);
+		m_GeometryPullPipeline->AddColorAttachment(normalsFormat);
+		m_GeometryPullPipeline->AddColorAttachment(albedoFormat);
+		m_GeometryPullPipeline->AddDepthAttachment(depthFormat);
+		m_GeometryPullPipeline->AddPushConstantSlot(VK_SHADER_STAGE_VERTEX_BIT, sizeof(uint32_t), 0); // Where the camera transforms start
+		m_GeometryPullPipeline->CreatePipeline(context, managers->m_ResourceManager->GetBindlessDescriptorLayout());
 	}
 
 	void CGeometryNode::UpdateGeometryBuffers(CGraphicsContext* context, SGraphicsManagers* managers)
 	{
 		CCamera* camera = managers->m_InputManager->GetCamera();
 
-		for (uint32_t i = 0; i < managers->m_Modelmanager->GetNumModels(); i++)
+		// Camera is view 0
+		managers->m_Modelmanager->UpdateObjectTransforms(context, 0, camera->GetProjectionMatrix() * camera->GetLookAtMatrix());
+	}
+
+	void CGeometryNode::EditMaterials(SGraphicsManagers* managers)
+	{
+		static int materialIndex = 0;
+
+		CModelManager* modelManager = managers->m_Modelmanager;
+		if (!ImGui::CollapsingHeader("Materials"))
+			return;
+
+		ImGui::SliderInt("Material", &materialIndex, 0, (int)modelManager->GetNumMaterials() - 1);
+		materialIndex = glm::clamp(materialIndex, 0, (int)modelManager->GetNumMaterials() - 1);
+
+		// Only the edited material is sent to the GPU
+		SModelMaterial material = modelManager->GetMaterial((uint32_t)materialIndex);
+		bool isChanged = ImGui::ColorEdit3("Diffuse", &material.m_Diffuse.x);
+		isChanged     |= ImGui::SliderFloat("Shininess", &material.m_Shininess, 0.0f, 256.0f);
+		isChanged     |= ImGui::SliderFloat("Metalness", &material.m_Metallness, 0.0f, 1.0f);
+		isChanged     |= ImGui::SliderFloat("Fresnel", &material.m_Fresnel, 0.0f, 1.0f);
+		if (isChanged)
+			modelManager->SetMaterial((uint32_t)materialIndex, material);
+
+		ImGui::Text("Ranges uploaded last frame: %u", m_NumMaterialRangesUploaded);
+	}
+
+	void CGeometryNode::BuildDrawList(SGraphicsManagers* managers)
+	{
+		CModelManager* modelManager = managers->m_Modelmanager;
+		CCamera*       camera       = managers->m_InputManager->GetCamera();
+
+		const glm::vec3 cameraPosition  = camera->GetPosition();
+		const glm::vec3 cameraDirection = camera->GetDirection();
+		const float     cameraFar       = camera->GetFar();
+
+		m_DrawList.Clear();
+		for (uint32_t i = 0; i < modelManager->GetNumModels(); i++)
 		{
-			CModel* model = managers->m_Modelmanager->GetModel(i);
+			CModel* model = modelManager->GetModel(i);
 
-			SGeometryUniformBuffer uboModel{};
-			uboModel.m_ModelMat      = model->GetTransform();
-			uboModel.m_ViewMat       = camera->GetLookAtMatrix();
-			uboModel.m_ProjectionMat = camera->GetProjectionMatrix();
+			// Meshes don't have bounds of their own so they all get the depth of the model. Materials are per model
+			// so its meshes share a depth bucket and stay next to each other, the buffers are still bound once per model
+			const glm::AABB  bounds          = model->GetAABB();
+			const glm::vec3  boundsCenter    = (bounds.getMin() + bounds.getMax()) * 0.5f;
+			const float      normalizedDepth = glm::dot(boundsCenter - cameraPosition, cameraDirection) / cameraFar;
 
-			void* data;
-			vkMapMemory(context->GetLogicalDevice(), model->GetGeometryMemoryBuffer().m_Memory, 0, sizeof(SGeometryUniformBuffer), 0, &data);
-			memcpy(data, &uboModel, sizeof(uboModel));
-			vkUnmapMemory(context->GetLogicalDevice(), model->GetGeometryMemoryBuffer().m_Memory);
+			for (uint32_t j = 0; j < model->GetNumMeshes(); j++)
+			{
+				const uint32_t materialIndex = modelManager->GetMaterialIndex(i, model->GetMesh(j).m_MaterialId);
+				m_DrawList.AddDraw(CDrawList::MakeSortKey(GEOMETRY_DRAW_PASS, GEOMETRY_DRAW_PIPELINE, materialIndex, normalizedDepth), i, j);
+			}
 		}
+
+		if (g_SortDraws)
+			m_DrawList.Sort();
 	}
 
 	void CGeometryNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
 	{
 		CResourceManager* resourceManager = managers->m_ResourceManager;
+		CModelManager*    modelManager    = managers->m_Modelmanager;
+
+		// Binds are counted by the previous frame. Vertex pulling doesn't bind anything per draw
+		ImGui::Begin("Geometry Pass");
+		ImGui::Checkbox("Sort Draws", &g_SortDraws);
+		ImGui::Text("Draws: %u", m_DrawList.GetNumDraws());
+		ImGui::Text("Vertex/index buffer binds: %u", m_NumBufferBinds);
+		ImGui::Text("Material push constants: %u", m_NumPushConstants);
+		ImGui::Checkbox("Parallel Recording", &g_ParallelRecording);
+		ImGui::Text("Recorded in %u chunks on up to %u threads: %.3f ms", m_NumChunks, managers->m_RecordingManager->GetNumThreads(), m_RecordTimeMs);
+		EditMaterials(managers);
+		ImGui::End();
+
+		// Has to happen before rendering starts
+		m_NumMaterialRangesUploaded = modelManager->UploadDirtyMaterials(commandBuffer);
 
-		SRenderResource positionsAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Positions, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 		SRenderResource normalsAttachment   = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Normals,   VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 		SRenderResource albedoAttachment    = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Albedo,    VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 		SRenderResource depthAttachment     = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Depth,     VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 		
-		std::vector<SRenderResource> renderAttachments = { positionsAttachment, normalsAttachment, albedoAttachment, depthAttachment };
+		std::vector<SRenderResource> renderAttachments = { normalsAttachment, albedoAttachment, depthAttachment };
 
-		BeginRendering("GBuffers", context, commandBuffer, renderAttachments);
 		UpdateGeometryBuffers(context, managers);
 
-		m_GeometryPipeline->BindPipeline(commandBuffer);
+		if (modelManager->IsVertexPullingEnabled())
+		{
+			BeginRendering("GBuffers", context, commandBuffer, renderAttachments);
 
-		for (uint32_t i = 0; i < managers->m_Modelmanager->GetNumModels(); i++)
+			m_GeometryPullPipeline->BindPipeline(commandBuffer);
+			resourceManager->BindBindlessTable(context, commandBuffer, m_GeometryPullPipeline->GetPipelineLayout());
+
+			// Every mesh of every model in one go. The shared index buffer is the only buffer bind
+			modelManager->BindDrawIndexBuffer(commandBuffer);
+			m_NumBufferBinds   = 1;
+			m_NumPushConstants = 0;
+			m_NumChunks        = 0;
+
+			uint32_t objectTransformOffset = modelManager->GetObjectTransformIndex(context, 0, 0);
+			m_GeometryPullPipeline->PushConstants(commandBuffer, (void*)&objectTransformOffset);
+			vkCmdDrawIndexedIndirect(commandBuffer, modelManager->GetIndirectDrawBuffer(), 0, modelManager->GetNumDraws(), sizeof(VkDrawIndexedIndirectCommand));
+
+			EndRendering(context, commandBuffer);
+			return;
+		}
+
+		const auto recordStart = std::chrono::high_resolution_clock::now();
+
+		BuildDrawList(managers);
+
+		// Small scenes are recorded right into the frame's command buffer. Starting a secondary command buffer costs more than a few draws
+		const uint32_t numDraws  = m_DrawList.GetNumDraws();
+		const uint32_t numChunks = g_ParallelRecording ? std::min(managers->m_RecordingManager->GetNumThreads(), std::max(numDraws / GEOMETRY_MIN_DRAWS_PER_CHUNK, 1u)) : 1;
+
+		std::vector<SDrawRecordStats> chunkStats(std::max(numChunks, 1u));
+		if (numChunks <= 1)
 		{
-			CModel* model = managers->m_Modelmanager->GetModel(i);
+			BeginRendering("GBuffers", context, commandBuffer, renderAttachments);
+			RecordDraws(context, managers, commandBuffer, 0, numDraws, chunkStats[0]);
+			EndRendering(context, commandBuffer);
+		}
+		else
+		{
+			SRenderingInheritance inheritance{};
+			inheritance.m_ColorFormats = { normalsAttachment.m_Format, albedoAttachment.m_Format };
+			inheritance.m_DepthFormat  = depthAttachment.m_Format;
 
-			//managers->m_DebugManager->DrawDebugAABB(model->GetAABB(), glm::vec3(1.0f, 1.0f, 0.0f));
+			// Consecutive ranges of the sorted list so each chunk keeps the bind savings of the sort. Sizes differ by at most one draw
+			const std::vector<VkCommandBuffer> chunkCommandBuffers = managers->m_RecordingManager->RecordSecondary(context, inheritance, numChunks,
+				[&](VkCommandBuffer chunkCommandBuffer, uint32_t chunkIndex)
+				{
+					const uint32_t firstDraw = (uint32_t)((uint64_t)chunkIndex * numDraws / numChunks);
+					const uint32_t endDraw   = (uint32_t)((uint64_t)(chunkIndex + 1) * numDraws / numChunks);
 
-			model->BindVertexAndIndexBuffers(commandBuffer);
-			model->BindGeometryTable(context, commandBuffer, m_GeometryPipeline->GetPipelineLayout());
-			for (uint32_t j = 0; j < model->GetNumMeshes(); j++)
+					// Dynamic state isn't inherited from the primary command buffer
+					SetViewportScissor(chunkCommandBuffer, context->GetRenderResolution());
+					RecordDraws(context, managers, chunkCommandBuffer, firstDraw, endDraw - firstDraw, chunkStats[chunkIndex]);
+				});
+
+			BeginRendering("GBuffers", context, commandBuffer, renderAttachments, VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT);
+			vkCmdExecuteCommands(commandBuffer, (uint32_t)chunkCommandBuffers.size(), chunkCommandBuffers.data());
+			EndRendering(context, commandBuffer);
+		}
+
+		m_NumBufferBinds   = 0;
+		m_NumPushConstants = 0;
+		m_NumChunks        = numChunks;
+		for (const SDrawRecordStats& stats : chunkStats)
+		{
+			m_NumBufferBinds   += stats.m_NumBufferBinds;
+			m_NumPushConstants += stats.m_NumPushConstants;
+		}
+
+		// Smoothed so the number in the Geometry Pass window is readable
+		const float recordTimeMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - recordStart).count();
+		m_RecordTimeMs = m_RecordTimeMs * 0.95f + recordTimeMs * 0.05f;
+	}
+
+	void CGeometryNode::RecordDraws(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t numDraws, SDrawRecordStats& stats)
+	{
+		CModelManager* modelManager = managers->m_Modelmanager;
+
+		m_GeometryPipeline->BindPipeline(commandBuffer);
+		managers->m_ResourceManager->BindBindlessTable(context, commandBuffer, m_GeometryPipeline->GetPipelineLayout());
+
+		// Only record a bind when it differs from what is already bound
+		uint32_t boundModelIndex    = UINT32_MAX;
+		uint32_t boundMaterialIndex = UINT32_MAX;
+
+		for (uint32_t i = firstDraw; i < firstDraw + numDraws; i++)
+		{
+			const SDrawListItem& draw  = m_DrawList.GetDraw(i);
+			CModel*              model = modelManager->GetModel(draw.m_ModelIndex);
+
+			if (draw.m_ModelIndex != boundModelIndex)
 			{
-				SMaterialMesh modelMesh = model->GetMesh(j);
-				SModelMaterial material     = model->GetMaterial(modelMesh.m_MaterialId);
-				material.m_UseAlbedoTexture = model->GetModelTexture() != nullptr;
+				model->BindVertexAndIndexBuffers(commandBuffer);
+				boundModelIndex = draw.m_ModelIndex;
+				stats.m_NumBufferBinds++;
+			}
 
-				m_GeometryPipeline->PushConstants(commandBuffer, (void*)&material);
-				vkCmdDrawIndexed(commandBuffer, modelMesh.m_NumVertices, 1, modelMesh.m_StartIndex, 0, 0);
+			SMaterialMesh modelMesh = model->GetMesh(draw.m_MeshIndex);
+			uint32_t materialIndex  = modelManager->GetMaterialIndex(draw.m_ModelIndex, modelMesh.m_MaterialId);
+			if (materialIndex != boundMaterialIndex)
+			{
+				m_GeometryPipeline->PushConstants(commandBuffer, (void*)&materialIndex);
+				boundMaterialIndex = materialIndex;
+				stats.m_NumPushConstants++;
 			}
-		}
 
-		EndRendering(context, commandBuffer);
+			const uint32_t objectTransformIndex = modelManager->GetObjectTransformIndex(context, 0, draw.m_ModelIndex);
+			vkCmdDrawIndexed(commandBuffer, modelMesh.m_NumVertices, 1, modelMesh.m_StartIndex, 0, objectTransformIndex);
+		}
 	}
 
 	void CGeometryNode::Cleanup(CGraphicsContext* context)
 	{
 		m_GeometryPipeline->Cleanup(context);
+		m_GeometryPullPipeline->Cleanup(context);
 	}
 };
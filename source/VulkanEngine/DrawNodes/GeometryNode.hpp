@@ -3,6 +3,7 @@
 #include <DrawNodes/DrawNode.hpp>
 #include <DrawNodes/Utils/Pipeline.hpp>
 #include <DrawNodes/Utils/BindingTable.hpp>
+#include <DrawNodes/Utils/DrawList.hpp>
 
 /* 
 	Draw scene geometry into G-Buffers
@@ -10,6 +11,13 @@
 
 namespace NVulkanEngine
 {
+	// Binds recorded by one chunk of the draw list
+	struct SDrawRecordStats
+	{
+		uint32_t m_NumBufferBinds   = 0;
+		uint32_t m_NumPushConstants = 0;
+	};
+
 	class CGeometryNode : public CDrawNode
 	{
 	public:
@@ -17,13 +25,32 @@ namespace NVulkanEngine
 		~CGeometryNode() = default;
 
 		virtual void Init(CGraphicsContext* context, SGraphicsManagers* managers)  override;
+		virtual std::vector<EResourceIndices> GetResourceUsage() override;
 		virtual void Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) override;
 		virtual void Cleanup(CGraphicsContext* context) override;
 
 	private:
 		void UpdateGeometryBuffers(CGraphicsContext* context, SGraphicsManagers* managers);
+		void BuildDrawList(SGraphicsManagers* managers);
+		void EditMaterials(SGraphicsManagers* managers);
+
+		// Records a range of the sorted draw list. Called from the recording threads so it must only read shared state
+		void RecordDraws(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t numDraws, SDrawRecordStats& stats);
 
 		// Pipeline (shader binding is done in model)
 		CPipeline* m_GeometryPipeline = nullptr;
+
+		// Same output but the vertex shader reads the vertices by buffer address. Used when vertex pulling is enabled
+		CPipeline* m_GeometryPullPipeline = nullptr;
+
+		// Every mesh of every model, sorted by material and then front to back
+		CDrawList m_DrawList = {};
+
+		// What the last frame recorded. Shown in the Geometry Pass window
+		uint32_t m_NumBufferBinds            = 0;
+		uint32_t m_NumPushConstants          = 0;
+		uint32_t m_NumMaterialRangesUploaded = 0;
+		uint32_t m_NumChunks                 = 0;
+		float    m_RecordTimeMs              = 0.0f; // CPU time of building, sorting and recording the draw list
 	} ;
 }
\ No newline at end of file
@@ -1,33 +1,93 @@
 #include "LightingNode.hpp"
 #include "ShadowNode.hpp"
+#include "SkyNode.hpp"
 
 #include <imgui.h>
 
-static float g_LightRadius = 1500.0f;
+#include <algorithm>
+#include <cstddef>
+#include <format>
+
+// Froxel grid. Must match MAX_LIGHTS_PER_CLUSTER in lightculling.comp and deferred.frag
+#define CLUSTER_GRID_X           16
+#define CLUSTER_GRID_Y           9
+#define CLUSTER_GRID_Z           24
+#define MAX_LIGHTS_PER_CLUSTER   128
+#define MAX_POINT_LIGHTS         16384
+#define LIGHT_CULLING_GROUP_SIZE 64 // local_size_x in lightculling.comp
+
+static int   g_NumActivePointLights = -1; // -1 means all of them
+static bool  g_AnimatePointLights   = true;
+static float g_PointLightTime       = 0.0f;
 
 namespace NVulkanEngine
 {
+	struct SPointLightGPU
+	{
+		glm::vec4 m_PositionRadius;
+		glm::vec4 m_ColorIntensity;
+	};
+
+	struct SLightCullingUniformBuffer
+	{
+		glm::mat4  m_ViewMatrix;
+		glm::mat4  m_InvProjection;
+		glm::uvec4 m_ClusterGridSize; // xyz number of clusters, w number of lights
+		glm::vec2  m_TileSize;
+		glm::vec2  m_ScreenSize;
+		float      m_Near;
+		float      m_Far;
+	};
+
 	struct SDeferredLightingUniformBuffer
 	{
-		struct Light
-		{
-			glm::mat4 m_LightMatrix;
+		glm::mat4  m_CascadeMatrices[MAX_SHADOW_CASCADES];
+		glm::vec4  m_CascadeSplits; // View space far distance of each cascade
+		glm::vec4  m_SunDirection;
+		glm::vec4  m_SunColor;
+		glm::vec3  m_ViewPos;
+		uint32_t   m_NumCascades;
 
-			glm::vec3 m_LightPosition;
-			float     m_LightRadius;
+		// Shadow filtering. See SShadowFilterSettings
+		glm::vec4  m_CascadeWorldSizes[MAX_SHADOW_CASCADES]; // x width, y depth range, z texel size in world units
+		glm::uvec4 m_ShadowFilterMode;                       // x mode, y number of samples
+		glm::vec4  m_ShadowFilterParams;                     // x radius in texels, y tan of half the sun angle, z normal offset in texels, w max penumbra in texels
 
-			glm::vec3 m_LightColor;
-			float     m_LightIntensity;
-		};
+		// For reconstructing world position from depth
+		glm::mat4  m_InvViewProjection;
 
-		Light     m_Lights[1];
-		glm::vec3 m_ViewPos;
-		float     m_Pad1;
+		// For finding the cluster of a pixel
+		glm::mat4  m_ViewMatrix;
+		glm::uvec4 m_ClusterGridSize;
+		glm::vec2  m_TileSize;
+		glm::vec2  m_ScreenSize;
+		float      m_Near;
+		float      m_Far;
+		uint32_t   m_VisualizeCascades;
+		uint32_t   m_SkyResolution; // ESkyResolution. Fills the last four bytes before the vec4 below
+
+		// Sky might only cover the top left part of the sky box. xy screen uv to sky box uv, zw max uv so filtering stays inside of it
+		glm::vec4  m_SkyUVScale;
 	};
 
+	// std140 puts a vec4 on a 16 byte boundary. C++ does not so a gap in front of it shifts everything after
+	static_assert(offsetof(SDeferredLightingUniformBuffer, m_SkyUVScale) % 16 == 0, "SDeferredLightingUniformBuffer must match the UBO in deferred.frag");
+
+	std::vector<EResourceIndices> CLightingNode::GetResourceUsage()
+	{
+		return
+		{
+			EResourceIndices::Normals,
+			EResourceIndices::Albedo,
+			EResourceIndices::Depth,
+			EResourceIndices::ShadowMap,
+			EResourceIndices::AtmosphericsSkyBox,
+			EResourceIndices::SceneColor
+		};
+	}
+
 	void CLightingNode::Init(CGraphicsContext* context, SGraphicsManagers* managers)
 	{
-		const SRenderResource positionsAttachment    = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Positions);
 		const SRenderResource normalsAttachment      = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Normals);
 		const SRenderResource albedoAttachment       = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Albedo);
 		const SRenderResource depthAttachment        = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Depth);
@@ -36,14 +96,73 @@ namespace NVulkanEngine
 
 		m_DeferredUniformBuffer = CreateUniformBuffer(context, m_DeferredLightBufferMemory, sizeof(SDeferredLightingUniformBuffer));
 
+		// Light list is rewritten by the CPU every frame. The cluster lists only ever live on the GPU
+		m_NumClusters = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+
+		const VkDeviceSize pointLightBufferSize        = sizeof(SPointLightGPU) * MAX_POINT_LIGHTS;
+		const VkDeviceSize clusterLightCountBufferSize = sizeof(uint32_t) * m_NumClusters;
+		const VkDeviceSize clusterLightIndexBufferSize = sizeof(uint32_t) * m_NumClusters * MAX_LIGHTS_PER_CLUSTER;
+
+		m_LightCullingUniformBuffer = CreateUniformBuffer(context, m_LightCullingBufferMemory, sizeof(SLightCullingUniformBuffer), true);
+		m_PointLightBuffer          = CreateStorageBuffer(context, m_PointLightBufferMemory,  pointLightBufferSize,        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+		m_ClusterLightCountBuffer   = CreateStorageBuffer(context, m_ClusterLightCountMemory, clusterLightCountBufferSize, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+		m_ClusterLightIndexBuffer   = CreateStorageBuffer(context, m_ClusterLightIndexMemory, clusterLightIndexBufferSize, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+
+		m_LightCullingTable = new CBindingTable();
+		m_LightCullingTable->AddUniformBufferBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, m_LightCullingUniformBuffer, sizeof(SLightCullingUniformBuffer));
+		m_LightCullingTable->AddStorageBufferBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, m_PointLightBuffer,          pointLightBufferSize);
+		m_LightCullingTable->AddStorageBufferBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, m_ClusterLightCountBuffer,   clusterLightCountBufferSize);
+		m_LightCullingTable->AddStorageBufferBinding(3, VK_SHADER_STAGE_COMPUTE_BIT, m_ClusterLightIndexBuffer,   clusterLightIndexBufferSize);
+		m_LightCullingTable->CreateBindings(context);
+
+		m_LightCullingPipeline = new CPipeline(EPipelineType::COMPUTE);
+		m_LightCullingPipeline->SetDebugName("Light Culling");
+		m_LightCullingPipeline->SetComputeShader("shaders/lightculling.comp.spv");
+		m_LightCullingPipeline->CreatePipeline(context, m_LightCullingTable->GetDescriptorSetLayout());
+
+		// Everything outside the shadow map is lit
+		VkSamplerCreateInfo shadowSamplerInfo{};
+		shadowSamplerInfo.sType                   = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		shadowSamplerInfo.minFilter               = VK_FILTER_LINEAR;
+		shadowSamplerInfo.magFilter               = VK_FILTER_LINEAR;
+		shadowSamplerInfo.mipmapMode              = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		shadowSamplerInfo.addressModeU            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		shadowSamplerInfo.addressModeV            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		shadowSamplerInfo.addressModeW            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		shadowSamplerInfo.maxAnisotropy           = 1.0f;
+		shadowSamplerInfo.minLod                  = 0.0f;
+		shadowSamplerInfo.maxLod                  = 0.0f;
+		shadowSamplerInfo.borderColor             = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		shadowSamplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+		// Lit when the receiver is closer to the sun than what is stored. Linear filtering blends the 2x2 comparison results
+		shadowSamplerInfo.compareEnable           = VK_TRUE;
+		shadowSamplerInfo.compareOp               = VK_COMPARE_OP_LESS_OR_EQUAL;
+		if (vkCreateSampler(context->GetLogicalDevice(), &shadowSamplerInfo, nullptr, &m_ShadowComparisonSampler) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create shadow comparison sampler!");
+		}
+
+		shadowSamplerInfo.minFilter               = VK_FILTER_NEAREST;
+		shadowSamplerInfo.magFilter               = VK_FILTER_NEAREST;
+		shadowSamplerInfo.compareEnable           = VK_FALSE;
+		shadowSamplerInfo.compareOp               = VK_COMPARE_OP_ALWAYS;
+		if (vkCreateSampler(context->GetLogicalDevice(), &shadowSamplerInfo, nullptr, &m_ShadowDepthSampler) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create shadow depth sampler!");
+		}
+
 		m_DeferredTable = new CBindingTable();
-		m_DeferredTable->AddSampledImageBinding(0,  VK_SHADER_STAGE_FRAGMENT_BIT, positionsAttachment.m_ImageView,    positionsAttachment.m_Format,    context->GetLinearClampSampler());
-		m_DeferredTable->AddSampledImageBinding(1,  VK_SHADER_STAGE_FRAGMENT_BIT, normalsAttachment.m_ImageView,      normalsAttachment.m_Format,      context->GetLinearClampSampler());
-		m_DeferredTable->AddSampledImageBinding(2,  VK_SHADER_STAGE_FRAGMENT_BIT, albedoAttachment.m_ImageView,       albedoAttachment.m_Format,       context->GetLinearClampSampler());
-		m_DeferredTable->AddSampledImageBinding(3,  VK_SHADER_STAGE_FRAGMENT_BIT, depthAttachment.m_ImageView,        depthAttachment.m_Format,        context->GetLinearClampSampler());
-		m_DeferredTable->AddSampledImageBinding(4,  VK_SHADER_STAGE_FRAGMENT_BIT, shadowMapAttachment.m_ImageView,    shadowMapAttachment.m_Format,    context->GetLinearClampSampler());
-		m_DeferredTable->AddSampledImageBinding(5,  VK_SHADER_STAGE_FRAGMENT_BIT, atmosphericsAttachment.m_ImageView, atmosphericsAttachment.m_Format, context->GetLinearClampSampler());
-		m_DeferredTable->AddUniformBufferBinding(6, VK_SHADER_STAGE_FRAGMENT_BIT, m_DeferredUniformBuffer, sizeof(SDeferredLightingUniformBuffer));
+		m_DeferredTable->AddSampledImageBinding(0,  VK_SHADER_STAGE_FRAGMENT_BIT, normalsAttachment.m_ImageView,      normalsAttachment.m_Format,      context->GetLinearClampSampler());
+		m_DeferredTable->AddSampledImageBinding(1,  VK_SHADER_STAGE_FRAGMENT_BIT, albedoAttachment.m_ImageView,       albedoAttachment.m_Format,       context->GetLinearClampSampler());
+		m_DeferredTable->AddSampledImageBinding(2,  VK_SHADER_STAGE_FRAGMENT_BIT, depthAttachment.m_ImageView,        depthAttachment.m_Format,        context->GetLinearClampSampler());
+		m_DeferredTable->AddSampledImageBinding(3,  VK_SHADER_STAGE_FRAGMENT_BIT, shadowMapAttachment.m_ImageView,    shadowMapAttachment.m_Format,    m_ShadowComparisonSampler);
+		m_DeferredTable->AddSampledImageBinding(4,  VK_SHADER_STAGE_FRAGMENT_BIT, atmosphericsAttachment.m_ImageView, atmosphericsAttachment.m_Format, context->GetLinearClampSampler());
+		m_DeferredTable->AddUniformBufferBinding(5, VK_SHADER_STAGE_FRAGMENT_BIT, m_DeferredUniformBuffer, sizeof(SDeferredLightingUniformBuffer));
+		m_DeferredTable->AddStorageBufferBinding(6, VK_SHADER_STAGE_FRAGMENT_BIT, m_PointLightBuffer,        pointLightBufferSize);
+		m_DeferredTable->AddStorageBufferBinding(7, VK_SHADER_STAGE_FRAGMENT_BIT, m_ClusterLightCountBuffer, clusterLightCountBufferSize);
+		m_DeferredTable->AddStorageBufferBinding(8, VK_SHADER_STAGE_FRAGMENT_BIT, m_ClusterLightIndexBuffer, clusterLightIndexBufferSize);
+		m_DeferredTable->AddSampledImageBinding(9,  VK_SHADER_STAGE_FRAGMENT_BIT, shadowMapAttachment.m_ImageView,    shadowMapAttachment.m_Format,    m_ShadowDepthSampler);
 		m_DeferredTable->CreateBindings(context);
 
 		const VkFormat sceneColorAttachmentFormat = managers->m_ResourceManager->GetRenderResource(EResourceIndices::SceneColor).m_Format;
@@ -60,27 +179,152 @@ namespace NVulkanEngine
 
 	void CLightingNode::UpdateLightBuffers(CGraphicsContext* context, SGraphicsManagers* managers)
 	{
+		CCamera* camera = managers->m_InputManager->GetCamera();
+		CLightManager* lightManager = managers->m_LightManager;
+
+		const std::vector<SLightSource>& lightSources = lightManager->GetLightSources();
+
+		// Gather the point lights. The sun is handled separately since it is the only one casting shadows
+		static std::vector<SPointLightGPU> pointLights = {};
+		pointLights.clear();
+
+		for (uint32_t i = 0; i < lightSources.size(); i++)
+		{
+			const SLightSource& lightSource = lightSources[i];
+			if (lightSource.m_Type != ELightType::POINT)
+				continue;
+
+			glm::vec3 lightPosition = lightSource.m_Position;
+			if (g_AnimatePointLights)
+			{
+				// Just some wobbling so we can see the lights are dynamic
+				const float phase = (float)i * 0.37f;
+				lightPosition += glm::vec3(glm::sin(g_PointLightTime + phase), glm::sin(g_PointLightTime * 1.3f + phase) * 0.5f, glm::cos(g_PointLightTime + phase)) * lightSource.m_Radius;
+			}
+
+			SPointLightGPU pointLight{};
+			pointLight.m_PositionRadius = glm::vec4(lightPosition, lightSource.m_Radius);
+			pointLight.m_ColorIntensity = glm::vec4(lightSource.m_Color, lightSource.m_Intensity);
+			pointLights.push_back(pointLight);
+		}
+
+		const int numPointLights = (int)std::min(pointLights.size(), (size_t)MAX_POINT_LIGHTS);
+		if (g_NumActivePointLights < 0 || g_NumActivePointLights > numPointLights)
+			g_NumActivePointLights = numPointLights;
+
+		ImGui::Begin("Lights");
+		ImGui::SliderInt("Active point lights", &g_NumActivePointLights, 0, numPointLights);
+		ImGui::Checkbox("Animate point lights", &g_AnimatePointLights);
+		ImGui::Text("Clusters: %d x %d x %d (max %d lights per cluster)", CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, MAX_LIGHTS_PER_CLUSTER);
+		ImGui::End();
+
+		if (g_AnimatePointLights)
+			g_PointLightTime += context->GetDeltaTime();
+
+		const VkExtent2D renderResolution = context->GetRenderResolution();
+		const glm::vec2  screenSize       = glm::vec2((float)renderResolution.width, (float)renderResolution.height);
+		const glm::vec2  tileSize         = glm::ceil(screenSize / glm::vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y));
+		const glm::uvec4 clusterGridSize  = glm::uvec4(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, (uint32_t)g_NumActivePointLights);
+
+		const glm::mat4 viewMatrix       = camera->GetLookAtMatrix();
+		const glm::mat4 projectionMatrix = camera->GetProjectionMatrix();
+
+		SLightCullingUniformBuffer lightCullingUbo{};
+		lightCullingUbo.m_ViewMatrix      = viewMatrix;
+		lightCullingUbo.m_InvProjection   = glm::inverse(projectionMatrix);
+		lightCullingUbo.m_ClusterGridSize = clusterGridSize;
+		lightCullingUbo.m_TileSize        = tileSize;
+		lightCullingUbo.m_ScreenSize      = screenSize;
+		lightCullingUbo.m_Near            = camera->GetNear();
+		lightCullingUbo.m_Far             = camera->GetFar();
+
+		const SLightSource sunlight = lightManager->GetSunlight();
+
 		SDeferredLightingUniformBuffer deferredLightingUbo{};
-		deferredLightingUbo.m_Lights[0].m_LightColor     = glm::vec3(1.0f, 1.0f, 1.0f);
-		deferredLightingUbo.m_Lights[0].m_LightPosition  = glm::vec3(0.0f, 1000.0f, 30.0f);
-		deferredLightingUbo.m_Lights[0].m_LightRadius    = g_LightRadius;
-		deferredLightingUbo.m_Lights[0].m_LightIntensity = 100.0f;
-		deferredLightingUbo.m_Lights[0].m_LightMatrix    = CShadowNode::GetLightMatrix();
-		deferredLightingUbo.m_ViewPos                    = managers->m_InputManager->GetCamera()->GetPosition();
-		deferredLightingUbo.m_Pad1                       = 0.0f;
+		const uint32_t numCascades = managers->m_ResourceManager->GetRenderResource(EResourceIndices::ShadowMap).m_LayerCount;
+		for (uint32_t i = 0; i < numCascades; i++)
+		{
+			deferredLightingUbo.m_CascadeMatrices[i]  = CShadowNode::GetCascadeMatrix(i);
+			deferredLightingUbo.m_CascadeSplits[i]    = CShadowNode::GetCascadeSplit(i);
+		}
+		deferredLightingUbo.m_NumCascades       = numCascades;
+
+		const uint32_t shadowMapResolution = managers->m_ResourceManager->GetRenderResource(EResourceIndices::ShadowMap).m_Extent.width;
+		for (uint32_t i = 0; i < numCascades; i++)
+		{
+			const glm::vec2 cascadeWorldSize = CShadowNode::GetCascadeWorldSize(i);
+			deferredLightingUbo.m_CascadeWorldSizes[i] = glm::vec4(cascadeWorldSize.x, cascadeWorldSize.y, cascadeWorldSize.x / (float)shadowMapResolution, 0.0f);
+		}
+
+		const SShadowFilterSettings filterSettings = CShadowNode::GetFilterSettings();
+		deferredLightingUbo.m_ShadowFilterMode   = glm::uvec4((uint32_t)filterSettings.m_Mode, (uint32_t)filterSettings.m_NumSamples, 0, 0);
+		deferredLightingUbo.m_ShadowFilterParams = glm::vec4(
+			filterSettings.m_FilterRadius,
+			glm::tan(glm::radians(filterSettings.m_SunAngularSize) * 0.5f),
+			filterSettings.m_NormalOffset,
+			filterSettings.m_MaxPenumbra);
+		deferredLightingUbo.m_SunDirection      = glm::vec4(CShadowNode::GetSunlightDirection(), 0.0f);
+		deferredLightingUbo.m_SunColor          = glm::vec4(sunlight.m_Color * sunlight.m_Intensity, 1.0f);
+		deferredLightingUbo.m_ViewPos           = camera->GetPosition();
+		deferredLightingUbo.m_InvViewProjection = glm::inverse(projectionMatrix * viewMatrix);
+		deferredLightingUbo.m_ViewMatrix        = viewMatrix;
+		deferredLightingUbo.m_ClusterGridSize   = clusterGridSize;
+		deferredLightingUbo.m_TileSize          = tileSize;
+		deferredLightingUbo.m_ScreenSize        = screenSize;
+		deferredLightingUbo.m_Near              = camera->GetNear();
+		deferredLightingUbo.m_Far               = camera->GetFar();
+		deferredLightingUbo.m_VisualizeCascades = CShadowNode::GetVisualizeCascades() ? 1 : 0;
+
+		const VkExtent2D skyBoxExtent = managers->m_ResourceManager->GetRenderResource(EResourceIndices::AtmosphericsSkyBox).m_Extent;
+		const VkExtent2D skyExtent    = CSkyNode::GetSkyExtent(context->GetRenderResolution());
+		const glm::vec2  skyBoxSize   = glm::vec2(skyBoxExtent.width, skyBoxExtent.height);
+		const glm::vec2  skySize      = glm::vec2(skyExtent.width, skyExtent.height);
+		deferredLightingUbo.m_SkyUVScale        = glm::vec4(skySize / skyBoxSize, (skySize - 0.5f) / skyBoxSize);
+		deferredLightingUbo.m_SkyResolution     = (uint32_t)CSkyNode::GetSkyResolution();
 
 		void* data;
 		vkMapMemory(context->GetLogicalDevice(), m_DeferredLightBufferMemory, 0, sizeof(SDeferredLightingUniformBuffer), 0, &data);
 		memcpy(data, &deferredLightingUbo, sizeof(SDeferredLightingUniformBuffer));
 		vkUnmapMemory(context->GetLogicalDevice(), m_DeferredLightBufferMemory);
+
+		vkMapMemory(context->GetLogicalDevice(), m_LightCullingBufferMemory, 0, sizeof(SLightCullingUniformBuffer), 0, &data);
+		memcpy(data, &lightCullingUbo, sizeof(SLightCullingUniformBuffer));
+		vkUnmapMemory(context->GetLogicalDevice(), m_LightCullingBufferMemory);
+
+		if (g_NumActivePointLights > 0)
+		{
+			const VkDeviceSize pointLightDataSize = sizeof(SPointLightGPU) * g_NumActivePointLights;
+
+			vkMapMemory(context->GetLogicalDevice(), m_PointLightBufferMemory, 0, pointLightDataSize, 0, &data);
+			memcpy(data, pointLights.data(), pointLightDataSize);
+			vkUnmapMemory(context->GetLogicalDevice(), m_PointLightBufferMemory);
+		}
 	}
 
-	void CLightingNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
+	void CLightingNode::CullLights(CGraphicsContext* context, VkCommandBuffer commandBuffer)
+	{
+		// Previous frame might still be reading the cluster lists in its lighting pass
+		GlobalBarrier(commandBuffer, GetComputeBarrierStages(context, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT), VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+		// One thread per cluster
+		BeginCompute("Light Culling", context, commandBuffer, m_LightCullingPipeline, m_LightCullingTable);
+		Dispatch(commandBuffer, glm::uvec3(m_NumClusters, 1, 1), glm::uvec3(LIGHT_CULLING_GROUP_SIZE, 1, 1));
+		EndCompute(context, commandBuffer);
+
+		// Cluster lists have to be written before the lighting pass reads them
+		GlobalBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, GetComputeBarrierStages(context, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT), VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	void CLightingNode::DispatchAsyncCompute(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
 	{
 		UpdateLightBuffers(context, managers);
+		CullLights(context, commandBuffer);
+	}
 
+	void CLightingNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
+	{
+		// Cluster lists are already done. See DispatchAsyncCompute()
 		CResourceManager* resourceManager = managers->m_ResourceManager;
-		resourceManager->TransitionResource(commandBuffer, EResourceIndices::Positions,          VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		resourceManager->TransitionResource(commandBuffer, EResourceIndices::Normals,            VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		resourceManager->TransitionResource(commandBuffer, EResourceIndices::Albedo,             VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		resourceManager->TransitionResource(commandBuffer, EResourceIndices::Depth,              VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
@@ -94,10 +338,15 @@ namespace NVulkanEngine
 
 		m_DeferredTable->BindTable(context, commandBuffer, m_DeferredPipeline->GetPipelineLayout());
 		m_DeferredPipeline->BindPipeline(commandBuffer);
-		
+
+		// Most of the cost of this pass is the shadow filter. Time each filter setting separately so they can be compared
+		uint32_t deferredTimer = managers->m_ProfilerManager->BeginTimer(commandBuffer, std::format("Deferred - {}", CShadowNode::GetFilterName()));
+
 		// Draw single triangle covering entire screen. See deferred.vert
 		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
+		managers->m_ProfilerManager->EndTimer(commandBuffer, deferredTimer);
+
 		EndRendering(context, commandBuffer);
 	}
 
@@ -105,11 +354,26 @@ namespace NVulkanEngine
 	{
 		vkDestroyBuffer(context->GetLogicalDevice(), m_DeferredUniformBuffer, nullptr);
 		vkFreeMemory(context->GetLogicalDevice(), m_DeferredLightBufferMemory, nullptr);
+		vkDestroyBuffer(context->GetLogicalDevice(), m_LightCullingUniformBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_LightCullingBufferMemory, nullptr);
+		vkDestroyBuffer(context->GetLogicalDevice(), m_PointLightBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_PointLightBufferMemory, nullptr);
+		vkDestroyBuffer(context->GetLogicalDevice(), m_ClusterLightCountBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_ClusterLightCountMemory, nullptr);
+		vkDestroyBuffer(context->GetLogicalDevice(), m_ClusterLightIndexBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_ClusterLightIndexMemory, nullptr);
+
+		vkDestroySampler(context->GetLogicalDevice(), m_ShadowComparisonSampler, nullptr);
+		vkDestroySampler(context->GetLogicalDevice(), m_ShadowDepthSampler, nullptr);
 
 		m_DeferredTable->Cleanup(context);
 		m_DeferredPipeline->Cleanup(context);
+		m_LightCullingTable->Cleanup(context);
+		m_LightCullingPipeline->Cleanup(context);
 
 		delete m_DeferredTable;
 		delete m_DeferredPipeline;
+		delete m_LightCullingTable;
+		delete m_LightCullingPipeline;
 	}
 }
\ No newline at end of file
@@ -5,7 +5,8 @@
 #include <DrawNodes/Utils/BindingTable.hpp>
 
 /*
-	Does deferred lighting
+	Does deferred lighting. Point lights are first binned into 3D clusters by a compute pass
+	so each pixel only has to loop over the lights that can actually reach it
 */
 
 namespace NVulkanEngine
@@ -17,17 +18,41 @@ namespace NVulkanEngine
 		~CLightingNode() = default;
 
 		virtual void Init(CGraphicsContext * context, SGraphicsManagers * managers)  override;
+		virtual std::vector<EResourceIndices> GetResourceUsage() override;
 		virtual void Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) override;
 		virtual void Cleanup(CGraphicsContext* context) override;
 
+		// Light culling only needs the camera and the light list so it can overlap the geometry passes
+		virtual bool HasAsyncCompute() override { return true; };
+		virtual void DispatchAsyncCompute(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) override;
+
 	private:
 		void UpdateLightBuffers(CGraphicsContext* context, SGraphicsManagers* managers);
+		void CullLights(CGraphicsContext* context, VkCommandBuffer commandBuffer);
 
 		VkBuffer       m_DeferredUniformBuffer       = VK_NULL_HANDLE;
 		VkDeviceMemory m_DeferredLightBufferMemory   = VK_NULL_HANDLE;
 
+		// Clustered lighting
+		VkBuffer       m_LightCullingUniformBuffer   = VK_NULL_HANDLE;
+		VkDeviceMemory m_LightCullingBufferMemory    = VK_NULL_HANDLE;
+		VkBuffer       m_PointLightBuffer            = VK_NULL_HANDLE;
+		VkDeviceMemory m_PointLightBufferMemory      = VK_NULL_HANDLE;
+		VkBuffer       m_ClusterLightCountBuffer     = VK_NULL_HANDLE;
+		VkDeviceMemory m_ClusterLightCountMemory     = VK_NULL_HANDLE;
+		VkBuffer       m_ClusterLightIndexBuffer     = VK_NULL_HANDLE;
+		VkDeviceMemory m_ClusterLightIndexMemory     = VK_NULL_HANDLE;
+
+		uint32_t       m_NumClusters                 = 0;
+
+		// Shadow map is sampled with hardware PCF. The blocker search for PCSS needs the raw depth
+		VkSampler      m_ShadowComparisonSampler     = VK_NULL_HANDLE;
+		VkSampler      m_ShadowDepthSampler          = VK_NULL_HANDLE;
+
 		// Pipeline & shader binding
 		CBindingTable* m_DeferredTable               = nullptr;
 		CPipeline*     m_DeferredPipeline            = nullptr;
+		CBindingTable* m_LightCullingTable           = nullptr;
+		CPipeline*     m_LightCullingPipeline        = nullptr;
 	};
 }
\ No newline at end of file
@@ -4,45 +4,76 @@
 
 #include <glm-aabb/AABB.hpp>
 
-#define SHADOWMAP_RESOLUTION 4096
+#include <cfloat>
+#include <format>
 
-static float g_SunZenithDegrees  = 80.0f;
-static float g_SunAzimuthDegrees = 45.0f;
+static float g_SunZenithDegrees   = 80.0f;
+static float g_SunAzimuthDegrees  = 45.0f;
+
+// Blend between uniform (0) and logarithmic (1) cascade splits
+static float g_CascadeSplitLambda = 0.8f;
+
+// Cascades don't go further than this from the camera
+static float g_ShadowDistance     = 6000.0f;
+
+// Turn off to redraw every cascade every frame
+static bool  g_CacheShadowMaps    = true;
+
+// Slope scaled bias takes care of surfaces at grazing angles to the sun. The normal offset in deferred.frag does the rest
+static float g_DepthBiasConstant  = 1.25f;
+static float g_DepthBiasSlope     = 1.75f;
+
+static const char* g_ShadowFilterModeNames[] = { "Hardware PCF", "Poisson", "Rotated Grid", "PCSS" };
 
 namespace NVulkanEngine
 {
-	glm::mat4 CShadowNode::s_LightMatrix = glm::identity<glm::mat4>();
 	glm::vec3 CShadowNode::s_SunlightDirection = glm::vec3(0.0f, 0.0f, 0.0f);
-	struct SShadowUniformBuffer
+	glm::mat4 CShadowNode::s_CascadeMatrices[MAX_SHADOW_CASCADES] = {};
+	float     CShadowNode::s_CascadeSplits[MAX_SHADOW_CASCADES]   = {};
+	glm::vec2 CShadowNode::s_CascadeWorldSizes[MAX_SHADOW_CASCADES] = {};
+	SShadowFilterSettings CShadowNode::s_FilterSettings  = {};
+	uint32_t  CShadowNode::s_NumCascades         = 4;
+	uint32_t  CShadowNode::s_ShadowMapResolution = 2048;
+	bool      CShadowNode::s_VisualizeCascades   = false;
+
+	std::vector<EResourceIndices> CShadowNode::GetResourceUsage()
 	{
-		glm::mat4 m_ModelMatrix;
-		glm::mat4 m_ViewMatrix;
-		glm::mat4 m_ProjectionMatrix;
-	};
+		return
+		{
+			EResourceIndices::ShadowMap,
+			EResourceIndices::ShadowMapStatic
+		};
+	}
 
 	void CShadowNode::Init(CGraphicsContext* context, SGraphicsManagers* managers)
 	{
-		for (uint32_t i = 0; i < managers->m_Modelmanager->GetNumModels(); i++)
-		{
-			CModel* model = managers->m_Modelmanager->GetModel(i);
-			model->CreateShadowMemoryBuffer(context, (VkDeviceSize)sizeof(SShadowUniformBuffer));
-			model->CreateShadowBindingTable(context);
-		}
-
 		VkFormat shadowMapFormat = managers->m_ResourceManager->GetRenderResource(EResourceIndices::ShadowMap).m_Format;
 
-		// Just get any descriptor set layout since they are the same for all the models atm
-		VkDescriptorSetLayout modelDescriptorSetLayout = managers->m_Modelmanager->GetModel(0)->GetModelDescriptorSetLayout();
-
 		m_ShadowPipeline = new CPipeline(EPipelineType::GRAPHICS);
 		m_ShadowPipeline->SetVertexShader("shaders/shadow.vert.spv");
 		m_ShadowPipeline->SetFragmentShader("shaders/shadow.frag.spv");
 		m_ShadowPipeline->SetCullingMode(VK_CULL_MODE_BACK_BIT);
+		m_ShadowPipeline->SetDepthBiasEnabled(true);
 		m_ShadowPipeline->SetVertexInput(sizeof(SModelVertex), VK_VERTEX_INPUT_RATE_VERTEX);
 		m_ShadowPipeline->AddVertexAttribute(0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(SModelVertex, m_Position));
 		m_ShadowPipeline->AddDepthAttachment(shadowMapFormat);
-		m_ShadowPipeline->AddPushConstantSlot(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(SModelMaterial), 0);
-		m_ShadowPipeline->CreatePipeline(context, modelDescriptorSetLayout);
+		m_ShadowPipeline->CreatePipeline(context, managers->m_ResourceManager->GetBindlessDescriptorLayout());
+
+		m_ShadowPullPipeline = new CPipeline(EPipelineType::GRAPHICS);
+		m_ShadowPullPipeline->SetVertexShader("shaders/shadowpull.vert.spv");
+		m_ShadowPullPipeline->SetFragmentShader("shaders/shadow.frag.spv");
+		m_ShadowPullPipeline->SetCullingMode(VK_CULL_MODE_BACK_BIT);
+		m_ShadowPullPipeline->SetDepthBiasEnabled(true);
+		m_ShadowPullPipeline->AddDepthAttachment(shadowMapFormat);
+		m_ShadowPullPipeline->AddPushConstantSlot(VK_SHADER_STAGE_VERTEX_BIT, sizeof(uint32_t), 0); // Where the cascade transforms start
+		m_ShadowPullPipeline->CreatePipeline(context, managers->m_ResourceManager->GetBindlessDescriptorLayout());
+
+		// Shadow map contents are gone after the resources have been recreated
+		for (uint32_t i = 0; i < MAX_SHADOW_CASCADES; i++)
+		{
+			m_IsCascadeCached[i] = false;
+		}
+		m_CasterTransformVersions.assign(managers->m_Modelmanager->GetNumModels(), UINT32_MAX);
 	}
 
 	glm::mat4 GetZenithAzimuthRotationMatrix(float zenithRadians, float azimuthRadians)
@@ -56,199 +87,414 @@ namespace NVulkanEngine
 		return rotationMatrix;
 	}
 
-	void GetSunlightTransformAndDirection(const SGraphicsManagers* managers, glm::vec3& sunlightDirection, glm::mat4& lookatMatrix, glm::mat4& projectionMatrix)
+	// Direction towards the sun
+	glm::vec3 GetSunlightDirectionFromAngles()
 	{
-		glm::AABB sceneBounds = managers->m_Modelmanager->GetSceneBounds();
-
 		glm::mat4 sunlightrotationMatrix = glm::identity<glm::mat4>();
 		sunlightrotationMatrix = glm::rotate(sunlightrotationMatrix, glm::radians(g_SunAzimuthDegrees), glm::vec3(0.0f, 1.0f, 0.0f));
 		sunlightrotationMatrix = glm::rotate(sunlightrotationMatrix, glm::radians(g_SunZenithDegrees), glm::vec3(0.0f, 0.0f, 1.0f));
 
-		glm::vec3 sunlightForwardVector = -(sunlightrotationMatrix * glm::vec4(0.0f, -1.0f, 0.0f, 0.0f));
-		glm::vec3 sunlightRightVector = glm::cross(sunlightForwardVector, glm::vec3(0.0f, 1.0f, 0.0f));
-
-		// If vectors are parallel cross product is not defined
-		if (glm::length(sunlightRightVector) < 1e-6f)
-			sunlightRightVector = glm::vec3(0.1f, 1.0f, 0.0f);
-
-		sunlightRightVector = -glm::normalize(sunlightRightVector);
-		glm::vec3 sunlightUpVector = -glm::cross(sunlightForwardVector, -sunlightRightVector);
-
-		float viewMatrixTranslationX    = glm::dot(sceneBounds.getCenter(), sunlightRightVector);
-		float viewMatrixTranslationY    = glm::dot(sceneBounds.getCenter(), sunlightUpVector);
-		float viewMatrixTranslationZ    = glm::dot(sceneBounds.getCenter(), sunlightForwardVector);
-		glm::vec3 viewMatrixTranslation = glm::vec3(viewMatrixTranslationX, viewMatrixTranslationY, viewMatrixTranslationZ);
-
-		// This is just a look at matrix really
-		glm::mat4 sunlightViewMatrix = glm::mat4(
-			glm::vec4(sunlightRightVector, 0.0f),
-			glm::vec4(sunlightUpVector, 0.0f),
-			glm::vec4(sunlightForwardVector, 0.0f),
-			glm::vec4(viewMatrixTranslation, 1.0f));
-		sunlightViewMatrix = glm::inverse(sunlightViewMatrix);
-		sceneBounds.transformCorners(sunlightViewMatrix);
-		
-		// TODO: I think bounds are not tight enough
-		glm::mat4 sunlightOrthoMatrix = glm::ortho(
-			sceneBounds.getMin().x,
-			sceneBounds.getMax().x,
-			sceneBounds.getMin().y,
-			sceneBounds.getMax().y,
-			-sceneBounds.getMax().z,
-			-sceneBounds.getMin().z);
-		sunlightOrthoMatrix[1][1] *= -1;
-
-		lookatMatrix = sunlightViewMatrix;
-		projectionMatrix = sunlightOrthoMatrix;
-		sunlightDirection = sunlightForwardVector;
+		return glm::normalize(-glm::vec3(sunlightrotationMatrix * glm::vec4(0.0f, -1.0f, 0.0f, 0.0f)));
 	}
 
-	void CShadowNode::UpdateShadowBuffers(CGraphicsContext* context, SGraphicsManagers* managers)
+	// Min and max of the bounds corners after transforming them
+	void TransformBounds(const glm::AABB& bounds, const glm::mat4& transform, glm::vec3& transformedMin, glm::vec3& transformedMax)
+	{
+		const glm::vec3 boundsMin = bounds.getMin();
+		const glm::vec3 boundsMax = bounds.getMax();
+
+		transformedMin = glm::vec3( FLT_MAX,  FLT_MAX,  FLT_MAX);
+		transformedMax = glm::vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (uint32_t i = 0; i < 8; i++)
+		{
+			glm::vec3 corner = glm::vec3(
+				(i & 1) ? boundsMax.x : boundsMin.x,
+				(i & 2) ? boundsMax.y : boundsMin.y,
+				(i & 4) ? boundsMax.z : boundsMin.z);
+
+			glm::vec3 transformedCorner = transform * glm::vec4(corner, 1.0f);
+			transformedMin = glm::min(transformedMin, transformedCorner);
+			transformedMax = glm::max(transformedMax, transformedCorner);
+		}
+	}
+
+	void CShadowNode::UpdateCascades(SGraphicsManagers* managers, uint32_t numCascades, uint32_t shadowMapResolution)
 	{
-		//glm::vec3 cameraPosition = managers->m_InputManager->GetCamera()->GetPosition();
-
-		//glm::mat4 sunlightRotationMatrix = GetZenithAzimuthRotationMatrix(glm::radians(g_SunZenithDegrees), glm::radians(g_SunAzimuthDegrees));
-
-		//glm::vec3 sunlightlightPosition  = sunlightRotationMatrix * glm::vec4(0.0f, 1500.0f, 0.0f, 1.0f);
-		//glm::vec3 sunlightlightDirection = glm::normalize(-sunlightlightPosition);
-		//glm::vec3 sunlightUpDirection    = sunlightRotationMatrix * glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
-
-		//glm::mat4 sunlightLookAt = glm::lookAt(
-		//	sunlightlightPosition,
-		//	sunlightlightDirection,
-		//	sunlightUpDirection
-		//);
-
-		//glm::AABB sceneBounds = managers->m_Modelmanager->GetSceneBounds();
-
-		//glm::mat4 lightOrthoMatrix = glm::ortho(
-		//	sceneBounds.getMin().x,
-		//	sceneBounds.getMax().x,
-		//	sceneBounds.getMin().z,
-		//	sceneBounds.getMax().z,
-		//	-sceneBounds.getMax().y + sunlightlightPosition.y,
-		//	-sceneBounds.getMin().y + sunlightlightPosition.y);
-		////glm::mat4 lightOrthoMatrix = glm::ortho(-2000.0f, 2000.0f, -2000.0f, 2000.0f, 1100.0f, 1800.0f);
-		//lightOrthoMatrix[1][1] *= -1; // Vulkan requirement
-
-		//glm::mat4 cameraLookAt = managers->m_InputManager->GetCamera()->GetLookAtMatrix();
-		//glm::mat4 cameraProjection = managers->m_InputManager->GetCamera()->GetProjectionMatrix();
-		//glm::mat4 invCameraViewProjection = glm::inverse(lightOrthoMatrix * sunlightLookAt);
-
-		//// The 8 corners of the camera view frustum in NDC space
-		//glm::vec4 corners[8] =
-		//{
-		//	glm::vec4(-1.0f, -1.0f, 0.0f, 1.0f),
-		//	glm::vec4(-1.0f, -1.0f,  1.0f, 1.0f),
-		//	glm::vec4( 1.0f, -1.0f, 0.0f, 1.0f),
-		//	glm::vec4( 1.0f, -1.0f,  1.0f, 1.0f),
-		//	glm::vec4(-1.0f,  1.0f, 0.0f, 1.0f),
-		//	glm::vec4(-1.0f,  1.0f,  1.0f, 1.0f), 
-		//	glm::vec4( 1.0f,  1.0f, 0.0f, 1.0f),
-		//	glm::vec4( 1.0f,  1.0f,  1.0f, 1.0f) 
-		//};
-
-		//for (uint32_t i = 0; i < 8; i++)
-		//{
-		//	corners[i] = invCameraViewProjection * corners[i];
-		//	corners[i] /= corners[i].w; // Perspective divide
-		//}
-
-		//glm::vec3 debugLineColor = glm::vec3(1.0f, 0.0f, 0.0f);
-
-		//float minX = INFINITY;
-		//float minY = INFINITY;
-		//float minZ = INFINITY;
-		//float maxX = -INFINITY;
-		//float maxY = -INFINITY;
-		//float maxZ = -INFINITY;
-
-		//// Find the min and max values
-		//for (uint32_t i = 0; i < 8; i++)
-		//{
-		//	if (corners[i].x < minX)
-		//		minX = corners[i].x;
-		//	if (corners[i].x > maxX)
-		//		maxX = corners[i].x;
-		//	if (corners[i].y < minY)
-		//		minY = corners[i].y;
-		//	if (corners[i].y > maxY)
-		//		maxY = corners[i].y;
-		//	if (corners[i].z < minZ)
-		//		minZ = corners[i].z;
-		//	if (corners[i].z > maxZ)
-		//		maxZ = corners[i].z;
-		//}
-
-
-		//managers->m_DebugManager->DrawDebugAABB(glm::vec3(minX, minY, minZ), glm::vec3(maxX, maxY, maxZ), glm::vec3(1.0f, 0.0f, 0.0f));
-		//managers->m_DebugManager->DrawDebugAABB(glm::vec3(minX, minY, -maxZ), glm::vec3(maxX, maxY, -minZ), glm::vec3(1.0f, 0.0f, 0.0f));
-
-		//glm::mat4 lightOrthoMatrix = glm::ortho(minX, maxX, minY, maxY, -maxZ, -minZ);
+		CCamera* camera = managers->m_InputManager->GetCamera();
+
+		s_SunlightDirection = GetSunlightDirectionFromAngles();
 
+		// Same rotation for all cascades. Looks along the direction the light travels
+		glm::vec3 lightUp = glm::abs(s_SunlightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		m_LightViewMatrix = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), -s_SunlightDirection, lightUp);
+
+		// Casters outside the camera frustum can still throw shadows into it so the near plane is pulled back to the scene bounds
+		glm::vec3 sceneMin, sceneMax;
+		TransformBounds(managers->m_Modelmanager->GetSceneBounds(), m_LightViewMatrix, sceneMin, sceneMax);
+
+		const float cameraNear = camera->GetNear();
+		const float cameraFar  = camera->GetFar();
+		const float shadowFar  = glm::min(g_ShadowDistance, cameraFar);
+
+		// Corners of the camera frustum on the near and far plane in world space
+		const glm::mat4 invCameraViewProjection = glm::inverse(camera->GetProjectionMatrix() * camera->GetLookAtMatrix());
+		const glm::vec2 ndcCorners[4] = { glm::vec2(-1.0f, -1.0f), glm::vec2(1.0f, -1.0f), glm::vec2(-1.0f, 1.0f), glm::vec2(1.0f, 1.0f) };
+
+		glm::vec3 nearCorners[4];
+		glm::vec3 farCorners[4];
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			glm::vec4 nearCorner = invCameraViewProjection * glm::vec4(ndcCorners[i], 0.0f, 1.0f);
+			glm::vec4 farCorner  = invCameraViewProjection * glm::vec4(ndcCorners[i], 1.0f, 1.0f);
+			nearCorners[i] = glm::vec3(nearCorner) / nearCorner.w;
+			farCorners[i]  = glm::vec3(farCorner)  / farCorner.w;
+		}
+
+		float splitNear = cameraNear;
+		for (uint32_t cascade = 0; cascade < numCascades; cascade++)
+		{
+			// Practical split scheme. Logarithmic splits give the best texel distribution but the first cascade becomes tiny
+			const float splitRatio   = (float)(cascade + 1) / (float)numCascades;
+			const float uniformSplit = cameraNear + (shadowFar - cameraNear) * splitRatio;
+			const float logSplit     = cameraNear * glm::pow(shadowFar / cameraNear, splitRatio);
+			const float splitFar     = glm::mix(uniformSplit, logSplit, g_CascadeSplitLambda);
+
+			// View depth is linear along the rays from the near to the far corners
+			const float nearFraction = (splitNear - cameraNear) / (cameraFar - cameraNear);
+			const float farFraction  = (splitFar  - cameraNear) / (cameraFar - cameraNear);
+
+			glm::vec3 sliceCorners[8];
+			glm::vec3 sliceCenter = glm::vec3(0.0f, 0.0f, 0.0f);
+			for (uint32_t i = 0; i < 4; i++)
+			{
+				sliceCorners[i]     = glm::mix(nearCorners[i], farCorners[i], nearFraction);
+				sliceCorners[i + 4] = glm::mix(nearCorners[i], farCorners[i], farFraction);
+				sliceCenter += sliceCorners[i] + sliceCorners[i + 4];
+			}
+			sliceCenter /= 8.0f;
+
+			// Fit a sphere instead of a box so the size of the cascade doesn't change when the camera rotates
+			float radius = 0.0f;
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				radius = glm::max(radius, glm::length(sliceCorners[i] - sliceCenter));
+			}
+			radius = glm::ceil(radius * 16.0f) / 16.0f;
+
+			// Only move the cascade in whole texels to stop the shadow edges from shimmering
+			const float texelSize = (2.0f * radius) / (float)shadowMapResolution;
+			glm::vec3 lightSpaceCenter = m_LightViewMatrix * glm::vec4(sliceCenter, 1.0f);
+			lightSpaceCenter.x = glm::floor(lightSpaceCenter.x / texelSize) * texelSize;
+			lightSpaceCenter.y = glm::floor(lightSpaceCenter.y / texelSize) * texelSize;
+
+			SShadowCascade& shadowCascade = m_Cascades[cascade];
+			shadowCascade.m_BoundsMin = glm::vec3(lightSpaceCenter.x - radius, lightSpaceCenter.y - radius, lightSpaceCenter.z - radius);
+			shadowCascade.m_BoundsMax = glm::vec3(lightSpaceCenter.x + radius, lightSpaceCenter.y + radius, glm::max(sceneMax.z, lightSpaceCenter.z + radius));
+
+			// Light looks down -Z
+			glm::mat4 cascadeProjectionMatrix = glm::ortho(
+				shadowCascade.m_BoundsMin.x,
+				shadowCascade.m_BoundsMax.x,
+				shadowCascade.m_BoundsMin.y,
+				shadowCascade.m_BoundsMax.y,
+				-shadowCascade.m_BoundsMax.z,
+				-shadowCascade.m_BoundsMin.z);
+			cascadeProjectionMatrix[1][1] *= -1;
+			cascadeProjectionMatrix[3][1] *= -1;
+
+			s_CascadeMatrices[cascade]   = cascadeProjectionMatrix * m_LightViewMatrix;
+			s_CascadeSplits[cascade]     = splitFar;
+			s_CascadeWorldSizes[cascade] = glm::vec2(2.0f * radius, shadowCascade.m_BoundsMax.z - shadowCascade.m_BoundsMin.z);
+
+			splitNear = splitFar;
+		}
+	}
+
+	void CShadowNode::UpdateShadowBuffers(CGraphicsContext* context, SGraphicsManagers* managers)
+	{
 		static float sunZenithAndAzimuth[2] = { g_SunZenithDegrees, g_SunAzimuthDegrees };
+		static int   numCascades            = (int)s_NumCascades;
+		static int   resolutionIndex        = 1;
+
+		const uint32_t shadowMapResolutions[]      = { 1024, 2048, 4096 };
+		const char*    shadowMapResolutionNames[]  = { "1024", "2048", "4096" };
 
 		ImGui::Begin("Shadow Pass");
 		ImGui::SliderFloat2("Zenith & Azimuth", sunZenithAndAzimuth, 0.0f, 360.0f);
 		g_SunZenithDegrees = sunZenithAndAzimuth[0];
 		g_SunAzimuthDegrees = sunZenithAndAzimuth[1];
+
+		ImGui::SliderInt("Cascades", &numCascades, 1, MAX_SHADOW_CASCADES);
+		ImGui::Combo("Resolution", &resolutionIndex, shadowMapResolutionNames, IM_ARRAYSIZE(shadowMapResolutionNames));
+		ImGui::SliderFloat("Split Lambda", &g_CascadeSplitLambda, 0.0f, 1.0f);
+		ImGui::SliderFloat("Shadow Distance", &g_ShadowDistance, 500.0f, 10000.0f);
+		ImGui::Checkbox("Visualize Cascades", &s_VisualizeCascades);
+		ImGui::Checkbox("Cache Shadow Maps", &g_CacheShadowMaps);
+
+		m_DepthBiasChanged  = ImGui::SliderFloat("Depth Bias Constant", &g_DepthBiasConstant, 0.0f, 10.0f);
+		m_DepthBiasChanged |= ImGui::SliderFloat("Depth Bias Slope", &g_DepthBiasSlope, 0.0f, 10.0f);
+
+		if (ImGui::CollapsingHeader("Filtering", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			SShadowFilterSettings& filterSettings = s_FilterSettings;
+
+			int filterMode = (int)filterSettings.m_Mode;
+			ImGui::Combo("Filter", &filterMode, g_ShadowFilterModeNames, IM_ARRAYSIZE(g_ShadowFilterModeNames));
+			filterSettings.m_Mode = (EShadowFilterMode)filterMode;
+
+			// Rotated grid rounds down to the closest square
+			if (filterSettings.m_Mode != EShadowFilterMode::Hardware)
+			{
+				ImGui::SliderInt("Samples", &filterSettings.m_NumSamples, 1, MAX_SHADOW_FILTER_SAMPLES);
+				ImGui::SliderFloat("Normal Offset (texels)", &filterSettings.m_NormalOffset, 0.0f, 4.0f);
+			}
+			if (filterSettings.m_Mode == EShadowFilterMode::Poisson || filterSettings.m_Mode == EShadowFilterMode::RotatedGrid)
+			{
+				ImGui::SliderFloat("Radius (texels)", &filterSettings.m_FilterRadius, 0.5f, 8.0f);
+			}
+			if (filterSettings.m_Mode == EShadowFilterMode::PCSS)
+			{
+				ImGui::SliderFloat("Sun Size (degrees)", &filterSettings.m_SunAngularSize, 0.1f, 5.0f);
+				ImGui::SliderFloat("Max Penumbra (texels)", &filterSettings.m_MaxPenumbra, 1.0f, 64.0f);
+			}
+		}
+
+		const SRenderResource shadowMap = managers->m_ResourceManager->GetRenderResource(EResourceIndices::ShadowMap);
+		const float shadowMapSizeMB = (float)shadowMap.m_Extent.width * shadowMap.m_Extent.height * shadowMap.m_LayerCount * sizeof(float) / (1024.0f * 1024.0f);
+		ImGui::Text("Shadow map: %u x %u x %u (%.1f MB)", shadowMap.m_Extent.width, shadowMap.m_Extent.height, shadowMap.m_LayerCount, shadowMapSizeMB);
+		for (uint32_t i = 0; i < shadowMap.m_LayerCount; i++)
+		{
+			ImGui::Text("Cascade %u: up to %.0f units, %u casters, %s", i, s_CascadeSplits[i], m_NumCastersDrawn[i], m_IsCascadeRedrawn[i] ? "redrawn" : "cached");
+		}
 		ImGui::End();
 
-		glm::mat4 sunlightViewMatrix       = glm::identity<glm::mat4>();
-		glm::mat4 sunlightProjectionMatrix = glm::identity<glm::mat4>();
-		GetSunlightTransformAndDirection(managers, s_SunlightDirection, sunlightViewMatrix, sunlightProjectionMatrix);
+		// The shadow map has to be recreated for these. Keep rendering with the old one until then
+		if ((uint32_t)numCascades != s_NumCascades || shadowMapResolutions[resolutionIndex] != s_ShadowMapResolution)
+		{
+			s_NumCascades         = (uint32_t)numCascades;
+			s_ShadowMapResolution = shadowMapResolutions[resolutionIndex];
+			managers->m_ResourceManager->RequestResourceRecreation();
+		}
 
-		s_LightMatrix = sunlightProjectionMatrix * sunlightViewMatrix;
+		UpdateCascades(managers, shadowMap.m_LayerCount, shadowMap.m_Extent.width);
 
+		m_StaticCastersMoved  = false;
+		m_DynamicCastersMoved = false;
 		for (uint32_t i = 0; i < managers->m_Modelmanager->GetNumModels(); i++)
 		{
 			CModel* model = managers->m_Modelmanager->GetModel(i);
-			
-			SShadowUniformBuffer uboShadow{};
-			uboShadow.m_ViewMatrix       = sunlightViewMatrix;
-			uboShadow.m_ProjectionMatrix = sunlightProjectionMatrix;
-			uboShadow.m_ModelMatrix      = model->GetTransform();
-			
-			void* data;
-			vkMapMemory(context->GetLogicalDevice(), model->GetShadowMemoryBuffer().m_Memory, 0, sizeof(SShadowUniformBuffer), 0, &data);
-			memcpy(data, &uboShadow, sizeof(uboShadow));
-			vkUnmapMemory(context->GetLogicalDevice(), model->GetShadowMemoryBuffer().m_Memory);
+
+			// Cascades that only contain casters which haven't moved can stay cached
+			const uint32_t transformVersion = model->GetTransformVersion();
+			if (transformVersion == m_CasterTransformVersions[i])
+				continue;
+
+			m_CasterTransformVersions[i] = transformVersion;
+			m_StaticCastersMoved  |= !model->IsDynamic();
+			m_DynamicCastersMoved |=  model->IsDynamic();
 		}
+	}
 
+	std::string CShadowNode::GetFilterName()
+	{
+		if (s_FilterSettings.m_Mode == EShadowFilterMode::Hardware)
+			return g_ShadowFilterModeNames[(uint32_t)EShadowFilterMode::Hardware];
 
+		return std::format("{} {}", g_ShadowFilterModeNames[(uint32_t)s_FilterSettings.m_Mode], s_FilterSettings.m_NumSamples);
 	}
 
-	void CShadowNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
+	void CShadowNode::DrawCascade(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer, SRenderResource attachment, uint32_t cascadeIndex, bool dynamicCasters)
 	{
-		CDebugManager* debugManager = managers->m_DebugManager;
+		// Render into a single layer
+		attachment.m_RenderAttachmentInfo.imageView = attachment.m_LayerImageViews[cascadeIndex];
 
-		CResourceManager* resourceManager = managers->m_ResourceManager;
-		SRenderResource shadowmapAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::ShadowMap, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+		const std::string markerName = std::format("Shadow Map - Cascade {} ({})", cascadeIndex, dynamicCasters ? "Dynamic" : "Static");
+		BeginRendering(markerName, context, commandBuffer, attachment.m_Extent, { attachment });
 
-		VkExtent2D prevRenderResolution = context->GetRenderResolution();
-		context->SetRenderResolution(VkExtent2D(SHADOWMAP_RESOLUTION, SHADOWMAP_RESOLUTION));
+		CModelManager* modelManager  = managers->m_Modelmanager;
+		const bool     vertexPulling = modelManager->IsVertexPullingEnabled();
 
-		BeginRendering("Shadow Map", context, commandBuffer, {shadowmapAttachment});
-		UpdateShadowBuffers(context, managers);
+		CPipeline* pipeline = vertexPulling ? m_ShadowPullPipeline : m_ShadowPipeline;
+		pipeline->BindPipeline(commandBuffer);
+		managers->m_ResourceManager->BindBindlessTable(context, commandBuffer, pipeline->GetPipelineLayout());
+		vkCmdSetDepthBias(commandBuffer, g_DepthBiasConstant, 0.0f, g_DepthBiasSlope);
 
-		m_ShadowPipeline->BindPipeline(commandBuffer);
+		if (vertexPulling)
+		{
+			// Cascades come after the camera in the object transforms
+			uint32_t objectTransformOffset = modelManager->GetObjectTransformIndex(context, 1 + cascadeIndex, 0);
+			pipeline->PushConstants(commandBuffer, (void*)&objectTransformOffset);
+			modelManager->BindDrawIndexBuffer(commandBuffer);
+		}
 
-		for (uint32_t i = 0; i < managers->m_Modelmanager->GetNumModels(); i++)
+		const SShadowCascade& shadowCascade = m_Cascades[cascadeIndex];
+
+		// Vertex pulling. Casters next to each other in the indirect draw buffer are drawn together
+		uint32_t firstPendingDraw = 0;
+		uint32_t numPendingDraws  = 0;
+
+		for (uint32_t i = 0; i < modelManager->GetNumModels(); i++)
 		{
-			CModel* model = managers->m_Modelmanager->GetModel(i);
+			CModel* model = modelManager->GetModel(i);
+			if (model->IsDynamic() != dynamicCasters)
+				continue;
+
+			// Bounds are computed when the model is loaded so they can't be trusted for dynamic models. Those are always drawn
+			// Only cull on the far side. Anything between the light and the cascade can cast into it
+			const bool outsideCascade = !dynamicCasters && (
+				m_CasterBoundsMax[i].x < shadowCascade.m_BoundsMin.x || m_CasterBoundsMin[i].x > shadowCascade.m_BoundsMax.x ||
+				m_CasterBoundsMax[i].y < shadowCascade.m_BoundsMin.y || m_CasterBoundsMin[i].y > shadowCascade.m_BoundsMax.y ||
+				m_CasterBoundsMax[i].z < shadowCascade.m_BoundsMin.z);
+
+			if (outsideCascade)
+				continue;
+
+			m_NumCastersDrawn[cascadeIndex]++;
+
+			if (vertexPulling)
+			{
+				const uint32_t firstDraw = modelManager->GetFirstDrawIndex(i);
+				if (numPendingDraws > 0 && firstPendingDraw + numPendingDraws != firstDraw)
+				{
+					vkCmdDrawIndexedIndirect(commandBuffer, modelManager->GetIndirectDrawBuffer(), firstPendingDraw * sizeof(VkDrawIndexedIndirectCommand), numPendingDraws, sizeof(VkDrawIndexedIndirectCommand));
+					numPendingDraws = 0;
+				}
+				if (numPendingDraws == 0)
+					firstPendingDraw = firstDraw;
+
+				numPendingDraws += model->GetNumMeshes();
+				continue;
+			}
 
 			model->BindVertexAndIndexBuffers(commandBuffer);
-			model->BindShadowTable(context, commandBuffer, m_ShadowPipeline->GetPipelineLayout());
+
+			// Cascades come after the camera in the object transforms
+			const uint32_t objectTransformIndex = modelManager->GetObjectTransformIndex(context, 1 + cascadeIndex, i);
 			for (uint32_t j = 0; j < model->GetNumMeshes(); j++)
 			{
 				SMaterialMesh modelMesh = model->GetMesh(j);
-				vkCmdDrawIndexed(commandBuffer, modelMesh.m_NumVertices, 1, modelMesh.m_StartIndex, 0, 0);
+				vkCmdDrawIndexed(commandBuffer, modelMesh.m_NumVertices, 1, modelMesh.m_StartIndex, 0, objectTransformIndex);
 			}
 		}
 
+		if (numPendingDraws > 0)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, modelManager->GetIndirectDrawBuffer(), firstPendingDraw * sizeof(VkDrawIndexedIndirectCommand), numPendingDraws, sizeof(VkDrawIndexedIndirectCommand));
+		}
+
 		EndRendering(context, commandBuffer);
+	}
+
+	void CShadowNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
+	{
+		CResourceManager* resourceManager = managers->m_ResourceManager;
+
+		UpdateShadowBuffers(context, managers);
+
+		const SRenderResource shadowMap       = resourceManager->GetRenderResource(EResourceIndices::ShadowMap);
+		const SRenderResource staticShadowMap = resourceManager->GetRenderResource(EResourceIndices::ShadowMapStatic);
+
+		// Static casters go into their own cache when there is something dynamic to draw on top of them
+		const bool hasStaticCache = staticShadowMap.m_Image != VK_NULL_HANDLE;
+
+		// The cascade matrix contains both the sun direction and where the camera is, so comparing it covers everything except casters moving
+		bool isStaticDirty[MAX_SHADOW_CASCADES] = {};
+		bool anyStaticDirty = false;
+		bool anyRedrawn     = false;
+		for (uint32_t cascade = 0; cascade < shadowMap.m_LayerCount; cascade++)
+		{
+			isStaticDirty[cascade] = !g_CacheShadowMaps || !m_IsCascadeCached[cascade] || m_StaticCastersMoved || m_DepthBiasChanged || m_CachedCascadeMatrices[cascade] != s_CascadeMatrices[cascade];
+			m_IsCascadeRedrawn[cascade] = isStaticDirty[cascade] || (hasStaticCache && m_DynamicCastersMoved);
 
-		context->SetRenderResolution(prevRenderResolution);
+			anyStaticDirty |= isStaticDirty[cascade];
+			anyRedrawn     |= m_IsCascadeRedrawn[cascade];
+		}
+
+		// Whatever is in the shadow map from an earlier frame is still good
+		if (!anyRedrawn)
+			return;
+
+		// Light space bounds of the models are the same for every cascade
+		const uint32_t numModels = managers->m_Modelmanager->GetNumModels();
+		m_CasterBoundsMin.resize(numModels);
+		m_CasterBoundsMax.resize(numModels);
+		for (uint32_t i = 0; i < numModels; i++)
+		{
+			TransformBounds(managers->m_Modelmanager->GetModel(i)->GetAABB(), m_LightViewMatrix, m_CasterBoundsMin[i], m_CasterBoundsMax[i]);
+		}
+
+		for (uint32_t cascade = 0; cascade < shadowMap.m_LayerCount; cascade++)
+		{
+			if (!m_IsCascadeRedrawn[cascade])
+				continue;
+
+			m_NumCastersDrawn[cascade] = 0;
+			managers->m_Modelmanager->UpdateObjectTransforms(context, 1 + cascade, s_CascadeMatrices[cascade]);
+		}
+
+		if (hasStaticCache)
+		{
+			if (anyStaticDirty)
+			{
+				SRenderResource staticAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::ShadowMapStatic, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+				for (uint32_t cascade = 0; cascade < shadowMap.m_LayerCount; cascade++)
+				{
+					if (isStaticDirty[cascade])
+						DrawCascade(context, managers, commandBuffer, staticAttachment, cascade, false);
+				}
+			}
+
+			// Start from the static casters and draw the dynamic ones on top
+			SRenderResource staticAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::ShadowMapStatic, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+			SRenderResource shadowAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::ShadowMap,       VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+			std::vector<VkImageCopy> copyRegions = {};
+			for (uint32_t cascade = 0; cascade < shadowMap.m_LayerCount; cascade++)
+			{
+				if (!m_IsCascadeRedrawn[cascade])
+					continue;
+
+				VkImageCopy copyRegion{};
+				copyRegion.srcSubresource.aspectMask     = VK_IMAGE_ASPECT_DEPTH_BIT;
+				copyRegion.srcSubresource.mipLevel       = 0;
+				copyRegion.srcSubresource.baseArrayLayer = cascade;
+				copyRegion.srcSubresource.layerCount     = 1;
+				copyRegion.dstSubresource                = copyRegion.srcSubresource;
+				copyRegion.extent                        = { shadowMap.m_Extent.width, shadowMap.m_Extent.height, 1 };
+				copyRegions.push_back(copyRegion);
+			}
+
+			vkCmdCopyImage(
+				commandBuffer,
+				staticAttachment.m_Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				shadowAttachment.m_Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				(uint32_t)copyRegions.size(), copyRegions.data());
+
+			shadowAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::ShadowMap, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+			for (uint32_t cascade = 0; cascade < shadowMap.m_LayerCount; cascade++)
+			{
+				if (m_IsCascadeRedrawn[cascade])
+					DrawCascade(context, managers, commandBuffer, shadowAttachment, cascade, true);
+			}
+		}
+		else
+		{
+			SRenderResource shadowAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::ShadowMap, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+			for (uint32_t cascade = 0; cascade < shadowMap.m_LayerCount; cascade++)
+			{
+				if (m_IsCascadeRedrawn[cascade])
+					DrawCascade(context, managers, commandBuffer, shadowAttachment, cascade, false);
+			}
+		}
+
+		for (uint32_t cascade = 0; cascade < shadowMap.m_LayerCount; cascade++)
+		{
+			if (!isStaticDirty[cascade])
+				continue;
+
+			m_CachedCascadeMatrices[cascade] = s_CascadeMatrices[cascade];
+			m_IsCascadeCached[cascade]       = true;
+		}
 	}
 
 	void CShadowNode::Cleanup(CGraphicsContext* context)
@@ -258,5 +504,8 @@ namespace NVulkanEngine
 
 		m_ShadowPipeline->Cleanup(context);
 		delete m_ShadowPipeline;
+
+		m_ShadowPullPipeline->Cleanup(context);
+		delete m_ShadowPullPipeline;
 	}
-};
\ No newline at end of file
+};
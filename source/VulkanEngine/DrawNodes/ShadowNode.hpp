@@ -5,12 +5,37 @@
 #include <DrawNodes/DrawNode.hpp>
 #include <DrawNodes/Utils/Pipeline.hpp>
 
-/* 
-	Draw geometry into shadow map depth buffer
+/*
+	Draw geometry into cascaded shadow maps. One layer of the shadow map per cascade.
+	Cascades are only redrawn when their projection or the casters in them change
 */
 
+// Must match deferred.frag
+#define MAX_SHADOW_CASCADES       4
+#define MAX_SHADOW_FILTER_SAMPLES 32
+
 namespace NVulkanEngine
 {
+	// How deferred.frag filters the shadow map. Must match deferred.frag
+	enum class EShadowFilterMode : uint32_t
+	{
+		Hardware    = 0, // Single bilinear comparison tap
+		Poisson     = 1,
+		RotatedGrid = 2,
+		PCSS        = 3, // Blocker search + Poisson kernel scaled by the estimated penumbra
+		Count
+	};
+
+	struct SShadowFilterSettings
+	{
+		EShadowFilterMode m_Mode              = EShadowFilterMode::Poisson;
+		int               m_NumSamples        = 16;
+		float             m_FilterRadius      = 1.5f;  // In texels
+		float             m_SunAngularSize    = 0.53f; // Degrees. Light size for PCSS
+		float             m_MaxPenumbra       = 32.0f; // In texels. Caps the PCSS kernel
+		float             m_NormalOffset      = 1.0f;  // In texels
+	};
+
 	class CShadowNode : public CDrawNode
 	{
 	public:
@@ -18,24 +43,81 @@ namespace NVulkanEngine
 		~CShadowNode() = default;
 
 		virtual void Init(CGraphicsContext* context, SGraphicsManagers* managers)  override;
+		virtual std::vector<EResourceIndices> GetResourceUsage() override;
 		virtual void Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) override;
 		virtual void Cleanup(CGraphicsContext* context) override;
 
-		static glm::mat4 GetLightMatrix() { return s_LightMatrix; };
 		static glm::vec3 GetSunlightDirection() { return s_SunlightDirection; };
 
+		// Shadow map settings. Changing these recreates the shadow map resource
+		static uint32_t GetNumCascades() { return s_NumCascades; };
+		static uint32_t GetShadowMapResolution() { return s_ShadowMapResolution; };
+
+		// Light view projection and view space far distance of each cascade rendered this frame
+		static glm::mat4 GetCascadeMatrix(uint32_t cascadeIndex) { return s_CascadeMatrices[cascadeIndex]; };
+		static float GetCascadeSplit(uint32_t cascadeIndex) { return s_CascadeSplits[cascadeIndex]; };
+		static bool GetVisualizeCascades() { return s_VisualizeCascades; };
+
+		// World space width and depth range of a cascade. Used to turn filter sizes from world units into shadow map uv
+		static glm::vec2 GetCascadeWorldSize(uint32_t cascadeIndex) { return s_CascadeWorldSizes[cascadeIndex]; };
+
+		static SShadowFilterSettings GetFilterSettings() { return s_FilterSettings; };
+
+		// Mode and sample count. Shows up in the GPU timings so filter costs can be compared
+		static std::string GetFilterName();
+
 	private:
+		void UpdateCascades(SGraphicsManagers* managers, uint32_t numCascades, uint32_t shadowMapResolution);
 		void UpdateShadowBuffers(CGraphicsContext* context, SGraphicsManagers* managers);
 
+		// Draws either the static or the dynamic casters of a cascade into a layer of the attachment
+		void DrawCascade(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer, SRenderResource attachment, uint32_t cascadeIndex, bool dynamicCasters);
+
+		// Light space bounds of a cascade. Used for culling casters
+		struct SShadowCascade
+		{
+			glm::vec3 m_BoundsMin = glm::vec3(0.0f, 0.0f, 0.0f);
+			glm::vec3 m_BoundsMax = glm::vec3(0.0f, 0.0f, 0.0f);
+		};
+
 		std::vector<SDescriptorSets> m_DescriptorSetsShadow = { };
 
 		// Shadow Uniform Buffer
 		VkBuffer					  m_ShadowBuffer       = VK_NULL_HANDLE;
 		VkDeviceMemory				  m_ShadowBufferMemory = VK_NULL_HANDLE;
 
-		static glm::mat4              s_LightMatrix;
+		glm::mat4                     m_LightViewMatrix    = glm::identity<glm::mat4>();
+		SShadowCascade                m_Cascades[MAX_SHADOW_CASCADES]   = {};
+		uint32_t                      m_NumCastersDrawn[MAX_SHADOW_CASCADES] = {};
+
+		// Light space bounds of every model. Only valid for static models
+		std::vector<glm::vec3>        m_CasterBoundsMin    = {};
+		std::vector<glm::vec3>        m_CasterBoundsMax    = {};
+
+		// Static casters of a cascade are cached until its projection changes or a static caster moves
+		glm::mat4                     m_CachedCascadeMatrices[MAX_SHADOW_CASCADES] = {};
+		bool                          m_IsCascadeCached[MAX_SHADOW_CASCADES]       = {};
+		bool                          m_IsCascadeRedrawn[MAX_SHADOW_CASCADES]      = {};
+
+		// Transform version of each model when its shadow UBO was last written
+		std::vector<uint32_t>         m_CasterTransformVersions = {};
+		bool                          m_StaticCastersMoved      = false;
+		bool                          m_DynamicCastersMoved     = false;
+
+		// Depth bias changed this frame. Cached cascades were drawn with the old one
+		bool                          m_DepthBiasChanged        = false;
+
 		static glm::vec3			  s_SunlightDirection;
+		static glm::mat4              s_CascadeMatrices[MAX_SHADOW_CASCADES];
+		static float                  s_CascadeSplits[MAX_SHADOW_CASCADES];
+		static glm::vec2              s_CascadeWorldSizes[MAX_SHADOW_CASCADES];
+		static SShadowFilterSettings  s_FilterSettings;
+		static uint32_t               s_NumCascades;
+		static uint32_t               s_ShadowMapResolution;
+		static bool                   s_VisualizeCascades;
+
 		// Pipeline
 		CPipeline* m_ShadowPipeline = nullptr;
+		CPipeline* m_ShadowPullPipeline = nullptr; // Vertex pulling
 	};
-}
\ No newline at end of file
+}
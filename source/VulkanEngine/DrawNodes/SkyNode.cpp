@@ -3,6 +3,9 @@
 
 #include <imgui.h>
 
+#include <algorithm>
+#include <format>
+
 //
 // I took all these values from shadertoy so no idea if they are scientifically accurate
 // Source https://www.shadertoy.com/view/wlBXWK
@@ -24,8 +27,20 @@ static constexpr float g_AbsorptionMaxHeight = 30e3f;
 static constexpr float g_AbsorptionFallof    = 4e3f;
 
 static float     g_ScatteringIntensity   = 40.0f;
-static int       g_NumInscatteringPoints = 16;
-static int       g_NumOpticalDepthPoints = 8;
+static int       g_NumInscatteringPoints = 16; // Sky view LUT raymarch steps
+static int       g_NumOpticalDepthPoints = 8;  // Transmittance LUT raymarch steps
+
+// LUT resolutions. Sky view LUT is what ends up on screen so it gets the most texels
+static constexpr VkExtent2D g_TransmittanceLutSize   = { 256, 64 };
+static constexpr VkExtent2D g_MultiScatteringLutSize = { 32, 32 };
+static constexpr VkExtent2D g_SkyViewLutSize         = { 192, 108 };
+
+static constexpr VkFormat g_AtmosphericsLutFormat    = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+#define ATMOSPHERICS_LUT_GROUP_SIZE 8 // local_size_x and local_size_y in the sky LUT compute shaders
+
+static const char* g_SkyResolutionNames[] = { "Full", "1/4", "1/8", "Panoramic 256x128" };
+static constexpr VkExtent2D g_PanoramicSkySize = { 256, 128 };
 
 namespace NVulkanEngine
 {
@@ -62,26 +77,170 @@ namespace NVulkanEngine
 		//
 		glm::uint32_t m_AllowMieScattering    = 0;
 		glm::float32  m_ScatteringIntensity   = 0.0f;
-		glm::vec2     m_Pad0                  = glm::vec2(0xdeadbeef, 0xdeadbeef);
+		glm::uint32_t m_SkyResolution         = 0; // ESkyResolution
+		glm::float32  m_Pad0                  = 0.0f;
 	};
 
+	ESkyResolution CSkyNode::s_SkyResolution = ESkyResolution::Full;
+
+	VkExtent2D CSkyNode::GetSkyExtent(VkExtent2D renderResolution)
+	{
+		switch (s_SkyResolution)
+		{
+		case ESkyResolution::Quarter:
+			return { std::max(renderResolution.width / 4, 1u), std::max(renderResolution.height / 4, 1u) };
+		case ESkyResolution::Eighth:
+			return { std::max(renderResolution.width / 8, 1u), std::max(renderResolution.height / 8, 1u) };
+		case ESkyResolution::Panoramic:
+			return { std::min(g_PanoramicSkySize.width, renderResolution.width), std::min(g_PanoramicSkySize.height, renderResolution.height) };
+		default:
+			return renderResolution;
+		}
+	}
+
+	std::string CSkyNode::GetSkyResolutionName()
+	{
+		return g_SkyResolutionNames[(uint32_t)s_SkyResolution];
+	}
+
+	std::vector<EResourceIndices> CSkyNode::GetResourceUsage()
+	{
+		return
+		{
+			EResourceIndices::AtmosphericsSkyBox,
+			EResourceIndices::Depth
+		};
+	}
+
 	void CSkyNode::Init(CGraphicsContext* context, SGraphicsManagers* managers)
 	{
 		const SRenderResource atmosphericsAttachment  = managers->m_ResourceManager->GetRenderResource(EResourceIndices::AtmosphericsSkyBox);
 		const SRenderResource depthAttachment         = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Depth);
 
-		m_AtmosphericsUniformBuffer = CreateUniformBuffer(context, m_AtmosphericsBufferMemory, sizeof(SAtmosphericsFragmentConstants));
+		m_AtmosphericsUniformBuffer = CreateUniformBuffer(context, m_AtmosphericsBufferMemory, sizeof(SAtmosphericsFragmentConstants), true);
+
+		CreateLut(context, m_TransmittanceLut,   g_TransmittanceLutSize.width,   g_TransmittanceLutSize.height);
+		CreateLut(context, m_MultiScatteringLut, g_MultiScatteringLutSize.width, g_MultiScatteringLutSize.height);
+		CreateLut(context, m_SkyViewLut,         g_SkyViewLutSize.width,         g_SkyViewLutSize.height);
+		m_LutsDirty = true;
+
+		m_TransmittanceTable = new CBindingTable();
+		m_TransmittanceTable->AddUniformBufferBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, m_AtmosphericsUniformBuffer, sizeof(SAtmosphericsFragmentConstants));
+		m_TransmittanceTable->AddStorageImageBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLut.m_ImageView);
+		m_TransmittanceTable->CreateBindings(context);
+
+		m_TransmittancePipeline = new CPipeline(EPipelineType::COMPUTE);
+		m_TransmittancePipeline->SetDebugName("Sky Transmittance LUT");
+		m_TransmittancePipeline->SetComputeShader("shaders/skytransmittance.comp.spv");
+		m_TransmittancePipeline->CreatePipeline(context, m_TransmittanceTable->GetDescriptorSetLayout());
+
+		m_MultiScatteringTable = new CBindingTable();
+		m_MultiScatteringTable->AddUniformBufferBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, m_AtmosphericsUniformBuffer, sizeof(SAtmosphericsFragmentConstants));
+		m_MultiScatteringTable->AddStorageImageBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, m_MultiScatteringLut.m_ImageView);
+		m_MultiScatteringTable->AddSampledImageBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLut.m_ImageView, g_AtmosphericsLutFormat, context->GetLinearClampSampler());
+		m_MultiScatteringTable->CreateBindings(context);
+
+		m_MultiScatteringPipeline = new CPipeline(EPipelineType::COMPUTE);
+		m_MultiScatteringPipeline->SetDebugName("Sky Multiple Scattering LUT");
+		m_MultiScatteringPipeline->SetComputeShader("shaders/skymultiscattering.comp.spv");
+		m_MultiScatteringPipeline->CreatePipeline(context, m_MultiScatteringTable->GetDescriptorSetLayout());
+
+		m_SkyViewTable = new CBindingTable();
+		m_SkyViewTable->AddUniformBufferBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, m_AtmosphericsUniformBuffer, sizeof(SAtmosphericsFragmentConstants));
+		m_SkyViewTable->AddStorageImageBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, m_SkyViewLut.m_ImageView);
+		m_SkyViewTable->AddSampledImageBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, m_TransmittanceLut.m_ImageView,   g_AtmosphericsLutFormat, context->GetLinearClampSampler());
+		m_SkyViewTable->AddSampledImageBinding(3, VK_SHADER_STAGE_COMPUTE_BIT, m_MultiScatteringLut.m_ImageView, g_AtmosphericsLutFormat, context->GetLinearClampSampler());
+		m_SkyViewTable->CreateBindings(context);
+
+		m_SkyViewPipeline = new CPipeline(EPipelineType::COMPUTE);
+		m_SkyViewPipeline->SetDebugName("Sky View LUT");
+		m_SkyViewPipeline->SetComputeShader("shaders/skyview.comp.spv");
+		m_SkyViewPipeline->CreatePipeline(context, m_SkyViewTable->GetDescriptorSetLayout());
 
 		m_AtmosphericsPipeline = new CPipeline(EPipelineType::GRAPHICS);
 		m_AtmosphericsPipeline->SetVertexShader("shaders/atmospherics.vert.spv");
 		m_AtmosphericsPipeline->SetFragmentShader("shaders/atmospherics.frag.spv");
 		m_AtmosphericsPipeline->SetCullingMode(VK_CULL_MODE_NONE);
-		m_AtmosphericsPipeline->AddSampledImageBinding(0, VK_SHADER_STAGE_FRAGMENT_BIT, depthAttachment.m_ImageView, depthAttachment.m_Format, context->GetLinearClampSampler());
+		m_AtmosphericsPipeline->SetDepthState(true, false, VK_COMPARE_OP_LESS_OR_EQUAL); // Triangle is on the far plane so only uncovered pixels pass
 		m_AtmosphericsPipeline->AddSampledBufferBinding(1, VK_SHADER_STAGE_FRAGMENT_BIT, m_AtmosphericsUniformBuffer, sizeof(SAtmosphericsFragmentConstants));
+		m_AtmosphericsPipeline->AddSampledImageBinding(2, VK_SHADER_STAGE_FRAGMENT_BIT, m_SkyViewLut.m_ImageView, g_AtmosphericsLutFormat, context->GetLinearClampSampler());
 		m_AtmosphericsPipeline->AddColorAttachment(atmosphericsAttachment.m_Format);
 		m_AtmosphericsPipeline->AddDepthAttachment(depthAttachment.m_Format);
 		m_AtmosphericsPipeline->AddPushConstantSlot(VK_SHADER_STAGE_VERTEX_BIT, sizeof(SAtmosphericsVertexPushConstants), 0);
 		m_AtmosphericsPipeline->CreatePipeline(context);
+
+		m_AtmosphericsReducedPipeline = new CPipeline(EPipelineType::GRAPHICS);
+		m_AtmosphericsReducedPipeline->SetVertexShader("shaders/atmospherics.vert.spv");
+		m_AtmosphericsReducedPipeline->SetFragmentShader("shaders/atmospherics.frag.spv");
+		m_AtmosphericsReducedPipeline->SetCullingMode(VK_CULL_MODE_NONE);
+		m_AtmosphericsReducedPipeline->SetDepthState(false, false, VK_COMPARE_OP_ALWAYS);
+		m_AtmosphericsReducedPipeline->AddSampledBufferBinding(1, VK_SHADER_STAGE_FRAGMENT_BIT, m_AtmosphericsUniformBuffer, sizeof(SAtmosphericsFragmentConstants));
+		m_AtmosphericsReducedPipeline->AddSampledImageBinding(2, VK_SHADER_STAGE_FRAGMENT_BIT, m_SkyViewLut.m_ImageView, g_AtmosphericsLutFormat, context->GetLinearClampSampler());
+		m_AtmosphericsReducedPipeline->AddColorAttachment(atmosphericsAttachment.m_Format);
+		m_AtmosphericsReducedPipeline->AddPushConstantSlot(VK_SHADER_STAGE_VERTEX_BIT, sizeof(SAtmosphericsVertexPushConstants), 0);
+		m_AtmosphericsReducedPipeline->CreatePipeline(context);
+	}
+
+	void CSkyNode::CreateLut(CGraphicsContext* context, SAtmosphericsLut& lut, uint32_t width, uint32_t height)
+	{
+		lut.m_Extent        = { width, height };
+		lut.m_CurrentLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		lut.m_Image         = CreateImage(
+			context,
+			width,
+			height,
+			1,
+			VK_SAMPLE_COUNT_1_BIT,
+			g_AtmosphericsLutFormat,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			lut.m_ImageMemory,
+			true);
+		lut.m_ImageView = CreateImageView(context, lut.m_Image, g_AtmosphericsLutFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	}
+
+	void CSkyNode::ComputeLut(CGraphicsContext* context, VkCommandBuffer commandBuffer, const std::string& markerName, CPipeline* pipeline, CBindingTable* bindingTable, SAtmosphericsLut& lut)
+	{
+		// Previous readers have to be done before we overwrite it. Old contents can be thrown away
+		ImageBarrier(
+			commandBuffer,
+			lut.m_Image,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_GENERAL,
+			GetComputeBarrierStages(context, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT),
+			lut.m_CurrentLayout == VK_IMAGE_LAYOUT_UNDEFINED ? 0 : VK_ACCESS_SHADER_READ_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT);
+
+		// One thread per texel
+		BeginCompute(markerName, context, commandBuffer, pipeline, bindingTable);
+		Dispatch(commandBuffer, glm::uvec3(lut.m_Extent.width, lut.m_Extent.height, 1), glm::uvec3(ATMOSPHERICS_LUT_GROUP_SIZE, ATMOSPHERICS_LUT_GROUP_SIZE, 1));
+		EndCompute(context, commandBuffer);
+
+		// Both the following LUT passes and the full screen sky pass sample it
+		ImageBarrier(
+			commandBuffer,
+			lut.m_Image,
+			VK_IMAGE_LAYOUT_GENERAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_WRITE_BIT,
+			GetComputeBarrierStages(context, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT),
+			VK_ACCESS_SHADER_READ_BIT);
+
+		lut.m_CurrentLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	void CSkyNode::DestroyLut(CGraphicsContext* context, SAtmosphericsLut& lut)
+	{
+		VkDevice device = context->GetLogicalDevice();
+
+		vkDestroyImageView(device, lut.m_ImageView, nullptr);
+		vkDestroyImage(device, lut.m_Image, nullptr);
+		vkFreeMemory(device, lut.m_ImageMemory, nullptr);
+
+		lut = {};
 	}
 
 	void CSkyNode::UpdateAtmosphericsConstants(CGraphicsContext* context, SGraphicsManagers* managers)
@@ -114,6 +273,7 @@ namespace NVulkanEngine
 		atmosphericsUbo.m_MieHeight              = g_MieMaxHeight;
 		atmosphericsUbo.m_AllowMieScattering     = true;
 		atmosphericsUbo.m_ScatteringIntensity    = g_ScatteringIntensity;
+		atmosphericsUbo.m_SkyResolution          = (uint32_t)s_SkyResolution;
 
 		void* data;
 		vkMapMemory(context->GetLogicalDevice(), m_AtmosphericsBufferMemory, 0, sizeof(SAtmosphericsFragmentConstants), 0, &data);
@@ -121,16 +281,35 @@ namespace NVulkanEngine
 		vkUnmapMemory(context->GetLogicalDevice(), m_AtmosphericsBufferMemory);
 	}
 
-	void CSkyNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
+	void CSkyNode::DispatchAsyncCompute(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
 	{
+		// Anything that changes the atmosphere itself invalidates the transmittance and multiple scattering LUTs
 		ImGui::Begin("Atmospherics");
-		ImGui::SliderFloat("Atmosphere Radius", &g_AtmosphereScale, 0.0f, 1.0f);
-		ImGui::SliderFloat("Planet Radius", &g_PlanetRadius, 0.0f, 6000.0f);
+		m_LutsDirty |= ImGui::SliderFloat("Atmosphere Radius", &g_AtmosphereScale, 0.0f, 1.0f);
+		m_LutsDirty |= ImGui::SliderFloat("Planet Radius", &g_PlanetRadius, 0.0f, 6000.0f);
 		ImGui::SliderInt("Num Inscattering Points", &g_NumInscatteringPoints, 0, 128);
-		ImGui::SliderInt("Num Optical Depth Points", &g_NumOpticalDepthPoints, 0, 64);
+		m_LutsDirty |= ImGui::SliderInt("Num Optical Depth Points", &g_NumOpticalDepthPoints, 0, 64);
 		ImGui::SliderFloat("Scattering Intensity", &g_ScatteringIntensity, 0.0f, 1000.0f);
+
+		int skyResolution = (int)s_SkyResolution;
+		ImGui::Combo("Sky Resolution", &skyResolution, g_SkyResolutionNames, IM_ARRAYSIZE(g_SkyResolutionNames));
+		s_SkyResolution = (ESkyResolution)skyResolution;
 		ImGui::End();
 
+		UpdateAtmosphericsConstants(context, managers);
+
+		if (m_LutsDirty)
+		{
+			ComputeLut(context, commandBuffer, "Sky Transmittance LUT",        m_TransmittancePipeline,   m_TransmittanceTable,   m_TransmittanceLut);
+			ComputeLut(context, commandBuffer, "Sky Multiple Scattering LUT",  m_MultiScatteringPipeline, m_MultiScatteringTable, m_MultiScatteringLut);
+			m_LutsDirty = false;
+		}
+		ComputeLut(context, commandBuffer, "Sky View LUT", m_SkyViewPipeline, m_SkyViewTable, m_SkyViewLut);
+	}
+
+	void CSkyNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
+	{
+		// Sky view LUT is already done. See DispatchAsyncCompute()
 		CCamera* camera = managers->m_InputManager->GetCamera();
 		glm::mat4 viewMatrix = camera->GetLookAtMatrix();
 		viewMatrix[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
@@ -142,21 +321,29 @@ namespace NVulkanEngine
 		vertexPushConstants.m_InvViewProjectionMatrix = invViewProjectionMatrix;
 		vertexPushConstants.m_CameraFar = camera->GetFar();
 
-		UpdateAtmosphericsConstants(context, managers);
-
 		CResourceManager* resourceManager = managers->m_ResourceManager;
-		resourceManager->TransitionResource(commandBuffer, EResourceIndices::Depth, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+		SRenderResource depthAttachment        = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Depth, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
 		SRenderResource atmosphericsAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::AtmosphericsSkyBox, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
+		// Depth test against the scene so covered pixels never reach the fragment shader
+		const bool isFullResolution = s_SkyResolution == ESkyResolution::Full;
+
+		uint32_t skyTimer = managers->m_ProfilerManager->BeginTimer(commandBuffer, std::format("Sky - {}", GetSkyResolutionName()));
+
 		std::vector<SRenderResource> inscatteringAttachments = { atmosphericsAttachment };
-		BeginRendering("Skybox", context, commandBuffer, inscatteringAttachments);
+		if (isFullResolution)
+			inscatteringAttachments.push_back(depthAttachment);
+		BeginRendering("Skybox", context, commandBuffer, GetSkyExtent(context->GetRenderResolution()), inscatteringAttachments);
 
-		m_AtmosphericsPipeline->BindPipeline(context, commandBuffer);
-		m_AtmosphericsPipeline->PushConstants(commandBuffer, (void*)&vertexPushConstants);
+		CPipeline* atmosphericsPipeline = isFullResolution ? m_AtmosphericsPipeline : m_AtmosphericsReducedPipeline;
+		atmosphericsPipeline->BindPipeline(context, commandBuffer);
+		atmosphericsPipeline->PushConstants(commandBuffer, (void*)&vertexPushConstants);
 
 		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
 		EndRendering(context, commandBuffer);
+
+		managers->m_ProfilerManager->EndTimer(commandBuffer, skyTimer);
 	}
 
 	void CSkyNode::Cleanup(CGraphicsContext* context)
@@ -166,9 +353,27 @@ namespace NVulkanEngine
 		vkDestroyBuffer(device, m_AtmosphericsUniformBuffer, nullptr);
 		vkFreeMemory(device, m_AtmosphericsBufferMemory, nullptr);
 
+		DestroyLut(context, m_TransmittanceLut);
+		DestroyLut(context, m_MultiScatteringLut);
+		DestroyLut(context, m_SkyViewLut);
+
+		m_TransmittanceTable->Cleanup(context);
+		m_TransmittancePipeline->Cleanup(context);
+		m_MultiScatteringTable->Cleanup(context);
+		m_MultiScatteringPipeline->Cleanup(context);
+		m_SkyViewTable->Cleanup(context);
+		m_SkyViewPipeline->Cleanup(context);
 		m_AtmosphericsPipeline->Cleanup(context);
+		m_AtmosphericsReducedPipeline->Cleanup(context);
 
+		delete m_TransmittanceTable;
+		delete m_TransmittancePipeline;
+		delete m_MultiScatteringTable;
+		delete m_MultiScatteringPipeline;
+		delete m_SkyViewTable;
+		delete m_SkyViewPipeline;
 		delete m_AtmosphericsPipeline;
+		delete m_AtmosphericsReducedPipeline;
 	}
 
 };
\ No newline at end of file
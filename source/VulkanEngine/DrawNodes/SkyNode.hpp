@@ -5,11 +5,34 @@
 #include <DrawNodes/Utils/BindingTable.hpp>
 
 /* 
-	Draw stuff on the sky. Currently an atmospheric scattering raymarcher
+	Draw stuff on the sky. Currently atmospheric scattering. Transmittance and multiple scattering are precomputed into
+	lookup tables whenever the atmosphere changes, the sky as seen from the camera is raymarched into a small LUT every frame
+	and the full screen pass only samples that
 */
 
 namespace NVulkanEngine
 {
+	// Size of the sky in the sky box. The reduced ones only use the top left corner and get bilinearly upsampled by deferred.frag.
+	// Must match deferred.frag
+	enum class ESkyResolution : uint32_t
+	{
+		Full      = 0,
+		Quarter   = 1,
+		Eighth    = 2,
+		Panoramic = 3, // 256x128 equirectangular map of the whole sky, independent of the render resolution
+		Count
+	};
+
+	// Lookup table only used by the sky node. Kept in shader read only layout when it is not being written to
+	struct SAtmosphericsLut
+	{
+		VkImage        m_Image         = VK_NULL_HANDLE;
+		VkDeviceMemory m_ImageMemory   = VK_NULL_HANDLE;
+		VkImageView    m_ImageView     = VK_NULL_HANDLE;
+		VkExtent2D     m_Extent        = { 0, 0 };
+		VkImageLayout  m_CurrentLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
 	class CSkyNode : public CDrawNode
 	{
 	public:
@@ -17,15 +40,51 @@ namespace NVulkanEngine
 		~CSkyNode() = default;
 
 		virtual void Init(CGraphicsContext* context, SGraphicsManagers* managers)  override;
+		virtual std::vector<EResourceIndices> GetResourceUsage() override;
 		virtual void Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) override;
 		virtual void Cleanup(CGraphicsContext* context) override;
 
+		// LUTs only depend on the atmosphere and the camera so they can overlap the geometry passes
+		virtual bool HasAsyncCompute() override { return true; };
+		virtual void DispatchAsyncCompute(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) override;
+
+		static ESkyResolution GetSkyResolution() { return s_SkyResolution; };
+
+		// Part of the sky box that the sky is rendered into
+		static VkExtent2D GetSkyExtent(VkExtent2D renderResolution);
+
+		// Shows up in the GPU timings so the resolutions can be compared
+		static std::string GetSkyResolutionName();
+
 	private:
 		void UpdateAtmosphericsConstants(CGraphicsContext* context, SGraphicsManagers* managers);
 
+		void CreateLut(CGraphicsContext* context, SAtmosphericsLut& lut, uint32_t width, uint32_t height);
+		void ComputeLut(CGraphicsContext* context, VkCommandBuffer commandBuffer, const std::string& markerName, CPipeline* pipeline, CBindingTable* bindingTable, SAtmosphericsLut& lut);
+		void DestroyLut(CGraphicsContext* context, SAtmosphericsLut& lut);
+
 		VkBuffer       m_AtmosphericsUniformBuffer = VK_NULL_HANDLE;
 		VkDeviceMemory m_AtmosphericsBufferMemory  = VK_NULL_HANDLE;
 
-		CPipeline*     m_AtmosphericsPipeline      = nullptr;
+		// Full resolution is depth tested against the scene. The reduced resolutions have no depth buffer to test against
+		CPipeline*     m_AtmosphericsPipeline        = nullptr;
+		CPipeline*     m_AtmosphericsReducedPipeline = nullptr;
+
+		// Only depend on the atmosphere parameters
+		SAtmosphericsLut m_TransmittanceLut        = {};
+		SAtmosphericsLut m_MultiScatteringLut      = {};
+		bool             m_LutsDirty               = true;
+
+		// Depends on the camera height and sun direction so this one is updated every frame
+		SAtmosphericsLut m_SkyViewLut              = {};
+
+		CBindingTable* m_TransmittanceTable        = nullptr;
+		CPipeline*     m_TransmittancePipeline     = nullptr;
+		CBindingTable* m_MultiScatteringTable      = nullptr;
+		CPipeline*     m_MultiScatteringPipeline   = nullptr;
+		CBindingTable* m_SkyViewTable              = nullptr;
+		CPipeline*     m_SkyViewPipeline           = nullptr;
+
+		static ESkyResolution s_SkyResolution;
 	};
 }
\ No newline at end of file
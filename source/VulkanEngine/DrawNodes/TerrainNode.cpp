@@ -1,170 +1,383 @@
 #include "TerrainNode.hpp"
 #include <VulkanGraphicsEngineUtils.hpp>
 
-namespace NVulkanEngine
-{
+#include <imgui.h>
 
-	struct STerrainVertices
-	{
-	};
+static bool  g_DrawTerrain         = true;
+static float g_TerrainHeightScale  = 400.0f; // World height of a white heightmap texel
+static float g_TerrainHeightOffset = -50.0f;
+static float g_TerrainTexelSize    = 4.0f;   // World size of a heightmap texel
+static float g_TerrainLodDistance  = 256.0f; // Range of the finest LOD. Every level after doubles it
 
+static constexpr float g_TerrainMorphStart = 0.7f; // Morph to the next LOD over the last 30% of a range
 
-	struct STerrainVertexPushConstants
+namespace NVulkanEngine
+{
+	struct STerrainPushConstants
 	{
 		glm::mat4 m_ViewProjectionMatrix = glm::identity<glm::mat4>();
+		//
+		glm::vec3 m_CameraPosition       = glm::vec3(0.0f, 0.0f, 0.0f);
+		float     m_TexelSize            = 0.0f;
+		//
+		float     m_HeightScale          = 0.0f;
+		float     m_HeightOffset         = 0.0f;
+		float     m_HeightMapWidth       = 0.0f;
+		float     m_HeightMapHeight      = 0.0f;
+		//
+		uint32_t  m_NumTileMips          = 0;
+		float     m_Pad0[3]              = { 0.0f, 0.0f, 0.0f };
 	};
 
-	struct STerrainFragmentConstants
+	void CTerrainNode::CreateNodeBounds()
 	{
-		float m_TestConst = 0;
-	};
+		m_HeightMapWidth  = m_TileCache.GetWidth();
+		m_HeightMapHeight = m_TileCache.GetHeight();
 
-	void CTerrainNode::CreateTerrainVertices(CGraphicsContext* context)
-	{
-		int textureChannels = 0;
-		stbi_uc* pixelData = stbi_load("./assets/terrain/iceland_heightmap.png", &m_TerrainTextureWidth, &m_TerrainTextureHeight, &textureChannels, STBI_rgb_alpha);
+		// Terrain is made of the quads between texel centers
+		const uint32_t numQuadsX = m_HeightMapWidth  - 1;
+		const uint32_t numQuadsY = m_HeightMapHeight - 1;
 
-		if (!pixelData)
+		// Enough levels for the root node to cover the whole heightmap
+		m_NumLodLevels = 1;
+		while ((TERRAIN_PATCH_RESOLUTION << (m_NumLodLevels - 1)) < std::max(numQuadsX, numQuadsY))
 		{
-			throw std::runtime_error("failed to load terrain texture image!");
+			m_NumLodLevels++;
 		}
 
-		constexpr float terrainHeightScale = 64.0f;
-		constexpr float terrainHeightShift = 16.0f;
+		m_NumNodes.resize(m_NumLodLevels);
+		m_NodeHeightBounds.resize(m_NumLodLevels);
 
-		std::vector<glm::vec3> terrainVertices;	
-		std::vector<uint32_t> terrainIndices;
-		terrainVertices.reserve(m_TerrainTextureHeight * m_TerrainTextureWidth);
-		terrainIndices.reserve(m_TerrainTextureHeight * m_TerrainTextureWidth * 2);
+		// Finest nodes are the bounds cells baked into the tile file
+		m_NumNodes[0]         = m_TileCache.GetNumBoundsCells();
+		m_NodeHeightBounds[0] = m_TileCache.GetHeightBounds();
 
-		for (uint32_t i = 0; i < (uint32_t)m_TerrainTextureHeight; i++)
+		// Coarser levels are the union of their children
+		for (uint32_t lodLevel = 1; lodLevel < m_NumLodLevels; lodLevel++)
 		{
-			for (uint32_t j = 0; j < (uint32_t)m_TerrainTextureWidth; j++)
+			const glm::uvec2 numChildNodes = m_NumNodes[lodLevel - 1];
+
+			m_NumNodes[lodLevel] = (numChildNodes + 1u) / 2u;
+			m_NodeHeightBounds[lodLevel].resize(m_NumNodes[lodLevel].x * m_NumNodes[lodLevel].y);
+			for (uint32_t nodeY = 0; nodeY < m_NumNodes[lodLevel].y; nodeY++)
 			{
-				unsigned char* terrainHeightMapValue = pixelData + (j + m_TerrainTextureWidth * i) * textureChannels;
+				for (uint32_t nodeX = 0; nodeX < m_NumNodes[lodLevel].x; nodeX++)
+				{
+					glm::vec2 heightBounds = glm::vec2(1.0f, 0.0f);
+					for (uint32_t childY = nodeY * 2; childY < std::min(nodeY * 2 + 2, numChildNodes.y); childY++)
+					{
+						for (uint32_t childX = nodeX * 2; childX < std::min(nodeX * 2 + 2, numChildNodes.x); childX++)
+						{
+							const glm::vec2 childBounds = m_NodeHeightBounds[lodLevel - 1][childX + childY * numChildNodes.x];
+							heightBounds.x = std::min(heightBounds.x, childBounds.x);
+							heightBounds.y = std::max(heightBounds.y, childBounds.y);
+						}
+					}
+					m_NodeHeightBounds[lodLevel][nodeX + nodeY * m_NumNodes[lodLevel].x] = heightBounds;
+				}
+			}
+		}
+	}
 
-				float terrainVertexX = -m_TerrainTextureHeight / 2.0f + m_TerrainTextureHeight * i / (float) m_TerrainTextureHeight;
-				float terrainVertexY = (int) terrainHeightMapValue[0] * terrainHeightScale - terrainHeightShift;
-				float terrainVertexZ = -m_TerrainTextureWidth / 2.0f + m_TerrainTextureWidth * j / (float) m_TerrainTextureWidth;
-				glm::vec3 terrainVertex = glm::vec3(terrainVertexX, terrainVertexY, terrainVertexZ);
+	void CTerrainNode::CreatePatchMesh(CGraphicsContext* context)
+	{
+		constexpr uint32_t numPatchVertices = TERRAIN_PATCH_RESOLUTION + 1;
 
-				terrainVertices.push_back(terrainVertex);
-				terrainIndices.push_back(j + m_TerrainTextureWidth * (i + 0));
-				terrainIndices.push_back(j + m_TerrainTextureWidth * (i + 1));
+		// Positions are in patch quads. The vertex shader scales them to the node size
+		std::vector<glm::vec2> patchVertices;
+		patchVertices.reserve(numPatchVertices * numPatchVertices);
+		for (uint32_t j = 0; j < numPatchVertices; j++)
+		{
+			for (uint32_t i = 0; i < numPatchVertices; i++)
+			{
+				patchVertices.push_back(glm::vec2((float)i, (float)j));
 			}
 		}
 
-		stbi_image_free(pixelData);
-
-		m_NumTerrainVertices = (uint32_t)terrainVertices.size();
-		m_NumTerrainIndices  = (uint32_t)terrainIndices.size();
+		// Wound counter clockwise when seen from above. x goes along i and z along j
+		std::vector<uint32_t> patchIndices;
+		patchIndices.reserve(TERRAIN_PATCH_RESOLUTION * TERRAIN_PATCH_RESOLUTION * 6);
+		for (uint32_t j = 0; j < TERRAIN_PATCH_RESOLUTION; j++)
+		{
+			for (uint32_t i = 0; i < TERRAIN_PATCH_RESOLUTION; i++)
+			{
+				const uint32_t a = (i + 0) + (j + 0) * numPatchVertices;
+				const uint32_t b = (i + 1) + (j + 0) * numPatchVertices;
+				const uint32_t c = (i + 0) + (j + 1) * numPatchVertices;
+				const uint32_t d = (i + 1) + (j + 1) * numPatchVertices;
 
+				patchIndices.insert(patchIndices.end(), { a, c, b, b, c, d });
+			}
+		}
 
-		VkDeviceSize terrainVertexBufferSize = (VkDeviceSize)m_NumTerrainVertices * sizeof(glm::vec3);
-		VkDeviceSize terrainIndexBufferSize  = (VkDeviceSize)m_NumTerrainIndices  * sizeof(uint32_t);
+		m_NumPatchIndices = (uint32_t)patchIndices.size();
 
 		CreateBufferAndCopyData(
-			context, 
-			m_TerrainVertexBuffer, 
-			m_TerrainVertexBufferMemory, 
-			terrainVertices.data(), 
-			terrainVertexBufferSize, 
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+			context,
+			m_PatchVertexBuffer,
+			m_PatchVertexBufferMemory,
+			patchVertices.data(),
+			(VkDeviceSize)patchVertices.size() * sizeof(glm::vec2),
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 		);
 
 		CreateBufferAndCopyData(
-			context, 
-			m_TerrainIndexBuffer, 
-			m_TerrainIndexBufferMemory, 
-			terrainIndices.data(), 
-			terrainIndexBufferSize, 
-			VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+			context,
+			m_PatchIndexBuffer,
+			m_PatchIndexBufferMemory,
+			patchIndices.data(),
+			(VkDeviceSize)patchIndices.size() * sizeof(uint32_t),
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
 		);
 	}
 
+	std::vector<EResourceIndices> CTerrainNode::GetResourceUsage()
+	{
+		return
+		{
+			EResourceIndices::Normals,
+			EResourceIndices::Albedo,
+			EResourceIndices::Depth
+		};
+	}
+
 	void CTerrainNode::Init(CGraphicsContext* context, SGraphicsManagers* managers)
 	{
-		CreateTerrainVertices(context);
+		m_TileCache.Init(context, "./assets/terrain/iceland_heightmap.png", TERRAIN_PATCH_RESOLUTION);
+
+		CreateNodeBounds();
+		CreatePatchMesh(context);
 
-		m_TerrainUniformBuffer = CreateUniformBuffer(context, m_TerrainUniformBufferMemory, sizeof(STerrainFragmentConstants));
+		m_TerrainNodeBuffer = CreateStorageBuffer(
+			context,
+			m_TerrainNodeBufferMemory,
+			sizeof(STerrainNodeGPU) * MAX_TERRAIN_NODES * g_MaxFramesInFlight,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-		const SRenderResource sceneColorAttachment = managers->m_ResourceManager->GetRenderResource(EResourceIndices::SceneColor);
-		const SRenderResource depthAttachment      = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Depth);
+		m_SelectedNodes.reserve(MAX_TERRAIN_NODES);
 
+		m_TerrainTable = new CBindingTable();
+		m_TerrainTable->AddStorageBufferBinding(0, VK_SHADER_STAGE_VERTEX_BIT, m_TerrainNodeBuffer, sizeof(STerrainNodeGPU) * MAX_TERRAIN_NODES * g_MaxFramesInFlight);
+		m_TerrainTable->AddSampledImageBinding(1, VK_SHADER_STAGE_VERTEX_BIT,   m_TileCache.GetCacheImageView(),       CTerrainTileCache::s_CacheFormat,       context->GetLinearClampSampler());
+		m_TerrainTable->AddSampledImageBinding(2, VK_SHADER_STAGE_VERTEX_BIT,   m_TileCache.GetIndirectionImageView(), CTerrainTileCache::s_IndirectionFormat, m_TileCache.GetIndirectionSampler());
+		m_TerrainTable->AddSampledImageBinding(3, VK_SHADER_STAGE_FRAGMENT_BIT, m_TileCache.GetNormalCacheImageView(), CTerrainTileCache::s_NormalCacheFormat, context->GetLinearClampSampler());
+		m_TerrainTable->AddSampledImageBinding(4, VK_SHADER_STAGE_FRAGMENT_BIT, m_TileCache.GetIndirectionImageView(), CTerrainTileCache::s_IndirectionFormat, m_TileCache.GetIndirectionSampler());
+		m_TerrainTable->CreateBindings(context);
+
+		VkFormat normalsFormat = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Normals).m_Format;
+		VkFormat albedoFormat  = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Albedo).m_Format;
+		VkFormat depthFormat   = managers->m_ResourceManager->GetRenderResource(EResourceIndices::Depth).m_Format;
 
 		m_TerrainPipeline = new CPipeline(EPipelineType::GRAPHICS);
 		m_TerrainPipeline->SetVertexShader("shaders/terrain.vert.spv");
 		m_TerrainPipeline->SetFragmentShader("shaders/terrain.frag.spv");
 		m_TerrainPipeline->SetCullingMode(VK_CULL_MODE_BACK_BIT);
-		m_TerrainPipeline->SetPrimitiveTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
-		m_TerrainPipeline->SetVertexInput(sizeof(glm::vec3), VK_VERTEX_INPUT_RATE_VERTEX);
-		m_TerrainPipeline->AddVertexAttribute(0, VK_FORMAT_R32G32B32_SFLOAT, 0);
-		m_TerrainPipeline->AddSampledBufferBinding(0, VK_SHADER_STAGE_FRAGMENT_BIT, m_TerrainUniformBuffer, sizeof(STerrainFragmentConstants));
-		m_TerrainPipeline->AddPushConstantSlot(VK_SHADER_STAGE_VERTEX_BIT, sizeof(STerrainVertexPushConstants), 0);
-		m_TerrainPipeline->AddColorAttachment(sceneColorAttachment.m_Format);
-		m_TerrainPipeline->AddDepthAttachment(depthAttachment.m_Format);
-		m_TerrainPipeline->CreatePipeline(context);
+		m_TerrainPipeline->SetVertexInput(sizeof(glm::vec2), VK_VERTEX_INPUT_RATE_VERTEX);
+		m_TerrainPipeline->AddVertexAttribute(0, VK_FORMAT_R32G32_SFLOAT, 0);
+		m_TerrainPipeline->AddPushConstantSlot(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(STerrainPushConstants), 0);
+		m_TerrainPipeline->AddColorAttachment(normalsFormat);
+		m_TerrainPipeline->AddColorAttachment(albedoFormat);
+		m_TerrainPipeline->AddDepthAttachment(depthFormat);
+		m_TerrainPipeline->CreatePipeline(context, m_TerrainTable->GetDescriptorSetLayout());
+	}
+
+	void CTerrainNode::GetNodeBounds(uint32_t nodeX, uint32_t nodeY, uint32_t lodLevel, glm::vec3& boundsMin, glm::vec3& boundsMax)
+	{
+		const uint32_t  nodeSize     = TERRAIN_PATCH_RESOLUTION << lodLevel;
+		const glm::vec2 heightBounds = m_NodeHeightBounds[lodLevel][nodeX + nodeY * m_NumNodes[lodLevel].x];
+		const glm::vec2 terrainSize  = glm::vec2((float)(m_HeightMapWidth - 1), (float)(m_HeightMapHeight - 1));
+
+		// Heightmap texels to world. Terrain is centered on the origin
+		const glm::vec2 nodeMin = glm::vec2((float)(nodeX * nodeSize), (float)(nodeY * nodeSize));
+		const glm::vec2 nodeMax = glm::min(nodeMin + (float)nodeSize, terrainSize);
+
+		const glm::vec2 worldMin = (nodeMin - terrainSize * 0.5f) * g_TerrainTexelSize;
+		const glm::vec2 worldMax = (nodeMax - terrainSize * 0.5f) * g_TerrainTexelSize;
+
+		boundsMin = glm::vec3(worldMin.x, heightBounds.x * g_TerrainHeightScale + g_TerrainHeightOffset, worldMin.y);
+		boundsMax = glm::vec3(worldMax.x, heightBounds.y * g_TerrainHeightScale + g_TerrainHeightOffset, worldMax.y);
+	}
+
+	void CTerrainNode::SelectNode(uint32_t nodeX, uint32_t nodeY, uint32_t lodLevel, const glm::vec4* frustumPlanes, const glm::vec3& cameraPosition)
+	{
+		// Root covers more than the heightmap so some children fall outside of it
+		if (nodeX >= m_NumNodes[lodLevel].x || nodeY >= m_NumNodes[lodLevel].y || m_SelectedNodes.size() >= MAX_TERRAIN_NODES)
+			return;
+
+		glm::vec3 boundsMin, boundsMax;
+		GetNodeBounds(nodeX, nodeY, lodLevel, boundsMin, boundsMax);
+
+		// Outside if the corner furthest along the plane normal is behind it
+		for (uint32_t i = 0; i < 6; i++)
+		{
+			const glm::vec3 planeNormal    = glm::vec3(frustumPlanes[i]);
+			const glm::vec3 furthestCorner = glm::vec3(
+				planeNormal.x > 0.0f ? boundsMax.x : boundsMin.x,
+				planeNormal.y > 0.0f ? boundsMax.y : boundsMin.y,
+				planeNormal.z > 0.0f ? boundsMax.z : boundsMin.z);
+
+			if (glm::dot(planeNormal, furthestCorner) + frustumPlanes[i].w < 0.0f)
+				return;
+		}
+
+		// Split the node if the camera is close enough for the finer level to be used somewhere in it
+		const float distanceToNode = glm::length(glm::max(glm::max(boundsMin - cameraPosition, cameraPosition - boundsMax), glm::vec3(0.0f)));
+		if (lodLevel > 0 && distanceToNode < m_LodRanges[lodLevel - 1])
+		{
+			for (uint32_t childY = 0; childY < 2; childY++)
+			{
+				for (uint32_t childX = 0; childX < 2; childX++)
+				{
+					SelectNode(nodeX * 2 + childX, nodeY * 2 + childY, lodLevel - 1, frustumPlanes, cameraPosition);
+				}
+			}
+			return;
+		}
+
+		const float nodeSize   = (float)(TERRAIN_PATCH_RESOLUTION << lodLevel);
+		const float rangeStart = lodLevel > 0 ? m_LodRanges[lodLevel - 1] : 0.0f;
+		const float rangeEnd   = m_LodRanges[lodLevel];
+
+		// Pages for this LOD and the one it morphs into
+		const glm::uvec2 texelMin = glm::uvec2(nodeX, nodeY) * (uint32_t)nodeSize;
+		const glm::uvec2 texelMax = glm::min(texelMin + (uint32_t)nodeSize, glm::uvec2(m_HeightMapWidth - 1, m_HeightMapHeight - 1));
+		m_TileCache.RequestTexels(lodLevel,     texelMin, texelMax);
+		m_TileCache.RequestTexels(lodLevel + 1, texelMin, texelMax);
+
+		STerrainNodeGPU terrainNode{};
+		terrainNode.m_OffsetSize = glm::vec4(nodeX * nodeSize, nodeY * nodeSize, nodeSize, (float)lodLevel);
+		terrainNode.m_MorphRange = glm::vec4(glm::mix(rangeStart, rangeEnd, g_TerrainMorphStart), rangeEnd, 0.0f, 0.0f);
+		m_SelectedNodes.push_back(terrainNode);
 	}
 
-	void CTerrainNode::UpdateTerrainConstants(CGraphicsContext* context, SGraphicsManagers* managers)
+	void CTerrainNode::SelectNodes(SGraphicsManagers* managers)
 	{
+		CCamera* camera = managers->m_InputManager->GetCamera();
+
+		m_LodRanges.resize(m_NumLodLevels);
+		for (uint32_t lodLevel = 0; lodLevel < m_NumLodLevels; lodLevel++)
+		{
+			m_LodRanges[lodLevel] = g_TerrainLodDistance * (float)(1u << lodLevel);
+		}
 
+		// Frustum planes from the rows of the view projection matrix. Depth is zero to one so near is just the third row
+		const glm::mat4 viewProjection = camera->GetProjectionMatrix() * camera->GetLookAtMatrix();
+		const glm::vec4 rowX = glm::vec4(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+		const glm::vec4 rowY = glm::vec4(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+		const glm::vec4 rowZ = glm::vec4(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+		const glm::vec4 rowW = glm::vec4(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+		const glm::vec4 frustumPlanes[6] =
+		{
+			rowW + rowX,
+			rowW - rowX,
+			rowW + rowY,
+			rowW - rowY,
+			rowZ,
+			rowW - rowZ
+		};
+
+		m_SelectedNodes.clear();
+		SelectNode(0, 0, m_NumLodLevels - 1, frustumPlanes, camera->GetPosition());
+	}
+
+	void CTerrainNode::UpdateTerrainNodes(CGraphicsContext* context)
+	{
+		if (m_SelectedNodes.empty())
+			return;
+
+		const VkDeviceSize frameOffset = sizeof(STerrainNodeGPU) * MAX_TERRAIN_NODES * context->GetFrameIndex();
+		const VkDeviceSize nodesSize   = sizeof(STerrainNodeGPU) * m_SelectedNodes.size();
+
+		void* data;
+		vkMapMemory(context->GetLogicalDevice(), m_TerrainNodeBufferMemory, frameOffset, nodesSize, 0, &data);
+		memcpy(data, m_SelectedNodes.data(), (size_t)nodesSize);
+		vkUnmapMemory(context->GetLogicalDevice(), m_TerrainNodeBufferMemory);
 	}
 
 	void CTerrainNode::Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer)
 	{
-		UpdateTerrainConstants(context, managers);
+		ImGui::Begin("Terrain");
+		ImGui::Checkbox("Draw Terrain", &g_DrawTerrain);
+		ImGui::SliderFloat("Height Scale", &g_TerrainHeightScale, 0.0f, 2000.0f);
+		ImGui::SliderFloat("Height Offset", &g_TerrainHeightOffset, -1000.0f, 1000.0f);
+		ImGui::SliderFloat("Texel Size", &g_TerrainTexelSize, 0.25f, 16.0f);
+		ImGui::SliderFloat("LOD Distance", &g_TerrainLodDistance, 32.0f, 2048.0f);
+		ImGui::Text("Nodes: %u / %u", (uint32_t)m_SelectedNodes.size(), MAX_TERRAIN_NODES);
+		ImGui::Text("Triangles: %u", (uint32_t)m_SelectedNodes.size() * (m_NumPatchIndices / 3));
+		ImGui::Text("Resident pages: %u / %u", m_TileCache.GetNumResidentPages(), TERRAIN_TILE_CACHE_SLOTS * TERRAIN_TILE_CACHE_SLOTS);
+		ImGui::Text("Pending pages: %u", m_TileCache.GetNumPendingPages());
+		ImGui::End();
+
+		if (!g_DrawTerrain)
+		{
+			m_SelectedNodes.clear();
+			return;
+		}
+
+		SelectNodes(managers);
+		UpdateTerrainNodes(context);
+		m_TileCache.SetNormalScale(g_TerrainHeightScale, g_TerrainTexelSize);
+		m_TileCache.Update(context, commandBuffer);
 
-		//glm::mat4 cameraLookAt = managers->m_InputManager->GetCamera()->GetLookAtMatrix();
-		//glm::mat4 cameraProjection = managers->m_InputManager->GetCamera()->GetProjectionMatrix();
-		glm::mat4 cameraLookAt = glm::lookAt(glm::vec3(67.0f, 627.5f, 170.0f), glm::vec3(67.0f, 627.5f, 170.0f) + glm::vec3(-0.45f, -0.67f, -0.58f), glm::vec3(-0.41f, 0.73f, -0.53f));
-		glm::mat4 cameraProjection = glm::perspective(glm::radians(45.0f), (float)g_DisplayWidth / (float)g_DisplayHeight, 0.1f, 100000.0f);
+		if (m_SelectedNodes.empty())
+			return;
 
-		glm::mat4 cameraViewProjectionMatrix = cameraProjection * cameraLookAt;
-		STerrainVertexPushConstants terrainPushConstants{};
-		terrainPushConstants.m_ViewProjectionMatrix = cameraViewProjectionMatrix;
+		CCamera* camera = managers->m_InputManager->GetCamera();
+
+		STerrainPushConstants terrainPushConstants{};
+		terrainPushConstants.m_ViewProjectionMatrix = camera->GetProjectionMatrix() * camera->GetLookAtMatrix();
+		terrainPushConstants.m_CameraPosition       = camera->GetPosition();
+		terrainPushConstants.m_TexelSize            = g_TerrainTexelSize;
+		terrainPushConstants.m_HeightScale          = g_TerrainHeightScale;
+		terrainPushConstants.m_HeightOffset         = g_TerrainHeightOffset;
+		terrainPushConstants.m_HeightMapWidth       = (float)m_HeightMapWidth;
+		terrainPushConstants.m_HeightMapHeight      = (float)m_HeightMapHeight;
+		terrainPushConstants.m_NumTileMips          = m_TileCache.GetNumMips();
 
 		CResourceManager* resourceManager = managers->m_ResourceManager;
-		resourceManager->TransitionResource(commandBuffer, EResourceIndices::Depth, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
-		SRenderResource depthAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Depth, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-		SRenderResource sceneColorAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::SceneColor, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		SRenderResource normalsAttachment = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Normals, VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		SRenderResource albedoAttachment  = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Albedo,  VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		SRenderResource depthAttachment   = resourceManager->TransitionResource(commandBuffer, EResourceIndices::Depth,   VK_ATTACHMENT_LOAD_OP_LOAD, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
-		BeginRendering("Terrain", context, commandBuffer, { sceneColorAttachment, depthAttachment });
+		BeginRendering("Terrain", context, commandBuffer, { normalsAttachment, albedoAttachment, depthAttachment });
 
-		m_TerrainPipeline->BindPipeline(context, commandBuffer);
+		m_TerrainPipeline->BindPipeline(commandBuffer);
+		m_TerrainTable->BindTable(context, commandBuffer, m_TerrainPipeline->GetPipelineLayout());
 		m_TerrainPipeline->PushConstants(commandBuffer, (void*)&terrainPushConstants);
 
-		VkBuffer vertexBuffer[] = { m_TerrainVertexBuffer };
+		VkBuffer vertexBuffer[] = { m_PatchVertexBuffer };
 		VkDeviceSize vertexOffsets[] = { 0 };
 		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffer, vertexOffsets);
-		vkCmdBindIndexBuffer(commandBuffer, m_TerrainIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
-		const uint32_t NUM_STRIPS          = m_TerrainTextureHeight - 1;
-		const uint32_t NUM_VERTS_PER_STRIP = m_TerrainTextureWidth * 2;
+		vkCmdBindIndexBuffer(commandBuffer, m_PatchIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-		for (unsigned int strip = 0; strip < NUM_STRIPS; ++strip)
-		{
-			//vkCmdDrawIndexed(commandBuffer, NUM_VERTS_PER_STRIP, 1, (NUM_VERTS_PER_STRIP * strip), 0, 0); // offset to starting index
-		}
+		// One instance per node. First instance points gl_InstanceIndex at this frame's nodes
+		vkCmdDrawIndexed(commandBuffer, m_NumPatchIndices, (uint32_t)m_SelectedNodes.size(), 0, 0, MAX_TERRAIN_NODES * context->GetFrameIndex());
 
 		EndRendering(context, commandBuffer);
 	}
 
 	void CTerrainNode::Cleanup(CGraphicsContext* context)
 	{
-		vkDestroyBuffer(context->GetLogicalDevice(), m_TerrainVertexBuffer, nullptr);
-		vkFreeMemory(context->GetLogicalDevice(), m_TerrainVertexBufferMemory, nullptr);
+		vkDestroyBuffer(context->GetLogicalDevice(), m_PatchVertexBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_PatchVertexBufferMemory, nullptr);
 
-		vkDestroyBuffer(context->GetLogicalDevice(), m_TerrainIndexBuffer, nullptr);
-		vkFreeMemory(context->GetLogicalDevice(), m_TerrainIndexBufferMemory, nullptr);
+		vkDestroyBuffer(context->GetLogicalDevice(), m_PatchIndexBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_PatchIndexBufferMemory, nullptr);
 
-		vkDestroyBuffer(context->GetLogicalDevice(), m_TerrainUniformBuffer, nullptr);
-		vkFreeMemory(context->GetLogicalDevice(), m_TerrainUniformBufferMemory, nullptr);
+		vkDestroyBuffer(context->GetLogicalDevice(), m_TerrainNodeBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_TerrainNodeBufferMemory, nullptr);
 
+		m_TileCache.Cleanup(context);
+
+		m_TerrainTable->Cleanup(context);
 		m_TerrainPipeline->Cleanup(context);
+
+		delete m_TerrainTable;
+		delete m_TerrainPipeline;
 	}
 
-};
\ No newline at end of file
+};
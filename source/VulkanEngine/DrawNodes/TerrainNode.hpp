@@ -3,13 +3,27 @@
 #include <DrawNodes/DrawNode.hpp>
 #include <DrawNodes/Utils/Pipeline.hpp>
 #include <DrawNodes/Utils/BindingTable.hpp>
+#include <DrawNodes/Utils/TerrainTileCache.hpp>
 
 /*
-	Draw heightmap terrain. Implementation TBD so currently does nothing hihi
+	Draw heightmap terrain with a CDLOD quadtree. Every selected node is the same grid patch instanced across the terrain,
+	the vertex shader displaces it with the heightmap and morphs it toward the next LOD so there are no cracks between levels.
+	The heightmap is streamed in pages around the camera through CTerrainTileCache.
+	Writes into the G-buffer so it gets lit like everything else
 */
 
+// Must match terrain.vert
+#define TERRAIN_PATCH_RESOLUTION 32  // Quads along one side of a node
+#define MAX_TERRAIN_NODES        512 // Caps the number of vertices drawn no matter the heightmap size
+
 namespace NVulkanEngine
 {
+	struct STerrainNodeGPU
+	{
+		glm::vec4 m_OffsetSize; // xy offset and z size in heightmap texels, w LOD level
+		glm::vec4 m_MorphRange; // x start and y end distance of the morph to the next LOD
+	};
+
 	class CTerrainNode : public CDrawNode
 	{
 	public:
@@ -17,28 +31,47 @@ namespace NVulkanEngine
 		~CTerrainNode() = default;
 
 		virtual void Init(CGraphicsContext* context, SGraphicsManagers* managers)  override;
+		virtual std::vector<EResourceIndices> GetResourceUsage() override;
 		virtual void Draw(CGraphicsContext* context, SGraphicsManagers* managers, VkCommandBuffer commandBuffer) override;
 		virtual void Cleanup(CGraphicsContext* context) override;
 
 	private:
-		void UpdateTerrainConstants(CGraphicsContext* context, SGraphicsManagers* managers);
-		void CreateTerrainVertices(CGraphicsContext* context);
+		void CreateNodeBounds();
+		void CreatePatchMesh(CGraphicsContext* context);
+
+		// Walks the quadtree and fills m_SelectedNodes
+		void SelectNodes(SGraphicsManagers* managers);
+		void SelectNode(uint32_t nodeX, uint32_t nodeY, uint32_t lodLevel, const glm::vec4* frustumPlanes, const glm::vec3& cameraPosition);
+		void GetNodeBounds(uint32_t nodeX, uint32_t nodeY, uint32_t lodLevel, glm::vec3& boundsMin, glm::vec3& boundsMax);
 
-		VkBuffer        m_TerrainUniformBuffer = VK_NULL_HANDLE;
-		VkDeviceMemory  m_TerrainUniformBufferMemory  = VK_NULL_HANDLE;
+		void UpdateTerrainNodes(CGraphicsContext* context);
 
-		VkBuffer        m_TerrainVertexBuffer       = VK_NULL_HANDLE;
-		VkDeviceMemory  m_TerrainVertexBufferMemory = VK_NULL_HANDLE;
+		// Heightmap
+		CTerrainTileCache m_TileCache               = {};
+		uint32_t          m_HeightMapWidth          = 0;
+		uint32_t          m_HeightMapHeight         = 0;
 
-		VkBuffer        m_TerrainIndexBuffer        = VK_NULL_HANDLE;
-		VkDeviceMemory  m_TerrainIndexBufferMemory  = VK_NULL_HANDLE;
+		// Min and max height of every node in every LOD level. Index 0 is the finest level
+		std::vector<std::vector<glm::vec2>> m_NodeHeightBounds = {};
+		std::vector<glm::uvec2>             m_NumNodes         = {}; // Nodes along x and y per LOD level
+		uint32_t                            m_NumLodLevels     = 0;
+
+		// The grid patch every node draws
+		VkBuffer        m_PatchVertexBuffer         = VK_NULL_HANDLE;
+		VkDeviceMemory  m_PatchVertexBufferMemory   = VK_NULL_HANDLE;
+		VkBuffer        m_PatchIndexBuffer          = VK_NULL_HANDLE;
+		VkDeviceMemory  m_PatchIndexBufferMemory    = VK_NULL_HANDLE;
+		uint32_t        m_NumPatchIndices           = 0;
+
+		// Selected nodes. One range of MAX_TERRAIN_NODES per frame in flight
+		VkBuffer        m_TerrainNodeBuffer         = VK_NULL_HANDLE;
+		VkDeviceMemory  m_TerrainNodeBufferMemory   = VK_NULL_HANDLE;
+
+		std::vector<STerrainNodeGPU> m_SelectedNodes = {};
+		std::vector<float>           m_LodRanges     = {};
 
 		// Pipeline & shader binding
+		CBindingTable* m_TerrainTable          = nullptr;
 		CPipeline*     m_TerrainPipeline       = nullptr;
-
-		int m_TerrainTextureWidth       = -1;
-		int m_TerrainTextureHeight      = -1;
-		uint32_t m_NumTerrainVertices   = 0;
-		uint32_t m_NumTerrainIndices    = 0;
 	};
-}
\ No newline at end of file
+}
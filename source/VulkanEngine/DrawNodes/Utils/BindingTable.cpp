@@ -2,6 +2,7 @@
 #include <GraphicsContext.hpp>
 
 #include <array>
+#include <chrono>
 
 namespace NVulkanEngine
 {
@@ -25,67 +26,18 @@ namespace NVulkanEngine
 		m_VertexInputAttributes.push_back(attributeDescription);
 	}
 
-	void CBindingTable::AllocateDescriptorPool(CGraphicsContext* context)
-	{
-		uint32_t numBufferDescriptors = m_NumBufferDescriptors * g_MaxFramesInFlight;
-		uint32_t numImageDescriptors  = m_NumImageDescriptors  * g_MaxFramesInFlight;
-		uint32_t numDescriptorSets    = (uint32_t) m_DescriptorInfos.size() * g_MaxFramesInFlight;
-
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type            = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = numBufferDescriptors;
-		poolSizes[1].type            = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = numImageDescriptors;
-
-		VkDescriptorPoolCreateInfo poolInfo{};
-		poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-		poolInfo.poolSizeCount = m_NumImageDescriptors > 0 ? static_cast<uint32_t>(poolSizes.size()) : 1;
-		poolInfo.pPoolSizes    = poolSizes.data();
-		poolInfo.maxSets       = numDescriptorSets;
-
-		VkResult result = vkCreateDescriptorPool(context->GetLogicalDevice(), &poolInfo, nullptr, &m_DescriptorPool);
-
-		if (result != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to allocate descriptor sets!");
-		}
-	}
-
-
 	void CBindingTable::AllocateDescriptorSetLayout(CGraphicsContext* context)
 	{
-		VkDescriptorSetLayoutCreateInfo layoutInfo{};
-		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-		layoutInfo.bindingCount = static_cast<uint32_t>(m_DescriptorSetLayoutBindings.size());
-		layoutInfo.pBindings = m_DescriptorSetLayoutBindings.data();
-
-		VkResult result = vkCreateDescriptorSetLayout(context->GetLogicalDevice(), &layoutInfo, nullptr, &m_DescriptorSetLayout);
-
-		if (result != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to create descriptor set layout!");
-		}
+		// Tables with the same bindings share one layout
+		m_DescriptorSetLayout = context->GetDescriptorManager()->GetDescriptorSetLayout(context, m_DescriptorSetLayoutBindings);
 	}
 
 	void CBindingTable::AllocateDescriptorSets(CGraphicsContext* context)
 	{
-		std::vector<VkDescriptorSetLayout> descritporSetLayouts(g_MaxFramesInFlight, m_DescriptorSetLayout);
-
-		VkDescriptorSetAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		allocInfo.descriptorPool = m_DescriptorPool;
-		allocInfo.pSetLayouts = descritporSetLayouts.data();
-
-		allocInfo.descriptorSetCount = g_MaxFramesInFlight;
-
 		m_DescriptorSets.resize(g_MaxFramesInFlight);
 
-		VkResult result = vkAllocateDescriptorSets(context->GetLogicalDevice(), &allocInfo, m_DescriptorSets.data());
-
-		if (result != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to allocate descriptor sets!");
-		}
+		// All sets of the table come from the same pool so they can be given back together
+		m_DescriptorPool = context->GetDescriptorManager()->AllocateDescriptorSets(context, m_DescriptorSetLayout, g_MaxFramesInFlight, m_DescriptorSets.data());
 	}
 
 
@@ -117,12 +69,58 @@ namespace NVulkanEngine
 		m_NumImageDescriptors++;
 	}
 
+	void CBindingTable::AddStorageBufferBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkBuffer buffer, VkDeviceSize bufferSize)
+	{
+		VkDescriptorSetLayoutBinding descriptorLayoutBinding = CreateDescriptorSetLayoutBinding(bindingSlot, shaderStage, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+		m_DescriptorSetLayoutBindings.push_back(descriptorLayoutBinding);
+
+		SDescriptorInfo writeDescriptor{};
+		writeDescriptor.m_BufferInfo = { buffer, 0, bufferSize };
+		writeDescriptor.m_ImageInfo  = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED };
+
+		m_DescriptorInfos.push_back(writeDescriptor);
+		m_NumStorageBufferDescriptors++;
+	}
+
+	void CBindingTable::AddStorageImageBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkImageView imageView)
+	{
+		VkDescriptorSetLayoutBinding descriptorLayoutBinding = CreateDescriptorSetLayoutBinding(bindingSlot, shaderStage, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+		m_DescriptorSetLayoutBindings.push_back(descriptorLayoutBinding);
+
+		SDescriptorInfo writeDescriptor{};
+		writeDescriptor.m_BufferInfo = { VK_NULL_HANDLE, 0, VK_WHOLE_SIZE };
+		writeDescriptor.m_ImageInfo  = CreateDescriptorImageInfo(imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL);
+
+		m_DescriptorInfos.push_back(writeDescriptor);
+		m_NumStorageImageDescriptors++;
+	}
+
 	void CBindingTable::CreateBindings(CGraphicsContext* context)
 	{
-		AllocateDescriptorPool(context);
+		CDescriptorManager* descriptorManager = context->GetDescriptorManager();
+
 		AllocateDescriptorSetLayout(context);
-		AllocateDescriptorSets(context);
 
+		if (descriptorManager->UsesDescriptorBuffers())
+		{
+			m_DescriptorBufferRange = descriptorManager->AllocateDescriptorBufferRange(context, descriptorManager->GetDescriptorSetLayoutSize(context, m_DescriptorSetLayout));
+
+			const auto writeStart = std::chrono::high_resolution_clock::now();
+			WriteDescriptorBuffer(context);
+			descriptorManager->AddWriteStats(std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - writeStart).count(), (uint32_t)m_DescriptorInfos.size());
+		}
+		else
+		{
+			AllocateDescriptorSets(context);
+
+			const auto writeStart = std::chrono::high_resolution_clock::now();
+			WriteDescriptorSets(context);
+			descriptorManager->AddWriteStats(std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - writeStart).count(), (uint32_t)(m_DescriptorInfos.size() * m_DescriptorSets.size()));
+		}
+	}
+
+	void CBindingTable::WriteDescriptorSets(CGraphicsContext* context)
+	{
 		// Transfer our descriptor infos to a write descriptor
 		for (uint32_t i = 0; i < m_DescriptorSets.size(); i++)
 		{
@@ -139,17 +137,17 @@ namespace NVulkanEngine
 				writeDescriptors[j].descriptorType = descriptorType;
 				writeDescriptors[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 				writeDescriptors[j].dstSet = descriptorSet;
-				writeDescriptors[j].dstBinding = j;
+				writeDescriptors[j].dstBinding = m_DescriptorSetLayoutBindings[j].binding;
 				writeDescriptors[j].descriptorCount = 1;
 				writeDescriptors[j].descriptorType = descriptorType;
 				writeDescriptors[j].dstArrayElement = 0;
 
-				if (descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+				if (descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
 				{
 					writeDescriptors[j].pBufferInfo = &m_DescriptorInfos[j].m_BufferInfo;
 					writeDescriptors[j].pImageInfo = VK_NULL_HANDLE;
 				}
-				else if (descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+				else if (descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)
 				{
 					writeDescriptors[j].pBufferInfo = VK_NULL_HANDLE;
 					writeDescriptors[j].pImageInfo = &m_DescriptorInfos[j].m_ImageInfo;
@@ -160,19 +158,62 @@ namespace NVulkanEngine
 		}
 	}
 
-	void CBindingTable::BindTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)
+	void CBindingTable::WriteDescriptorBuffer(CGraphicsContext* context)
 	{
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &m_DescriptorSets[context->GetFrameIndex()], 0, nullptr);
+		CDescriptorManager* descriptorManager = context->GetDescriptorManager();
+
+		// The descriptors are the same for every frame in flight so one copy is enough
+		for (uint32_t i = 0; i < m_DescriptorInfos.size(); i++)
+		{
+			const VkDescriptorSetLayoutBinding& binding = m_DescriptorSetLayoutBindings[i];
+			uint8_t* descriptor = m_DescriptorBufferRange.m_MappedData + descriptorManager->GetDescriptorBindingOffset(context, m_DescriptorSetLayout, binding.binding);
+
+			if (binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+			{
+				const VkDescriptorBufferInfo& bufferInfo = m_DescriptorInfos[i].m_BufferInfo;
+				descriptorManager->GetBufferDescriptor(context, binding.descriptorType, bufferInfo.buffer, bufferInfo.range, descriptor);
+			}
+			else
+			{
+				descriptorManager->GetImageDescriptor(context, binding.descriptorType, m_DescriptorInfos[i].m_ImageInfo, descriptor);
+			}
+		}
+	}
+
+	void CBindingTable::BindTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkPipelineBindPoint bindPoint)
+	{
+		if (m_DescriptorBufferRange.m_MappedData != nullptr)
+		{
+			context->GetDescriptorManager()->BindDescriptorBuffer(commandBuffer, bindPoint, pipelineLayout, m_DescriptorBufferRange);
+			return;
+		}
+
+		vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, 0, 1, &m_DescriptorSets[context->GetFrameIndex()], 0, nullptr);
 	}
 
 	void CBindingTable::Cleanup(CGraphicsContext* context)
 	{
-		vkDestroyDescriptorPool(context->GetLogicalDevice(), m_DescriptorPool, nullptr);
-		vkDestroyDescriptorSetLayout(context->GetLogicalDevice(), m_DescriptorSetLayout, nullptr);
+		// The layout is owned by the descriptor manager. Tables without resources never allocated anything
+		if (m_DescriptorPool != VK_NULL_HANDLE)
+		{
+			context->GetDescriptorManager()->FreeDescriptorSets(context, m_DescriptorPool, (uint32_t)m_DescriptorSets.size(), m_DescriptorSets.data());
+		}
+		if (m_DescriptorBufferRange.m_MappedData != nullptr)
+		{
+			context->GetDescriptorManager()->FreeDescriptorBufferRange(m_DescriptorBufferRange);
+		}
 
+		m_DescriptorBufferRange = {};
+		m_DescriptorPool      = VK_NULL_HANDLE;
+		m_DescriptorSetLayout = VK_NULL_HANDLE;
 		m_DescriptorSets.clear();
 		m_DescriptorInfos.clear();
 		m_DescriptorSetLayoutBindings.clear();
 		m_VertexInputAttributes.clear();
+
+		m_NumBufferDescriptors        = 0;
+		m_NumImageDescriptors         = 0;
+		m_NumStorageBufferDescriptors = 0;
+		m_NumStorageImageDescriptors  = 0;
 	}
 };
\ No newline at end of file
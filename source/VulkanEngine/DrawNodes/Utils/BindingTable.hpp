@@ -2,6 +2,7 @@
 
 #include <vulkan/vulkan.h>
 #include <VulkanGraphicsEngineUtils.hpp>
+#include <Managers/DescriptorManager.hpp>
 
 #include <vector>
 
@@ -54,20 +55,23 @@ namespace NVulkanEngine
 		void AddVertexShaderAttribute(uint32_t locationSlot, VkFormat format, uint32_t offset);
 		void AddUniformBufferBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkBuffer buffer, uint32_t bufferSize);
 		void AddSampledImageBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkImageView imageView, VkFormat format, VkSampler sampler);
+		void AddStorageBufferBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkBuffer buffer, VkDeviceSize bufferSize);
+		void AddStorageImageBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkImageView imageView); // Image has to be in VK_IMAGE_LAYOUT_GENERAL when bound
 		void CreateBindings(CGraphicsContext* context);
 
-		bool HasResourcesToBind() { return ((m_NumImageDescriptors + m_NumBufferDescriptors) > 0); };
+		bool HasResourcesToBind() { return ((m_NumImageDescriptors + m_NumBufferDescriptors + m_NumStorageBufferDescriptors + m_NumStorageImageDescriptors) > 0); };
 
 		VkDescriptorSetLayout GetDescriptorSetLayout() { return m_DescriptorSetLayout; };
 
-		void BindTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout);
+		void BindTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS);
 
 		void Cleanup(CGraphicsContext* context);
 
 	private:
-		void AllocateDescriptorPool(CGraphicsContext* context);
 		void AllocateDescriptorSetLayout(CGraphicsContext* context);
 		void AllocateDescriptorSets(CGraphicsContext* context);
+		void WriteDescriptorSets(CGraphicsContext* context);
+		void WriteDescriptorBuffer(CGraphicsContext* context);
 
 		std::vector<VkVertexInputAttributeDescription> m_VertexInputAttributes = { };
 
@@ -81,12 +85,15 @@ namespace NVulkanEngine
 		std::vector<SDescriptorInfo>              m_DescriptorInfos = { }; // Holder for the current descriptors. Consumed in CreateBindings()
 		std::vector<VkDescriptorSetLayoutBinding> m_DescriptorSetLayoutBindings = {};
 
-		VkDescriptorPool                   m_DescriptorPool       =   VK_NULL_HANDLE;   // The pool from which we allocate descriptors
-		VkDescriptorSetLayout              m_DescriptorSetLayout  = { VK_NULL_HANDLE }; // The layout of the shader descriptor bindings
+		VkDescriptorPool                   m_DescriptorPool       =   VK_NULL_HANDLE;   // The shared pool our sets were allocated from. Owned by CDescriptorManager
+		VkDescriptorSetLayout              m_DescriptorSetLayout  = { VK_NULL_HANDLE }; // The layout of the shader descriptor bindings. Owned by CDescriptorManager
 		std::vector<VkDescriptorSet>       m_DescriptorSets       = { VK_NULL_HANDLE }; // The actual data to bind into each descriptor layout slot
+		SDescriptorBufferRange             m_DescriptorBufferRange = {};                // Used instead of the sets when the descriptor manager has descriptor buffers
 
-		uint32_t m_NumBufferDescriptors = 0;
-		uint32_t m_NumImageDescriptors  = 0;
+		uint32_t m_NumBufferDescriptors        = 0;
+		uint32_t m_NumImageDescriptors         = 0;
+		uint32_t m_NumStorageBufferDescriptors = 0;
+		uint32_t m_NumStorageImageDescriptors  = 0;
 
 	};
 
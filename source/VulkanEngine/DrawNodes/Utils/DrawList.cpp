@@ -0,0 +1,80 @@
+#include "DrawList.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace NVulkanEngine
+{
+	uint64_t CDrawList::MakeSortKey(uint32_t passIndex, uint32_t pipelineIndex, uint32_t materialIndex, float normalizedDepth)
+	{
+		const uint32_t maxDepthBucket = (1u << DRAW_KEY_DEPTH_BITS) - 1;
+		const uint32_t depthBucket    = (uint32_t)(std::clamp(normalizedDepth, 0.0f, 1.0f) * (float)maxDepthBucket);
+
+		uint64_t sortKey = passIndex & ((1u << DRAW_KEY_PASS_BITS) - 1);
+		sortKey = (sortKey << DRAW_KEY_PIPELINE_BITS) | (pipelineIndex & ((1u << DRAW_KEY_PIPELINE_BITS) - 1));
+		sortKey = (sortKey << DRAW_KEY_DEPTH_BITS)    | depthBucket;
+		sortKey = (sortKey << DRAW_KEY_MATERIAL_BITS) | (materialIndex & ((1u << DRAW_KEY_MATERIAL_BITS) - 1));
+
+		// Whatever is left over goes at the bottom
+		return sortKey << (64 - DRAW_KEY_PASS_BITS - DRAW_KEY_PIPELINE_BITS - DRAW_KEY_DEPTH_BITS - DRAW_KEY_MATERIAL_BITS);
+	}
+
+	void CDrawList::Clear()
+	{
+		m_Draws.clear();
+	}
+
+	void CDrawList::AddDraw(uint64_t sortKey, uint32_t modelIndex, uint32_t meshIndex)
+	{
+		SDrawListItem draw{};
+		draw.m_SortKey    = sortKey;
+		draw.m_ModelIndex = modelIndex;
+		draw.m_MeshIndex  = meshIndex;
+
+		m_Draws.push_back(draw);
+	}
+
+	void CDrawList::Sort()
+	{
+		const size_t numDraws = m_Draws.size();
+		if (numDraws < 2)
+			return;
+
+		// One histogram per byte in a single pass over the keys
+		std::array<std::array<uint32_t, 256>, 8> histograms = {};
+		for (const SDrawListItem& draw : m_Draws)
+		{
+			for (uint32_t byte = 0; byte < 8; byte++)
+			{
+				histograms[byte][(draw.m_SortKey >> (byte * 8)) & 0xFF]++;
+			}
+		}
+
+		m_SortScratch.resize(numDraws);
+		for (uint32_t byte = 0; byte < 8; byte++)
+		{
+			std::array<uint32_t, 256>& histogram = histograms[byte];
+
+			// Every key has the same value in this byte so the order wouldn't change
+			const uint32_t firstKeyBucket = (m_Draws[0].m_SortKey >> (byte * 8)) & 0xFF;
+			if (histogram[firstKeyBucket] == numDraws)
+				continue;
+
+			// Counts to offsets
+			uint32_t offset = 0;
+			for (uint32_t bucket = 0; bucket < 256; bucket++)
+			{
+				const uint32_t count = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += count;
+			}
+
+			// Stable, so the order from the lower bytes is kept
+			for (const SDrawListItem& draw : m_Draws)
+			{
+				m_SortScratch[histogram[(draw.m_SortKey >> (byte * 8)) & 0xFF]++] = draw;
+			}
+			m_Draws.swap(m_SortScratch);
+		}
+	}
+};
\ No newline at end of file
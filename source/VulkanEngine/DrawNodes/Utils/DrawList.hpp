@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+	Draws of a pass in the order they should be recorded. Every draw gets a 64 bit sort key and the list is radix sorted on it,
+	so draws that share a pipeline or material end up next to each other and their binds only have to be recorded once.
+	Opaque draws go front to back in coarse depth buckets so early depth testing throws away as much as possible,
+	materials are grouped within a bucket
+*/
+
+// Bits of the sort key from the top. Depth is quantized into buckets between the near and far plane
+#define DRAW_KEY_PASS_BITS     4
+#define DRAW_KEY_PIPELINE_BITS 8
+#define DRAW_KEY_DEPTH_BITS    12
+#define DRAW_KEY_MATERIAL_BITS 24
+
+namespace NVulkanEngine
+{
+	struct SDrawListItem
+	{
+		uint64_t m_SortKey    = 0;
+		uint32_t m_ModelIndex = 0;
+		uint32_t m_MeshIndex  = 0;
+	};
+
+	class CDrawList
+	{
+	public:
+		CDrawList() = default;
+		~CDrawList() = default;
+
+		// Normalized depth is 0 at the camera and 1 at the far plane. Anything outside is clamped
+		static uint64_t MakeSortKey(uint32_t passIndex, uint32_t pipelineIndex, uint32_t materialIndex, float normalizedDepth);
+
+		void Clear();
+		void AddDraw(uint64_t sortKey, uint32_t modelIndex, uint32_t meshIndex);
+
+		// Least significant byte first. Bytes that are the same for every key are skipped
+		void Sort();
+
+		uint32_t             GetNumDraws() { return (uint32_t)m_Draws.size(); };
+		const SDrawListItem& GetDraw(uint32_t index) { return m_Draws[index]; };
+
+	private:
+		std::vector<SDrawListItem> m_Draws       = {};
+		std::vector<SDrawListItem> m_SortScratch = {};
+	};
+};
\ No newline at end of file
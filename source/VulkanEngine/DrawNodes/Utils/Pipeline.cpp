@@ -4,10 +4,20 @@
 #include <VulkanGraphicsEngineUtils.hpp>
 
 #include <array>
+#include <chrono>
 #include <string>
 
 namespace NVulkanEngine
 {
+	SPipelineCreationStats CPipeline::s_CreationStats = {};
+
+	SPipelineCreationStats CPipeline::ConsumeCreationStats()
+	{
+		SPipelineCreationStats creationStats = s_CreationStats;
+		s_CreationStats = {};
+		return creationStats;
+	}
+
 	CPipeline::CPipeline(EPipelineType type)
 	{
 		m_Type = type;
@@ -27,12 +37,28 @@ namespace NVulkanEngine
 	{
 		m_FragmentShaderPath = fragmentShaderPath;
 	}
+	void CPipeline::SetComputeShader(const std::string& computeShaderPath)
+	{
+		m_ComputeShaderPath = computeShaderPath;
+	}
 
 	void CPipeline::SetCullingMode(VkCullModeFlagBits cullMode)
 	{
 		m_CullMode = cullMode;
 	}
 
+	void CPipeline::SetDepthBiasEnabled(bool depthBiasEnabled)
+	{
+		m_DepthBiasEnabled = depthBiasEnabled;
+	}
+
+	void CPipeline::SetDepthState(bool depthTestEnabled, bool depthWriteEnabled, VkCompareOp depthCompareOp)
+	{
+		m_DepthTestEnabled  = depthTestEnabled;
+		m_DepthWriteEnabled = depthWriteEnabled;
+		m_DepthCompareOp    = depthCompareOp;
+	}
+
 	void CPipeline::AddSampledImageBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkImageView imageView, VkFormat format, VkSampler sampler)
 	{
 		m_BindingTable->AddSampledImageBinding(bindingSlot, shaderStage, imageView, format, sampler);
@@ -95,12 +121,83 @@ namespace NVulkanEngine
 		{
 			m_BindingTable->CreateBindings(context);
 		}
-		CreateGraphicsPipeline(context, m_BindingTable->GetDescriptorSetLayout());
+		CreatePipeline(context, m_BindingTable->GetDescriptorSetLayout());
 	}
 
 	void CPipeline::CreatePipeline(CGraphicsContext* context, VkDescriptorSetLayout descriptorSetLayout)
 	{
-		CreateGraphicsPipeline(context, descriptorSetLayout);
+		if (m_Type == EPipelineType::COMPUTE)
+			CreateComputePipeline(context, descriptorSetLayout);
+		else
+			CreateGraphicsPipeline(context, descriptorSetLayout);
+	}
+
+	void CPipeline::CreateComputePipeline(CGraphicsContext* context, VkDescriptorSetLayout descriptorSetLayout)
+	{
+#if defined(_DEBUG)
+		std::cout << "\n --- Creating Compute pipeline ---" << "\n" << std::endl;
+#endif
+
+		VkShaderModule computeShaderModule = CreateShaderModule(context->GetLogicalDevice(), m_ComputeShaderPath);
+
+		VkPipelineShaderStageCreateInfo computeShaderStageInfo{};
+		computeShaderStageInfo.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		computeShaderStageInfo.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+		computeShaderStageInfo.module = computeShaderModule;
+		computeShaderStageInfo.pName  = "main";
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 1;
+		pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+		pipelineLayoutInfo.pushConstantRangeCount = m_PushConstantsRanges.size != 0 ? 1 : 0;
+		pipelineLayoutInfo.pPushConstantRanges = &m_PushConstantsRanges;
+
+		if (vkCreatePipelineLayout(context->GetLogicalDevice(), &pipelineLayoutInfo, nullptr, &m_PipelineLayout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create pipeline layout!");
+		}
+
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage  = computeShaderStageInfo;
+		pipelineInfo.layout = m_PipelineLayout;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		if (context->IsDescriptorBufferEnabled())
+			pipelineInfo.flags |= VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT; // Shader inputs come from the descriptor buffer
+
+		const auto creationStart = std::chrono::high_resolution_clock::now();
+		if (vkCreateComputePipelines(context->GetLogicalDevice(), context->GetPipelineCache(), 1, &pipelineInfo, nullptr, &m_Pipeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create compute pipeline!");
+		}
+		s_CreationStats.m_TimeMs += std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - creationStart).count();
+		s_CreationStats.m_NumPipelines++;
+
+		PFN_vkSetDebugUtilsObjectNameEXT vkSetDebugUtilsObjectNameEXT = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(context->GetVulkanInstance(), "vkSetDebugUtilsObjectNameEXT");
+		if (vkSetDebugUtilsObjectNameEXT)
+		{
+			const std::string computeShaderBase  = m_ComputeShaderPath.substr(m_ComputeShaderPath.find_last_of("/\\") + 1);
+			const std::string computeShaderName  = "Compute Shader - " + computeShaderBase;
+			const std::string pipelineName       = "Pipeline - " + m_DebugName;
+			const std::string pipelineLayoutName = "Pipeline Layout - " + m_DebugName;
+
+			VkDebugUtilsObjectNameInfoEXT nameInfo = { VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT };
+			nameInfo.objectType   = VK_OBJECT_TYPE_SHADER_MODULE;
+			nameInfo.objectHandle = (uint64_t)computeShaderModule;
+			nameInfo.pObjectName  = computeShaderName.c_str();
+			vkSetDebugUtilsObjectNameEXT(context->GetLogicalDevice(), &nameInfo);
+			nameInfo.objectType   = VK_OBJECT_TYPE_PIPELINE;
+			nameInfo.objectHandle = (uint64_t)m_Pipeline;
+			nameInfo.pObjectName  = pipelineName.c_str();
+			vkSetDebugUtilsObjectNameEXT(context->GetLogicalDevice(), &nameInfo);
+			nameInfo.objectType   = VK_OBJECT_TYPE_PIPELINE_LAYOUT;
+			nameInfo.objectHandle = (uint64_t)m_PipelineLayout;
+			nameInfo.pObjectName  = pipelineLayoutName.c_str();
+			vkSetDebugUtilsObjectNameEXT(context->GetLogicalDevice(), &nameInfo);
+		}
+
+		vkDestroyShaderModule(context->GetLogicalDevice(), computeShaderModule, nullptr);
 	}
 
 	void CPipeline::CreateGraphicsPipeline(CGraphicsContext* context, VkDescriptorSetLayout descriptorSetLayout)
@@ -129,7 +226,7 @@ namespace NVulkanEngine
 		VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 
 		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertexInputInfo.vertexBindingDescriptionCount = 1; // single binding descriptor for now
+		vertexInputInfo.vertexBindingDescriptionCount = m_VertexAttributeDescriptions.empty() ? 0 : 1; // single binding descriptor for now. None when the shader fetches its own vertices
 		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(m_VertexAttributeDescriptions.size());
 		vertexInputInfo.pVertexBindingDescriptions = &m_VertexInputBindingDescription;
 		vertexInputInfo.pVertexAttributeDescriptions = m_VertexAttributeDescriptions.data();
@@ -150,7 +247,7 @@ namespace NVulkanEngine
 		rasterizer.rasterizerDiscardEnable = VK_FALSE;
 		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
 		rasterizer.lineWidth = 1.0f;
-		rasterizer.depthBiasEnable = VK_FALSE;
+		rasterizer.depthBiasEnable = m_DepthBiasEnabled ? VK_TRUE : VK_FALSE;
 
 		switch(m_CullMode)
 		{
@@ -187,13 +284,16 @@ namespace NVulkanEngine
 		colorBlending.blendConstants[2] = 0.0f;
 		colorBlending.blendConstants[3] = 0.0f;
 
-		std::array<VkDynamicState, 3> dynamicStates =
+		std::vector<VkDynamicState> dynamicStates =
 		{
 			VK_DYNAMIC_STATE_VIEWPORT,
 			VK_DYNAMIC_STATE_SCISSOR,
 			VK_DYNAMIC_STATE_LINE_WIDTH
 		};
 
+		if (m_DepthBiasEnabled)
+			dynamicStates.push_back(VK_DYNAMIC_STATE_DEPTH_BIAS);
+
 		VkPipelineDynamicStateCreateInfo dynamicState{};
 		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
 		dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
@@ -213,9 +313,9 @@ namespace NVulkanEngine
 
 		VkPipelineDepthStencilStateCreateInfo depthStencil{};
 		depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		depthStencil.depthTestEnable = VK_TRUE;
-		depthStencil.depthWriteEnable = VK_TRUE;
-		depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+		depthStencil.depthTestEnable = m_DepthTestEnabled ? VK_TRUE : VK_FALSE;
+		depthStencil.depthWriteEnable = m_DepthWriteEnabled ? VK_TRUE : VK_FALSE;
+		depthStencil.depthCompareOp = m_DepthCompareOp;
 		depthStencil.depthBoundsTestEnable = VK_FALSE;
 		depthStencil.minDepthBounds = 0.0f; // Optional
 		depthStencil.maxDepthBounds = 1.0f; // Optional
@@ -242,15 +342,20 @@ namespace NVulkanEngine
 		pipelineInfo.pDynamicState = &dynamicState;
 		pipelineInfo.pDepthStencilState = &depthStencil;
 		pipelineInfo.layout = m_PipelineLayout;
+		if (context->IsDescriptorBufferEnabled())
+			pipelineInfo.flags |= VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT; // Shader inputs come from the descriptor buffer
 		pipelineInfo.renderPass = VK_NULL_HANDLE;  // Don't need this since we are using dynamic rendering :)
 		pipelineInfo.pNext = &renderingCreateInfo; // Set this instead!
 		pipelineInfo.subpass = 0;
 		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-		if (vkCreateGraphicsPipelines(context->GetLogicalDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_Pipeline) != VK_SUCCESS)
+		const auto creationStart = std::chrono::high_resolution_clock::now();
+		if (vkCreateGraphicsPipelines(context->GetLogicalDevice(), context->GetPipelineCache(), 1, &pipelineInfo, nullptr, &m_Pipeline) != VK_SUCCESS)
 		{
 			throw std::runtime_error("failed to create graphics pipeline!");
 		}
+		s_CreationStats.m_TimeMs += std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - creationStart).count();
+		s_CreationStats.m_NumPipelines++;
 
 		PFN_vkSetDebugUtilsObjectNameEXT vkSetDebugUtilsObjectNameEXT = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(context->GetVulkanInstance(), "vkSetDebugUtilsObjectNameEXT");
 		if (vkSetDebugUtilsObjectNameEXT)
@@ -288,13 +393,13 @@ namespace NVulkanEngine
 	void CPipeline::BindPipeline(CGraphicsContext* context, VkCommandBuffer commandBuffer)
 	{
 		if (m_BindingTable->HasResourcesToBind())
-			m_BindingTable->BindTable(context, commandBuffer, m_PipelineLayout);
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_Pipeline);
+			m_BindingTable->BindTable(context, commandBuffer, m_PipelineLayout, GetBindPoint());
+		vkCmdBindPipeline(commandBuffer, GetBindPoint(), m_Pipeline);
 	}
 
 	void CPipeline::BindPipeline(VkCommandBuffer commandBuffer)
 	{
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_Pipeline);
+		vkCmdBindPipeline(commandBuffer, GetBindPoint(), m_Pipeline);
 	}
 
 	void CPipeline::PushConstants(VkCommandBuffer commandBuffer, void* data)
@@ -15,12 +15,18 @@
 enum class EPipelineType
 {
 	GRAPHICS = 0,
-	COMPUTE = 1, // Not implemented yet
+	COMPUTE = 1,
 	COUNT = 2,
 };
 
 namespace NVulkanEngine
 {
+	struct SPipelineCreationStats
+	{
+		float    m_TimeMs       = 0.0f;
+		uint32_t m_NumPipelines = 0;
+	};
+
 	class CPipeline
 	{
 	public:
@@ -32,6 +38,7 @@ namespace NVulkanEngine
 		// Shaders
 		void SetVertexShader(const std::string& vertexShaderPath);
 		void SetFragmentShader(const std::string& fragmentShaderPath);
+		void SetComputeShader(const std::string& computeShaderPath);
 
 		// Vertex info
 		void SetVertexInput(uint32_t stride, VkVertexInputRate vertexInputRate);
@@ -40,6 +47,12 @@ namespace NVulkanEngine
 		// Pipeline states
 		void SetPrimitiveTopology(VkPrimitiveTopology primitiveTopology);
 		void SetCullingMode(VkCullModeFlagBits cullMode);
+
+		// Depth bias factors are dynamic state. Set them with vkCmdSetDepthBias after binding the pipeline
+		void SetDepthBiasEnabled(bool depthBiasEnabled);
+
+		// Depth test and write with VK_COMPARE_OP_LESS by default
+		void SetDepthState(bool depthTestEnabled, bool depthWriteEnabled, VkCompareOp depthCompareOp);
 	
 		// Shader inputs
 		void AddSampledImageBinding(uint32_t bindingSlot, VkShaderStageFlagBits shaderStage, VkImageView imageView, VkFormat format, VkSampler sampler);
@@ -54,16 +67,24 @@ namespace NVulkanEngine
 		void CreatePipeline(CGraphicsContext* context, VkDescriptorSetLayout descriptorSetLayout);
 
 		VkPipelineLayout GetPipelineLayout() { return m_PipelineLayout; };
+		VkPipelineBindPoint GetBindPoint() { return m_Type == EPipelineType::COMPUTE ? VK_PIPELINE_BIND_POINT_COMPUTE : VK_PIPELINE_BIND_POINT_GRAPHICS; };
 
 		void BindPipeline(CGraphicsContext* context, VkCommandBuffer commandBuffer);
 		void BindPipeline(VkCommandBuffer commandBuffer);
 		void PushConstants(VkCommandBuffer, void* pushConstantData);
 
 		void Cleanup(CGraphicsContext* context);
+
+		// Time spent creating pipelines since the last call. See CPipelineManager::ReportCreationTime()
+		static SPipelineCreationStats ConsumeCreationStats();
+
 	private:
 		EPipelineType m_Type = EPipelineType::COUNT;
 
+		static SPipelineCreationStats s_CreationStats;
+
 		void CreateGraphicsPipeline(CGraphicsContext* context, VkDescriptorSetLayout descriptorSetLayout);
+		void CreateComputePipeline(CGraphicsContext* context, VkDescriptorSetLayout descriptorSetLayout);
 
 		VkVertexInputBindingDescription m_VertexInputBindingDescription = {};
 		std::vector<VkVertexInputAttributeDescription> m_VertexAttributeDescriptions    = {};
@@ -77,6 +98,10 @@ namespace NVulkanEngine
 		std::vector<VkFormat> m_ColorAttachmentFormats = {};
 
 		VkCullModeFlagBits    m_CullMode               = VK_CULL_MODE_BACK_BIT;
+		bool                  m_DepthBiasEnabled       = false;
+		bool                  m_DepthTestEnabled       = true;
+		bool                  m_DepthWriteEnabled      = true;
+		VkCompareOp           m_DepthCompareOp         = VK_COMPARE_OP_LESS;
 
 		VkPushConstantRange   m_PushConstantsRanges    = {};
 
@@ -0,0 +1,660 @@
+#include "TerrainTileCache.hpp"
+
+#include <stbi/stb_image.h>
+
+#include <algorithm>
+#include <bit>
+#include <filesystem>
+
+#define TERRAIN_TILE_FILE_MAGIC   0x454C4954 // "TILE"
+#define TERRAIN_TILE_FILE_VERSION 1
+
+#define TERRAIN_TILE_NORMALS_GROUP_SIZE 8 // local_size_x and local_size_y in terrainnormals.comp
+
+namespace NVulkanEngine
+{
+	struct STerrainTileNormalsConstants
+	{
+		glm::ivec2 m_SlotOrigin   = glm::ivec2(0, 0);
+		float      m_HeightScale  = 0.0f;
+		float      m_TexelSpacing = 0.0f; // World distance between texels of the slot's mip
+	};
+
+	glm::uvec2 CTerrainTileCache::GetNumPages(uint32_t mip)
+	{
+		const uint32_t mipWidth  = std::max(1u, m_Header.m_Width  >> mip);
+		const uint32_t mipHeight = std::max(1u, m_Header.m_Height >> mip);
+
+		return glm::uvec2((mipWidth + m_Header.m_PageSize - 1) / m_Header.m_PageSize, (mipHeight + m_Header.m_PageSize - 1) / m_Header.m_PageSize);
+	}
+
+	void CTerrainTileCache::BakeTileFile(const std::string& heightMapPath, const std::string& tileFilePath, uint32_t boundsCellSize)
+	{
+		// Only time the whole heightmap is in memory. Shipping the tile file without the heightmap skips this entirely
+		int heightMapWidth = 0, heightMapHeight = 0, heightMapChannels = 0;
+		stbi_uc* pixelData = stbi_load(heightMapPath.c_str(), &heightMapWidth, &heightMapHeight, &heightMapChannels, STBI_grey);
+
+		if (!pixelData)
+		{
+			throw std::runtime_error("failed to load terrain heightmap image!");
+		}
+
+		m_Header = {};
+		m_Header.m_Magic          = TERRAIN_TILE_FILE_MAGIC;
+		m_Header.m_Version        = TERRAIN_TILE_FILE_VERSION;
+		m_Header.m_Width          = (uint32_t)heightMapWidth;
+		m_Header.m_Height         = (uint32_t)heightMapHeight;
+		m_Header.m_PageSize       = TERRAIN_TILE_PAGE_SIZE;
+		m_Header.m_PageBorder     = TERRAIN_TILE_PAGE_BORDER;
+		m_Header.m_BoundsCellSize = boundsCellSize;
+
+		// Mips down to the first one that fits in a single page
+		m_Header.m_NumMips = 1;
+		while (GetNumPages(m_Header.m_NumMips - 1) != glm::uvec2(1, 1))
+		{
+			m_Header.m_NumMips++;
+		}
+
+		std::vector<std::vector<uint8_t>> mipData(m_Header.m_NumMips);
+		mipData[0].assign(pixelData, pixelData + (size_t)m_Header.m_Width * m_Header.m_Height);
+		stbi_image_free(pixelData);
+
+		// 2x2 box filter, same as the blit the heightmap mips used to be generated with
+		for (uint32_t mip = 1; mip < m_Header.m_NumMips; mip++)
+		{
+			const uint32_t srcWidth  = std::max(1u, m_Header.m_Width  >> (mip - 1));
+			const uint32_t srcHeight = std::max(1u, m_Header.m_Height >> (mip - 1));
+			const uint32_t dstWidth  = std::max(1u, m_Header.m_Width  >> mip);
+			const uint32_t dstHeight = std::max(1u, m_Header.m_Height >> mip);
+
+			const std::vector<uint8_t>& srcData = mipData[mip - 1];
+			std::vector<uint8_t>&       dstData = mipData[mip];
+			dstData.resize((size_t)dstWidth * dstHeight);
+
+			for (uint32_t y = 0; y < dstHeight; y++)
+			{
+				for (uint32_t x = 0; x < dstWidth; x++)
+				{
+					const uint32_t x0 = std::min(x * 2, srcWidth - 1), x1 = std::min(x * 2 + 1, srcWidth - 1);
+					const uint32_t y0 = std::min(y * 2, srcHeight - 1), y1 = std::min(y * 2 + 1, srcHeight - 1);
+
+					const uint32_t sum = srcData[x0 + y0 * srcWidth] + srcData[x1 + y0 * srcWidth] + srcData[x0 + y1 * srcWidth] + srcData[x1 + y1 * srcWidth];
+					dstData[x + y * dstWidth] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+
+		// Min and max height per cell. Cells share their edge texels with their neighbours
+		const uint32_t numQuadsX = std::max(1u, m_Header.m_Width  - 1);
+		const uint32_t numQuadsY = std::max(1u, m_Header.m_Height - 1);
+		const glm::uvec2 numBoundsCells = glm::uvec2((numQuadsX + boundsCellSize - 1) / boundsCellSize, (numQuadsY + boundsCellSize - 1) / boundsCellSize);
+
+		std::vector<uint8_t> heightBounds((size_t)numBoundsCells.x * numBoundsCells.y * 2);
+		for (uint32_t cellY = 0; cellY < numBoundsCells.y; cellY++)
+		{
+			for (uint32_t cellX = 0; cellX < numBoundsCells.x; cellX++)
+			{
+				const uint32_t startX = cellX * boundsCellSize;
+				const uint32_t startY = cellY * boundsCellSize;
+				const uint32_t endX   = std::min(startX + boundsCellSize, m_Header.m_Width  - 1);
+				const uint32_t endY   = std::min(startY + boundsCellSize, m_Header.m_Height - 1);
+
+				uint8_t minHeight = 255, maxHeight = 0;
+				for (uint32_t y = startY; y <= endY; y++)
+				{
+					for (uint32_t x = startX; x <= endX; x++)
+					{
+						minHeight = std::min(minHeight, mipData[0][x + y * m_Header.m_Width]);
+						maxHeight = std::max(maxHeight, mipData[0][x + y * m_Header.m_Width]);
+					}
+				}
+				heightBounds[(cellX + cellY * numBoundsCells.x) * 2 + 0] = minHeight;
+				heightBounds[(cellX + cellY * numBoundsCells.x) * 2 + 1] = maxHeight;
+			}
+		}
+
+		std::ofstream tileFile(tileFilePath, std::ios::binary | std::ios::trunc);
+		if (!tileFile.is_open())
+		{
+			throw std::runtime_error("failed to create terrain tile file!");
+		}
+
+		tileFile.write((const char*)&m_Header, sizeof(STerrainTileFileHeader));
+		tileFile.write((const char*)heightBounds.data(), heightBounds.size());
+
+		// Pages in mip, row, column order. Border texels are clamped at the edges of the heightmap
+		std::vector<uint8_t> pageData((size_t)TERRAIN_TILE_SLOT_SIZE * TERRAIN_TILE_SLOT_SIZE);
+		for (uint32_t mip = 0; mip < m_Header.m_NumMips; mip++)
+		{
+			const int32_t    mipWidth  = (int32_t)std::max(1u, m_Header.m_Width  >> mip);
+			const int32_t    mipHeight = (int32_t)std::max(1u, m_Header.m_Height >> mip);
+			const glm::uvec2 numPages  = GetNumPages(mip);
+
+			for (uint32_t pageY = 0; pageY < numPages.y; pageY++)
+			{
+				for (uint32_t pageX = 0; pageX < numPages.x; pageX++)
+				{
+					for (int32_t y = 0; y < TERRAIN_TILE_SLOT_SIZE; y++)
+					{
+						for (int32_t x = 0; x < TERRAIN_TILE_SLOT_SIZE; x++)
+						{
+							const int32_t srcX = std::clamp((int32_t)(pageX * TERRAIN_TILE_PAGE_SIZE) - TERRAIN_TILE_PAGE_BORDER + x, 0, mipWidth  - 1);
+							const int32_t srcY = std::clamp((int32_t)(pageY * TERRAIN_TILE_PAGE_SIZE) - TERRAIN_TILE_PAGE_BORDER + y, 0, mipHeight - 1);
+							pageData[x + y * TERRAIN_TILE_SLOT_SIZE] = mipData[mip][srcX + srcY * mipWidth];
+						}
+					}
+					tileFile.write((const char*)pageData.data(), pageData.size());
+				}
+			}
+		}
+	}
+
+	bool CTerrainTileCache::ReadTileFileHeader(const std::string& tileFilePath, uint32_t boundsCellSize)
+	{
+		m_TileFile.close();
+		m_TileFile.clear();
+		m_TileFile.open(tileFilePath, std::ios::binary);
+		if (!m_TileFile.is_open())
+			return false;
+
+		m_TileFile.read((char*)&m_Header, sizeof(STerrainTileFileHeader));
+
+		// Rebake if any of the layout the cache expects has changed
+		if (!m_TileFile ||
+			m_Header.m_Magic          != TERRAIN_TILE_FILE_MAGIC   ||
+			m_Header.m_Version        != TERRAIN_TILE_FILE_VERSION ||
+			m_Header.m_PageSize       != TERRAIN_TILE_PAGE_SIZE    ||
+			m_Header.m_PageBorder     != TERRAIN_TILE_PAGE_BORDER  ||
+			m_Header.m_BoundsCellSize != boundsCellSize)
+		{
+			m_TileFile.close();
+			return false;
+		}
+
+		const uint32_t numQuadsX = std::max(1u, m_Header.m_Width  - 1);
+		const uint32_t numQuadsY = std::max(1u, m_Header.m_Height - 1);
+		m_NumBoundsCells = glm::uvec2((numQuadsX + boundsCellSize - 1) / boundsCellSize, (numQuadsY + boundsCellSize - 1) / boundsCellSize);
+
+		std::vector<uint8_t> heightBounds((size_t)m_NumBoundsCells.x * m_NumBoundsCells.y * 2);
+		m_TileFile.read((char*)heightBounds.data(), heightBounds.size());
+
+		m_HeightBounds.resize((size_t)m_NumBoundsCells.x * m_NumBoundsCells.y);
+		for (size_t i = 0; i < m_HeightBounds.size(); i++)
+		{
+			m_HeightBounds[i] = glm::vec2(heightBounds[i * 2 + 0], heightBounds[i * 2 + 1]) / 255.0f;
+		}
+
+		m_PageBytes      = (size_t)TERRAIN_TILE_SLOT_SIZE * TERRAIN_TILE_SLOT_SIZE;
+		m_PageDataOffset = sizeof(STerrainTileFileHeader) + heightBounds.size();
+
+		m_MipFirstPage.resize(m_Header.m_NumMips);
+		uint64_t numPages = 0;
+		for (uint32_t mip = 0; mip < m_Header.m_NumMips; mip++)
+		{
+			m_MipFirstPage[mip] = numPages;
+			numPages += (uint64_t)GetNumPages(mip).x * GetNumPages(mip).y;
+		}
+
+		return (bool)m_TileFile;
+	}
+
+	void CTerrainTileCache::Init(CGraphicsContext* context, const std::string& heightMapPath, uint32_t boundsCellSize)
+	{
+		const std::string tileFilePath = heightMapPath.substr(0, heightMapPath.find_last_of('.')) + ".tiles";
+
+		bool needsBake = !std::filesystem::exists(tileFilePath);
+		if (!needsBake && std::filesystem::exists(heightMapPath))
+		{
+			needsBake = std::filesystem::last_write_time(heightMapPath) > std::filesystem::last_write_time(tileFilePath);
+		}
+
+		if (needsBake || !ReadTileFileHeader(tileFilePath, boundsCellSize))
+		{
+			BakeTileFile(heightMapPath, tileFilePath, boundsCellSize);
+			if (!ReadTileFileHeader(tileFilePath, boundsCellSize))
+			{
+				throw std::runtime_error("failed to read terrain tile file!");
+			}
+		}
+
+		// Page cache
+		m_CacheImage = CreateImage(
+			context,
+			TERRAIN_TILE_CACHE_SLOTS * TERRAIN_TILE_SLOT_SIZE,
+			TERRAIN_TILE_CACHE_SLOTS * TERRAIN_TILE_SLOT_SIZE,
+			1,
+			VK_SAMPLE_COUNT_1_BIT,
+			s_CacheFormat,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			m_CacheImageMemory);
+		m_CacheImageView = CreateImageView(context, m_CacheImage, s_CacheFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+		// Normals for every cache texel. Generated on the GPU from the heights whenever a page is streamed in
+		m_NormalCacheImage = CreateImage(
+			context,
+			TERRAIN_TILE_CACHE_SLOTS * TERRAIN_TILE_SLOT_SIZE,
+			TERRAIN_TILE_CACHE_SLOTS * TERRAIN_TILE_SLOT_SIZE,
+			1,
+			VK_SAMPLE_COUNT_1_BIT,
+			s_NormalCacheFormat,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			m_NormalCacheImageMemory);
+		m_NormalCacheImageView = CreateImageView(context, m_NormalCacheImage, s_NormalCacheFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+		m_NormalsTable = new CBindingTable();
+		m_NormalsTable->AddSampledImageBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, m_CacheImageView, s_CacheFormat, context->GetLinearClampSampler());
+		m_NormalsTable->AddStorageImageBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, m_NormalCacheImageView);
+		m_NormalsTable->CreateBindings(context);
+
+		m_NormalsPipeline = new CPipeline(EPipelineType::COMPUTE);
+		m_NormalsPipeline->SetDebugName("Terrain Tile Normals");
+		m_NormalsPipeline->SetComputeShader("shaders/terrainnormals.comp.spv");
+		m_NormalsPipeline->AddPushConstantSlot(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(STerrainTileNormalsConstants), 0);
+		m_NormalsPipeline->CreatePipeline(context, m_NormalsTable->GetDescriptorSetLayout());
+
+		m_Slots.resize(TERRAIN_TILE_CACHE_SLOTS * TERRAIN_TILE_CACHE_SLOTS);
+
+		// Indirection
+		const glm::uvec2 numPages = GetNumPages(0);
+		m_IndirectionSize = glm::uvec2(std::bit_ceil(numPages.x), std::bit_ceil(numPages.y));
+
+		m_Indirection.resize(m_Header.m_NumMips);
+		m_IndirectionBytes = 0;
+		for (uint32_t mip = 0; mip < m_Header.m_NumMips; mip++)
+		{
+			const glm::uvec2 mipSize = glm::max(m_IndirectionSize >> mip, glm::uvec2(1));
+			if (glm::any(glm::lessThan(mipSize, GetNumPages(mip))))
+			{
+				throw std::runtime_error("failed to fit terrain pages in the indirection texture!");
+			}
+
+			m_Indirection[mip].resize((size_t)mipSize.x * mipSize.y);
+			m_IndirectionBytes += m_Indirection[mip].size() * sizeof(uint32_t);
+		}
+
+		m_IndirectionImage = CreateImage(
+			context,
+			m_IndirectionSize.x,
+			m_IndirectionSize.y,
+			m_Header.m_NumMips,
+			VK_SAMPLE_COUNT_1_BIT,
+			s_IndirectionFormat,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			m_IndirectionImageMemory);
+		m_IndirectionImageView = CreateImageView(context, m_IndirectionImage, s_IndirectionFormat, VK_IMAGE_ASPECT_COLOR_BIT, m_Header.m_NumMips);
+
+		// Integer formats can't be filtered. Only ever read with texelFetch anyway
+		m_IndirectionSampler = CreateSampler(
+			context,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			VK_FILTER_NEAREST,
+			VK_FILTER_NEAREST,
+			0.0f,
+			0.0f,
+			(float)m_Header.m_NumMips);
+
+		m_StagingFrameSize = (VkDeviceSize)(TERRAIN_TILE_UPLOADS * m_PageBytes + m_IndirectionBytes);
+		m_StagingBuffer = CreateBuffer(
+			context,
+			m_StagingBufferMemory,
+			m_StagingFrameSize * g_MaxFramesInFlight,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		// Requested every frame so they are streamed in first and never evicted
+		m_PinnedPages = { GetPageKey(m_Header.m_NumMips - 1, 0, 0) };
+	}
+
+	void CTerrainTileCache::RequestTexels(uint32_t mip, glm::uvec2 texelMin, glm::uvec2 texelMax)
+	{
+		mip = std::min(mip, m_Header.m_NumMips - 1);
+
+		// One extra texel around the rectangle for the normals
+		const glm::uvec2 mipMin   = glm::max(texelMin >> mip, glm::uvec2(1)) - 1u;
+		const glm::uvec2 mipMax   = (texelMax >> mip) + 1u;
+		const glm::uvec2 numPages = GetNumPages(mip);
+
+		const glm::uvec2 pageMin = glm::min(mipMin / (uint32_t)TERRAIN_TILE_PAGE_SIZE, numPages - 1u);
+		const glm::uvec2 pageMax = glm::min(mipMax / (uint32_t)TERRAIN_TILE_PAGE_SIZE, numPages - 1u);
+
+		for (uint32_t pageY = pageMin.y; pageY <= pageMax.y; pageY++)
+		{
+			for (uint32_t pageX = pageMin.x; pageX <= pageMax.x; pageX++)
+			{
+				m_RequestedPages.push_back(GetPageKey(mip, pageX, pageY));
+			}
+		}
+	}
+
+	uint32_t CTerrainTileCache::FindFreeSlot()
+	{
+		uint32_t leastRecentlyUsedSlot = UINT32_MAX;
+		for (uint32_t i = 0; i < m_Slots.size(); i++)
+		{
+			const STerrainTileSlot& slot = m_Slots[i];
+			if (slot.m_PageKey == UINT32_MAX)
+				return i;
+
+			// Pages used this frame can't be evicted
+			if (slot.m_IsPinned || slot.m_LastUsedFrame == m_FrameCounter)
+				continue;
+
+			if (leastRecentlyUsedSlot == UINT32_MAX || slot.m_LastUsedFrame < m_Slots[leastRecentlyUsedSlot].m_LastUsedFrame)
+				leastRecentlyUsedSlot = i;
+		}
+
+		return leastRecentlyUsedSlot;
+	}
+
+	void CTerrainTileCache::UpdateIndirection()
+	{
+		// Coarsest first so missing pages can point at their parent's entry
+		for (int32_t mip = (int32_t)m_Header.m_NumMips - 1; mip >= 0; mip--)
+		{
+			const glm::uvec2 mipSize  = glm::max(m_IndirectionSize >> (uint32_t)mip, glm::uvec2(1));
+			const glm::uvec2 numPages = GetNumPages(mip);
+
+			for (uint32_t y = 0; y < mipSize.y; y++)
+			{
+				for (uint32_t x = 0; x < mipSize.x; x++)
+				{
+					uint32_t& entry = m_Indirection[mip][x + y * mipSize.x];
+
+					auto residentPage = (x < numPages.x && y < numPages.y) ? m_ResidentPages.find(GetPageKey(mip, x, y)) : m_ResidentPages.end();
+					if (residentPage != m_ResidentPages.end())
+					{
+						const uint32_t slotX = residentPage->second % TERRAIN_TILE_CACHE_SLOTS;
+						const uint32_t slotY = residentPage->second / TERRAIN_TILE_CACHE_SLOTS;
+						entry = slotX | (slotY << 8) | ((uint32_t)mip << 16) | (0xFFu << 24);
+					}
+					else if (mip + 1 < (int32_t)m_Header.m_NumMips)
+					{
+						const glm::uvec2 parentSize = glm::max(m_IndirectionSize >> (uint32_t)(mip + 1), glm::uvec2(1));
+						entry = m_Indirection[mip + 1][std::min(x / 2, parentSize.x - 1) + std::min(y / 2, parentSize.y - 1) * parentSize.x];
+					}
+					else
+					{
+						entry = 0;
+					}
+				}
+			}
+		}
+	}
+
+	void CTerrainTileCache::Update(CGraphicsContext* context, VkCommandBuffer commandBuffer)
+	{
+		m_FrameCounter++;
+
+		m_RequestedPages.insert(m_RequestedPages.end(), m_PinnedPages.begin(), m_PinnedPages.end());
+		std::sort(m_RequestedPages.begin(), m_RequestedPages.end());
+		m_RequestedPages.erase(std::unique(m_RequestedPages.begin(), m_RequestedPages.end()), m_RequestedPages.end());
+
+		std::vector<uint32_t> missingPages;
+		for (uint32_t pageKey : m_RequestedPages)
+		{
+			auto residentPage = m_ResidentPages.find(pageKey);
+			if (residentPage != m_ResidentPages.end())
+				m_Slots[residentPage->second].m_LastUsedFrame = m_FrameCounter;
+			else
+				missingPages.push_back(pageKey);
+		}
+		m_RequestedPages.clear();
+
+		// Coarse pages first. They cover more of the terrain and everything finer falls back to them
+		std::stable_sort(missingPages.begin(), missingPages.end(), [](uint32_t a, uint32_t b) { return (a >> 24) > (b >> 24); });
+
+		std::vector<uint32_t> normalSlots = UploadPages(context, commandBuffer, missingPages);
+
+		// Normals depend on the terrain scale so every resident page needs new ones when it changes
+		if (m_NormalsDirty)
+		{
+			normalSlots.clear();
+			for (const auto& [pageKey, slotIndex] : m_ResidentPages)
+			{
+				normalSlots.push_back(slotIndex);
+			}
+			m_NormalsDirty = false;
+		}
+
+		if (!normalSlots.empty())
+		{
+			GenerateNormals(context, commandBuffer, normalSlots);
+		}
+	}
+
+	std::vector<uint32_t> CTerrainTileCache::UploadPages(CGraphicsContext* context, VkCommandBuffer commandBuffer, const std::vector<uint32_t>& missingPages)
+	{
+		m_NumPendingPages = (uint32_t)missingPages.size();
+		if (missingPages.empty())
+			return {};
+
+		const VkDeviceSize stagingOffset = m_StagingFrameSize * context->GetFrameIndex();
+
+		uint8_t* stagingData;
+		vkMapMemory(context->GetLogicalDevice(), m_StagingBufferMemory, stagingOffset, m_StagingFrameSize, 0, (void**)&stagingData);
+
+		std::vector<VkBufferImageCopy> pageCopies;
+		std::vector<uint32_t>          uploadedSlots;
+		for (uint32_t pageKey : missingPages)
+		{
+			if (pageCopies.size() >= TERRAIN_TILE_UPLOADS)
+				break;
+
+			const uint32_t slotIndex = FindFreeSlot();
+			if (slotIndex == UINT32_MAX)
+				break;
+
+			STerrainTileSlot& slot = m_Slots[slotIndex];
+			if (slot.m_PageKey != UINT32_MAX)
+				m_ResidentPages.erase(slot.m_PageKey);
+
+			const uint32_t mip   = pageKey >> 24;
+			const uint32_t pageY = (pageKey >> 12) & 0xFFF;
+			const uint32_t pageX = pageKey & 0xFFF;
+
+			const uint64_t pageIndex = m_MipFirstPage[mip] + (uint64_t)pageY * GetNumPages(mip).x + pageX;
+			m_TileFile.seekg((std::streamoff)(m_PageDataOffset + pageIndex * m_PageBytes));
+			m_TileFile.read((char*)stagingData + pageCopies.size() * m_PageBytes, m_PageBytes);
+
+			if (!m_TileFile)
+			{
+				throw std::runtime_error("failed to read terrain tile!");
+			}
+
+			slot.m_PageKey       = pageKey;
+			slot.m_LastUsedFrame = m_FrameCounter;
+			slot.m_IsPinned      = std::find(m_PinnedPages.begin(), m_PinnedPages.end(), pageKey) != m_PinnedPages.end();
+			m_ResidentPages[pageKey] = slotIndex;
+
+			VkBufferImageCopy pageCopy{};
+			pageCopy.bufferOffset                    = stagingOffset + pageCopies.size() * m_PageBytes;
+			pageCopy.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+			pageCopy.imageSubresource.mipLevel       = 0;
+			pageCopy.imageSubresource.baseArrayLayer = 0;
+			pageCopy.imageSubresource.layerCount     = 1;
+			pageCopy.imageOffset                     = { (int32_t)((slotIndex % TERRAIN_TILE_CACHE_SLOTS) * TERRAIN_TILE_SLOT_SIZE), (int32_t)((slotIndex / TERRAIN_TILE_CACHE_SLOTS) * TERRAIN_TILE_SLOT_SIZE), 0 };
+			pageCopy.imageExtent                     = { TERRAIN_TILE_SLOT_SIZE, TERRAIN_TILE_SLOT_SIZE, 1 };
+			pageCopies.push_back(pageCopy);
+			uploadedSlots.push_back(slotIndex);
+		}
+
+		m_NumPendingPages = (uint32_t)(missingPages.size() - pageCopies.size());
+
+		if (pageCopies.empty())
+		{
+			vkUnmapMemory(context->GetLogicalDevice(), m_StagingBufferMemory);
+			return {};
+		}
+
+		// Whole indirection texture goes up with the pages. It is tiny compared to a single page
+		UpdateIndirection();
+
+		std::vector<VkBufferImageCopy> indirectionCopies(m_Header.m_NumMips);
+		size_t indirectionOffset = TERRAIN_TILE_UPLOADS * m_PageBytes;
+		for (uint32_t mip = 0; mip < m_Header.m_NumMips; mip++)
+		{
+			const glm::uvec2 mipSize = glm::max(m_IndirectionSize >> mip, glm::uvec2(1));
+			memcpy(stagingData + indirectionOffset, m_Indirection[mip].data(), m_Indirection[mip].size() * sizeof(uint32_t));
+
+			VkBufferImageCopy& indirectionCopy = indirectionCopies[mip];
+			indirectionCopy.bufferOffset                    = stagingOffset + indirectionOffset;
+			indirectionCopy.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+			indirectionCopy.imageSubresource.mipLevel       = mip;
+			indirectionCopy.imageSubresource.baseArrayLayer = 0;
+			indirectionCopy.imageSubresource.layerCount     = 1;
+			indirectionCopy.imageOffset                     = { 0, 0, 0 };
+			indirectionCopy.imageExtent                     = { mipSize.x, mipSize.y, 1 };
+
+			indirectionOffset += m_Indirection[mip].size() * sizeof(uint32_t);
+		}
+
+		vkUnmapMemory(context->GetLogicalDevice(), m_StagingBufferMemory);
+
+		const float streamingMarkerColor[4] = { 0.6f, 0.5f, 0.3f, 1.0f };
+		BeginMarker(context->GetVulkanInstance(), commandBuffer, "Terrain Tile Streaming", streamingMarkerColor);
+
+		// Previous frames sampling the cache have to be done before slots are overwritten. Resident pages have to survive the transition
+		VkImageMemoryBarrier barriers[2] = {};
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			barriers[i].sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barriers[i].oldLayout                       = m_CurrentLayout;
+			barriers[i].newLayout                       = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[i].srcAccessMask                   = m_CurrentLayout == VK_IMAGE_LAYOUT_UNDEFINED ? 0 : VK_ACCESS_SHADER_READ_BIT;
+			barriers[i].dstAccessMask                   = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[i].srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+			barriers[i].dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+			barriers[i].subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+			barriers[i].subresourceRange.baseMipLevel   = 0;
+			barriers[i].subresourceRange.baseArrayLayer = 0;
+			barriers[i].subresourceRange.layerCount     = 1;
+		}
+		barriers[0].image                         = m_CacheImage;
+		barriers[0].subresourceRange.levelCount   = 1;
+		barriers[1].image                         = m_IndirectionImage;
+		barriers[1].subresourceRange.levelCount   = m_Header.m_NumMips;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+		vkCmdCopyBufferToImage(commandBuffer, m_StagingBuffer, m_CacheImage,       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)pageCopies.size(),        pageCopies.data());
+		vkCmdCopyBufferToImage(commandBuffer, m_StagingBuffer, m_IndirectionImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)indirectionCopies.size(), indirectionCopies.data());
+
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			barriers[i].oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[i].newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+		m_CurrentLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		EndMarker(context->GetVulkanInstance(), commandBuffer);
+
+		return uploadedSlots;
+	}
+
+	void CTerrainTileCache::SetNormalScale(float heightScale, float texelSize)
+	{
+		m_NormalsDirty |= heightScale != m_NormalHeightScale || texelSize != m_NormalTexelSize;
+
+		m_NormalHeightScale = heightScale;
+		m_NormalTexelSize   = texelSize;
+	}
+
+	void CTerrainTileCache::GenerateNormals(CGraphicsContext* context, VkCommandBuffer commandBuffer, const std::vector<uint32_t>& slotIndices)
+	{
+		const float normalsMarkerColor[4] = { 0.5f, 0.6f, 0.3f, 1.0f };
+		BeginMarker(context->GetVulkanInstance(), commandBuffer, "Terrain Tile Normals", normalsMarkerColor);
+
+		// Slots that are not regenerated keep their normals so the old contents have to survive
+		VkImageMemoryBarrier barrier{};
+		barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout                       = m_NormalCacheLayout;
+		barrier.newLayout                       = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcAccessMask                   = m_NormalCacheLayout == VK_IMAGE_LAYOUT_UNDEFINED ? 0 : VK_ACCESS_SHADER_READ_BIT;
+		barrier.dstAccessMask                   = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image                           = m_NormalCacheImage;
+		barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel   = 0;
+		barrier.subresourceRange.levelCount     = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount     = 1;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		m_NormalsPipeline->BindPipeline(commandBuffer);
+		m_NormalsTable->BindTable(context, commandBuffer, m_NormalsPipeline->GetPipelineLayout(), m_NormalsPipeline->GetBindPoint());
+
+		// One thread per slot texel, borders included
+		const uint32_t numWorkGroups = (TERRAIN_TILE_SLOT_SIZE + TERRAIN_TILE_NORMALS_GROUP_SIZE - 1) / TERRAIN_TILE_NORMALS_GROUP_SIZE;
+		for (uint32_t slotIndex : slotIndices)
+		{
+			const uint32_t mip = m_Slots[slotIndex].m_PageKey >> 24;
+
+			STerrainTileNormalsConstants normalsConstants{};
+			normalsConstants.m_SlotOrigin   = glm::ivec2(slotIndex % TERRAIN_TILE_CACHE_SLOTS, slotIndex / TERRAIN_TILE_CACHE_SLOTS) * TERRAIN_TILE_SLOT_SIZE;
+			normalsConstants.m_HeightScale  = m_NormalHeightScale;
+			normalsConstants.m_TexelSpacing = m_NormalTexelSize * (float)(1u << mip);
+
+			m_NormalsPipeline->PushConstants(commandBuffer, (void*)&normalsConstants);
+			vkCmdDispatch(commandBuffer, numWorkGroups, numWorkGroups, 1);
+		}
+
+		barrier.oldLayout     = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		m_NormalCacheLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		EndMarker(context->GetVulkanInstance(), commandBuffer);
+	}
+
+	void CTerrainTileCache::Cleanup(CGraphicsContext* context)
+	{
+		VkDevice device = context->GetLogicalDevice();
+
+		m_TileFile.close();
+
+		vkDestroyBuffer(device, m_StagingBuffer, nullptr);
+		vkFreeMemory(device, m_StagingBufferMemory, nullptr);
+
+		vkDestroySampler(device, m_IndirectionSampler, nullptr);
+		vkDestroyImageView(device, m_IndirectionImageView, nullptr);
+		vkDestroyImage(device, m_IndirectionImage, nullptr);
+		vkFreeMemory(device, m_IndirectionImageMemory, nullptr);
+
+		vkDestroyImageView(device, m_CacheImageView, nullptr);
+		vkDestroyImage(device, m_CacheImage, nullptr);
+		vkFreeMemory(device, m_CacheImageMemory, nullptr);
+
+		vkDestroyImageView(device, m_NormalCacheImageView, nullptr);
+		vkDestroyImage(device, m_NormalCacheImage, nullptr);
+		vkFreeMemory(device, m_NormalCacheImageMemory, nullptr);
+
+		m_NormalsTable->Cleanup(context);
+		m_NormalsPipeline->Cleanup(context);
+
+		delete m_NormalsTable;
+		delete m_NormalsPipeline;
+
+		m_Slots.clear();
+		m_ResidentPages.clear();
+		m_RequestedPages.clear();
+		m_CurrentLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+		m_NormalCacheLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	}
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <VulkanGraphicsEngineUtils.hpp>
+#include <DrawNodes/Utils/Pipeline.hpp>
+#include <DrawNodes/Utils/BindingTable.hpp>
+
+#include <glm/glm.hpp>
+
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Virtual texture for terrain heightmaps. The heightmap is baked once into a file of mipmapped pages that are streamed into
+	a fixed size page cache as the terrain asks for them. An indirection texture maps every virtual page to its cache slot,
+	or to the closest coarser page that is resident, so the heightmap can be far larger than what fits in memory.
+	Normals for a page are derived from its heights by a compute pass as soon as it is streamed in
+*/
+
+// Must match terrain.vert and terrain.frag
+#define TERRAIN_TILE_PAGE_SIZE    128 // Texels along one side of a page
+#define TERRAIN_TILE_PAGE_BORDER  1   // Texels copied from the neighbours on every side so filtering works across pages
+#define TERRAIN_TILE_CACHE_SLOTS  16  // Slots along one side of the cache
+
+#define TERRAIN_TILE_SLOT_SIZE    (TERRAIN_TILE_PAGE_SIZE + TERRAIN_TILE_PAGE_BORDER * 2)
+#define TERRAIN_TILE_UPLOADS      8   // Max pages streamed in per frame
+
+namespace NVulkanEngine
+{
+	struct STerrainTileFileHeader
+	{
+		uint32_t m_Magic          = 0;
+		uint32_t m_Version        = 0;
+		uint32_t m_Width          = 0;
+		uint32_t m_Height         = 0;
+		uint32_t m_PageSize       = 0;
+		uint32_t m_PageBorder     = 0;
+		uint32_t m_NumMips        = 0;
+		uint32_t m_BoundsCellSize = 0; // Texels along one side of a min max height cell
+	};
+
+	struct STerrainTileSlot
+	{
+		uint32_t m_PageKey       = UINT32_MAX;
+		uint64_t m_LastUsedFrame = 0;
+		bool     m_IsPinned      = false; // Coarsest mip is always resident so every lookup has something to fall back to
+	};
+
+	class CTerrainTileCache
+	{
+	public:
+		CTerrainTileCache() = default;
+		~CTerrainTileCache() = default;
+
+		// Bakes the tile file next to the heightmap if it is missing or out of date and opens it for streaming
+		void Init(CGraphicsContext* context, const std::string& heightMapPath, uint32_t boundsCellSize);
+
+		// Request every page at mip covering the texel rectangle. Mip 0 texels. Requests are consumed by the next Update()
+		void RequestTexels(uint32_t mip, glm::uvec2 texelMin, glm::uvec2 texelMax);
+
+		// Streams in missing pages, generates their normals and updates the indirection texture. Has to be recorded outside of rendering
+		void Update(CGraphicsContext* context, VkCommandBuffer commandBuffer);
+
+		// World scale of the heights. Regenerates the normals of every resident page when changed
+		void SetNormalScale(float heightScale, float texelSize);
+
+		void Cleanup(CGraphicsContext* context);
+
+		uint32_t GetWidth()        { return m_Header.m_Width; };
+		uint32_t GetHeight()       { return m_Header.m_Height; };
+		uint32_t GetNumMips()      { return m_Header.m_NumMips; };
+
+		// Min and max normalized height of every cell. Read from the tile file so the heightmap never has to be loaded
+		const std::vector<glm::vec2>& GetHeightBounds() { return m_HeightBounds; };
+		glm::uvec2                    GetNumBoundsCells() { return m_NumBoundsCells; };
+
+		VkImageView GetCacheImageView()       { return m_CacheImageView; };
+		VkImageView GetNormalCacheImageView() { return m_NormalCacheImageView; };
+		VkImageView GetIndirectionImageView() { return m_IndirectionImageView; };
+		VkSampler   GetIndirectionSampler()   { return m_IndirectionSampler; };
+
+		uint32_t GetNumResidentPages()  { return (uint32_t)m_ResidentPages.size(); };
+		uint32_t GetNumPendingPages()   { return m_NumPendingPages; };
+
+		static constexpr VkFormat s_CacheFormat       = VK_FORMAT_R8_UNORM;
+		static constexpr VkFormat s_NormalCacheFormat = VK_FORMAT_R8G8B8A8_UNORM; // Normal * 0.5 + 0.5
+		static constexpr VkFormat s_IndirectionFormat = VK_FORMAT_R8G8B8A8_UINT; // Slot x, slot y, resident mip
+
+	private:
+		void BakeTileFile(const std::string& heightMapPath, const std::string& tileFilePath, uint32_t boundsCellSize);
+		bool ReadTileFileHeader(const std::string& tileFilePath, uint32_t boundsCellSize);
+
+		glm::uvec2 GetNumPages(uint32_t mip);
+		uint32_t   GetPageKey(uint32_t mip, uint32_t pageX, uint32_t pageY) { return (mip << 24) | (pageY << 12) | pageX; };
+		uint32_t   FindFreeSlot();
+
+		void UpdateIndirection();
+
+		// Returns the slots that got new pages
+		std::vector<uint32_t> UploadPages(CGraphicsContext* context, VkCommandBuffer commandBuffer, const std::vector<uint32_t>& missingPages);
+		void                  GenerateNormals(CGraphicsContext* context, VkCommandBuffer commandBuffer, const std::vector<uint32_t>& slotIndices);
+
+		STerrainTileFileHeader m_Header   = {};
+		std::ifstream          m_TileFile = {};
+
+		std::vector<uint64_t>  m_MipFirstPage = {}; // Index of the first page of every mip in the tile file
+		size_t                 m_PageDataOffset = 0;
+		size_t                 m_PageBytes      = 0;
+
+		std::vector<glm::vec2> m_HeightBounds   = {};
+		glm::uvec2             m_NumBoundsCells = glm::uvec2(0);
+
+		// Physical pages
+		VkImage        m_CacheImage        = VK_NULL_HANDLE;
+		VkDeviceMemory m_CacheImageMemory  = VK_NULL_HANDLE;
+		VkImageView    m_CacheImageView    = VK_NULL_HANDLE;
+
+		// Same layout as the page cache
+		VkImage        m_NormalCacheImage       = VK_NULL_HANDLE;
+		VkDeviceMemory m_NormalCacheImageMemory = VK_NULL_HANDLE;
+		VkImageView    m_NormalCacheImageView   = VK_NULL_HANDLE;
+		VkImageLayout  m_NormalCacheLayout      = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		CBindingTable* m_NormalsTable      = nullptr;
+		CPipeline*     m_NormalsPipeline   = nullptr;
+		float          m_NormalHeightScale = 0.0f;
+		float          m_NormalTexelSize   = 0.0f;
+		bool           m_NormalsDirty      = false;
+
+		// One texel per virtual page, one mip per page mip. Sized to a power of two so every page mip fits in an image mip
+		VkImage        m_IndirectionImage       = VK_NULL_HANDLE;
+		VkDeviceMemory m_IndirectionImageMemory = VK_NULL_HANDLE;
+		VkImageView    m_IndirectionImageView   = VK_NULL_HANDLE;
+		VkSampler      m_IndirectionSampler     = VK_NULL_HANDLE;
+		glm::uvec2     m_IndirectionSize        = glm::uvec2(0);
+
+		std::vector<std::vector<uint32_t>> m_Indirection = {}; // CPU copy of every indirection mip
+		size_t                             m_IndirectionBytes = 0;
+
+		// One staging range per frame in flight. Fits the per frame page uploads and the whole indirection texture
+		VkBuffer       m_StagingBuffer       = VK_NULL_HANDLE;
+		VkDeviceMemory m_StagingBufferMemory = VK_NULL_HANDLE;
+		VkDeviceSize   m_StagingFrameSize    = 0;
+
+		std::vector<STerrainTileSlot>          m_Slots            = {};
+		std::unordered_map<uint32_t, uint32_t> m_ResidentPages    = {}; // Page key to slot
+		std::vector<uint32_t>                  m_RequestedPages   = {};
+		std::vector<uint32_t>                  m_PinnedPages      = {};
+		uint32_t                               m_NumPendingPages  = 0;
+
+		uint64_t       m_FrameCounter   = 0;
+		VkImageLayout  m_CurrentLayout  = VK_IMAGE_LAYOUT_UNDEFINED; // Of both the cache and the indirection
+	};
+}
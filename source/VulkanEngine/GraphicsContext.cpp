@@ -18,6 +18,9 @@ namespace NVulkanEngine
 		VkCommandPool    commandPool,
 		VkQueue          graphicsQueue,
 		VkQueue          presentQueue,
+		VkQueue          computeQueue,
+		uint32_t         graphicsQueueFamily,
+		uint32_t         computeQueueFamily,
 		VkSampler        linearClampSampler,
 		VkSampler        linearRepeatSampler,
 		VkExtent2D       renderResolution)
@@ -30,6 +33,9 @@ namespace NVulkanEngine
 		m_CommandPool         = commandPool;
 		m_GraphicsQueue       = graphicsQueue;
 		m_PresentQueue        = presentQueue;
+		m_ComputeQueue        = computeQueue;
+		m_QueueFamilyIndices[0] = graphicsQueueFamily;
+		m_QueueFamilyIndices[1] = computeQueueFamily;
 		m_LinearClampSampler  = linearClampSampler;
 		m_LinearRepeatSampler = linearRepeatSampler;
 		m_RenderResolution    = renderResolution;
@@ -52,4 +58,24 @@ namespace NVulkanEngine
 	{
 		m_RenderResolution = resolution;
 	}
+
+	void CGraphicsContext::SetAsyncComputeEnabled(bool isEnabled)
+	{
+		m_IsAsyncComputeEnabled = isEnabled && HasAsyncComputeQueue();
+	}
+
+	void CGraphicsContext::SetDescriptorBufferEnabled(bool isEnabled)
+	{
+		m_IsDescriptorBufferEnabled = isEnabled;
+	}
+
+	void CGraphicsContext::SetPipelineCache(VkPipelineCache pipelineCache)
+	{
+		m_PipelineCache = pipelineCache;
+	}
+
+	void CGraphicsContext::SetDescriptorManager(CDescriptorManager* descriptorManager)
+	{
+		m_DescriptorManager = descriptorManager;
+	}
 };
\ No newline at end of file
@@ -8,6 +8,8 @@
 
 namespace NVulkanEngine
 {
+	class CDescriptorManager;
+
 	static uint32_t g_DisplayWidth      = 1920;
 	static uint32_t g_DisplayHeight     = 1080;
 	static const uint16_t g_MaxFramesInFlight = 2;
@@ -28,6 +30,9 @@ namespace NVulkanEngine
 			VkCommandPool    commandPool,
 			VkQueue          graphicsQueue,
 			VkQueue          presentQueue,
+			VkQueue          computeQueue,
+			uint32_t         graphicsQueueFamily,
+			uint32_t         computeQueueFamily,
 			VkSampler        linearClampSampler,
 			VkSampler        linearRepeatSampler,
 			VkExtent2D       renderResolution);
@@ -40,17 +45,32 @@ namespace NVulkanEngine
 		const VkCommandPool    GetCommandPool()         { return m_CommandPool; }
 		const VkQueue          GetGraphicsQueue()       { return m_GraphicsQueue; }
 		const VkQueue          GetPresentQueue()        { return m_PresentQueue; }
+		const VkQueue          GetComputeQueue()        { return m_ComputeQueue; }
+		const uint32_t*        GetQueueFamilyIndices()  { return m_QueueFamilyIndices; }
 		const VkSampler        GetLinearClampSampler()  { return m_LinearClampSampler; }
 		const VkSampler        GetLinearRepeatSampler() { return m_LinearRepeatSampler; }
+		const VkPipelineCache  GetPipelineCache()       { return m_PipelineCache; }
+		CDescriptorManager*    GetDescriptorManager()   { return m_DescriptorManager; }
 		const VkExtent2D       GetRenderResolution()    { return m_RenderResolution; }
 		const float            GetDeltaTime()           { return m_DeltaTime; }
 		const uint32_t         GetFrameIndex()          { return m_FrameIndex; }
 		const uint32_t         GetSwapchainImageIndex() { return m_SwapchainImageIndex; }
 
+		// Async compute needs a compute only queue family. Without one compute work is recorded on the graphics queue
+		const bool             HasAsyncComputeQueue()   { return m_ComputeQueue != VK_NULL_HANDLE; }
+		const bool             IsAsyncComputeEnabled()  { return m_IsAsyncComputeEnabled; }
+
+		// Set once at startup. Pipelines and binding tables use VK_EXT_descriptor_buffer instead of descriptor sets
+		const bool             IsDescriptorBufferEnabled() { return m_IsDescriptorBufferEnabled; }
+
 		void SetDeltaTime(float deltaTime);
 		void SetFrameIndex(uint32_t frameIndex);
 		void SetSwapchainImageIndex(uint32_t imageIndex);
 		void SetRenderResolution(const VkExtent2D resolution);
+		void SetAsyncComputeEnabled(bool isEnabled);
+		void SetDescriptorBufferEnabled(bool isEnabled);
+		void SetPipelineCache(VkPipelineCache pipelineCache);
+		void SetDescriptorManager(CDescriptorManager* descriptorManager);
 
 	private:
 		VkInstance        m_VulkanInstance                 = VK_NULL_HANDLE;
@@ -61,8 +81,14 @@ namespace NVulkanEngine
 		VkCommandPool     m_CommandPool                    = VK_NULL_HANDLE;
 		VkQueue           m_GraphicsQueue                  = VK_NULL_HANDLE;
 		VkQueue           m_PresentQueue                   = VK_NULL_HANDLE;
+		VkQueue           m_ComputeQueue                   = VK_NULL_HANDLE;
+		uint32_t          m_QueueFamilyIndices[2]          = { 0, 0 }; // Graphics and compute
+		bool              m_IsAsyncComputeEnabled          = false;
+		bool              m_IsDescriptorBufferEnabled      = false;
 		VkSampler         m_LinearClampSampler             = VK_NULL_HANDLE;
 		VkSampler         m_LinearRepeatSampler            = VK_NULL_HANDLE;
+		VkPipelineCache   m_PipelineCache                  = VK_NULL_HANDLE; // Owned by CPipelineManager
+		CDescriptorManager* m_DescriptorManager            = nullptr;        // Layouts and pools used by the binding tables
 		VkExtent2D        m_RenderResolution               = { 0,0 };
 		float             m_DeltaTime                      = 0.0f;
 		uint32_t          m_FrameIndex                     = 0;
@@ -0,0 +1,442 @@
+#include "DescriptorManager.hpp"
+
+#include <VulkanGraphicsEngineUtils.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+// Sets in the first pool of each chain. Every pool added after that is twice the size of the one before it
+static const uint32_t g_PersistentSetsPerPool = 64;
+static const uint32_t g_TransientSetsPerPool  = 32;
+
+// Holds every table including the bindless one. Clamped to what the device can address from one binding
+static const VkDeviceSize g_DescriptorBufferSize = 4 * 1024 * 1024;
+
+// Descriptors of each type per set in a pool. Roughly what the binding tables use on average
+static constexpr std::array<std::pair<VkDescriptorType, uint32_t>, 4> g_DescriptorsPerSet =
+{{
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         2 },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         2 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          1 }
+}};
+
+namespace NVulkanEngine
+{
+	void CDescriptorManager::Init(CGraphicsContext* context)
+	{
+		m_PersistentPools.m_SetsPerPool = g_PersistentSetsPerPool;
+		for (uint32_t i = 0; i < g_MaxFramesInFlight; i++)
+		{
+			m_TransientPools[i].m_SetsPerPool = g_TransientSetsPerPool;
+		}
+
+		if (context->IsDescriptorBufferEnabled())
+		{
+			CreateDescriptorBuffer(context);
+		}
+
+		std::cout << "Descriptor backend: " << (UsesDescriptorBuffers() ? "descriptor buffers" : "descriptor sets") << std::endl;
+
+		context->SetDescriptorManager(this);
+	}
+
+	void CDescriptorManager::CreateDescriptorBuffer(CGraphicsContext* context)
+	{
+		VkDevice device = context->GetLogicalDevice();
+
+		m_VkGetDescriptorSetLayoutSizeEXT          = (PFN_vkGetDescriptorSetLayoutSizeEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutSizeEXT");
+		m_VkGetDescriptorSetLayoutBindingOffsetEXT = (PFN_vkGetDescriptorSetLayoutBindingOffsetEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutBindingOffsetEXT");
+		m_VkGetDescriptorEXT                       = (PFN_vkGetDescriptorEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorEXT");
+		m_VkCmdBindDescriptorBuffersEXT            = (PFN_vkCmdBindDescriptorBuffersEXT)vkGetDeviceProcAddr(device, "vkCmdBindDescriptorBuffersEXT");
+		m_VkCmdSetDescriptorBufferOffsetsEXT       = (PFN_vkCmdSetDescriptorBufferOffsetsEXT)vkGetDeviceProcAddr(device, "vkCmdSetDescriptorBufferOffsetsEXT");
+
+		if (!m_VkGetDescriptorSetLayoutSizeEXT || !m_VkGetDescriptorSetLayoutBindingOffsetEXT || !m_VkGetDescriptorEXT || !m_VkCmdBindDescriptorBuffersEXT || !m_VkCmdSetDescriptorBufferOffsetsEXT)
+		{
+			throw std::runtime_error("failed to load descriptor buffer functions!");
+		}
+
+		m_DescriptorBufferProperties = {};
+		m_DescriptorBufferProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT;
+
+		VkPhysicalDeviceProperties2 deviceProperties{};
+		deviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		deviceProperties.pNext = &m_DescriptorBufferProperties;
+		vkGetPhysicalDeviceProperties2(context->GetPhysicalDevice(), &deviceProperties);
+
+		// Combined image samplers count as both resource and sampler descriptors
+		const VkDeviceSize bufferSize = std::min({ g_DescriptorBufferSize, m_DescriptorBufferProperties.maxResourceDescriptorBufferRange, m_DescriptorBufferProperties.maxSamplerDescriptorBufferRange });
+
+		m_DescriptorBuffer = CreateBuffer(
+			context,
+			m_DescriptorBufferMemory,
+			bufferSize,
+			VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		m_DescriptorBufferAddress = GetBufferDeviceAddress(context, m_DescriptorBuffer);
+
+		vkMapMemory(device, m_DescriptorBufferMemory, 0, bufferSize, 0, (void**)&m_MappedDescriptorBuffer);
+		memset(m_MappedDescriptorBuffer, 0, bufferSize);
+
+		m_FreeDescriptorBufferRanges = { { 0, bufferSize, m_MappedDescriptorBuffer } };
+	}
+
+	size_t CDescriptorManager::SLayoutKeyHash::operator()(const std::vector<uint64_t>& key) const
+	{
+		size_t hash = key.size();
+		for (uint64_t value : key)
+		{
+			hash ^= std::hash<uint64_t>{}(value) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+		}
+
+		return hash;
+	}
+
+	VkDescriptorSetLayout CDescriptorManager::GetDescriptorSetLayout(CGraphicsContext* context, const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+	{
+		// Tables add their bindings in any order so sort them to make equal layouts give the same key
+		std::vector<VkDescriptorSetLayoutBinding> sortedBindings = bindings;
+		std::sort(sortedBindings.begin(), sortedBindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b)
+		{
+			return a.binding < b.binding;
+		});
+
+		std::vector<uint64_t> key = {};
+		key.reserve(sortedBindings.size() * 2);
+		for (const VkDescriptorSetLayoutBinding& binding : sortedBindings)
+		{
+			key.push_back(((uint64_t)binding.binding         << 32) | (uint64_t)binding.descriptorType);
+			key.push_back(((uint64_t)binding.descriptorCount << 32) | (uint64_t)binding.stageFlags);
+		}
+
+		auto cachedLayout = m_Layouts.find(key);
+		if (cachedLayout != m_Layouts.end())
+		{
+			return cachedLayout->second;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.flags        = UsesDescriptorBuffers() ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
+		layoutInfo.bindingCount = (uint32_t)sortedBindings.size();
+		layoutInfo.pBindings    = sortedBindings.data();
+
+		VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+		if (vkCreateDescriptorSetLayout(context->GetLogicalDevice(), &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create descriptor set layout!");
+		}
+
+		m_Layouts.emplace(std::move(key), layout);
+
+		return layout;
+	}
+
+	VkDescriptorPool CDescriptorManager::CreatePool(CGraphicsContext* context, uint32_t numSets, VkDescriptorPoolCreateFlags flags)
+	{
+		std::array<VkDescriptorPoolSize, g_DescriptorsPerSet.size()> poolSizes{};
+		for (uint32_t i = 0; i < poolSizes.size(); i++)
+		{
+			poolSizes[i].type            = g_DescriptorsPerSet[i].first;
+			poolSizes[i].descriptorCount = g_DescriptorsPerSet[i].second * numSets;
+		}
+
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.flags         = flags;
+		poolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+		poolInfo.pPoolSizes    = poolSizes.data();
+		poolInfo.maxSets       = numSets;
+
+		VkDescriptorPool pool = VK_NULL_HANDLE;
+		if (vkCreateDescriptorPool(context->GetLogicalDevice(), &poolInfo, nullptr, &pool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create descriptor pool!");
+		}
+
+		return pool;
+	}
+
+	VkDescriptorPool CDescriptorManager::AllocateFromChain(CGraphicsContext* context, SDescriptorPoolChain& chain, VkDescriptorPoolCreateFlags flags, VkDescriptorSetLayout layout, uint32_t numSets, VkDescriptorSet* descriptorSets)
+	{
+		std::vector<VkDescriptorSetLayout> layouts(numSets, layout);
+
+		VkDescriptorSetAllocateInfo allocInfo{};
+		allocInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.pSetLayouts        = layouts.data();
+		allocInfo.descriptorSetCount = numSets;
+
+		// Pools before the current one were full the last time they were tried
+		for (uint32_t i = chain.m_CurrentPool; i < chain.m_Pools.size(); i++)
+		{
+			allocInfo.descriptorPool = chain.m_Pools[i];
+
+			VkResult result = vkAllocateDescriptorSets(context->GetLogicalDevice(), &allocInfo, descriptorSets);
+			if (result == VK_SUCCESS)
+			{
+				chain.m_CurrentPool = i;
+				return chain.m_Pools[i];
+			}
+
+			if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+			{
+				throw std::runtime_error("failed to allocate descriptor sets!");
+			}
+		}
+
+		// Everything is full. Grow the chain
+		if (!chain.m_Pools.empty())
+		{
+			chain.m_SetsPerPool *= 2;
+		}
+		chain.m_SetsPerPool = std::max(chain.m_SetsPerPool, numSets);
+
+		VkDescriptorPool pool = CreatePool(context, chain.m_SetsPerPool, flags);
+		chain.m_Pools.push_back(pool);
+		chain.m_CurrentPool = (uint32_t)chain.m_Pools.size() - 1;
+
+		allocInfo.descriptorPool = pool;
+		if (vkAllocateDescriptorSets(context->GetLogicalDevice(), &allocInfo, descriptorSets) != VK_SUCCESS)
+		{
+			// A fresh pool only fails if the layout uses more descriptors of one type than g_DescriptorsPerSet has room for
+			throw std::runtime_error("failed to allocate descriptor sets from a new pool!");
+		}
+
+		return pool;
+	}
+
+	VkDescriptorPool CDescriptorManager::AllocateDescriptorSets(CGraphicsContext* context, VkDescriptorSetLayout layout, uint32_t numSets, VkDescriptorSet* descriptorSets)
+	{
+		return AllocateFromChain(context, m_PersistentPools, VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, layout, numSets, descriptorSets);
+	}
+
+	void CDescriptorManager::FreeDescriptorSets(CGraphicsContext* context, VkDescriptorPool pool, uint32_t numSets, const VkDescriptorSet* descriptorSets)
+	{
+		vkFreeDescriptorSets(context->GetLogicalDevice(), pool, numSets, descriptorSets);
+
+		// The pool has room again so start looking from there next time
+		for (uint32_t i = 0; i < m_PersistentPools.m_Pools.size(); i++)
+		{
+			if (m_PersistentPools.m_Pools[i] == pool)
+			{
+				m_PersistentPools.m_CurrentPool = std::min(m_PersistentPools.m_CurrentPool, i);
+				break;
+			}
+		}
+	}
+
+	VkDescriptorSet CDescriptorManager::AllocateTransientDescriptorSet(CGraphicsContext* context, VkDescriptorSetLayout layout)
+	{
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		AllocateFromChain(context, m_TransientPools[context->GetFrameIndex()], 0, layout, 1, &descriptorSet);
+
+		return descriptorSet;
+	}
+
+	void CDescriptorManager::BeginFrame(CGraphicsContext* context, uint32_t frameIndex)
+	{
+		SDescriptorPoolChain& chain = m_TransientPools[frameIndex];
+
+		// Resetting a pool is cheaper than freeing its sets one by one
+		for (VkDescriptorPool pool : chain.m_Pools)
+		{
+			vkResetDescriptorPool(context->GetLogicalDevice(), pool, 0);
+		}
+
+		chain.m_CurrentPool = 0;
+	}
+
+	VkDeviceSize CDescriptorManager::GetDescriptorSetLayoutSize(CGraphicsContext* context, VkDescriptorSetLayout layout)
+	{
+		VkDeviceSize layoutSize = 0;
+		m_VkGetDescriptorSetLayoutSizeEXT(context->GetLogicalDevice(), layout, &layoutSize);
+
+		return layoutSize;
+	}
+
+	VkDeviceSize CDescriptorManager::GetDescriptorBindingOffset(CGraphicsContext* context, VkDescriptorSetLayout layout, uint32_t binding)
+	{
+		VkDeviceSize bindingOffset = 0;
+		m_VkGetDescriptorSetLayoutBindingOffsetEXT(context->GetLogicalDevice(), layout, binding, &bindingOffset);
+
+		return bindingOffset;
+	}
+
+	size_t CDescriptorManager::GetDescriptorSize(VkDescriptorType descriptorType)
+	{
+		// Buffer descriptors are larger when robustBufferAccess is enabled, which it always is
+		switch (descriptorType)
+		{
+		case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:         return m_DescriptorBufferProperties.robustUniformBufferDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:         return m_DescriptorBufferProperties.robustStorageBufferDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: return m_DescriptorBufferProperties.combinedImageSamplerDescriptorSize;
+		case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:          return m_DescriptorBufferProperties.storageImageDescriptorSize;
+		default:
+			throw std::runtime_error("descriptor type is not supported by the descriptor buffer backend!");
+		}
+	}
+
+	void CDescriptorManager::GetBufferDescriptor(CGraphicsContext* context, VkDescriptorType descriptorType, VkBuffer buffer, VkDeviceSize bufferSize, void* descriptor)
+	{
+		VkDescriptorAddressInfoEXT addressInfo{};
+		addressInfo.sType   = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT;
+		addressInfo.address = GetBufferDeviceAddress(context, buffer);
+		addressInfo.range   = bufferSize;
+		addressInfo.format  = VK_FORMAT_UNDEFINED;
+
+		VkDescriptorGetInfoEXT getInfo{};
+		getInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+		getInfo.type  = descriptorType;
+		if (descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+			getInfo.data.pUniformBuffer = &addressInfo;
+		else
+			getInfo.data.pStorageBuffer = &addressInfo;
+
+		m_VkGetDescriptorEXT(context->GetLogicalDevice(), &getInfo, GetDescriptorSize(descriptorType), descriptor);
+	}
+
+	void CDescriptorManager::GetImageDescriptor(CGraphicsContext* context, VkDescriptorType descriptorType, const VkDescriptorImageInfo& imageInfo, void* descriptor)
+	{
+		VkDescriptorGetInfoEXT getInfo{};
+		getInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+		getInfo.type  = descriptorType;
+		if (descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+			getInfo.data.pCombinedImageSampler = &imageInfo;
+		else
+			getInfo.data.pStorageImage = &imageInfo;
+
+		m_VkGetDescriptorEXT(context->GetLogicalDevice(), &getInfo, GetDescriptorSize(descriptorType), descriptor);
+	}
+
+	SDescriptorBufferRange CDescriptorManager::AllocateDescriptorBufferRange(CGraphicsContext* context, VkDeviceSize size)
+	{
+		const VkDeviceSize alignment = m_DescriptorBufferProperties.descriptorBufferOffsetAlignment;
+		const VkDeviceSize alignedSize = (size + alignment - 1) & ~(alignment - 1);
+
+		// First fit. Tables are few and only come and go on resize
+		for (uint32_t i = 0; i < m_FreeDescriptorBufferRanges.size(); i++)
+		{
+			SDescriptorBufferRange& freeRange = m_FreeDescriptorBufferRanges[i];
+			if (freeRange.m_Size < alignedSize)
+				continue;
+
+			SDescriptorBufferRange range = { freeRange.m_Offset, alignedSize, m_MappedDescriptorBuffer + freeRange.m_Offset };
+
+			freeRange.m_Offset     += alignedSize;
+			freeRange.m_Size       -= alignedSize;
+			freeRange.m_MappedData  = m_MappedDescriptorBuffer + freeRange.m_Offset;
+			if (freeRange.m_Size == 0)
+				m_FreeDescriptorBufferRanges.erase(m_FreeDescriptorBufferRanges.begin() + i);
+
+			return range;
+		}
+
+		throw std::runtime_error("descriptor buffer is full!");
+	}
+
+	void CDescriptorManager::FreeDescriptorBufferRange(const SDescriptorBufferRange& range)
+	{
+		auto next = std::lower_bound(m_FreeDescriptorBufferRanges.begin(), m_FreeDescriptorBufferRanges.end(), range, [](const SDescriptorBufferRange& a, const SDescriptorBufferRange& b)
+		{
+			return a.m_Offset < b.m_Offset;
+		});
+		next = m_FreeDescriptorBufferRanges.insert(next, range);
+
+		// Merge with the free range after and before it
+		if (next + 1 != m_FreeDescriptorBufferRanges.end() && next->m_Offset + next->m_Size == (next + 1)->m_Offset)
+		{
+			next->m_Size += (next + 1)->m_Size;
+			m_FreeDescriptorBufferRanges.erase(next + 1);
+		}
+		if (next != m_FreeDescriptorBufferRanges.begin() && (next - 1)->m_Offset + (next - 1)->m_Size == next->m_Offset)
+		{
+			(next - 1)->m_Size += next->m_Size;
+			m_FreeDescriptorBufferRanges.erase(next);
+		}
+	}
+
+	void CDescriptorManager::BindDescriptorBuffer(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, const SDescriptorBufferRange& range)
+	{
+		VkDescriptorBufferBindingInfoEXT bindingInfo{};
+		bindingInfo.sType   = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT;
+		bindingInfo.address = m_DescriptorBufferAddress;
+		bindingInfo.usage   = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+
+		// Every table lives in the same buffer so rebinding it is cheap. ImGui binding descriptor sets in between unbinds it
+		m_VkCmdBindDescriptorBuffersEXT(commandBuffer, 1, &bindingInfo);
+
+		const uint32_t bufferIndex = 0;
+		m_VkCmdSetDescriptorBufferOffsetsEXT(commandBuffer, bindPoint, pipelineLayout, 0, 1, &bufferIndex, &range.m_Offset);
+	}
+
+	void CDescriptorManager::AddWriteStats(float timeMs, uint32_t numDescriptors)
+	{
+		m_WriteStats.m_TimeMs         += timeMs;
+		m_WriteStats.m_NumDescriptors += numDescriptors;
+	}
+
+	void CDescriptorManager::ReportWriteTime(const std::string& reason)
+	{
+		std::cout << reason << ": wrote " << m_WriteStats.m_NumDescriptors << " descriptors in " << m_WriteStats.m_TimeMs << " ms using "
+			<< (UsesDescriptorBuffers() ? "descriptor buffers" : "descriptor sets") << std::endl;
+
+		m_WriteStats = {};
+	}
+
+	uint32_t CDescriptorManager::GetNumPools()
+	{
+		uint32_t numPools = (uint32_t)m_PersistentPools.m_Pools.size();
+		for (const SDescriptorPoolChain& chain : m_TransientPools)
+		{
+			numPools += (uint32_t)chain.m_Pools.size();
+		}
+
+		return numPools;
+	}
+
+	void CDescriptorManager::CleanupChain(CGraphicsContext* context, SDescriptorPoolChain& chain)
+	{
+		for (VkDescriptorPool pool : chain.m_Pools)
+		{
+			vkDestroyDescriptorPool(context->GetLogicalDevice(), pool, nullptr);
+		}
+
+		chain.m_Pools.clear();
+		chain.m_CurrentPool = 0;
+	}
+
+	void CDescriptorManager::Cleanup(CGraphicsContext* context)
+	{
+		std::cout << "Descriptor manager: " << m_Layouts.size() << " unique set layouts, " << GetNumPools() << " pools" << std::endl;
+
+		CleanupChain(context, m_PersistentPools);
+		for (SDescriptorPoolChain& chain : m_TransientPools)
+		{
+			CleanupChain(context, chain);
+		}
+
+		for (auto& layout : m_Layouts)
+		{
+			vkDestroyDescriptorSetLayout(context->GetLogicalDevice(), layout.second, nullptr);
+		}
+		m_Layouts.clear();
+
+		if (m_DescriptorBuffer != VK_NULL_HANDLE)
+		{
+			vkUnmapMemory(context->GetLogicalDevice(), m_DescriptorBufferMemory);
+			vkDestroyBuffer(context->GetLogicalDevice(), m_DescriptorBuffer, nullptr);
+			vkFreeMemory(context->GetLogicalDevice(), m_DescriptorBufferMemory, nullptr);
+
+			m_DescriptorBuffer           = VK_NULL_HANDLE;
+			m_DescriptorBufferMemory     = VK_NULL_HANDLE;
+			m_MappedDescriptorBuffer     = nullptr;
+			m_FreeDescriptorBufferRanges.clear();
+		}
+
+		context->SetDescriptorManager(nullptr);
+	}
+};
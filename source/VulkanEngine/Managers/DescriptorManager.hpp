@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GraphicsContext.hpp"
+
+/*
+	Owns the descriptor set layouts and descriptor pools used by the binding tables. Layouts with the same bindings
+	are only created once. Sets come from shared pools that grow when they run out instead of one exact fit pool per table.
+
+	On devices with VK_EXT_descriptor_buffer the tables skip descriptor sets altogether. Their descriptors are written
+	straight into one mapped descriptor buffer and bound by offset
+*/
+
+namespace NVulkanEngine
+{
+	// Part of the descriptor buffer that holds the descriptors of one table
+	struct SDescriptorBufferRange
+	{
+		VkDeviceSize m_Offset     = 0;
+		VkDeviceSize m_Size       = 0;
+		uint8_t*     m_MappedData = nullptr;
+	};
+
+	// CPU time spent writing descriptors since the last call. See CDescriptorManager::ReportWriteTime()
+	struct SDescriptorWriteStats
+	{
+		float    m_TimeMs         = 0.0f;
+		uint32_t m_NumDescriptors = 0;
+	};
+
+	class CDescriptorManager
+	{
+	public:
+		CDescriptorManager() = default;
+		~CDescriptorManager() = default;
+
+		// Hands the manager to the context so binding tables can reach it. Creates the descriptor buffer if the context has them enabled
+		void Init(CGraphicsContext* context);
+
+		// Returns the existing layout if one with the same bindings has already been created. Owned by the manager
+		VkDescriptorSetLayout GetDescriptorSetLayout(CGraphicsContext* context, const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+		// Descriptor buffer backend. Only valid when UsesDescriptorBuffers() is true
+		bool UsesDescriptorBuffers() { return m_DescriptorBuffer != VK_NULL_HANDLE; };
+		const VkPhysicalDeviceDescriptorBufferPropertiesEXT& GetDescriptorBufferProperties() { return m_DescriptorBufferProperties; };
+
+		VkDeviceSize GetDescriptorSetLayoutSize(CGraphicsContext* context, VkDescriptorSetLayout layout);
+		VkDeviceSize GetDescriptorBindingOffset(CGraphicsContext* context, VkDescriptorSetLayout layout, uint32_t binding);
+		size_t       GetDescriptorSize(VkDescriptorType descriptorType);
+
+		// Writes the descriptor to memory. It takes GetDescriptorSize() bytes
+		void GetBufferDescriptor(CGraphicsContext* context, VkDescriptorType descriptorType, VkBuffer buffer, VkDeviceSize bufferSize, void* descriptor);
+		void GetImageDescriptor(CGraphicsContext* context, VkDescriptorType descriptorType, const VkDescriptorImageInfo& imageInfo, void* descriptor);
+
+		SDescriptorBufferRange AllocateDescriptorBufferRange(CGraphicsContext* context, VkDeviceSize size);
+		void FreeDescriptorBufferRange(const SDescriptorBufferRange& range);
+
+		// Binds the descriptors in the range to set 0
+		void BindDescriptorBuffer(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, const SDescriptorBufferRange& range);
+
+		// Both backends report the time spent writing descriptors here
+		void AddWriteStats(float timeMs, uint32_t numDescriptors);
+		void ReportWriteTime(const std::string& reason);
+
+		// Sets that live until they are freed. Returns the pool they came from which is needed to free them again
+		VkDescriptorPool AllocateDescriptorSets(CGraphicsContext* context, VkDescriptorSetLayout layout, uint32_t numSets, VkDescriptorSet* descriptorSets);
+		void FreeDescriptorSets(CGraphicsContext* context, VkDescriptorPool pool, uint32_t numSets, const VkDescriptorSet* descriptorSets);
+
+		// Only valid for the frame it was allocated in. Every transient set of a frame is thrown away at once in BeginFrame
+		VkDescriptorSet AllocateTransientDescriptorSet(CGraphicsContext* context, VkDescriptorSetLayout layout);
+
+		// Call after the fence of the frame has been waited on
+		void BeginFrame(CGraphicsContext* context, uint32_t frameIndex);
+
+		uint32_t GetNumLayouts() { return (uint32_t)m_Layouts.size(); };
+		uint32_t GetNumPools();
+
+		void Cleanup(CGraphicsContext* context);
+
+	private:
+		// Pools that sets are allocated from. A new pool twice the size of the last one is added when they are all full
+		struct SDescriptorPoolChain
+		{
+			std::vector<VkDescriptorPool> m_Pools       = {};
+			uint32_t                      m_CurrentPool = 0;
+			uint32_t                      m_SetsPerPool = 0;
+		};
+
+		VkDescriptorPool CreatePool(CGraphicsContext* context, uint32_t numSets, VkDescriptorPoolCreateFlags flags);
+		VkDescriptorPool AllocateFromChain(CGraphicsContext* context, SDescriptorPoolChain& chain, VkDescriptorPoolCreateFlags flags, VkDescriptorSetLayout layout, uint32_t numSets, VkDescriptorSet* descriptorSets);
+		void CleanupChain(CGraphicsContext* context, SDescriptorPoolChain& chain);
+
+		void CreateDescriptorBuffer(CGraphicsContext* context);
+
+		struct SLayoutKeyHash
+		{
+			size_t operator()(const std::vector<uint64_t>& key) const;
+		};
+
+		// Each binding is packed into two integers and sorted by slot. Immutable samplers are not part of the key since no table uses them
+		std::unordered_map<std::vector<uint64_t>, VkDescriptorSetLayout, SLayoutKeyHash> m_Layouts = {};
+
+		SDescriptorPoolChain                                 m_PersistentPools = {};
+		std::array<SDescriptorPoolChain, g_MaxFramesInFlight> m_TransientPools  = {};
+
+		SDescriptorWriteStats m_WriteStats = {};
+
+		// Persistently mapped. Free ranges are kept sorted by offset so neighbours can be merged
+		VkBuffer                                      m_DescriptorBuffer           = VK_NULL_HANDLE;
+		VkDeviceMemory                                m_DescriptorBufferMemory     = VK_NULL_HANDLE;
+		VkDeviceAddress                               m_DescriptorBufferAddress    = 0;
+		uint8_t*                                      m_MappedDescriptorBuffer     = nullptr;
+		std::vector<SDescriptorBufferRange>           m_FreeDescriptorBufferRanges = {};
+		VkPhysicalDeviceDescriptorBufferPropertiesEXT m_DescriptorBufferProperties = {};
+
+		PFN_vkGetDescriptorSetLayoutSizeEXT          m_VkGetDescriptorSetLayoutSizeEXT          = nullptr;
+		PFN_vkGetDescriptorSetLayoutBindingOffsetEXT m_VkGetDescriptorSetLayoutBindingOffsetEXT = nullptr;
+		PFN_vkGetDescriptorEXT                       m_VkGetDescriptorEXT                       = nullptr;
+		PFN_vkCmdBindDescriptorBuffersEXT            m_VkCmdBindDescriptorBuffersEXT            = nullptr;
+		PFN_vkCmdSetDescriptorBufferOffsetsEXT       m_VkCmdSetDescriptorBufferOffsetsEXT       = nullptr;
+	};
+};
\ No newline at end of file
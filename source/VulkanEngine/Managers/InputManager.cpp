@@ -91,21 +91,26 @@ namespace NVulkanEngine
 		}
 	}
 
-	void CInputManager::UpdateCameraTransforms(CGraphicsContext* context, float deltaTime)
+	void CInputManager::SetCameraState(const SCameraState& cameraState)
 	{
-		const float sensitivity_mouse = 1.0f;
-		const float sensitivity_keys  = m_KeyStatus.m_Shift ? 8.0f : 2.0f;
+		m_CameraState = cameraState;
+	}
 
-		glm::vec3 cameraPosition  = m_Camera.GetPosition();
-		glm::vec3 cameraDirection = m_Camera.GetDirection();
-		glm::vec3 cameraUp        = m_Camera.GetUp();
+	SCameraState CInputManager::UpdateCameraState(GLFWwindow* window, float deltaTime)
+	{
+		// Movement used to be a fixed step per frame. Scaled by time now to keep the speed it had at 60 fps at any update rate
+		const float sensitivity_mouse = 1.0f;
+		const float sensitivity_keys  = (m_KeyStatus.m_Shift ? 8.0f : 2.0f) * 60.0f * deltaTime;
 
+		glm::vec3 cameraPosition  = m_CameraState.m_Position;
+		glm::vec3 cameraDirection = m_CameraState.m_Direction;
+		glm::vec3 cameraUp        = m_CameraState.m_Up;
 
 		if (m_MouseStatus.m_RightButton)
 		{
 			if (m_MouseStatus.m_FirstTimePressed)
 			{
-				glfwGetCursorPos(context->GetGLFWWindow(), &m_MouseStatus.m_MouseX, &m_MouseStatus.m_MouseY);
+				glfwGetCursorPos(window, &m_MouseStatus.m_MouseX, &m_MouseStatus.m_MouseY);
 				m_MouseStatus.m_FirstTimePressed = false;
 			}
 
@@ -113,7 +118,7 @@ namespace NVulkanEngine
 			double previousMouseY = m_MouseStatus.m_MouseY;
 
 			double currentMouseX, currentMouseY;
-			glfwGetCursorPos(context->GetGLFWWindow(), &currentMouseX, &currentMouseY);
+			glfwGetCursorPos(window, &currentMouseX, &currentMouseY);
 
 			float offsetX = static_cast<float>(previousMouseX - currentMouseX);
 			float offsetY = static_cast<float>(currentMouseY  - previousMouseY);
@@ -149,33 +154,42 @@ namespace NVulkanEngine
 
 		if (m_KeyStatus.m_Forward)
 		{
-			cameraPosition += cameraFront * (deltaTime + sensitivity_keys);
+			cameraPosition += cameraFront * sensitivity_keys;
 		}
 		if (m_KeyStatus.m_Backward)
 		{
-			cameraPosition -= cameraFront * (deltaTime + sensitivity_keys);
+			cameraPosition -= cameraFront * sensitivity_keys;
 		}
 		if (m_KeyStatus.m_Left)
 		{
-			cameraPosition -= glm::normalize(glm::cross(cameraDirection, cameraUp)) * (deltaTime + sensitivity_keys);
+			cameraPosition -= glm::normalize(glm::cross(cameraDirection, cameraUp)) * sensitivity_keys;
 		}
 		if (m_KeyStatus.m_Right)
 		{
-			cameraPosition += glm::normalize(glm::cross(cameraDirection, cameraUp)) * (deltaTime + sensitivity_keys);
+			cameraPosition += glm::normalize(glm::cross(cameraDirection, cameraUp)) * sensitivity_keys;
 		}
 		if (m_KeyStatus.m_Up)
 		{
-			cameraPosition.y += (deltaTime + sensitivity_keys);
+			cameraPosition.y += sensitivity_keys;
 		}
 		if (m_KeyStatus.m_Down)
 		{
-			cameraPosition.y -= (deltaTime + sensitivity_keys);
+			cameraPosition.y -= sensitivity_keys;
 		}
 
-		m_Camera.SetPosition(cameraPosition);
-		m_Camera.SetDirection(cameraFront);
-		m_Camera.SetNear(10.0f);
-		m_Camera.SetFar(10000.0f);
+		m_CameraState.m_Position  = cameraPosition;
+		m_CameraState.m_Direction = cameraFront;
+
+		return m_CameraState;
+	}
+
+	void CInputManager::ApplyCameraState(CGraphicsContext* context, const SCameraState& cameraState)
+	{
+		m_Camera.SetPosition(cameraState.m_Position);
+		m_Camera.SetDirection(cameraState.m_Direction);
+		m_Camera.SetUp(cameraState.m_Up);
+		m_Camera.SetNear(cameraState.m_Near);
+		m_Camera.SetFar(cameraState.m_Far);
 		m_Camera.UpdateCamera(context);
 	}
 
@@ -6,20 +6,37 @@
 #include "GraphicsContext.hpp"
 
 /*
-	Input manager keeps track of the camera and updates based on keyboard/mouse input
+	Input manager keeps track of the camera and updates based on keyboard/mouse input. Input is handled on the main thread
+	which produces camera states. The render thread applies them to the camera the draw nodes read
 */
 
 namespace NVulkanEngine
 {
+	struct SCameraState
+	{
+		glm::vec3 m_Position  = glm::vec3(0.0f, 0.0f, 0.0f);
+		glm::vec3 m_Direction = glm::vec3(1.0f, 0.0f, 0.0f);
+		glm::vec3 m_Up        = glm::vec3(0.0f, 1.0f, 0.0f);
+		float     m_Near      = 10.0f;
+		float     m_Far       = 10000.0f;
+	};
+
 	class CInputManager
 	{
 	public:
 		CInputManager() = default;
 		~CInputManager() = default;
 
-		// Should be called once per frame to update camera based on user input
-		void UpdateCameraTransforms(CGraphicsContext* context, float deltaTime);
+		// Main thread. Starting point for UpdateCameraState
+		void SetCameraState(const SCameraState& cameraState);
+
+		// Main thread. Moves the camera state based on user input. Can be called at any rate
+		SCameraState UpdateCameraState(GLFWwindow* window, float deltaTime);
+
+		// Render thread. Once per frame before the draw nodes read the camera
+		void ApplyCameraState(CGraphicsContext* context, const SCameraState& cameraState);
 
+		// Render thread
 		CCamera* GetCamera();
 
 		// Used as callback for GLFW keyboard input handling
@@ -28,7 +45,8 @@ namespace NVulkanEngine
 		// Used as callback for GLFW mouse input handling
 		void ProcessMouseInput(GLFWwindow* window, int button, int action, int mods);
 	private:
-		CCamera m_Camera;
+		CCamera      m_Camera;      // Render thread
+		SCameraState m_CameraState; // Main thread
 
 		struct SKeyStatus
 		{
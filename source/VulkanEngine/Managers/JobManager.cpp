@@ -0,0 +1,346 @@
+#include "JobManager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#define JOB_BENCHMARK_NUM_EMPTY_JOBS 100000
+#define JOB_BENCHMARK_NUM_ELEMENTS   (1 << 20)
+#define JOB_BENCHMARK_BATCH_SIZE     4096
+
+namespace NVulkanEngine
+{
+	static thread_local uint32_t t_ThreadIndex = INVALID_JOB_THREAD_INDEX;
+
+	uint32_t CJobManager::GetThreadIndex()
+	{
+		return t_ThreadIndex;
+	}
+
+	bool CJobManager::IsMainThread()
+	{
+		return t_ThreadIndex == 0;
+	}
+
+	void CJobManager::Init(uint32_t numExtraThreads)
+	{
+		const uint32_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+		const uint32_t numThreads      = std::clamp(hardwareThreads, 1u, (uint32_t)MAX_JOB_THREADS);
+
+		t_ThreadIndex = 0;
+
+		// Registered threads come after the workers. Workers only read m_Queues so it can't grow later
+		m_NextExtraThread = numThreads;
+		for (uint32_t i = 0; i < numThreads + numExtraThreads; i++)
+		{
+			m_Queues.push_back(std::make_unique<SJobQueue>());
+		}
+
+		for (uint32_t i = 1; i < numThreads; i++)
+		{
+			m_Workers.emplace_back(&CJobManager::WorkerLoop, this, i);
+		}
+
+		std::cout << "Job system: " << numThreads << " threads (" << hardwareThreads << " hardware threads)" << std::endl;
+	}
+
+	void CJobManager::RegisterThread()
+	{
+		if (t_ThreadIndex != INVALID_JOB_THREAD_INDEX)
+			return;
+
+		const uint32_t threadIndex = m_NextExtraThread.fetch_add(1, std::memory_order_relaxed);
+		if (threadIndex >= (uint32_t)m_Queues.size())
+		{
+			throw std::runtime_error("failed to register job thread, no free slot!");
+		}
+
+		t_ThreadIndex = threadIndex;
+	}
+
+	void CJobManager::Run(const std::function<void()>& function, SJobCounter* counter)
+	{
+		if (counter)
+			counter->m_NumPending.fetch_add(1, std::memory_order_relaxed);
+
+		Push({ function, counter });
+	}
+
+	void CJobManager::RunAfter(SJobCounter* dependency, const std::function<void()>& function, SJobCounter* counter)
+	{
+		if (counter)
+			counter->m_NumPending.fetch_add(1, std::memory_order_relaxed);
+
+		{
+			// The last Finish on the dependency takes the same lock so the job is either released by it or pushed here
+			std::lock_guard<std::mutex> lock(dependency->m_Mutex);
+			if (!dependency->IsDone())
+			{
+				dependency->m_Dependents.push_back({ function, counter });
+				return;
+			}
+		}
+
+		Push({ function, counter });
+	}
+
+	void CJobManager::RunOnMainThread(const std::function<void()>& function, SJobCounter* counter)
+	{
+		if (counter)
+			counter->m_NumPending.fetch_add(1, std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(m_MainThreadMutex);
+		m_MainThreadJobs.push_back({ function, counter });
+	}
+
+	void CJobManager::ProcessMainThreadJobs()
+	{
+		if (!IsMainThread())
+			return;
+
+		std::vector<SJob> jobs;
+		{
+			std::lock_guard<std::mutex> lock(m_MainThreadMutex);
+			jobs.swap(m_MainThreadJobs);
+		}
+
+		for (SJob& job : jobs)
+		{
+			Execute(job);
+		}
+	}
+
+	void CJobManager::Wait(SJobCounter* counter)
+	{
+		const uint32_t threadIndex = t_ThreadIndex;
+		if (threadIndex == INVALID_JOB_THREAD_INDEX)
+		{
+			throw std::runtime_error("failed to wait on jobs, thread is not registered with the job manager!");
+		}
+		while (!counter->IsDone())
+		{
+			// A worker job may be waiting on something only the main thread can do
+			if (IsMainThread())
+				ProcessMainThreadJobs();
+
+			SJob job;
+			if (TryGetJob(threadIndex, job))
+				Execute(job);
+			else
+				std::this_thread::yield();
+		}
+
+		// Finish may still hold the lock right after the last decrement. Take it once so the counter can be destroyed
+		std::lock_guard<std::mutex> lock(counter->m_Mutex);
+	}
+
+	void CJobManager::ParallelFor(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t begin, uint32_t end, uint32_t threadIndex)>& function)
+	{
+		batchSize = std::max(batchSize, 1u);
+		const uint32_t numBatches = (count + batchSize - 1) / batchSize;
+
+		if (GetThreadIndex() == INVALID_JOB_THREAD_INDEX)
+		{
+			throw std::runtime_error("failed to run parallel for, thread is not registered with the job manager!");
+		}
+
+		if (numBatches <= 1 || m_Queues.size() <= 1)
+		{
+			if (count > 0)
+				function(0, count, GetThreadIndex());
+			return;
+		}
+
+		SJobCounter counter;
+		for (uint32_t batch = 0; batch < numBatches; batch++)
+		{
+			const uint32_t begin = batch * batchSize;
+			const uint32_t end   = std::min(begin + batchSize, count);
+			Run([&function, begin, end]() { function(begin, end, GetThreadIndex()); }, &counter);
+		}
+		Wait(&counter);
+	}
+
+	void CJobManager::Push(SJob job)
+	{
+		// Threads without a queue of their own spread their jobs out
+		const uint32_t queueIndex = t_ThreadIndex != INVALID_JOB_THREAD_INDEX ? t_ThreadIndex : m_NextQueue.fetch_add(1, std::memory_order_relaxed) % (uint32_t)m_Queues.size();
+
+		{
+			std::lock_guard<std::mutex> lock(m_Queues[queueIndex]->m_Mutex);
+			m_Queues[queueIndex]->m_Jobs.push_back(std::move(job));
+		}
+
+		{
+			// Under the sleep lock so a worker can't check the count and then miss the notify
+			std::lock_guard<std::mutex> lock(m_SleepMutex);
+			m_NumQueuedJobs.fetch_add(1, std::memory_order_release);
+		}
+		m_WorkAvailable.notify_one();
+	}
+
+	bool CJobManager::TryGetJob(uint32_t threadIndex, SJob& job)
+	{
+		if (m_NumQueuedJobs.load(std::memory_order_acquire) == 0)
+			return false;
+
+		const uint32_t numQueues = (uint32_t)m_Queues.size();
+		for (uint32_t i = 0; i < numQueues; i++)
+		{
+			const uint32_t queueIndex = (threadIndex + i) % numQueues;
+			SJobQueue&     queue      = *m_Queues[queueIndex];
+
+			std::lock_guard<std::mutex> lock(queue.m_Mutex);
+			if (queue.m_Jobs.empty())
+				continue;
+
+			// Newest own job is still warm in the cache. Steal the oldest, it tends to be the biggest piece of work
+			if (i == 0)
+			{
+				job = std::move(queue.m_Jobs.back());
+				queue.m_Jobs.pop_back();
+			}
+			else
+			{
+				job = std::move(queue.m_Jobs.front());
+				queue.m_Jobs.pop_front();
+			}
+
+			m_NumQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		return false;
+	}
+
+	void CJobManager::Execute(SJob& job)
+	{
+		job.m_Function();
+		Finish(job.m_Counter);
+	}
+
+	void CJobManager::Finish(SJobCounter* counter)
+	{
+		if (!counter)
+			return;
+
+		std::vector<SJob> dependents;
+		{
+			std::lock_guard<std::mutex> lock(counter->m_Mutex);
+			if (counter->m_NumPending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+
+			dependents.swap(counter->m_Dependents);
+		}
+
+		for (SJob& dependent : dependents)
+		{
+			Push(std::move(dependent));
+		}
+	}
+
+	void CJobManager::WorkerLoop(uint32_t threadIndex)
+	{
+		t_ThreadIndex = threadIndex;
+
+		while (!m_IsShuttingDown.load(std::memory_order_acquire))
+		{
+			SJob job;
+			if (TryGetJob(threadIndex, job))
+			{
+				Execute(job);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_SleepMutex);
+			m_WorkAvailable.wait(lock, [this]()
+			{
+				return m_IsShuttingDown.load(std::memory_order_acquire) || m_NumQueuedJobs.load(std::memory_order_acquire) > 0;
+			});
+		}
+	}
+
+	SJobBenchmarkResult CJobManager::RunBenchmark()
+	{
+		SJobBenchmarkResult result{};
+		result.m_NumThreads   = (uint32_t)m_Workers.size() + 1; // Registered threads don't take part
+		result.m_NumEmptyJobs = JOB_BENCHMARK_NUM_EMPTY_JOBS;
+
+		// Scheduling overhead. Nothing but pushing, stealing and counting
+		{
+			SJobCounter counter;
+
+			auto startTime = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < JOB_BENCHMARK_NUM_EMPTY_JOBS; i++)
+			{
+				Run([]() {}, &counter);
+			}
+			Wait(&counter);
+			auto endTime = std::chrono::high_resolution_clock::now();
+
+			result.m_NanosecondsPerJob = std::chrono::duration<float, std::chrono::nanoseconds::period>(endTime - startTime).count() / JOB_BENCHMARK_NUM_EMPTY_JOBS;
+		}
+
+		// Scaling. Arithmetic only so memory bandwidth does not hide the thread count
+		std::vector<float> values(JOB_BENCHMARK_NUM_ELEMENTS, 0.0f);
+		const auto workload = [&values](uint32_t begin, uint32_t end, uint32_t threadIndex)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				float value = (float)i;
+				for (uint32_t iteration = 0; iteration < 32; iteration++)
+				{
+					value = std::sqrt(value * 1.0001f + 0.5f);
+				}
+				values[i] = value;
+			}
+		};
+
+		{
+			auto startTime = std::chrono::high_resolution_clock::now();
+			workload(0, JOB_BENCHMARK_NUM_ELEMENTS, 0);
+			auto endTime = std::chrono::high_resolution_clock::now();
+
+			result.m_SerialTimeMs = std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count();
+		}
+
+		{
+			auto startTime = std::chrono::high_resolution_clock::now();
+			ParallelFor(JOB_BENCHMARK_NUM_ELEMENTS, JOB_BENCHMARK_BATCH_SIZE, workload);
+			auto endTime = std::chrono::high_resolution_clock::now();
+
+			result.m_ParallelTimeMs = std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count();
+		}
+
+		result.m_Speedup = result.m_ParallelTimeMs > 0.0f ? result.m_SerialTimeMs / result.m_ParallelTimeMs : 0.0f;
+
+		std::cout << "Job benchmark: " << result.m_NumThreads << " threads, "
+			<< result.m_NanosecondsPerJob << " ns per empty job, "
+			<< result.m_SerialTimeMs << " ms serial, "
+			<< result.m_ParallelTimeMs << " ms parallel ("
+			<< result.m_Speedup << "x)" << std::endl;
+
+		return result;
+	}
+
+	void CJobManager::Cleanup()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_SleepMutex);
+			m_IsShuttingDown.store(true, std::memory_order_release);
+		}
+		m_WorkAvailable.notify_all();
+
+		for (std::thread& worker : m_Workers)
+		{
+			worker.join();
+		}
+		m_Workers.clear();
+
+		// Nothing should be left but run it rather than dropping it
+		ProcessMainThreadJobs();
+		m_Queues.clear();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+	Work stealing job system. Every worker thread owns a deque of jobs. It pushes and pops its own jobs at the back
+	and steals from the front of the other deques when it runs out. The main thread has a deque as well and runs jobs
+	while it waits on a counter. Jobs that have to run on the main thread, like GLFW calls, go through RunOnMainThread
+*/
+
+#define MAX_JOB_THREADS 32 // Including the main thread
+#define INVALID_JOB_THREAD_INDEX 0xFFFFFFFF
+
+namespace NVulkanEngine
+{
+	struct SJobCounter;
+
+	struct SJob
+	{
+		std::function<void()> m_Function = {};
+		SJobCounter*          m_Counter  = nullptr; // Decremented when the job is done. Optional
+	};
+
+	// Counts the jobs that are not done yet. Must outlive its jobs, Wait on it before it goes out of scope
+	struct SJobCounter
+	{
+		std::atomic<uint32_t> m_NumPending = 0;
+		std::mutex            m_Mutex;          // Guards m_Dependents and the last decrement
+		std::vector<SJob>     m_Dependents = {}; // Pushed when m_NumPending reaches zero
+
+		bool IsDone() { return m_NumPending.load(std::memory_order_acquire) == 0; };
+	};
+
+	struct SJobBenchmarkResult
+	{
+		uint32_t m_NumThreads         = 0;
+		uint32_t m_NumEmptyJobs       = 0;
+		float    m_NanosecondsPerJob  = 0.0f; // Push, pop and finish of an empty job
+		float    m_SerialTimeMs       = 0.0f; // Workload on the main thread only
+		float    m_ParallelTimeMs     = 0.0f; // Same workload with ParallelFor
+		float    m_Speedup            = 0.0f;
+	};
+
+	class CJobManager
+	{
+	public:
+		CJobManager() = default;
+		~CJobManager() = default;
+
+		// Must be called on the main thread. It becomes thread index 0. Threads that are not workers but wait on jobs,
+		// like the render thread, need one of the numExtraThreads slots and call RegisterThread before they do
+		void Init(uint32_t numExtraThreads = 0);
+
+		// Gives the calling thread its own queue and thread index
+		void RegisterThread();
+
+		void Run(const std::function<void()>& function, SJobCounter* counter = nullptr);
+
+		// Pushed once every job of dependency is done
+		void RunAfter(SJobCounter* dependency, const std::function<void()>& function, SJobCounter* counter = nullptr);
+
+		// Queued until the main thread calls ProcessMainThreadJobs or waits on a counter
+		void RunOnMainThread(const std::function<void()>& function, SJobCounter* counter = nullptr);
+		void ProcessMainThreadJobs();
+
+		// Runs other jobs until the counter is done instead of blocking. Only on the main thread, workers and registered threads
+		void Wait(SJobCounter* counter);
+
+		// Splits [0, count) into batches of batchSize and returns when every batch is done. threadIndex is unique
+		// among the threads running batches at the same time so it can index per thread data
+		void ParallelFor(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t begin, uint32_t end, uint32_t threadIndex)>& function);
+
+		// Scheduling cost per job and ParallelFor speedup on this machine. Blocks for a moment
+		SJobBenchmarkResult RunBenchmark();
+
+		// 0 on the main thread. INVALID_JOB_THREAD_INDEX on threads that are neither workers nor registered
+		static uint32_t GetThreadIndex();
+
+		// The thread Init was called on
+		static bool IsMainThread();
+
+		// Worker threads, the main thread and the registered thread slots
+		uint32_t GetNumThreads() { return (uint32_t)m_Queues.size(); };
+
+		void Cleanup();
+
+	private:
+		struct SJobQueue
+		{
+			std::mutex       m_Mutex;
+			std::deque<SJob> m_Jobs = {};
+		};
+
+		void Push(SJob job);
+
+		// Own queue first, then steals from the others
+		bool TryGetJob(uint32_t threadIndex, SJob& job);
+
+		void Execute(SJob& job);
+		void Finish(SJobCounter* counter);
+
+		void WorkerLoop(uint32_t threadIndex);
+
+		// Index 0 belongs to the main thread
+		std::vector<std::unique_ptr<SJobQueue>> m_Queues          = {};
+		std::vector<std::thread>                m_Workers         = {};
+		std::atomic<uint32_t>                   m_NumQueuedJobs   = 0;
+		std::atomic<uint32_t>                   m_NextQueue       = 0; // Round robin for threads that own no queue
+		std::atomic<uint32_t>                   m_NextExtraThread = 0; // Next index handed out by RegisterThread
+		std::atomic<bool>                       m_IsShuttingDown  = false;
+
+		// Idle workers sleep here instead of spinning
+		std::mutex              m_SleepMutex;
+		std::condition_variable m_WorkAvailable;
+
+		std::mutex        m_MainThreadMutex;
+		std::vector<SJob> m_MainThreadJobs = {};
+	};
+};
\ No newline at end of file
@@ -26,13 +26,27 @@ namespace NVulkanEngine
 		m_Lights[m_CurrentLightSourceIndex].m_Intensity = intensity;
 	}
 
+	void CLightManager::AddColor(glm::vec3 color)
+	{
+		m_Lights[m_CurrentLightSourceIndex].m_Color = color;
+	}
+
+	void CLightManager::AddRadius(float radius)
+	{
+		m_Lights[m_CurrentLightSourceIndex].m_Radius = radius;
+	}
+
 	void CLightManager::PushLight()
 	{
+		if (m_Lights[m_CurrentLightSourceIndex].m_Type == ELightType::SUN)
+			m_Sunlight = m_Lights[m_CurrentLightSourceIndex];
+
 		m_CurrentLightSourceIndex++;
 	}
 
 	void CLightManager::Cleanup(CGraphicsContext* context)
 	{
 		m_Lights.clear();
+		m_CurrentLightSourceIndex = 0;
 	}
 };
\ No newline at end of file
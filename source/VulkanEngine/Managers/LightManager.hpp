@@ -23,7 +23,9 @@ namespace NVulkanEngine
 		ELightType m_Type      = ELightType::COUNT;
 		glm::vec3  m_Position  = glm::vec3(0.0f, 0.0f, 0.0f);
 		glm::vec3  m_Direction = glm::vec3(0.0f, 0.0f, 0.0f);
+		glm::vec3  m_Color     = glm::vec3(1.0f, 1.0f, 1.0f);
 		float      m_Intensity = 1.0f;
+		float      m_Radius    = 100.0f; // Point lights only. Light has no contribution past this distance
 	};
 
 	class CLightManager
@@ -36,12 +38,15 @@ namespace NVulkanEngine
 		void AddPosition(glm::vec3 position);
 		void AddDirection(glm::vec3 rotation);
 		void AddIntensity(float);
+		void AddColor(glm::vec3 color);
+		void AddRadius(float radius);
 		void PushLight();
 
 		void Cleanup(CGraphicsContext* context);
 
 		SLightSource GetSunlight() { return m_Sunlight; };
 		SLightSource GetLightSource(uint32_t index) { return m_Lights[index]; };
+		const std::vector<SLightSource>& GetLightSources() { return m_Lights; };
 
 		const uint32_t GetNumLights() { return (uint32_t)m_Lights.size(); }
 
@@ -1,9 +1,60 @@
 #include "ModelManager.hpp"
 
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <xmmintrin.h>
 #include <vector>
 
 namespace NVulkanEngine
 {
+	// Model view projection of every object in one go. Matrices are column major so each column of the result is
+	// the view projection columns weighted by the matching column of the world matrix. Four floats at a time with SSE
+	static void TransformObjects(const glm::mat4& viewProjection, const glm::mat4* worldMatrices, const glm::mat3x4* normalMatrices, SObjectTransform* objectTransforms, uint32_t numObjects)
+	{
+		const __m128 viewProjectionColumn0 = _mm_loadu_ps(&viewProjection[0][0]);
+		const __m128 viewProjectionColumn1 = _mm_loadu_ps(&viewProjection[1][0]);
+		const __m128 viewProjectionColumn2 = _mm_loadu_ps(&viewProjection[2][0]);
+		const __m128 viewProjectionColumn3 = _mm_loadu_ps(&viewProjection[3][0]);
+
+		for (uint32_t i = 0; i < numObjects; i++)
+		{
+			const float* world               = &worldMatrices[i][0][0];
+			float*       modelViewProjection = &objectTransforms[i].m_ModelViewProjection[0][0];
+
+			for (uint32_t column = 0; column < 4; column++)
+			{
+				__m128 result = _mm_mul_ps(viewProjectionColumn0, _mm_set1_ps(world[column * 4 + 0]));
+				result = _mm_add_ps(result, _mm_mul_ps(viewProjectionColumn1, _mm_set1_ps(world[column * 4 + 1])));
+				result = _mm_add_ps(result, _mm_mul_ps(viewProjectionColumn2, _mm_set1_ps(world[column * 4 + 2])));
+				result = _mm_add_ps(result, _mm_mul_ps(viewProjectionColumn3, _mm_set1_ps(world[column * 4 + 3])));
+				_mm_storeu_ps(modelViewProjection + column * 4, result);
+			}
+
+			objectTransforms[i].m_World        = worldMatrices[i];
+			objectTransforms[i].m_NormalMatrix = normalMatrices[i];
+		}
+	}
+
+	// Copies the data into a new device local buffer through a staging buffer
+	static VkBuffer CreateDeviceLocalBuffer(CGraphicsContext* context, VkDeviceMemory& bufferMemory, const void* data, VkDeviceSize size, VkBufferUsageFlags usage)
+	{
+		VkDeviceMemory stagingBufferMemory;
+		VkBuffer stagingBuffer = CreateBuffer(context, stagingBufferMemory, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		void* mappedData;
+		vkMapMemory(context->GetLogicalDevice(), stagingBufferMemory, 0, size, 0, &mappedData);
+		memcpy(mappedData, data, (size_t)size);
+		vkUnmapMemory(context->GetLogicalDevice(), stagingBufferMemory);
+
+		VkBuffer buffer = CreateBuffer(context, bufferMemory, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		CopyBuffer(context, stagingBuffer, buffer, size);
+
+		vkDestroyBuffer(context->GetLogicalDevice(), stagingBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), stagingBufferMemory, nullptr);
+
+		return buffer;
+	}
+
 	void CModelManager::AddModelFilepath(const std::string& modelFilepath)
 	{
 		CModel* model = new CModel();
@@ -47,6 +98,11 @@ namespace NVulkanEngine
 		m_Models[m_CurrentModelIndex]->SetModelTexturePath("./assets/" + textureFilepath);
 	}
 
+	void CModelManager::SetIsDynamic(bool isDynamic)
+	{
+		m_Models[m_CurrentModelIndex]->SetIsDynamic(isDynamic);
+	}
+
 	void CModelManager::PushModel()
 	{
 		m_CurrentModelIndex++;
@@ -70,6 +126,16 @@ namespace NVulkanEngine
 		return (uint32_t)m_Models.size();
 	}
 
+	bool CModelManager::HasDynamicModels()
+	{
+		for (CModel* model : m_Models)
+		{
+			if (model->IsDynamic())
+				return true;
+		}
+		return false;
+	}
+
 	void CModelManager::SetSceneBounds(glm::AABB sceneBounds)
 	{
 		m_SceneBounds = sceneBounds;
@@ -80,8 +146,275 @@ namespace NVulkanEngine
 		return m_SceneBounds;
 	}
 
+	void CModelManager::CreateObjectTransformBuffer(CGraphicsContext* context, uint32_t numViews)
+	{
+		m_NumObjectTransformViews = numViews;
+
+		m_ObjectTransformBuffer = CreateStorageBuffer(context, m_ObjectTransformMemory, GetObjectTransformBufferSize(), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		vkMapMemory(context->GetLogicalDevice(), m_ObjectTransformMemory, 0, GetObjectTransformBufferSize(), 0, (void**)&m_MappedObjectTransforms);
+
+		m_WorldMatrices.resize(m_Models.size());
+		m_NormalMatrices.resize(m_Models.size());
+		m_WorldTransformVersions.assign(m_Models.size(), UINT32_MAX);
+	}
+
+	VkBuffer CModelManager::GetObjectTransformBuffer()
+	{
+		return m_ObjectTransformBuffer;
+	}
+
+	VkDeviceSize CModelManager::GetObjectTransformBufferSize()
+	{
+		return (VkDeviceSize)g_MaxFramesInFlight * m_NumObjectTransformViews * m_Models.size() * sizeof(SObjectTransform);
+	}
+
+	void CModelManager::UpdateObjectTransforms(CGraphicsContext* context, uint32_t viewIndex, const glm::mat4& viewProjection)
+	{
+		for (uint32_t i = 0; i < m_Models.size(); i++)
+		{
+			const uint32_t transformVersion = m_Models[i]->GetTransformVersion();
+			if (transformVersion == m_WorldTransformVersions[i])
+				continue;
+
+			m_WorldTransformVersions[i] = transformVersion;
+			m_WorldMatrices[i]  = m_Models[i]->GetTransform();
+			m_NormalMatrices[i] = glm::mat3x4(glm::inverseTranspose(glm::mat3(m_WorldMatrices[i])));
+		}
+
+		SObjectTransform* viewTransforms = m_MappedObjectTransforms + GetObjectTransformIndex(context, viewIndex, 0);
+		TransformObjects(viewProjection, m_WorldMatrices.data(), m_NormalMatrices.data(), viewTransforms, (uint32_t)m_Models.size());
+	}
+
+	uint32_t CModelManager::GetObjectTransformIndex(CGraphicsContext* context, uint32_t viewIndex, uint32_t modelIndex)
+	{
+		return (context->GetFrameIndex() * m_NumObjectTransformViews + viewIndex) * (uint32_t)m_Models.size() + modelIndex;
+	}
+
+	void CModelManager::CreateMaterialBuffer(CGraphicsContext* context)
+	{
+		std::vector<SModelMaterial> materials = {};
+
+		m_FirstMaterialIndices.resize(m_Models.size());
+		for (uint32_t i = 0; i < m_Models.size(); i++)
+		{
+			CModel* model = m_Models[i];
+			m_FirstMaterialIndices[i] = (uint32_t)materials.size();
+
+			for (uint32_t j = 0; j < model->GetNumMaterials(); j++)
+			{
+				SModelMaterial material = model->GetMaterial(j);
+				material.m_AlbedoTextureIndex = model->GetModelTexture() != nullptr ? (int32_t)model->GetModelTextureIndex() : -1;
+				materials.push_back(material);
+			}
+		}
+
+		// Storage buffers can't be empty
+		if (materials.empty())
+			materials.push_back(SModelMaterial{});
+
+		m_MaterialBufferSize = sizeof(SModelMaterial) * materials.size();
+		m_MaterialBuffer     = CreateDeviceLocalBuffer(context, m_MaterialMemory, materials.data(), m_MaterialBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+		// Kept around so edits only have to send what changed
+		m_Materials = materials;
+		m_IsMaterialDirty.assign(materials.size(), false);
+		m_NumDirtyMaterials = 0;
+	}
+
+	VkBuffer CModelManager::GetMaterialBuffer()
+	{
+		return m_MaterialBuffer;
+	}
+
+	VkDeviceSize CModelManager::GetMaterialBufferSize()
+	{
+		return m_MaterialBufferSize;
+	}
+
+	uint32_t CModelManager::GetMaterialIndex(uint32_t modelIndex, uint32_t materialId)
+	{
+		return m_FirstMaterialIndices[modelIndex] + materialId;
+	}
+
+	const SModelMaterial& CModelManager::GetMaterial(uint32_t materialIndex)
+	{
+		return m_Materials[materialIndex];
+	}
+
+	void CModelManager::SetMaterial(uint32_t materialIndex, const SModelMaterial& material)
+	{
+		m_Materials[materialIndex] = material;
+
+		if (!m_IsMaterialDirty[materialIndex])
+		{
+			m_IsMaterialDirty[materialIndex] = true;
+			m_NumDirtyMaterials++;
+		}
+	}
+
+	uint32_t CModelManager::UploadDirtyMaterials(VkCommandBuffer commandBuffer)
+	{
+		if (m_NumDirtyMaterials == 0)
+			return 0;
+
+		// Earlier frames may still be reading the buffer
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask       = VK_ACCESS_SHADER_READ_BIT;
+		barrier.dstAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer              = m_MaterialBuffer;
+		barrier.offset              = 0;
+		barrier.size                = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+		// Neighbouring dirty materials go out as one range. Updates are limited to 64 KB each
+		const uint32_t maxMaterialsPerUpdate = 65536 / sizeof(SModelMaterial);
+
+		uint32_t numRanges = 0;
+		uint32_t i         = 0;
+		while (i < m_Materials.size())
+		{
+			if (!m_IsMaterialDirty[i])
+			{
+				i++;
+				continue;
+			}
+
+			const uint32_t firstMaterial = i;
+			while (i < m_Materials.size() && m_IsMaterialDirty[i] && i - firstMaterial < maxMaterialsPerUpdate)
+			{
+				m_IsMaterialDirty[i] = false;
+				i++;
+			}
+
+			vkCmdUpdateBuffer(commandBuffer, m_MaterialBuffer, firstMaterial * sizeof(SModelMaterial), (i - firstMaterial) * sizeof(SModelMaterial), &m_Materials[firstMaterial]);
+			numRanges++;
+		}
+		m_NumDirtyMaterials = 0;
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+		return numRanges;
+	}
+
+	void CModelManager::CreateDrawBuffers(CGraphicsContext* context)
+	{
+		std::vector<SDrawData>                    drawData     = {};
+		std::vector<VkDrawIndexedIndirectCommand> drawCommands = {};
+		std::vector<uint32_t>                     indices      = {};
+
+		m_FirstDrawIndices.resize(m_Models.size());
+		for (uint32_t i = 0; i < m_Models.size(); i++)
+		{
+			CModel* model = m_Models[i];
+			m_FirstDrawIndices[i] = (uint32_t)drawData.size();
+
+			const uint32_t firstIndex = (uint32_t)indices.size();
+			indices.insert(indices.end(), model->GetIndices().begin(), model->GetIndices().end());
+
+			for (uint32_t j = 0; j < model->GetNumMeshes(); j++)
+			{
+				const SMaterialMesh mesh = model->GetMesh(j);
+
+				SDrawData draw{};
+				draw.m_VertexBufferAddress = model->GetVertexBufferAddress();
+				draw.m_ModelIndex          = i;
+				draw.m_MaterialIndex       = GetMaterialIndex(i, mesh.m_MaterialId);
+
+				// Indexed so the post transform cache still skips repeated vertices. gl_VertexIndex is the index into the model's own vertices
+				VkDrawIndexedIndirectCommand drawCommand{};
+				drawCommand.indexCount    = mesh.m_NumVertices;
+				drawCommand.instanceCount = 1;
+				drawCommand.firstIndex    = firstIndex + mesh.m_StartIndex;
+				drawCommand.vertexOffset  = 0;
+				drawCommand.firstInstance = (uint32_t)drawData.size();
+
+				drawData.push_back(draw);
+				drawCommands.push_back(drawCommand);
+			}
+		}
+
+		m_NumDraws = (uint32_t)drawData.size();
+
+		// Storage buffers can't be empty
+		if (drawData.empty())
+		{
+			drawData.push_back(SDrawData{});
+			drawCommands.push_back(VkDrawIndexedIndirectCommand{});
+		}
+
+		// Index buffers can't be empty either
+		if (indices.empty())
+			indices.push_back(0);
+
+		m_DrawDataBufferSize = sizeof(SDrawData) * drawData.size();
+		m_DrawDataBuffer     = CreateDeviceLocalBuffer(context, m_DrawDataMemory,     drawData.data(),     m_DrawDataBufferSize,                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		m_IndirectDrawBuffer = CreateDeviceLocalBuffer(context, m_IndirectDrawMemory, drawCommands.data(), sizeof(VkDrawIndexedIndirectCommand) * drawCommands.size(), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+		m_DrawIndexBuffer    = CreateDeviceLocalBuffer(context, m_DrawIndexMemory,    indices.data(),      sizeof(uint32_t) * indices.size(),                          VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	}
+
+	VkBuffer CModelManager::GetDrawDataBuffer()
+	{
+		return m_DrawDataBuffer;
+	}
+
+	VkDeviceSize CModelManager::GetDrawDataBufferSize()
+	{
+		return m_DrawDataBufferSize;
+	}
+
+	VkBuffer CModelManager::GetIndirectDrawBuffer()
+	{
+		return m_IndirectDrawBuffer;
+	}
+
+	void CModelManager::BindDrawIndexBuffer(VkCommandBuffer commandBuffer)
+	{
+		vkCmdBindIndexBuffer(commandBuffer, m_DrawIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	}
+
+	uint32_t CModelManager::GetFirstDrawIndex(uint32_t modelIndex)
+	{
+		return m_FirstDrawIndices[modelIndex];
+	}
+
+	uint32_t CModelManager::GetNumDraws()
+	{
+		return m_NumDraws;
+	}
+
+	void CModelManager::SetVertexPullingEnabled(bool isEnabled)
+	{
+		m_UseVertexPulling = isEnabled;
+	}
+
+	bool CModelManager::IsVertexPullingEnabled()
+	{
+		return m_UseVertexPulling;
+	}
+
 	void CModelManager::Cleanup(CGraphicsContext* context)
 	{
+		vkDestroyBuffer(context->GetLogicalDevice(), m_DrawDataBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_DrawDataMemory, nullptr);
+
+		vkDestroyBuffer(context->GetLogicalDevice(), m_IndirectDrawBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_IndirectDrawMemory, nullptr);
+
+		vkDestroyBuffer(context->GetLogicalDevice(), m_DrawIndexBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_DrawIndexMemory, nullptr);
+
+		vkDestroyBuffer(context->GetLogicalDevice(), m_MaterialBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_MaterialMemory, nullptr);
+
+		vkUnmapMemory(context->GetLogicalDevice(), m_ObjectTransformMemory);
+		vkDestroyBuffer(context->GetLogicalDevice(), m_ObjectTransformBuffer, nullptr);
+		vkFreeMemory(context->GetLogicalDevice(), m_ObjectTransformMemory, nullptr);
+
 		for (int i = 0; i < m_Models.size(); i++)
 		{
 			m_Models[i]->Cleanup(context);
@@ -15,6 +15,22 @@
 
 namespace NVulkanEngine
 {
+	// Matrices of one object as seen from one view. Computed on the CPU for all objects at once so the vertex shaders don't have to. Must match geometry.vert and shadow.vert
+	struct SObjectTransform
+	{
+		glm::mat4   m_ModelViewProjection = glm::identity<glm::mat4>();
+		glm::mat4   m_World               = glm::identity<glm::mat4>();
+		glm::mat3x4 m_NormalMatrix        = glm::mat3x4(1.0f); // Inverse transpose of the world matrix. Columns padded to vec4 the same way std430 does
+	};
+
+	// One mesh as seen by the vertex pulling shaders. The draw finds its own entry through firstInstance. Must match geometrypull.vert and shadowpull.vert
+	struct SDrawData
+	{
+		VkDeviceAddress m_VertexBufferAddress = 0;
+		uint32_t        m_ModelIndex          = 0; // Added to the object transform offset of the view
+		uint32_t        m_MaterialIndex       = 0;
+	};
+
 	class CModelManager
 	{
 	public:
@@ -26,19 +42,95 @@ namespace NVulkanEngine
 		void AddRotation(const glm::vec3& rotation);
 		void AddScaling(const glm::vec3& scaling);
 		void AddTexturePath(const std::string& textureFilepath);
+		void SetIsDynamic(bool isDynamic);
 		void PushModel();
 
 		uint32_t GetCurrentModelIndex();
 		CModel*  GetModel(uint32_t index);
 		const uint32_t GetNumModels();
+		bool HasDynamicModels();
 
 		void SetSceneBounds(glm::AABB sceneBounds);
 		glm::AABB GetSceneBounds();
 
+		// One set of object transforms per view and frame in flight. View 0 is the camera, the shadow cascades come after it
+		void CreateObjectTransformBuffer(CGraphicsContext* context, uint32_t numViews);
+		VkBuffer GetObjectTransformBuffer();
+		VkDeviceSize GetObjectTransformBufferSize();
+
+		// Transforms every model by the view projection and writes the result into this frame's part of the buffer
+		void UpdateObjectTransforms(CGraphicsContext* context, uint32_t viewIndex, const glm::mat4& viewProjection);
+
+		// Index of the model's transform in the buffer. Passed as firstInstance to the draw so it ends up in gl_InstanceIndex
+		uint32_t GetObjectTransformIndex(CGraphicsContext* context, uint32_t viewIndex, uint32_t modelIndex);
+
+		// Materials of every model in one buffer. Model textures have to be in the bindless table before this is called
+		void CreateMaterialBuffer(CGraphicsContext* context);
+		VkBuffer GetMaterialBuffer();
+		VkDeviceSize GetMaterialBufferSize();
+
+		// Index into the material buffer. This is all a draw needs to know about its material
+		uint32_t GetMaterialIndex(uint32_t modelIndex, uint32_t materialId);
+
+		// Changes are kept on the CPU until UploadDirtyMaterials() sends them to the material buffer
+		const SModelMaterial& GetMaterial(uint32_t materialIndex);
+		void SetMaterial(uint32_t materialIndex, const SModelMaterial& material);
+
+		// Records updates for the changed materials only. Must be outside of rendering. Returns the number of ranges uploaded
+		uint32_t UploadDirtyMaterials(VkCommandBuffer commandBuffer);
+		uint32_t GetNumMaterials() { return (uint32_t)m_Materials.size(); };
+
+		// Vertex pulling. Every mesh of every model gets a draw data entry and an indexed indirect draw command. The indices
+		// of all models share one index buffer, so all meshes can go out in one indirect draw with a single index buffer bind
+		void CreateDrawBuffers(CGraphicsContext* context);
+		VkBuffer GetDrawDataBuffer();
+		VkDeviceSize GetDrawDataBufferSize();
+		VkBuffer GetIndirectDrawBuffer();
+		void BindDrawIndexBuffer(VkCommandBuffer commandBuffer);
+
+		// Draws of a model are next to each other in the indirect draw buffer
+		uint32_t GetFirstDrawIndex(uint32_t modelIndex);
+		uint32_t GetNumDraws();
+
+		// Geometry and shadows fetch their vertices in the shader when this is on
+		void SetVertexPullingEnabled(bool isEnabled);
+		bool IsVertexPullingEnabled();
+
 		void Cleanup(CGraphicsContext* context);
 	private:
 		std::vector<CModel*> m_Models{};
 		int m_CurrentModelIndex = 0;
 		glm::AABB m_SceneBounds = {};
+
+		// Host visible and mapped for as long as it lives
+		VkBuffer          m_ObjectTransformBuffer   = VK_NULL_HANDLE;
+		VkDeviceMemory    m_ObjectTransformMemory   = VK_NULL_HANDLE;
+		SObjectTransform* m_MappedObjectTransforms  = nullptr;
+		uint32_t          m_NumObjectTransformViews = 0;
+
+		// World and normal matrices are the same for every view. Only rebuilt when the transform of the model changes
+		std::vector<glm::mat4>   m_WorldMatrices          = {};
+		std::vector<glm::mat3x4> m_NormalMatrices         = {};
+		std::vector<uint32_t>    m_WorldTransformVersions = {};
+
+		VkBuffer              m_MaterialBuffer       = VK_NULL_HANDLE;
+		VkDeviceMemory        m_MaterialMemory       = VK_NULL_HANDLE;
+		VkDeviceSize          m_MaterialBufferSize   = 0;
+		std::vector<uint32_t> m_FirstMaterialIndices = {}; // Where the materials of each model start
+
+		std::vector<SModelMaterial> m_Materials         = {}; // Same contents as the material buffer once dirty ones are uploaded
+		std::vector<bool>           m_IsMaterialDirty   = {};
+		uint32_t                    m_NumDirtyMaterials = 0;
+
+		VkBuffer              m_DrawDataBuffer       = VK_NULL_HANDLE;
+		VkDeviceMemory        m_DrawDataMemory       = VK_NULL_HANDLE;
+		VkDeviceSize          m_DrawDataBufferSize   = 0;
+		VkBuffer              m_IndirectDrawBuffer   = VK_NULL_HANDLE;
+		VkDeviceMemory        m_IndirectDrawMemory   = VK_NULL_HANDLE;
+		VkBuffer              m_DrawIndexBuffer      = VK_NULL_HANDLE; // Indices of every model after each other
+		VkDeviceMemory        m_DrawIndexMemory      = VK_NULL_HANDLE;
+		std::vector<uint32_t> m_FirstDrawIndices     = {}; // Where the draws of each model start
+		uint32_t              m_NumDraws             = 0;
+		bool                  m_UseVertexPulling     = false;
 	};
 };
\ No newline at end of file
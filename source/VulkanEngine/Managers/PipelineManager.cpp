@@ -1,7 +1,68 @@
 #include "PipelineManager.hpp"
 
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+// Next to the executable's working directory like the shaders
+static const char* g_PipelineCacheFilePath = "pipelinecache.bin";
+
 namespace NVulkanEngine
 {
+	void CPipelineManager::Init(CGraphicsContext* context)
+	{
+		std::vector<char> cacheData = {};
+
+		std::ifstream cacheFile(g_PipelineCacheFilePath, std::ios::binary | std::ios::ate);
+		if (cacheFile.is_open())
+		{
+			cacheData.resize((size_t)cacheFile.tellg());
+			cacheFile.seekg(0);
+			cacheFile.read(cacheData.data(), cacheData.size());
+
+			// Drivers are supposed to reject incompatible data themselves but not all of them do
+			if (!cacheFile || !IsCacheCompatible(context, cacheData))
+			{
+				std::cout << "Pipeline cache " << g_PipelineCacheFilePath << " is out of date. Starting with an empty cache" << std::endl;
+				cacheData.clear();
+			}
+		}
+
+		VkPipelineCacheCreateInfo cacheInfo{};
+		cacheInfo.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = cacheData.size();
+		cacheInfo.pInitialData    = cacheData.empty() ? nullptr : cacheData.data();
+
+		if (vkCreatePipelineCache(context->GetLogicalDevice(), &cacheInfo, nullptr, &m_PipelineCache) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
+
+		context->SetPipelineCache(m_PipelineCache);
+
+		std::cout << "Pipeline cache: loaded " << cacheData.size() / 1024 << " KB from " << g_PipelineCacheFilePath << std::endl;
+	}
+
+	bool CPipelineManager::IsCacheCompatible(CGraphicsContext* context, const std::vector<char>& cacheData)
+	{
+		VkPipelineCacheHeaderVersionOne header{};
+		if (cacheData.size() < sizeof(header))
+			return false;
+
+		memcpy(&header, cacheData.data(), sizeof(header));
+
+		VkPhysicalDeviceProperties deviceProperties{};
+		vkGetPhysicalDeviceProperties(context->GetPhysicalDevice(), &deviceProperties);
+
+		// The cache UUID changes with the driver version
+		return
+			header.headerSize    >= sizeof(header) &&
+			header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			header.vendorID      == deviceProperties.vendorID &&
+			header.deviceID      == deviceProperties.deviceID &&
+			memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
 
 	void CPipelineManager::RegisterPipeline(CPipeline* pipeline)
 	{
@@ -14,5 +75,31 @@ namespace NVulkanEngine
 		{
 			m_Pipelines[i]->CreatePipeline(context, desrcriptorLayout);
 		}
+
+		// Draw nodes register their pipelines again when they are re-initialized
+		m_Pipelines.clear();
+	}
+
+	void CPipelineManager::ReportCreationTime(const std::string& reason)
+	{
+		const SPipelineCreationStats creationStats = CPipeline::ConsumeCreationStats();
+		std::cout << reason << ": created " << creationStats.m_NumPipelines << " pipelines in " << creationStats.m_TimeMs << " ms" << std::endl;
+	}
+
+	void CPipelineManager::Cleanup(CGraphicsContext* context)
+	{
+		size_t cacheSize = 0;
+		vkGetPipelineCacheData(context->GetLogicalDevice(), m_PipelineCache, &cacheSize, nullptr);
+
+		std::vector<char> cacheData(cacheSize);
+		if (cacheSize > 0 && vkGetPipelineCacheData(context->GetLogicalDevice(), m_PipelineCache, &cacheSize, cacheData.data()) == VK_SUCCESS)
+		{
+			std::ofstream cacheFile(g_PipelineCacheFilePath, std::ios::binary | std::ios::trunc);
+			cacheFile.write(cacheData.data(), cacheSize);
+		}
+
+		vkDestroyPipelineCache(context->GetLogicalDevice(), m_PipelineCache, nullptr);
+		m_PipelineCache = VK_NULL_HANDLE;
+		context->SetPipelineCache(VK_NULL_HANDLE);
 	}
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include <DrawNodes/Utils/Pipeline.hpp>
 #include "GraphicsContext.hpp"
@@ -22,10 +23,25 @@ namespace NVulkanEngine
 		CPipelineManager() = default;
 		~CPipelineManager() = default;
 
+		// Loads the pipeline cache from disk and hands it to the context so every pipeline is created with it.
+		// Starts out empty if there is no cache file or if it was made by another device or driver
+		void Init(CGraphicsContext* context);
+
 		void RegisterPipeline(CPipeline* pipeline);
 		void CreatePipelines(CGraphicsContext* context, VkDescriptorSetLayout descriptorLayout);
 
+		// Prints the time spent creating pipelines since the last report
+		void ReportCreationTime(const std::string& reason);
+
+		VkPipelineCache GetPipelineCache() { return m_PipelineCache; };
+
+		// Saves the pipeline cache to disk
+		void Cleanup(CGraphicsContext* context);
+
 	private:
-		std::vector<CPipeline*> m_Pipelines = {};
+		bool IsCacheCompatible(CGraphicsContext* context, const std::vector<char>& cacheData);
+
+		std::vector<CPipeline*> m_Pipelines     = {};
+		VkPipelineCache         m_PipelineCache = VK_NULL_HANDLE;
 	};
 };
\ No newline at end of file
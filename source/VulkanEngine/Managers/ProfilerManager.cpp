@@ -0,0 +1,131 @@
+#include "ProfilerManager.hpp"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace NVulkanEngine
+{
+	void CProfilerManager::Init(CGraphicsContext* context)
+	{
+		VkPhysicalDeviceProperties deviceProperties{};
+		vkGetPhysicalDeviceProperties(context->GetPhysicalDevice(), &deviceProperties);
+
+		m_TimestampPeriod = deviceProperties.limits.timestampPeriod;
+		m_IsSupported     = deviceProperties.limits.timestampComputeAndGraphics == VK_TRUE;
+
+		if (!m_IsSupported)
+			return;
+
+		// Begin and end timestamp per timer for every frame in flight
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = MAX_GPU_TIMERS * 2 * g_MaxFramesInFlight;
+
+		if (vkCreateQueryPool(context->GetLogicalDevice(), &queryPoolInfo, nullptr, &m_QueryPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create timestamp query pool!");
+		}
+	}
+
+	void CProfilerManager::BeginFrame(CGraphicsContext* context, VkCommandBuffer commandBuffer, uint32_t frameIndex)
+	{
+		m_FrameIndex = frameIndex;
+
+		if (!m_IsSupported)
+			return;
+
+		const uint32_t firstQuery = frameIndex * MAX_GPU_TIMERS * 2;
+
+		std::vector<std::string>& timerNames = m_TimerNames[frameIndex];
+		if (!timerNames.empty())
+		{
+			std::vector<uint64_t> timestamps(timerNames.size() * 2);
+			VkResult result = vkGetQueryPoolResults(
+				context->GetLogicalDevice(),
+				m_QueryPool,
+				firstQuery,
+				(uint32_t)timestamps.size(),
+				timestamps.size() * sizeof(uint64_t),
+				timestamps.data(),
+				sizeof(uint64_t),
+				VK_QUERY_RESULT_64_BIT);
+
+			if (result == VK_SUCCESS)
+			{
+				for (uint32_t i = 0; i < timerNames.size(); i++)
+				{
+					const float timeMs = (float)(timestamps[i * 2 + 1] - timestamps[i * 2]) * m_TimestampPeriod / 1000000.0f;
+
+					auto timing = std::find_if(m_Timings.begin(), m_Timings.end(), [&](const SGpuTiming& gpuTiming) { return gpuTiming.m_Name == timerNames[i]; });
+					if (timing == m_Timings.end())
+						m_Timings.push_back({ timerNames[i], timeMs });
+					else
+						timing->m_TimeMs = timing->m_TimeMs * 0.9f + timeMs * 0.1f;
+				}
+			}
+		}
+		timerNames.clear();
+
+		// Also takes care of the reset queries need before their first use
+		vkCmdResetQueryPool(commandBuffer, m_QueryPool, firstQuery, MAX_GPU_TIMERS * 2);
+	}
+
+	uint32_t CProfilerManager::BeginTimer(VkCommandBuffer commandBuffer, const std::string& name)
+	{
+		std::vector<std::string>& timerNames = m_TimerNames[m_FrameIndex];
+		if (!m_IsSupported || timerNames.size() >= MAX_GPU_TIMERS)
+			return UINT32_MAX;
+
+		const uint32_t timerIndex = (uint32_t)timerNames.size();
+		timerNames.push_back(name);
+
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_QueryPool, (m_FrameIndex * MAX_GPU_TIMERS + timerIndex) * 2);
+
+		return timerIndex;
+	}
+
+	void CProfilerManager::EndTimer(VkCommandBuffer commandBuffer, uint32_t timerIndex)
+	{
+		if (timerIndex == UINT32_MAX)
+			return;
+
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_QueryPool, (m_FrameIndex * MAX_GPU_TIMERS + timerIndex) * 2 + 1);
+	}
+
+	const std::vector<SGpuTiming>& CProfilerManager::GetTimings()
+	{
+		return m_Timings;
+	}
+
+	void CProfilerManager::DrawTimings()
+	{
+		ImGui::Begin("GPU Timings");
+		if (!m_IsSupported)
+		{
+			ImGui::Text("Timestamps are not supported on this device!");
+		}
+		else
+		{
+			for (const SGpuTiming& timing : m_Timings)
+			{
+				ImGui::Text("%-24s %6.3f ms", timing.m_Name.c_str(), timing.m_TimeMs);
+			}
+		}
+		ImGui::End();
+	}
+
+	void CProfilerManager::Cleanup(CGraphicsContext* context)
+	{
+		vkDestroyQueryPool(context->GetLogicalDevice(), m_QueryPool, nullptr);
+		m_QueryPool = VK_NULL_HANDLE;
+
+		for (std::vector<std::string>& timerNames : m_TimerNames)
+		{
+			timerNames.clear();
+		}
+		m_Timings.clear();
+	}
+};
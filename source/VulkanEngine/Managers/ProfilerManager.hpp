@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <GraphicsContext.hpp>
+
+/*
+	GPU timings with timestamp queries. Results for a frame are read back the next time its frame index comes around since the fence has been waited on by then
+*/
+
+#define MAX_GPU_TIMERS 32
+
+namespace NVulkanEngine
+{
+	struct SGpuTiming
+	{
+		std::string m_Name   = "";
+		float       m_TimeMs = 0.0f; // Smoothed over a few frames
+	};
+
+	class CProfilerManager
+	{
+	public:
+		CProfilerManager() = default;
+		~CProfilerManager() = default;
+
+		void Init(CGraphicsContext* context);
+
+		// Reads back the timers recorded the last time this frame index was used and resets their queries. Call before any timers are started
+		void BeginFrame(CGraphicsContext* context, VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+		// Returns the timer to end. Timers can be nested but have to be ended on the graphics queue in the same frame
+		uint32_t BeginTimer(VkCommandBuffer commandBuffer, const std::string& name);
+		void     EndTimer(VkCommandBuffer commandBuffer, uint32_t timerIndex);
+
+		const std::vector<SGpuTiming>& GetTimings();
+
+		// ImGui window with all the timings
+		void DrawTimings();
+
+		void Cleanup(CGraphicsContext* context);
+	private:
+		VkQueryPool m_QueryPool       = VK_NULL_HANDLE;
+		float       m_TimestampPeriod = 0.0f; // Nanoseconds per tick
+		bool        m_IsSupported     = false;
+		uint32_t    m_FrameIndex      = 0;
+
+		// Names of the timers recorded for each frame in flight. Index in the list is the timer index
+		std::array<std::vector<std::string>, g_MaxFramesInFlight> m_TimerNames = {};
+
+		std::vector<SGpuTiming> m_Timings = {};
+	};
+};
@@ -0,0 +1,129 @@
+#include "RecordingManager.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace NVulkanEngine
+{
+	void CRecordingManager::Init(CGraphicsContext* context, CJobManager* jobManager)
+	{
+		m_JobManager = jobManager;
+
+		const uint32_t numThreads = jobManager->GetNumThreads();
+
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags            = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = context->GetQueueFamilyIndices()[0];
+
+		m_ThreadPools.resize(numThreads);
+		for (uint32_t i = 0; i < numThreads; i++)
+		{
+			for (uint32_t frame = 0; frame < g_MaxFramesInFlight; frame++)
+			{
+				if (vkCreateCommandPool(context->GetLogicalDevice(), &poolInfo, nullptr, &m_ThreadPools[i][frame].m_CommandPool) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to create recording command pool!");
+				}
+			}
+		}
+	}
+
+	void CRecordingManager::BeginFrame(CGraphicsContext* context, uint32_t frameIndex)
+	{
+		m_FrameIndex = frameIndex;
+
+		for (std::array<SThreadCommandPool, g_MaxFramesInFlight>& threadPools : m_ThreadPools)
+		{
+			SThreadCommandPool& pool = threadPools[frameIndex];
+			if (pool.m_NumUsed == 0)
+				continue;
+
+			vkResetCommandPool(context->GetLogicalDevice(), pool.m_CommandPool, 0);
+			pool.m_NumUsed = 0;
+		}
+	}
+
+	VkCommandBuffer CRecordingManager::GetCommandBuffer(CGraphicsContext* context, uint32_t threadIndex)
+	{
+		SThreadCommandPool& pool = m_ThreadPools[threadIndex][m_FrameIndex];
+
+		if (pool.m_NumUsed == pool.m_CommandBuffers.size())
+		{
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType              = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool        = pool.m_CommandPool;
+			allocInfo.level              = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			if (vkAllocateCommandBuffers(context->GetLogicalDevice(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			}
+			pool.m_CommandBuffers.push_back(commandBuffer);
+		}
+
+		return pool.m_CommandBuffers[pool.m_NumUsed++];
+	}
+
+	std::vector<VkCommandBuffer> CRecordingManager::RecordSecondary(
+		CGraphicsContext*                                                   context,
+		const SRenderingInheritance&                                        inheritance,
+		uint32_t                                                            numChunks,
+		const std::function<void(VkCommandBuffer commandBuffer, uint32_t chunkIndex)>& record)
+	{
+		std::vector<VkCommandBuffer> commandBuffers(numChunks, VK_NULL_HANDLE);
+
+		VkCommandBufferInheritanceRenderingInfo renderingInfo{};
+		renderingInfo.sType                   = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+		renderingInfo.colorAttachmentCount    = (uint32_t)inheritance.m_ColorFormats.size();
+		renderingInfo.pColorAttachmentFormats = inheritance.m_ColorFormats.data();
+		renderingInfo.depthAttachmentFormat   = inheritance.m_DepthFormat;
+		renderingInfo.rasterizationSamples    = VK_SAMPLE_COUNT_1_BIT;
+
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.pNext = &renderingInfo;
+
+		// One chunk per batch. Chunks are coarse so the scheduling cost does not matter
+		m_JobManager->ParallelFor(numChunks, 1, [&](uint32_t chunkIndex, uint32_t chunkEnd, uint32_t threadIndex)
+		{
+			VkCommandBuffer commandBuffer = GetCommandBuffer(context, threadIndex);
+
+			VkCommandBufferBeginInfo beginInfo{};
+			beginInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags            = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+			if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to begin recording secondary command buffer!");
+			}
+
+			record(commandBuffer, chunkIndex);
+
+			if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to record secondary command buffer!");
+			}
+
+			commandBuffers[chunkIndex] = commandBuffer;
+		});
+
+		return commandBuffers;
+	}
+
+	void CRecordingManager::Cleanup(CGraphicsContext* context)
+	{
+		// Destroying the pools frees their command buffers too
+		for (std::array<SThreadCommandPool, g_MaxFramesInFlight>& threadPools : m_ThreadPools)
+		{
+			for (SThreadCommandPool& pool : threadPools)
+			{
+				vkDestroyCommandPool(context->GetLogicalDevice(), pool.m_CommandPool, nullptr);
+			}
+		}
+		m_ThreadPools.clear();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <vector>
+
+#include <GraphicsContext.hpp>
+#include <Managers/JobManager.hpp>
+
+/*
+	Records secondary command buffers on the job system threads. A command pool can only be used by one thread at a time so every
+	job thread gets its own pool per frame in flight. The pools of a frame are reset at once in BeginFrame
+*/
+
+namespace NVulkanEngine
+{
+	// Attachment formats of the rendering the secondary command buffers are executed in
+	struct SRenderingInheritance
+	{
+		std::vector<VkFormat> m_ColorFormats = {};
+		VkFormat              m_DepthFormat  = VK_FORMAT_UNDEFINED;
+	};
+
+	class CRecordingManager
+	{
+	public:
+		CRecordingManager() = default;
+		~CRecordingManager() = default;
+
+		// Creates a command pool per job thread. The job manager must outlive this
+		void Init(CGraphicsContext* context, CJobManager* jobManager);
+
+		// Call after the fence of the frame has been waited on
+		void BeginFrame(CGraphicsContext* context, uint32_t frameIndex);
+
+		// Calls record once per chunk, spread over the job threads, and returns when every chunk is done.
+		// The command buffers are in chunk order. Execute them inside rendering begun with VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT
+		std::vector<VkCommandBuffer> RecordSecondary(
+			CGraphicsContext*                                                   context,
+			const SRenderingInheritance&                                        inheritance,
+			uint32_t                                                            numChunks,
+			const std::function<void(VkCommandBuffer commandBuffer, uint32_t chunkIndex)>& record);
+
+		uint32_t GetNumThreads() { return (uint32_t)m_ThreadPools.size(); };
+
+		void Cleanup(CGraphicsContext* context);
+
+	private:
+		struct SThreadCommandPool
+		{
+			VkCommandPool                m_CommandPool    = VK_NULL_HANDLE;
+			std::vector<VkCommandBuffer> m_CommandBuffers = {}; // Allocated as needed and reused every time the pool is reset
+			uint32_t                     m_NumUsed        = 0;
+		};
+
+		VkCommandBuffer GetCommandBuffer(CGraphicsContext* context, uint32_t threadIndex);
+
+		CJobManager* m_JobManager = nullptr;
+
+		// Indexed by CJobManager::GetThreadIndex
+		std::vector<std::array<SThreadCommandPool, g_MaxFramesInFlight>> m_ThreadPools = {};
+		uint32_t                                                          m_FrameIndex  = 0;
+	};
+};
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <VulkanGraphicsEngineUtils.hpp>
 #include <backends/imgui_impl_vulkan.h>
 
+#include <chrono>
+
 namespace NVulkanEngine
 {
 	CResourceManager::CResourceManager(VkInstance vulkanInstance)
@@ -12,6 +14,11 @@ namespace NVulkanEngine
 		m_BindlessBuffer = new CBindlessBuffer();
 	}
 
+	void CResourceManager::Init(CGraphicsContext* context)
+	{
+		m_BindlessBuffer->CreateBindings(context);
+	}
+
 	SRenderResource CResourceManager::AddRenderResource(
 		CGraphicsContext*     context,
 		const std::string     debugName,
@@ -22,22 +29,33 @@ namespace NVulkanEngine
 		VkImageUsageFlags     usage,
 		VkImageLayout         imageLayout,
 		uint32_t              width,
-		uint32_t              height)
+		uint32_t              height,
+		VkImageViewType       viewType,
+		uint32_t              layerCount)
 	{
-		SRenderResource renderResource  = CreateRenderResource(context, format, usage, imageLayout, width, height);
+		SRenderResourceAllocation& allocation = m_RenderResourceAllocations[(uint32_t)attachmentIndex];
+		allocation                 = {};
+		allocation.m_Sampler       = sampler;
+		allocation.m_ShaderStages  = shaderStageUsageFlags;
+		allocation.m_InitialLayout = imageLayout;
+		allocation.m_ViewType      = viewType;
 
-		// ImGui allocates a descriptor with VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER where there are some image layouts that are not allowed
-		VkImageLayout imGuiImageLayout = renderResource.m_CurrentImageLayout;
-		if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+		// Attachments that are never sampled or copied never have to leave the tile on tiled GPUs. Let the driver lazily back them
+		const VkImageUsageFlags attachmentOnlyUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+		if ((usage & ~attachmentOnlyUsage) == 0 && FindMemoryType(context->GetPhysicalDevice(), UINT32_MAX, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) >= 0)
 		{
-			imGuiImageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
-		}
-		else if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
-		{
-			imGuiImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			allocation.m_IsTransient = true;
 		}
 
-		renderResource.m_ImguiDescriptor  = ImGui_ImplVulkan_AddTexture(sampler, renderResource.m_ImageView, imGuiImageLayout);
+		SRenderResource renderResource{};
+		renderResource.m_Format     = format;
+		renderResource.m_ImageUsage = usage;
+		renderResource.m_Extent     = { width, height };
+		renderResource.m_LayerCount = layerCount;
+		renderResource.m_Image      = CreateUnboundImage(context, width, height, 1, VK_SAMPLE_COUNT_1_BIT, format, VK_IMAGE_TILING_OPTIMAL, usage, layerCount);
+
+		vkGetImageMemoryRequirements(context->GetLogicalDevice(), renderResource.m_Image, &allocation.m_MemoryRequirements);
 
 		// If no name is provided resource uses default name
 		if (debugName.length() > 0)
@@ -54,13 +72,198 @@ namespace NVulkanEngine
 			m_VkSetDebugUtilsObjectNameEXT(context->GetLogicalDevice(), &nameInfo);
 		}
 
-		// Add to the bindless table
-		m_BindlessBuffer->AddSampledImageBinding((uint32_t)attachmentIndex, shaderStageUsageFlags, renderResource.m_ImageView, format, sampler);
-
 		m_RenderResources[(uint32_t)attachmentIndex] = renderResource;
 		return renderResource;
 	}
 
+	void CResourceManager::MarkResourceUsage(EResourceIndices renderIndex, uint32_t drawNodeIndex)
+	{
+		SRenderResourceLifetime& lifetime = m_RenderResourceLifetimes[(uint32_t)renderIndex];
+		lifetime.m_FirstUse = std::min(lifetime.m_FirstUse, drawNodeIndex);
+		lifetime.m_LastUse  = std::max(lifetime.m_LastUse, drawNodeIndex);
+	}
+
+	void CResourceManager::MarkResourcePersistent(EResourceIndices renderIndex)
+	{
+		m_RenderResourceLifetimes[(uint32_t)renderIndex].m_IsPersistent = true;
+	}
+
+	static bool LifetimesOverlap(const SRenderResourceLifetime& first, const SRenderResourceLifetime& second)
+	{
+		// Resources nobody told us about have to stay alive the whole frame
+		if (first.m_FirstUse == UINT32_MAX || second.m_FirstUse == UINT32_MAX)
+			return true;
+
+		// Alive across the frame boundary
+		if (first.m_IsPersistent || second.m_IsPersistent)
+			return true;
+
+		return first.m_FirstUse <= second.m_LastUse && second.m_FirstUse <= first.m_LastUse;
+	}
+
+	void CResourceManager::AllocateRenderResources(CGraphicsContext* context)
+	{
+		struct SAliasingSlot
+		{
+			uint32_t              m_MemoryTypeIndex = 0;
+			VkDeviceSize          m_Offset          = 0;
+			VkDeviceSize          m_Size            = 0;
+			std::vector<uint32_t> m_Resources       = {};
+		};
+
+		// Biggest first so the smaller resources can be packed into memory the big ones are not using
+		std::vector<uint32_t> sortedResources = {};
+		for (uint32_t i = 0; i < m_RenderResources.size(); i++)
+		{
+			if (m_RenderResources[i].m_Image != VK_NULL_HANDLE)
+				sortedResources.push_back(i);
+		}
+		std::sort(sortedResources.begin(), sortedResources.end(), [this](uint32_t first, uint32_t second)
+		{
+			return m_RenderResourceAllocations[first].m_MemoryRequirements.size > m_RenderResourceAllocations[second].m_MemoryRequirements.size;
+		});
+
+		std::vector<SAliasingSlot> slots = {};
+		std::array<VkDeviceSize, VK_MAX_MEMORY_TYPES> heapSizes = {};
+
+		m_RenderResourceMemorySizeWithoutAliasing = 0;
+
+		for (uint32_t resourceIndex : sortedResources)
+		{
+			SRenderResourceAllocation& allocation = m_RenderResourceAllocations[resourceIndex];
+			const VkMemoryRequirements& requirements = allocation.m_MemoryRequirements;
+
+			m_RenderResourceMemorySizeWithoutAliasing += requirements.size;
+
+			int memoryTypeIndex = -1;
+			if (allocation.m_IsTransient)
+				memoryTypeIndex = FindMemoryType(context->GetPhysicalDevice(), requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+			if (memoryTypeIndex < 0)
+				memoryTypeIndex = FindMemoryType(context->GetPhysicalDevice(), requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			if (memoryTypeIndex < 0)
+				throw std::runtime_error("failed to find memory type for render resource!");
+
+			allocation.m_MemoryTypeIndex = (uint32_t)memoryTypeIndex;
+
+			// Look for memory already handed out to resources that are never alive at the same time as this one
+			int32_t slotIndex = -1;
+			for (uint32_t i = 0; i < slots.size() && slotIndex < 0; i++)
+			{
+				const SAliasingSlot& slot = slots[i];
+				if (slot.m_MemoryTypeIndex != allocation.m_MemoryTypeIndex || slot.m_Size < requirements.size || slot.m_Offset % requirements.alignment != 0)
+					continue;
+
+				bool overlaps = false;
+				for (uint32_t otherResourceIndex : slot.m_Resources)
+				{
+					overlaps |= LifetimesOverlap(m_RenderResourceLifetimes[resourceIndex], m_RenderResourceLifetimes[otherResourceIndex]);
+				}
+
+				if (!overlaps)
+					slotIndex = (int32_t)i;
+			}
+
+			if (slotIndex < 0)
+			{
+				VkDeviceSize& heapSize = heapSizes[allocation.m_MemoryTypeIndex];
+
+				SAliasingSlot slot{};
+				slot.m_MemoryTypeIndex = allocation.m_MemoryTypeIndex;
+				slot.m_Offset          = (heapSize + requirements.alignment - 1) / requirements.alignment * requirements.alignment;
+				slot.m_Size            = requirements.size;
+				heapSize               = slot.m_Offset + slot.m_Size;
+
+				slots.push_back(slot);
+				slotIndex = (int32_t)slots.size() - 1;
+			}
+			else
+			{
+				for (uint32_t otherResourceIndex : slots[slotIndex].m_Resources)
+				{
+					m_RenderResourceAllocations[otherResourceIndex].m_IsAliased = true;
+				}
+				allocation.m_IsAliased = true;
+			}
+
+			slots[slotIndex].m_Resources.push_back(resourceIndex);
+			allocation.m_MemoryOffset = slots[slotIndex].m_Offset;
+		}
+
+		std::array<VkDeviceMemory, VK_MAX_MEMORY_TYPES> heaps = {};
+
+		m_RenderResourceMemorySize = 0;
+		for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+		{
+			if (heapSizes[i] == 0)
+				continue;
+
+			VkMemoryAllocateInfo allocInfo{};
+			allocInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			allocInfo.allocationSize  = heapSizes[i];
+			allocInfo.memoryTypeIndex = i;
+
+			if (vkAllocateMemory(context->GetLogicalDevice(), &allocInfo, nullptr, &heaps[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate render resource memory!");
+			}
+
+			m_RenderResourceHeaps.push_back(heaps[i]);
+			m_RenderResourceMemorySize += heapSizes[i];
+		}
+
+		for (uint32_t resourceIndex : sortedResources)
+		{
+			const SRenderResourceAllocation& allocation = m_RenderResourceAllocations[resourceIndex];
+			SRenderResource& renderResource = m_RenderResources[resourceIndex];
+
+			VkDeviceMemory heap = heaps[allocation.m_MemoryTypeIndex];
+			vkBindImageMemory(context->GetLogicalDevice(), renderResource.m_Image, heap, allocation.m_MemoryOffset);
+
+			SRenderResource boundResource = CreateRenderResource(context, renderResource.m_Image, heap, renderResource.m_Format, renderResource.m_ImageUsage, allocation.m_InitialLayout, allocation.m_ViewType, renderResource.m_LayerCount);
+			memcpy(boundResource.m_DebugName, renderResource.m_DebugName, 64);
+			boundResource.m_Extent = renderResource.m_Extent;
+			renderResource = boundResource;
+
+			// ImGui and the bindless table expect plain 2D images so use the first layer of array resources
+			VkImageView sampledImageView = renderResource.m_LayerImageViews.empty() ? renderResource.m_ImageView : renderResource.m_LayerImageViews[0];
+
+			// Transient attachments can't be sampled so there is nothing to show in ImGui
+			if (!allocation.m_IsTransient)
+			{
+				// ImGui allocates a descriptor with VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER where there are some image layouts that are not allowed
+				VkImageLayout imGuiImageLayout = renderResource.m_CurrentImageLayout;
+				if (renderResource.m_ImageUsage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+				{
+					imGuiImageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+				}
+				else if (renderResource.m_ImageUsage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+				{
+					imGuiImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				}
+
+				renderResource.m_ImguiDescriptor = ImGui_ImplVulkan_AddTexture(allocation.m_Sampler, sampledImageView, imGuiImageLayout);
+
+				// Add to the bindless table
+				m_BindlessBuffer->AddSampledImageBinding(context, resourceIndex, sampledImageView, renderResource.m_Format, allocation.m_Sampler);
+			}
+		}
+
+#if defined(_DEBUG)
+		std::cout << "Render resources: " << m_RenderResourceMemorySizeWithoutAliasing / (1024 * 1024) << " MB without aliasing, "
+			<< m_RenderResourceMemorySize / (1024 * 1024) << " MB in " << m_RenderResourceHeaps.size() << " heap(s) with aliasing" << std::endl;
+#endif
+	}
+
+	void CResourceManager::BeginDrawNode(uint32_t drawNodeIndex)
+	{
+		for (uint32_t i = 0; i < m_RenderResources.size(); i++)
+		{
+			// Whatever is in aliased memory when a resource comes alive belongs to someone else
+			if (m_RenderResourceAllocations[i].m_IsAliased && m_RenderResourceLifetimes[i].m_FirstUse == drawNodeIndex)
+				m_DiscardContents[i] = true;
+		}
+	}
+
 	SUniformBufferResource CResourceManager::AddUniformBuffer(
 		CGraphicsContext*  context, 
 		const std::string& debugName,
@@ -84,11 +287,64 @@ namespace NVulkanEngine
 
 		m_BufferResources[(uint32_t) uniformBufferIndex] = uniformBufferResource;
 
-		m_BindlessBuffer->AddUniformBufferBinding((uint32_t)uniformBufferIndex, VK_SHADER_STAGE_ALL, (uint32_t)uniformBufferSize);
+		m_BindlessBuffer->AddUniformBufferBinding(context, (uint32_t)uniformBufferIndex, uniformBuffer, uniformBufferSize);
 
 		return uniformBufferResource;
 	}
 
+	void CResourceManager::AddBindlessStorageBuffer(CGraphicsContext* context, EStorageBufferIndices storageBufferIndex, VkBuffer buffer, VkDeviceSize bufferSize)
+	{
+		m_BindlessBuffer->AddStorageBufferBinding(context, (uint32_t)storageBufferIndex, buffer, bufferSize);
+	}
+
+	uint32_t CResourceManager::AddBindlessTexture(CGraphicsContext* context, VkImageView imageView, VkFormat format, VkSampler sampler)
+	{
+		if (m_NumBindlessTextures >= g_MaxBindlessTextures - g_NumStreamedBindlessTextures)
+		{
+			throw std::runtime_error("out of bindless texture slots!");
+		}
+
+		const uint32_t textureIndex = m_NumBindlessTextures++;
+		m_BindlessBuffer->AddSampledImageBinding(context, textureIndex, imageView, format, sampler);
+
+		m_StreamedTextureView    = imageView;
+		m_StreamedTextureFormat  = format;
+		m_StreamedTextureSampler = sampler;
+
+		return textureIndex;
+	}
+
+	float CResourceManager::StreamBindlessTextures(CGraphicsContext* context)
+	{
+		if (m_StreamedTextureView == VK_NULL_HANDLE)
+			return 0.0f;
+
+		const auto writeStart = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < g_NumStreamedBindlessTextures; i++)
+		{
+			m_BindlessBuffer->AddSampledImageBinding(context, g_MaxBindlessTextures - g_NumStreamedBindlessTextures + i, m_StreamedTextureView, m_StreamedTextureFormat, m_StreamedTextureSampler);
+		}
+
+		return std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - writeStart).count();
+	}
+
+	VkDescriptorSetLayout CResourceManager::GetBindlessDescriptorLayout()
+	{
+		return m_BindlessBuffer->GetDescriptorSetLayout();
+	}
+
+	void CResourceManager::BindBindlessTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkPipelineBindPoint bindPoint)
+	{
+		m_BindlessBuffer->BindTable(context, commandBuffer, pipelineLayout, bindPoint);
+	}
+
+	bool CResourceManager::ConsumeResourceRecreationRequest()
+	{
+		const bool recreationRequested = m_RecreationRequested;
+		m_RecreationRequested = false;
+		return recreationRequested;
+	}
+
 	const SRenderResource CResourceManager::GetRenderResource(const EResourceIndices index)
 	{
 		return m_RenderResources[(uint32_t)index];
@@ -99,6 +355,21 @@ namespace NVulkanEngine
 		return m_BufferResources[(uint32_t)index];
 	}
 
+	bool CResourceManager::IsRenderResourceAliased(EResourceIndices renderIndex)
+	{
+		return m_RenderResourceAllocations[(uint32_t)renderIndex].m_IsAliased;
+	}
+
+	VkDeviceSize CResourceManager::GetRenderResourceMemorySize()
+	{
+		return m_RenderResourceMemorySize;
+	}
+
+	VkDeviceSize CResourceManager::GetRenderResourceMemorySizeWithoutAliasing()
+	{
+		return m_RenderResourceMemorySizeWithoutAliasing;
+	}
+
 	const std::array<SRenderResource, (uint32_t)EResourceIndices::Count> CResourceManager::GetRenderResources()
 	{
 		return m_RenderResources;
@@ -117,6 +388,27 @@ namespace NVulkanEngine
 	{
 		SRenderResource& attachment = m_RenderResources[(uint32_t)index];
 
+		if (m_DiscardContents[(uint32_t)index])
+		{
+			// Memory is shared with a resource used earlier in the frame. Wait for it to be done before we start writing over it
+			VkMemoryBarrier aliasingBarrier{};
+			aliasingBarrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			aliasingBarrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			aliasingBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+			vkCmdPipelineBarrier(
+				commandBuffer,
+				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				0,
+				1, &aliasingBarrier,
+				0, nullptr,
+				0, nullptr);
+
+			attachment.m_CurrentImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			m_DiscardContents[(uint32_t)index] = false;
+		}
+
 		if (wantedLayout != VK_IMAGE_LAYOUT_UNDEFINED && wantedLayout != attachment.m_CurrentImageLayout)
 			TransitionImageLayout(commandBuffer, attachment, wantedLayout, 1);
 
@@ -131,11 +423,33 @@ namespace NVulkanEngine
 		for (uint32_t i = 0; i < m_RenderResources.size(); i++)
 		{
 			vkDestroyImageView(context->GetLogicalDevice(), m_RenderResources[i].m_ImageView, nullptr);
+			for (VkImageView layerImageView : m_RenderResources[i].m_LayerImageViews)
+			{
+				vkDestroyImageView(context->GetLogicalDevice(), layerImageView, nullptr);
+			}
 			vkDestroyImage(context->GetLogicalDevice(), m_RenderResources[i].m_Image, nullptr);
-			vkFreeMemory(context->GetLogicalDevice(), m_RenderResources[i].m_Memory, nullptr);
 
-			ImGui_ImplVulkan_RemoveTexture(m_RenderResources[i].m_ImguiDescriptor);
-			m_RenderResources[i] = {};			 
+			if (m_RenderResources[i].m_ImguiDescriptor != VK_NULL_HANDLE)
+				ImGui_ImplVulkan_RemoveTexture(m_RenderResources[i].m_ImguiDescriptor);
+
+			m_RenderResources[i]           = {};
+			m_RenderResourceLifetimes[i]   = {};
+			m_RenderResourceAllocations[i] = {};
+			m_DiscardContents[i]           = false;
+		}
+
+		// Memory is shared between resources so it is freed separately
+		for (VkDeviceMemory heap : m_RenderResourceHeaps)
+		{
+			vkFreeMemory(context->GetLogicalDevice(), heap, nullptr);
 		}
+		m_RenderResourceHeaps.clear();
+	}
+
+	void CResourceManager::CleanupBindlessTable(CGraphicsContext* context)
+	{
+		m_BindlessBuffer->Cleanup(context);
+		delete m_BindlessBuffer;
+		m_BindlessBuffer = nullptr;
 	}
-};
+};
\ No newline at end of file
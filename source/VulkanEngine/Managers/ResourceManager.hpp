@@ -3,6 +3,7 @@
 
 #include <array>
 #include <string>
+#include <vector>
 
 #include <GraphicsContext.hpp>
 #include <VulkanGraphicsEngineUtils.hpp>
@@ -14,13 +15,13 @@
 
 enum class EResourceIndices : uint32_t
 {
-	Positions          = 0,
-	Normals            = 1,
-	Albedo             = 2,
-	Depth              = 3,
-	ShadowMap          = 4,
-	SceneColor         = 5,
-	AtmosphericsSkyBox = 6,
+	Normals            = 0,
+	Albedo             = 1,
+	Depth              = 2,
+	ShadowMap          = 3,
+	SceneColor         = 4,
+	AtmosphericsSkyBox = 5,
+	ShadowMapStatic    = 6,
 	Count              = 7
 };
 
@@ -34,14 +35,51 @@ enum class EBufferIndices : uint32_t
 	Count        = 5,
 };
 
+// Slots of the storage buffers in the bindless table. Must match the shaders that use them
+enum class EStorageBufferIndices : uint32_t
+{
+	ObjectTransforms = 0,
+	Materials        = 1,
+	DrawData         = 2,
+	Count            = 3
+};
+
+// The last bindless texture slots are kept free for the texture streaming test
+static const uint32_t g_NumStreamedBindlessTextures = 256;
+
 namespace NVulkanEngine
 {
+	// First and last draw node (in render order) that touches a render resource
+	struct SRenderResourceLifetime
+	{
+		uint32_t m_FirstUse     = UINT32_MAX;
+		uint32_t m_LastUse      = 0;
+		bool     m_IsPersistent = false; // Contents have to survive until the next frame
+	};
+
+	// Where in the render resource heaps a resource ended up
+	struct SRenderResourceAllocation
+	{
+		VkMemoryRequirements  m_MemoryRequirements = {};
+		uint32_t              m_MemoryTypeIndex    = 0;
+		VkDeviceSize          m_MemoryOffset       = 0;
+		VkSampler             m_Sampler            = VK_NULL_HANDLE;
+		VkShaderStageFlagBits m_ShaderStages       = VK_SHADER_STAGE_FRAGMENT_BIT;
+		VkImageLayout         m_InitialLayout      = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageViewType       m_ViewType           = VK_IMAGE_VIEW_TYPE_2D;
+		bool                  m_IsTransient        = false;
+		bool                  m_IsAliased          = false;
+	};
+
 	class CResourceManager
 	{
 	public:
 		CResourceManager(VkInstance vulkanInstance);
 		~CResourceManager() = default;
 
+		// Creates the bindless table. It lives until CleanupBindlessTable so it survives resource recreation
+		void Init(CGraphicsContext* context);
+
 		SRenderResource AddRenderResource(
 			CGraphicsContext*     context,
 			const std::string     debugName,
@@ -52,7 +90,21 @@ namespace NVulkanEngine
 			VkImageUsageFlags     usage,
 			VkImageLayout         imageLayout,
 			uint32_t              width,
-			uint32_t              height);
+			uint32_t              height,
+			VkImageViewType       viewType   = VK_IMAGE_VIEW_TYPE_2D,
+			uint32_t              layerCount = 1);
+
+		// Let the manager know that a draw node reads or writes the resource. Must be done before AllocateRenderResources
+		void MarkResourceUsage(EResourceIndices renderIndex, uint32_t drawNodeIndex);
+
+		// Resource keeps its contents between frames so it can never share memory. Must be done before AllocateRenderResources
+		void MarkResourcePersistent(EResourceIndices renderIndex);
+
+		// Binds memory to every render resource added so far. Resources whose lifetimes never overlap share the same memory
+		void AllocateRenderResources(CGraphicsContext* context);
+
+		// Call before recording a draw node so aliased resources know when their contents can be thrown away
+		void BeginDrawNode(uint32_t drawNodeIndex);
 
 		SUniformBufferResource AddUniformBuffer(
 			CGraphicsContext* context,
@@ -66,20 +118,60 @@ namespace NVulkanEngine
 		// Returns the buffer if it has been created. You cannot modify this
 		const SUniformBufferResource GetBufferResource(EBufferIndices bufferIndex);
 		
+		// Storage buffers that shaders read through the bindless table
+		void AddBindlessStorageBuffer(CGraphicsContext* context, EStorageBufferIndices storageBufferIndex, VkBuffer buffer, VkDeviceSize bufferSize);
+
+		// Textures that aren't render resources, e.g model textures. Returns the index shaders use to sample it
+		uint32_t AddBindlessTexture(CGraphicsContext* context, VkImageView imageView, VkFormat format, VkSampler sampler);
+
+		// Writes the last added bindless texture into every slot reserved for streaming. No shader reads them.
+		// Returns the CPU time in milliseconds so the descriptor backends can be compared
+		float StreamBindlessTextures(CGraphicsContext* context);
+
 		VkDescriptorSetLayout GetBindlessDescriptorLayout();
+		void BindBindlessTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS);
 
 		const std::array<SRenderResource, (uint32_t)EResourceIndices::Count> GetRenderResources();
 		const std::array<SUniformBufferResource, (uint32_t)EBufferIndices::Count> GetBufferResources();
 
+		bool IsRenderResourceAliased(EResourceIndices renderIndex);
+
+		// Total memory used by render resources with and without aliasing
+		VkDeviceSize GetRenderResourceMemorySize();
+		VkDeviceSize GetRenderResourceMemorySizeWithoutAliasing();
+
+		// Draw nodes can ask for all render resources to be recreated, e.g when a resolution setting changes. Handled by the engine at the start of the next frame
+		void RequestResourceRecreation() { m_RecreationRequested = true; };
+		bool ConsumeResourceRecreationRequest();
+
 		// Returns the attachment in state ready for rendering
 		SRenderResource TransitionResource(VkCommandBuffer commandBuffer, EResourceIndices index,VkAttachmentLoadOp loadOperation, VkImageLayout wantedState);
 
 		void Cleanup(CGraphicsContext* context);
+		void CleanupBindlessTable(CGraphicsContext* context);
 	private:
 		std::array<SRenderResource, (uint32_t)EResourceIndices::Count> m_RenderResources = {};
 		std::array<SUniformBufferResource, (uint32_t)EBufferIndices::Count>   m_BufferResources = {};
 
-		CBindlessBuffer* m_BindlessBuffer = nullptr;
+		std::array<SRenderResourceLifetime, (uint32_t)EResourceIndices::Count>   m_RenderResourceLifetimes   = {};
+		std::array<SRenderResourceAllocation, (uint32_t)EResourceIndices::Count> m_RenderResourceAllocations = {};
+		std::array<bool, (uint32_t)EResourceIndices::Count>                      m_DiscardContents           = {};
+
+		// One heap per memory type that all render resources are placed in
+		std::vector<VkDeviceMemory> m_RenderResourceHeaps = {};
+
+		VkDeviceSize m_RenderResourceMemorySize                = 0;
+		VkDeviceSize m_RenderResourceMemorySizeWithoutAliasing = 0;
+
+		bool m_RecreationRequested = false;
+
+		// Render resources take the first texture slots, in the same order as EResourceIndices
+		CBindlessBuffer* m_BindlessBuffer      = nullptr;
+		uint32_t         m_NumBindlessTextures = (uint32_t)EResourceIndices::Count;
+
+		VkImageView      m_StreamedTextureView    = VK_NULL_HANDLE;
+		VkFormat         m_StreamedTextureFormat  = VK_FORMAT_UNDEFINED;
+		VkSampler        m_StreamedTextureSampler = VK_NULL_HANDLE;
 
 		// To mark attachments with debug names
 		PFN_vkSetDebugUtilsObjectNameEXT m_VkSetDebugUtilsObjectNameEXT = nullptr;
@@ -279,9 +279,11 @@ namespace NVulkanEngine
 			context,		
 			m_VertexBufferMemory,
 			bufferSize,
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, // Storage so vertex pulling can read it by address
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
+		m_VertexBufferAddress = GetBufferDeviceAddress(context, m_VertexBuffer);
+
 		/* Copy staging buffer to device*/
 		CopyBuffer(context, stagingBuffer, m_VertexBuffer, bufferSize);
 
@@ -335,46 +337,40 @@ namespace NVulkanEngine
 		return generatedNormal;
 	}
 
-	void CModel::CreateGeometryMemoryBuffer(CGraphicsContext* context, const VkDeviceSize size)
-	{
-		m_GeometryBuffer.m_Buffer = CreateUniformBuffer(context, m_GeometryBuffer.m_Memory, size);
-		m_GeometryBufferSize = (uint32_t)size;
-	}
-
-	void CModel::CreateShadowMemoryBuffer(CGraphicsContext* context, const VkDeviceSize size)
+	SDescriptorSets& CModel::GetDescriptorSetsRef()
 	{
-		m_ShadowBuffer.m_Buffer = CreateUniformBuffer(context, m_ShadowBuffer.m_Memory, size);
-		m_ShadowBufferSize = (uint32_t)size;
+		return m_DescriptorSets;
 	}
 
-	SUniformMemoryBuffer CModel::GetGeometryMemoryBuffer()
+	SDescriptorSets CModel::GetDescriptorSets()
 	{
-		return m_GeometryBuffer;
+		return m_DescriptorSets;
 	}
 
-	SUniformMemoryBuffer CModel::GetShadowMemoryBuffer()
+	glm::mat4 CModel::GetTransform()
 	{
-		return m_ShadowBuffer;
+		return m_Transform;
 	}
 
-	SDescriptorSets& CModel::GetDescriptorSetsRef()
+	void CModel::SetTransform(glm::mat4 transform)
 	{
-		return m_DescriptorSets;
+		m_Transform = transform;
+		m_TransformVersion++;
 	}
 
-	SDescriptorSets CModel::GetDescriptorSets()
+	uint32_t CModel::GetTransformVersion()
 	{
-		return m_DescriptorSets;
+		return m_TransformVersion;
 	}
 
-	glm::mat4 CModel::GetTransform()
+	void CModel::SetIsDynamic(bool isDynamic)
 	{
-		return m_Transform;
+		m_IsDynamic = isDynamic;
 	}
 
-	void CModel::SetTransform(glm::mat4 transform)
+	bool CModel::IsDynamic()
 	{
-		m_Transform = transform;
+		return m_IsDynamic;
 	}
 
 	glm::AABB CModel::GetAABB()
@@ -392,6 +388,16 @@ namespace NVulkanEngine
 		m_ModelTexture = texture;
 	}
 
+	uint32_t CModel::GetModelTextureIndex()
+	{
+		return m_ModelTextureIndex;
+	}
+
+	void CModel::SetModelTextureIndex(uint32_t textureIndex)
+	{
+		m_ModelTextureIndex = textureIndex;
+	}
+
 	void CModel::SetUsesModelTexture(bool uses_texture)
 	{
 		m_UsesModelTexture = uses_texture;
@@ -412,38 +418,31 @@ namespace NVulkanEngine
 		return m_Meshes[index];
 	}
 
-	VkDescriptorSetLayout CModel::GetModelDescriptorSetLayout()
-	{
-		return m_GeometryTable->GetDescriptorSetLayout();
-	}
-	
 	SModelMaterial CModel::GetMaterial(uint32_t materialId)
 	{
 		return m_Materials[materialId];
 	}
 
+	uint32_t CModel::GetNumMaterials()
+	{
+		return (uint32_t)m_Materials.size();
+	}
+
 	uint32_t CModel::GetNumIndices()
 	{
 		return static_cast<uint32_t>(m_Indices.size());
 	}
 
-	void CModel::CreateGeometryBindingTable(CGraphicsContext* context)
+	VkDeviceAddress CModel::GetVertexBufferAddress()
 	{
-		m_GeometryTable = new CBindingTable();
-		m_GeometryTable->AddUniformBufferBinding(0, VK_SHADER_STAGE_VERTEX_BIT, m_GeometryBuffer.m_Buffer, m_GeometryBufferSize);
-		m_GeometryTable->AddSampledImageBinding(1, VK_SHADER_STAGE_FRAGMENT_BIT, m_UsesModelTexture ? m_ModelTexture->GetTextureImageView() : VK_NULL_HANDLE, m_UsesModelTexture ? m_ModelTexture->GetTextureFormat() : VK_FORMAT_UNDEFINED, context->GetLinearRepeatSampler());
-		m_GeometryTable->CreateBindings(context);
+		return m_VertexBufferAddress;
 	}
 
-	void CModel::CreateShadowBindingTable(CGraphicsContext* context)
+	const std::vector<uint32_t>& CModel::GetIndices()
 	{
-		m_ShadowTable = new CBindingTable();
-		m_ShadowTable->AddUniformBufferBinding(0, VK_SHADER_STAGE_VERTEX_BIT, m_ShadowBuffer.m_Buffer, m_ShadowBufferSize);
-		m_ShadowTable->AddSampledImageBinding(1, VK_SHADER_STAGE_FRAGMENT_BIT, VK_NULL_HANDLE, VK_FORMAT_UNDEFINED, context->GetLinearRepeatSampler());
-		m_ShadowTable->CreateBindings(context);
+		return m_Indices;
 	}
 
-
 	void CModel::BindVertexAndIndexBuffers(VkCommandBuffer commandBuffer)
 	{
 		VkBuffer vertexBuffers[] = { m_VertexBuffer };
@@ -455,16 +454,6 @@ namespace NVulkanEngine
 		vkCmdBindIndexBuffer(commandBuffer, m_IndexBuffer, indexOfssets, VK_INDEX_TYPE_UINT32);
 	}
 
-	void CModel::BindGeometryTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)
-	{
-		m_GeometryTable->BindTable(context, commandBuffer, pipelineLayout);
-	}
-
-	void CModel::BindShadowTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)
-	{
-		m_ShadowTable->BindTable(context, commandBuffer, pipelineLayout);
-	}
-
 	void CModel::Cleanup(CGraphicsContext* context)
 	{
 		vkDestroyBuffer(context->GetLogicalDevice(), m_VertexBuffer, nullptr);
@@ -473,17 +462,6 @@ namespace NVulkanEngine
 		vkDestroyBuffer(context->GetLogicalDevice(), m_IndexBuffer, nullptr);
 		vkFreeMemory(context->GetLogicalDevice(), m_IndexBufferMemory, nullptr);
 
-		vkDestroyBuffer(context->GetLogicalDevice(), m_GeometryBuffer.m_Buffer, nullptr);
-		vkFreeMemory(context->GetLogicalDevice(), m_GeometryBuffer.m_Memory, nullptr);
-
-		vkDestroyBuffer(context->GetLogicalDevice(), m_ShadowBuffer.m_Buffer, nullptr);
-		vkFreeMemory(context->GetLogicalDevice(), m_ShadowBuffer.m_Memory, nullptr);
-
-		m_GeometryTable->Cleanup(context);
-		m_ShadowTable->Cleanup(context);
-		delete m_GeometryTable;
-		delete m_ShadowTable;
-
 		if(m_ModelTexture)
 			m_ModelTexture->DestroyTexture(context);
 	}
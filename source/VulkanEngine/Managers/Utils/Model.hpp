@@ -46,14 +46,6 @@ struct SDescriptorSets
 	std::vector<VkWriteDescriptorSet> m_WriteDescriptors = { };
 };
 
-// Unifom buffer object and its device memory
-struct SUniformMemoryBuffer
-{
-	VkBuffer       m_Buffer = VK_NULL_HANDLE;
-	VkDeviceMemory m_Memory = VK_NULL_HANDLE;
-
-};
-
 // A mesh is a subset of polygons inside the model. Model is split up this way to handle multiple materials per mdel
 struct SMaterialMesh
 {
@@ -62,18 +54,20 @@ struct SMaterialMesh
 	uint32_t m_NumVertices = 0;
 };
 
+// All materials of all models live in one storage buffer. Must match geometry.frag
 struct SModelMaterial
 {
-	glm::vec4    m_Diffuse          = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec4    m_Diffuse            = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
 	//
-	glm::float32 m_Shininess        = glm::float32(0.0f);
-	glm::float32 m_Metallness       = glm::float32(0.0f);
-	glm::float32 m_Fresnel          = glm::float32(0.0f);
-	glm::float32 m_Emission         = glm::float32(0.0f);
+	glm::float32 m_Shininess          = glm::float32(0.0f);
+	glm::float32 m_Metallness         = glm::float32(0.0f);
+	glm::float32 m_Fresnel            = glm::float32(0.0f);
+	glm::float32 m_Emission           = glm::float32(0.0f);
 	//
-	glm::float32 m_Transparency     = glm::float32(0.0f);
-	glm::float32 m_Reflectivity     = glm::float32(0.0f);
-	glm::int32   m_UseAlbedoTexture = 0;
+	glm::float32 m_Transparency       = glm::float32(0.0f);
+	glm::float32 m_Reflectivity       = glm::float32(0.0f);
+	glm::int32   m_AlbedoTextureIndex = -1; // Bindless texture index. Diffuse color is used when there is no texture
+	glm::float32 m_Padding            = glm::float32(0.0f);
 };
 
 namespace NVulkanEngine
@@ -97,6 +91,13 @@ namespace NVulkanEngine
 		glm::mat4          GetTransform();
 		void               SetTransform(glm::mat4 transform);
 
+		// Bumped every time the transform changes. Lets nodes that cache things built from the transform know when to rebuild
+		uint32_t           GetTransformVersion();
+
+		// Dynamic models are expected to move after the scene has been created
+		void               SetIsDynamic(bool isDynamic);
+		bool               IsDynamic();
+
 		glm::AABB          GetAABB();
 
 		void               SetUsesModelTexture(bool uses_texture);
@@ -105,30 +106,27 @@ namespace NVulkanEngine
 		CTexture*          GetModelTexture();
 		void               SetModelTexture(CTexture* texture);
 
-		void               CreateGeometryBindingTable(CGraphicsContext* context);
-		void               CreateShadowBindingTable(CGraphicsContext* context);
-
-		// Creates the geometry and shadow UBOs. Fetch with functions just below this
-		void               CreateGeometryMemoryBuffer(CGraphicsContext* context, const VkDeviceSize size);
-		void               CreateShadowMemoryBuffer(CGraphicsContext* context, const VkDeviceSize size);
-
-		SUniformMemoryBuffer GetGeometryMemoryBuffer();
-		SUniformMemoryBuffer GetShadowMemoryBuffer();
-
-		VkDescriptorSetLayout GetModelDescriptorSetLayout();
+		// Where the model texture ended up in the bindless table
+		uint32_t           GetModelTextureIndex();
+		void               SetModelTextureIndex(uint32_t textureIndex);
 
 		uint32_t           GetNumMeshes();
 		SMaterialMesh      GetMesh(const uint32_t index);
 		
 		uint32_t           GetNumIndices();
 
+		// Where the vertices are for shaders that fetch them on their own. See geometrypull.vert
+		VkDeviceAddress    GetVertexBufferAddress();
+
+		// Copied into the index buffer shared by every model for vertex pulling
+		const std::vector<uint32_t>& GetIndices();
+
 		// Get number of indices of model
 		SModelMaterial     GetMaterial(uint32_t materialId);
+		uint32_t           GetNumMaterials();
 
 		// Bind vertex and index buffers for a mesh
 		void               BindVertexAndIndexBuffers(VkCommandBuffer commandBuffer);
-		void               BindGeometryTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout);
-		void               BindShadowTable(CGraphicsContext* context, VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout);
 
 		// Cleanup model and meshes
 		void               Cleanup(CGraphicsContext* context);
@@ -145,6 +143,8 @@ namespace NVulkanEngine
 
 		glm::mat4              m_Transform          = glm::identity<glm::mat4>();
 		glm::AABB              m_ModelAABB      = {};
+		uint32_t               m_TransformVersion   = 0;
+		bool                   m_IsDynamic          = false;
 
 		SDescriptorSets        m_DescriptorSets     = {};
 
@@ -154,18 +154,11 @@ namespace NVulkanEngine
 		VkBuffer               m_IndexBuffer        = VK_NULL_HANDLE;
 		VkDeviceMemory         m_IndexBufferMemory  = VK_NULL_HANDLE;
 
-		// UBOs
-		SUniformMemoryBuffer   m_GeometryBuffer     = {};
-		SUniformMemoryBuffer   m_ShadowBuffer       = {};
-
-		uint32_t               m_GeometryBufferSize = 0;
-		uint32_t               m_ShadowBufferSize   = 0;
+		VkDeviceAddress        m_VertexBufferAddress = 0;
 
 		bool                   m_UsesModelTexture   = false;
 		CTexture*              m_ModelTexture       = nullptr;
-
-		CBindingTable*         m_GeometryTable      = nullptr;
-		CBindingTable*         m_ShadowTable        = nullptr;
+		uint32_t               m_ModelTextureIndex  = 0;
 
 		// Load a model .obj file using relative path
 		bool LoadModel(const std::string modelFilepath, const std::string materialSearchPath);
@@ -12,7 +12,7 @@ namespace NVulkanEngine
 
 		VkSurfaceFormatKHR surfaceFormat = ChooseSwapSurfaceFormat(swapChainSupport.formats);
 		VkPresentModeKHR presentMode = ChooseSwapPresentMode(swapChainSupport.presentModes);
-		VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities, context->GetGLFWWindow());
+		VkExtent2D extent = ChooseSwapExtent(swapChainSupport.capabilities, context->GetRenderResolution());
 
 		// Request one more image than the minium supported
 		m_ImageCount = swapChainSupport.capabilities.minImageCount + 1;
@@ -80,7 +80,7 @@ namespace NVulkanEngine
 #endif
 	}
 
-	VkExtent2D CSwapchain::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities, GLFWwindow* window)
+	VkExtent2D CSwapchain::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities, VkExtent2D windowExtent)
 	{
 		if (surfaceCapabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
 		{
@@ -88,14 +88,8 @@ namespace NVulkanEngine
 		}
 		else
 		{
-			int width, height;
-			glfwGetWindowSize(window, &width, &height);
-
-			VkExtent2D actualExtent =
-			{
-				static_cast<uint32_t>(width),
-				static_cast<uint32_t>(height)
-			};
+			// Window size as reported by the main thread. GLFW can't be queried from the render thread
+			VkExtent2D actualExtent = windowExtent;
 
 			actualExtent.width = std::clamp(actualExtent.width, surfaceCapabilities.minImageExtent.width, surfaceCapabilities.maxImageExtent.width);
 			actualExtent.height = std::clamp(actualExtent.height, surfaceCapabilities.minImageExtent.height, surfaceCapabilities.maxImageExtent.height);
@@ -44,7 +44,7 @@ namespace NVulkanEngine
 		void                Present(CGraphicsContext* context, VkSemaphore* signalSemaphore, uint32_t imageIndex);
 
 	private:
-		VkExtent2D         ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities, GLFWwindow* window);
+		VkExtent2D         ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities, VkExtent2D windowExtent);
 		VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 		VkPresentModeKHR   ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
 		void               CreateSwapChainImageViews(VkDevice vulkanDevice);
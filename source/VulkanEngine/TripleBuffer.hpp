@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/*
+	Lock free hand off of the newest state from one producer thread to one consumer thread. The producer writes a full copy
+	into its own slot and publishes it, the consumer picks up the newest published slot. Neither side ever waits on the other,
+	states the consumer did not get to in time are simply skipped
+*/
+
+namespace NVulkanEngine
+{
+	template<typename T>
+	class CTripleBuffer
+	{
+	public:
+		CTripleBuffer() = default;
+		~CTripleBuffer() = default;
+
+		// Producer. Fill in everything, the slot holds whatever was published two times ago
+		T& GetWriteBuffer() { return m_Buffers[m_WriteIndex]; };
+
+		// Producer. Swaps the written slot with the shared one
+		void Publish()
+		{
+			const uint8_t previousShared = m_Shared.exchange(m_WriteIndex | s_NewBit, std::memory_order_acq_rel);
+			m_WriteIndex = previousShared & s_IndexMask;
+		}
+
+		// Consumer. Takes the newest published slot. Returns false and keeps the current one if nothing new was published
+		bool Acquire()
+		{
+			if ((m_Shared.load(std::memory_order_relaxed) & s_NewBit) == 0)
+				return false;
+
+			const uint8_t previousShared = m_Shared.exchange(m_ReadIndex, std::memory_order_acq_rel);
+			m_ReadIndex = previousShared & s_IndexMask;
+			return true;
+		}
+
+		// Consumer
+		const T& GetReadBuffer() { return m_Buffers[m_ReadIndex]; };
+
+	private:
+		static constexpr uint8_t s_IndexMask = 0x3;
+		static constexpr uint8_t s_NewBit    = 0x4; // Set in m_Shared when it holds a slot the consumer has not seen
+
+		std::array<T, 3> m_Buffers = {};
+
+		uint8_t              m_WriteIndex = 0; // Only touched by the producer
+		std::atomic<uint8_t> m_Shared     = 1;
+		uint8_t              m_ReadIndex  = 2; // Only touched by the consumer
+	};
+};
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_vulkan.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <vector>
 #include <set>
@@ -25,6 +26,25 @@
 #include <thread>
 static float testvar = 0.0f;
 static float g_ImGuiGlobalFontSize = 1.0f;
+static bool  g_AsyncCompute        = true; // Only has an effect on devices with a compute only queue family
+
+// Set to false to compare against descriptor sets. Devices without VK_EXT_descriptor_buffer always use descriptor sets
+static const bool g_UseDescriptorBuffers = true;
+
+// Rewrites the bindless texture slots reserved for streaming every frame to measure the descriptor update cost
+static bool g_StreamBindlessTextures = false;
+
+// Geometry and shadows fetch vertices by buffer address and draw all meshes with indirect draws instead of binding vertex buffers per model
+static bool g_VertexPulling = false;
+
+// Seconds the main thread sleeps at most between input updates when no events come in
+static const double g_InputUpdateInterval = 0.002;
+
+// Longest step the camera takes in one input update. Waiting on events can block for a whole window move or resize
+static const float g_MaxInputDeltaTime = 1.0f / 30.0f;
+
+// Shows up in the GPU timings window. Same order as EDrawNodes
+static const char* g_DrawNodeNames[] = { "Geometry", "Shadows", "Terrain", "Skybox", "Lighting", "Debug" };
 
 static void check_vk_result(VkResult err)
 {
@@ -35,6 +55,29 @@ static void check_vk_result(VkResult err)
 		abort();
 }
 
+static void BeginCommandBuffer(VkCommandBuffer commandBuffer)
+{
+	vkResetCommandBuffer(commandBuffer, 0);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = 0; // Optional
+	beginInfo.pInheritanceInfo = nullptr; // Optional
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
+}
+
+static void EndCommandBuffer(VkCommandBuffer commandBuffer)
+{
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record command buffer!");
+	}
+}
+
 // Validation layer callback
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 	VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -87,19 +130,34 @@ namespace NVulkanEngine
 	void CVulkanGraphicsEngine::CreateScene()
 	{
 		CreateModels();
+		CreateDrawNodes();
 		CreateResources();
 		InitDrawNodes();
 
+		m_PipelineManager->ReportCreationTime("Startup");
+		m_DescriptorManager->ReportWriteTime("Startup");
+
 		m_IsRunning = true;
 	}
 
 	void CVulkanGraphicsEngine::Cleanup()
 	{
+		// The render thread finishes the frame it is on
+		m_IsRunning = false;
+		if (m_RenderThread.joinable())
+			m_RenderThread.join();
+
 		vkDeviceWaitIdle(m_VulkanDevice);
 
 		CleanupDrawNodes();
 		CleanupManagers();
 		CleanupImGui();
+
+		for (uint32_t i = 0; i < m_DrawNodes.size(); i++)
+		{
+			delete m_DrawNodes[i];
+			m_DrawNodes[i] = nullptr;
+		}
 		CleanupVulkan();
 		CleanupWindow();
 	}
@@ -108,6 +166,11 @@ namespace NVulkanEngine
 	{
 		vkDeviceWaitIdle(m_VulkanDevice);
 
+		// Set first. The swapchain falls back to it on surfaces without a fixed extent
+		g_DisplayWidth  = m_NewRenderResolution.width;
+		g_DisplayHeight = m_NewRenderResolution.height;
+		m_Context->SetRenderResolution(VkExtent2D(g_DisplayWidth, g_DisplayHeight));
+
 		// These don't directly depend on resolution but we need to recreate them anyway
 		m_Swapchain->Recreate(m_Context);
 		CleanupSyncObjects();
@@ -117,31 +180,36 @@ namespace NVulkanEngine
 		m_ResourceManager->Cleanup(m_Context);
 		CleanupDrawNodes();
 
-		g_DisplayWidth  = m_NewRenderResolution.width;
-		g_DisplayHeight = m_NewRenderResolution.height;
-		m_Context->SetRenderResolution(VkExtent2D(g_DisplayWidth, g_DisplayHeight));
-
 		// Order of init important here
 		CreateResources();
 		InitDrawNodes();
 
+		m_PipelineManager->ReportCreationTime("Resize");
+		m_DescriptorManager->ReportWriteTime("Resize");
+
 		m_NeedsResize = false;
 	}
 
 	void CVulkanGraphicsEngine::ResizeGLFWFrame(GLFWwindow* window, int newWidth, int newHeight)
 	{
-		m_NeedsResize = true;
-		m_NewRenderResolution = VkExtent2D(newWidth, newHeight);
+		// Picked up by the render thread with the next frame state
+		m_WindowExtent = VkExtent2D(newWidth, newHeight);
 	}
 
 	void CVulkanGraphicsEngine::ProcessGLFWKeyboardInputs(GLFWwindow* window, int key, int scancode, int action, int mods)
 	{
 		m_InputManager->ProcessKeyboardInputs(window, key, scancode, action, mods);
+
+		std::lock_guard<std::mutex> lock(m_ImGuiInputMutex);
+		ImGui_ImplGlfw_KeyCallback(window, key, scancode, action, mods);
 	}
 
 	void CVulkanGraphicsEngine::ProcessGLFWMouseInput(GLFWwindow* window, int button, int action, int mods)
 	{
 		m_InputManager->ProcessMouseInput(window, button, action, mods);
+
+		std::lock_guard<std::mutex> lock(m_ImGuiInputMutex);
+		ImGui_ImplGlfw_MouseButtonCallback(window, button, action, mods);
 	}
 
 	void CVulkanGraphicsEngine::InitWindow()
@@ -181,6 +249,9 @@ namespace NVulkanEngine
 
 
 		glfwSetFramebufferSizeCallback(m_Window, windowScaleCallback);
+
+		m_WindowExtent       = VkExtent2D(g_DisplayWidth, g_DisplayHeight);
+		m_RenderWindowExtent = m_WindowExtent;
 	}
 
 	void CVulkanGraphicsEngine::InitSwapchain()
@@ -196,6 +267,18 @@ namespace NVulkanEngine
 		m_LightManager = new CLightManager();
 		m_DebugManager = new CDebugManager();
 		m_ResourceManager = new CResourceManager(m_VulkanInstance);
+		m_ProfilerManager = new CProfilerManager();
+		m_PipelineManager = new CPipelineManager();
+		m_DescriptorManager = new CDescriptorManager();
+		m_RecordingManager = new CRecordingManager();
+		m_JobManager = new CJobManager();
+
+		m_JobManager->Init(1); // One extra slot for the render thread. Other managers may hand out work from their Init
+		m_DescriptorManager->Init(m_Context);
+		m_RecordingManager->Init(m_Context, m_JobManager);
+		m_ProfilerManager->Init(m_Context);
+		m_PipelineManager->Init(m_Context);
+		m_ResourceManager->Init(m_Context);
 
 		// For mouse and keyboard callbacks
 		glfwSetWindowUserPointer(m_Window, this);
@@ -203,29 +286,40 @@ namespace NVulkanEngine
 
 	void CVulkanGraphicsEngine::InitCamera()
 	{
-		CCamera* camera = m_InputManager->GetCamera();
-		
-		glm::vec3 cameraOriginPosition = glm::vec3(-300.0f, 250, -7.0f); // Arbitrary camera start position
-		glm::vec3 cameraViewDirection  = glm::vec3(1.0f, 0.0f, 0.0f);
-		glm::vec3 cameraUpDirection    = glm::vec3(0.0f, 1.0f, 0.0f);
-		
-		camera->SetPosition(cameraOriginPosition);
-		camera->SetDirection(cameraViewDirection);
-		camera->SetUp(cameraUpDirection);
+		SCameraState cameraState{};
+		cameraState.m_Position  = glm::vec3(-300.0f, 250, -7.0f); // Arbitrary camera start position
+		cameraState.m_Direction = glm::vec3(1.0f, 0.0f, 0.0f);
+		cameraState.m_Up        = glm::vec3(0.0f, 1.0f, 0.0f);
+
+		m_InputManager->SetCameraState(cameraState);
+		m_InputManager->ApplyCameraState(m_Context, cameraState);
 
-		camera->UpdateCamera(m_Context);
+		// The render thread starts from this until the main thread publishes its first state
+		m_FrameStates.GetWriteBuffer() = { cameraState, m_WindowExtent };
+		m_FrameStates.Publish();
 	}
 
 	void CVulkanGraphicsEngine::CleanupManagers()
 	{
 		m_ModelManager->Cleanup(m_Context);
 		m_ResourceManager->Cleanup(m_Context);
+		m_ResourceManager->CleanupBindlessTable(m_Context);
 		m_DebugManager->Cleanup(m_Context);
+		m_ProfilerManager->Cleanup(m_Context);
+		m_PipelineManager->Cleanup(m_Context);
+		m_DescriptorManager->Cleanup(m_Context); // Binding tables give their sets back in the cleanups above
+		m_RecordingManager->Cleanup(m_Context);
+		m_JobManager->Cleanup();
 
 		delete m_InputManager;
 		delete m_ModelManager;
 		delete m_DebugManager;
 		delete m_ResourceManager;
+		delete m_ProfilerManager;
+		delete m_PipelineManager;
+		delete m_DescriptorManager;
+		delete m_RecordingManager;
+		delete m_JobManager;
 	};
 
 
@@ -245,6 +339,9 @@ namespace NVulkanEngine
 			vkDestroySemaphore(m_VulkanDevice, m_RenderFinishedSemaphores[i], nullptr);
 			vkDestroyFence(m_VulkanDevice, m_InFlightFences[i], nullptr);
 		}
+
+		vkDestroySemaphore(m_VulkanDevice, m_GraphicsTimeline, nullptr);
+		vkDestroySemaphore(m_VulkanDevice, m_ComputeTimeline, nullptr);
 	}
 
 	void CVulkanGraphicsEngine::CleanupVulkan()
@@ -260,6 +357,8 @@ namespace NVulkanEngine
 		delete m_Swapchain;
 
 		vkDestroyCommandPool(m_VulkanDevice, m_CommandPool, nullptr);
+		if (m_ComputeCommandPool != VK_NULL_HANDLE)
+			vkDestroyCommandPool(m_VulkanDevice, m_ComputeCommandPool, nullptr);
 
 		vkDestroyDevice(m_VulkanDevice, nullptr);
 
@@ -282,6 +381,13 @@ namespace NVulkanEngine
 		ImGui_ImplVulkan_Shutdown();
 		ImGui_ImplGlfw_Shutdown();
 		ImGui::DestroyContext();
+
+		for (GLFWcursor* cursor : m_MouseCursors)
+		{
+			if (cursor)
+				glfwDestroyCursor(cursor);
+		}
+		m_MouseCursors.clear();
 	}
 
 	bool CVulkanGraphicsEngine::CheckDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*> deviceExtensions)
@@ -524,6 +630,8 @@ namespace NVulkanEngine
 
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		std::set<uint32_t> uniqueQueueFamilies = { m_QueueFamilies.m_GraphicsFamily.value(), m_QueueFamilies.m_PresentFamily.value() };
+		if (m_QueueFamilies.m_ComputeFamily.has_value())
+			uniqueQueueFamilies.insert(m_QueueFamilies.m_ComputeFamily.value());
 
 		float queuePriority = 1.0f;
 		for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -537,44 +645,91 @@ namespace NVulkanEngine
 			queueCreateInfos.push_back(queueCreateInfo);
 		}
 
+		// Descriptor buffers are optional. Shader inputs fall back to descriptor sets without them
+		std::vector<const char*> deviceExtensions = g_DeviceExtensions;
+
+		m_IsDescriptorBufferEnabled = g_UseDescriptorBuffers && CheckDeviceExtensionSupport(m_PhysicalDevice, { VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME });
+		if (m_IsDescriptorBufferEnabled)
+		{
+			VkPhysicalDeviceDescriptorBufferFeaturesEXT supportedDescriptorBufferFeatures{};
+			supportedDescriptorBufferFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+
+			VkPhysicalDeviceFeatures2 supportedFeatures{};
+			supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			supportedFeatures.pNext = &supportedDescriptorBufferFeatures;
+			vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &supportedFeatures);
+
+			m_IsDescriptorBufferEnabled = supportedDescriptorBufferFeatures.descriptorBuffer == VK_TRUE;
+		}
+		if (m_IsDescriptorBufferEnabled)
+		{
+			deviceExtensions.push_back(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+		}
+
 		VkPhysicalDeviceRobustness2FeaturesEXT vulkanRobustnessFeatures{};
 		vulkanRobustnessFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ROBUSTNESS_2_FEATURES_EXT;
 		vulkanRobustnessFeatures.nullDescriptor = VK_TRUE;
 		vulkanRobustnessFeatures.robustImageAccess2 = VK_TRUE;
 		vulkanRobustnessFeatures.robustBufferAccess2 = VK_TRUE;
 
+		// Synchronizes the graphics and async compute queues
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures{};
+		timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+		timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+		timelineSemaphoreFeatures.pNext = &vulkanRobustnessFeatures;
+
+		// Descriptor buffers point at uniform and storage buffers by address
+		VkPhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddressFeatures{};
+		bufferDeviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
+		bufferDeviceAddressFeatures.bufferDeviceAddress = VK_TRUE;
+		bufferDeviceAddressFeatures.pNext = &timelineSemaphoreFeatures;
+
 		VkPhysicalDeviceVulkan13Features vulkan13Features{};
 		vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
 		vulkan13Features.dynamicRendering = VK_TRUE;
 		vulkan13Features.robustImageAccess = VK_TRUE;
-		vulkan13Features.pNext = &vulkanRobustnessFeatures;
+		vulkan13Features.pNext = &bufferDeviceAddressFeatures;
 
 		VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexingFeatures{};
 		descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
 		descriptorIndexingFeatures.descriptorBindingPartiallyBound               = VK_TRUE;
+		descriptorIndexingFeatures.runtimeDescriptorArray                        = VK_TRUE;
 		descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind  = VK_TRUE;
 		descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
 		descriptorIndexingFeatures.descriptorBindingStorageImageUpdateAfterBind  = VK_TRUE;
 		descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind  = VK_TRUE;
 		descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
 		descriptorIndexingFeatures.descriptorBindingStorageImageUpdateAfterBind  = VK_TRUE;
+		descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending     = VK_TRUE; // Streaming bindless textures while frames are in flight
 		descriptorIndexingFeatures.pNext = &vulkan13Features;
 
 		VkPhysicalDeviceFeatures2 deviceFeatures2{};
 		deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
 		deviceFeatures2.features.robustBufferAccess = VK_TRUE;
 		deviceFeatures2.features.wideLines          = VK_TRUE;
+		deviceFeatures2.features.shaderSampledImageArrayDynamicIndexing = VK_TRUE; // Material textures in the bindless table
+		deviceFeatures2.features.multiDrawIndirect         = VK_TRUE; // Vertex pulling draws every mesh with one indirect draw
+		deviceFeatures2.features.drawIndirectFirstInstance = VK_TRUE; // which picks the draw data with firstInstance
 		deviceFeatures2.pNext = &descriptorIndexingFeatures;
 		//deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+		VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures{};
+		descriptorBufferFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+		descriptorBufferFeatures.descriptorBuffer = VK_TRUE;
+		if (m_IsDescriptorBufferEnabled)
+		{
+			descriptorBufferFeatures.pNext = deviceFeatures2.pNext;
+			deviceFeatures2.pNext = &descriptorBufferFeatures;
+		}
+
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 		createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());;
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.pNext = &deviceFeatures2;
 
-		createInfo.enabledExtensionCount = (uint32_t)g_DeviceExtensions.size();
-		createInfo.ppEnabledExtensionNames = g_DeviceExtensions.data();
+		createInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
+		createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
 		if (g_EnableValidationLayers) {
 			createInfo.enabledLayerCount = static_cast<uint32_t>(g_ValidationLayers.size());
@@ -590,6 +745,8 @@ namespace NVulkanEngine
 
 		vkGetDeviceQueue(m_VulkanDevice, m_QueueFamilies.m_GraphicsFamily.value(), 0, &m_GraphicsQueue);
 		vkGetDeviceQueue(m_VulkanDevice, m_QueueFamilies.m_PresentFamily.value(), 0, &m_PresentQueue);
+		if (m_QueueFamilies.m_ComputeFamily.has_value())
+			vkGetDeviceQueue(m_VulkanDevice, m_QueueFamilies.m_ComputeFamily.value(), 0, &m_ComputeQueue);
 
 #if defined(_DEBUG)
 		std::cout << "Succesfully created logical device and queues!\n" << std::endl;
@@ -614,6 +771,16 @@ namespace NVulkanEngine
 		{
 			throw std::runtime_error("failed to create command pool!");
 		}
+
+		if (queueFamilyIndices.m_ComputeFamily.has_value())
+		{
+			poolInfo.queueFamilyIndex = queueFamilyIndices.m_ComputeFamily.value();
+
+			if (vkCreateCommandPool(m_VulkanDevice, &poolInfo, nullptr, &m_ComputeCommandPool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create compute command pool!");
+			}
+		}
 	}
 
 	void CVulkanGraphicsEngine::CreateCommandBuffers()
@@ -631,6 +798,23 @@ namespace NVulkanEngine
 			throw std::runtime_error("failed to allocate command buffers!");
 		}
 
+		m_EarlyCommandBuffers.resize(g_MaxFramesInFlight);
+		if (vkAllocateCommandBuffers(m_VulkanDevice, &allocInfo, m_EarlyCommandBuffers.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
+
+		if (m_ComputeCommandPool != VK_NULL_HANDLE)
+		{
+			allocInfo.commandPool = m_ComputeCommandPool;
+
+			m_ComputeCommandBuffers.resize(g_MaxFramesInFlight);
+			if (vkAllocateCommandBuffers(m_VulkanDevice, &allocInfo, m_ComputeCommandBuffers.data()) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate compute command buffers!");
+			}
+		}
+
 #if defined(_DEBUG)
 		std::cout << "Command Pool & Buffers created!" << std::endl;
 #endif
@@ -658,6 +842,19 @@ namespace NVulkanEngine
 				throw std::runtime_error("failed to create semaphores!");
 			}
 		}
+
+		VkSemaphoreTypeCreateInfo timelineInfo{};
+		timelineInfo.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		timelineInfo.initialValue  = 0;
+		semaphoreInfo.pNext = &timelineInfo;
+
+		if (vkCreateSemaphore(m_VulkanDevice, &semaphoreInfo, nullptr, &m_GraphicsTimeline) != VK_SUCCESS ||
+			vkCreateSemaphore(m_VulkanDevice, &semaphoreInfo, nullptr, &m_ComputeTimeline) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create timeline semaphores!");
+		}
+		m_FrameNumber = 0;
 	}
 
 	void CVulkanGraphicsEngine::CreateSamplers()
@@ -693,30 +890,36 @@ namespace NVulkanEngine
 
 	void CVulkanGraphicsEngine::CreateResources()
 	{
-		m_ResourceManager->AddRenderResource(
-			m_Context,
-			"GBuffer - Positions",
-			EResourceIndices::Positions,
-			m_LinearClamp,
-			VK_SHADER_STAGE_FRAGMENT_BIT,
-			VK_FORMAT_R16G16B16A16_SFLOAT,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-			m_Context->GetRenderResolution().width,
-			m_Context->GetRenderResolution().height);
+		// Lifetimes follow the draw node order. Resources whose lifetimes never overlap end up sharing memory
+		for (uint32_t i = 0; i < m_DrawNodes.size(); i++)
+		{
+			for (EResourceIndices resourceIndex : m_DrawNodes[i]->GetResourceUsage())
+			{
+				m_ResourceManager->MarkResourceUsage(resourceIndex, i);
+			}
+		}
+
+		// Scene color is drawn by ImGui after all draw nodes are done
+		m_ResourceManager->MarkResourceUsage(EResourceIndices::SceneColor, (uint32_t)EDrawNodes::Count);
+
+		// Shadow maps are only redrawn when something changes
+		m_ResourceManager->MarkResourcePersistent(EResourceIndices::ShadowMap);
+		m_ResourceManager->MarkResourcePersistent(EResourceIndices::ShadowMapStatic);
 
+		// Position is reconstructed from depth. Normals are octahedral encoded in RG with roughness in B
 		m_ResourceManager->AddRenderResource(
 			m_Context,
 			"GBuffer - Normals",
 			EResourceIndices::Normals,
 			m_LinearClamp,
 			VK_SHADER_STAGE_FRAGMENT_BIT,
-			VK_FORMAT_R16G16B16A16_SFLOAT,
+			VK_FORMAT_A2B10G10R10_UNORM_PACK32,
 			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
 			m_Context->GetRenderResolution().width,
 			m_Context->GetRenderResolution().height);
 
+		// Metalness and fresnel share the alpha channel
 		m_ResourceManager->AddRenderResource(
 			m_Context,
 			"GBuffer - Albedo",
@@ -741,6 +944,7 @@ namespace NVulkanEngine
 			m_Context->GetRenderResolution().width,
 			m_Context->GetRenderResolution().height);
 
+		// One layer per cascade
 		m_ResourceManager->AddRenderResource(
 			m_Context,
 			"Shadow Map",
@@ -748,10 +952,30 @@ namespace NVulkanEngine
 			m_LinearClamp,
 			VK_SHADER_STAGE_FRAGMENT_BIT,
 			VK_FORMAT_D32_SFLOAT,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
 			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-			(uint32_t)4096,
-			(uint32_t)4096);
+			CShadowNode::GetShadowMapResolution(),
+			CShadowNode::GetShadowMapResolution(),
+			VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+			CShadowNode::GetNumCascades());
+
+		// Static casters only. Copied into the shadow map before the dynamic casters are drawn on top. Not needed if nothing moves
+		if (m_ModelManager->HasDynamicModels())
+		{
+			m_ResourceManager->AddRenderResource(
+				m_Context,
+				"Shadow Map - Static Casters",
+				EResourceIndices::ShadowMapStatic,
+				m_LinearClamp,
+				VK_SHADER_STAGE_FRAGMENT_BIT,
+				VK_FORMAT_D32_SFLOAT,
+				VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+				VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+				CShadowNode::GetShadowMapResolution(),
+				CShadowNode::GetShadowMapResolution(),
+				VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+				CShadowNode::GetNumCascades());
+		}
 
 		m_ResourceManager->AddRenderResource(
 			m_Context,
@@ -777,7 +1001,7 @@ namespace NVulkanEngine
 			m_Context->GetRenderResolution().width,
 			m_Context->GetRenderResolution().height);
 
-		
+		m_ResourceManager->AllocateRenderResources(m_Context);
 	}
 
 
@@ -792,7 +1016,59 @@ namespace NVulkanEngine
 		io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
 		io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;         // IF using Docking Branch
 
-		ImGui_ImplGlfw_InitForVulkan(m_Window, true);
+		// Callbacks are installed below instead. They run on the main thread and ImGui frames start on the render thread.
+		// The backend's NewFrame is never called since it queries GLFW. PollEvents gathers that on the main thread
+		ImGui_ImplGlfw_InitForVulkan(m_Window, false);
+
+		// Indexed by ImGuiMouseCursor. Shapes GLFW has no standard cursor for fall back to the arrow
+		m_MouseCursors.assign(ImGuiMouseCursor_COUNT, nullptr);
+		m_MouseCursors[ImGuiMouseCursor_Arrow]     = glfwCreateStandardCursor(GLFW_ARROW_CURSOR);
+		m_MouseCursors[ImGuiMouseCursor_TextInput] = glfwCreateStandardCursor(GLFW_IBEAM_CURSOR);
+		m_MouseCursors[ImGuiMouseCursor_ResizeNS]  = glfwCreateStandardCursor(GLFW_VRESIZE_CURSOR);
+		m_MouseCursors[ImGuiMouseCursor_ResizeEW]  = glfwCreateStandardCursor(GLFW_HRESIZE_CURSOR);
+		m_MouseCursors[ImGuiMouseCursor_Hand]      = glfwCreateStandardCursor(GLFW_HAND_CURSOR);
+
+		GLFWwindowfocusfun focusCallback = ([](GLFWwindow* window, int focused)
+		{
+			CVulkanGraphicsEngine& graphicsEngine = *static_cast<CVulkanGraphicsEngine*>(glfwGetWindowUserPointer(window));
+			std::lock_guard<std::mutex> lock(graphicsEngine.m_ImGuiInputMutex);
+			ImGui_ImplGlfw_WindowFocusCallback(window, focused);
+		});
+
+		GLFWcursorenterfun cursorEnterCallback = ([](GLFWwindow* window, int entered)
+		{
+			CVulkanGraphicsEngine& graphicsEngine = *static_cast<CVulkanGraphicsEngine*>(glfwGetWindowUserPointer(window));
+			std::lock_guard<std::mutex> lock(graphicsEngine.m_ImGuiInputMutex);
+			ImGui_ImplGlfw_CursorEnterCallback(window, entered);
+		});
+
+		GLFWcursorposfun cursorPosCallback = ([](GLFWwindow* window, double x, double y)
+		{
+			CVulkanGraphicsEngine& graphicsEngine = *static_cast<CVulkanGraphicsEngine*>(glfwGetWindowUserPointer(window));
+			std::lock_guard<std::mutex> lock(graphicsEngine.m_ImGuiInputMutex);
+			ImGui_ImplGlfw_CursorPosCallback(window, x, y);
+		});
+
+		GLFWscrollfun scrollCallback = ([](GLFWwindow* window, double offsetX, double offsetY)
+		{
+			CVulkanGraphicsEngine& graphicsEngine = *static_cast<CVulkanGraphicsEngine*>(glfwGetWindowUserPointer(window));
+			std::lock_guard<std::mutex> lock(graphicsEngine.m_ImGuiInputMutex);
+			ImGui_ImplGlfw_ScrollCallback(window, offsetX, offsetY);
+		});
+
+		GLFWcharfun charCallback = ([](GLFWwindow* window, unsigned int character)
+		{
+			CVulkanGraphicsEngine& graphicsEngine = *static_cast<CVulkanGraphicsEngine*>(glfwGetWindowUserPointer(window));
+			std::lock_guard<std::mutex> lock(graphicsEngine.m_ImGuiInputMutex);
+			ImGui_ImplGlfw_CharCallback(window, character);
+		});
+
+		// Key and mouse button go through ProcessGLFWKeyboardInputs and ProcessGLFWMouseInput
+		glfwSetWindowFocusCallback(m_Window, focusCallback);
+		glfwSetCursorEnterCallback(m_Window, cursorEnterCallback);
+		glfwSetCursorPosCallback(m_Window, cursorPosCallback);
+		glfwSetScrollCallback(m_Window, scrollCallback);
+		glfwSetCharCallback(m_Window, charCallback);
 
 		std::array<VkDescriptorPoolSize, 2> poolSizes{};
 		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -825,7 +1101,7 @@ namespace NVulkanEngine
 		init_info.Device                      = m_VulkanDevice;
 		init_info.QueueFamily                 = m_QueueFamilies.m_GraphicsFamily.value();
 		init_info.Queue                       = m_GraphicsQueue;
-		init_info.PipelineCache               = VK_NULL_HANDLE;
+		init_info.PipelineCache               = m_PipelineManager->GetPipelineCache();
 		init_info.DescriptorPool              = m_ImGuiDescriptorPool;
 		init_info.PipelineRenderingCreateInfo = pipeline_rendering_create_info;
 		init_info.UseDynamicRendering         = true;
@@ -851,9 +1127,13 @@ namespace NVulkanEngine
 			m_CommandPool,
 			m_GraphicsQueue,
 			m_PresentQueue,
+			m_ComputeQueue,
+			m_QueueFamilies.m_GraphicsFamily.value(),
+			m_QueueFamilies.m_ComputeFamily.value_or(m_QueueFamilies.m_GraphicsFamily.value()),
 			m_LinearClamp,
 			m_LinearRepeat,
 			VkExtent2D(g_DisplayWidth, g_DisplayHeight));
+		m_Context->SetDescriptorBufferEnabled(m_IsDescriptorBufferEnabled);
 	}
 
 	void CVulkanGraphicsEngine::CreateModels()
@@ -871,6 +1151,7 @@ namespace NVulkanEngine
 				modelTexture->CreateTexture(m_Context, model->GetModelTexturePath(), VK_FORMAT_R8G8B8A8_SRGB);
 
 				model->SetModelTexture(modelTexture);
+				model->SetModelTextureIndex(m_ResourceManager->AddBindlessTexture(m_Context, modelTexture->GetTextureImageView(), modelTexture->GetTextureFormat(), m_LinearRepeat));
 			}
 
 			model->CreateModelMeshes(m_Context);
@@ -879,9 +1160,18 @@ namespace NVulkanEngine
 		}
 
 		m_ModelManager->SetSceneBounds(sceneBounds);
+
+		// Camera and one view per shadow cascade
+		m_ModelManager->CreateObjectTransformBuffer(m_Context, 1 + MAX_SHADOW_CASCADES);
+		m_ModelManager->CreateMaterialBuffer(m_Context);
+		m_ModelManager->CreateDrawBuffers(m_Context);
+
+		m_ResourceManager->AddBindlessStorageBuffer(m_Context, EStorageBufferIndices::ObjectTransforms, m_ModelManager->GetObjectTransformBuffer(), m_ModelManager->GetObjectTransformBufferSize());
+		m_ResourceManager->AddBindlessStorageBuffer(m_Context, EStorageBufferIndices::Materials,        m_ModelManager->GetMaterialBuffer(),        m_ModelManager->GetMaterialBufferSize());
+		m_ResourceManager->AddBindlessStorageBuffer(m_Context, EStorageBufferIndices::DrawData,         m_ModelManager->GetDrawDataBuffer(),        m_ModelManager->GetDrawDataBufferSize());
 	}
 
-	void CVulkanGraphicsEngine::InitDrawNodes()
+	void CVulkanGraphicsEngine::CreateDrawNodes()
 	{
 		m_DrawNodes[(uint32_t)EDrawNodes::Geometry] = new CGeometryNode();
 		m_DrawNodes[(uint32_t)EDrawNodes::Shadows]  = new CShadowNode();
@@ -889,11 +1179,20 @@ namespace NVulkanEngine
 		m_DrawNodes[(uint32_t)EDrawNodes::Skybox]   = new CSkyNode();
 		m_DrawNodes[(uint32_t)EDrawNodes::Lighting] = new CLightingNode();
 		m_DrawNodes[(uint32_t)EDrawNodes::Debug]    = new CDebugNode();
+	}
 
+	void CVulkanGraphicsEngine::InitDrawNodes()
+	{
 		SGraphicsManagers managers{};
 		managers.m_InputManager      = m_InputManager;
 		managers.m_Modelmanager      = m_ModelManager;
-		managers.m_ResourceManager = m_ResourceManager;
+		managers.m_ResourceManager   = m_ResourceManager;
+		managers.m_LightManager      = m_LightManager;
+		managers.m_ProfilerManager   = m_ProfilerManager;
+		managers.m_PipelineManager   = m_PipelineManager;
+		managers.m_DebugManager      = m_DebugManager;
+		managers.m_RecordingManager  = m_RecordingManager;
+		managers.m_JobManager        = m_JobManager;
 
 		for (uint32_t i = 0; i < m_DrawNodes.size(); i++)
 		{
@@ -902,10 +1201,53 @@ namespace NVulkanEngine
 				drawNode->Init(m_Context, &managers);
 		}
 
-		m_PipelineManager->CreatePipelines(m_Context, m_BindlessBuffer->GetDescriptorSetLayout());
+		m_FirstAsyncComputeConsumer = (uint32_t)EDrawNodes::Count;
+		for (uint32_t i = 0; i < m_DrawNodes.size(); i++)
+		{
+			if (m_DrawNodes[i] && m_DrawNodes[i]->HasAsyncCompute())
+			{
+				m_FirstAsyncComputeConsumer = i;
+				break;
+			}
+		}
+
+		m_PipelineManager->CreatePipelines(m_Context, m_ResourceManager->GetBindlessDescriptorLayout());
 	}
 
-	void CVulkanGraphicsEngine::RecordDrawNodes(VkCommandBuffer commandBuffer)
+	void CVulkanGraphicsEngine::RecordAsyncCompute(VkCommandBuffer commandBuffer)
+	{
+		SGraphicsManagers managers{};
+		managers.m_InputManager      = m_InputManager;
+		managers.m_Modelmanager      = m_ModelManager;
+		managers.m_ResourceManager   = m_ResourceManager;
+		managers.m_LightManager      = m_LightManager;
+		managers.m_ProfilerManager   = m_ProfilerManager;
+		managers.m_PipelineManager   = m_PipelineManager;
+		managers.m_DebugManager      = m_DebugManager;
+		managers.m_RecordingManager  = m_RecordingManager;
+		managers.m_JobManager        = m_JobManager;
+
+		const bool isAsyncCompute = m_Context->IsAsyncComputeEnabled();
+
+		const float computeMarkerColor[4] = { 0.4f, 0.6f, 0.9f, 1.0f };
+		BeginMarker(m_VulkanInstance, commandBuffer, isAsyncCompute ? "Async Compute" : "Compute", computeMarkerColor);
+
+		// Timestamp queries are reset on the graphics queue so only the serial path can be timed. Compare Main Rendering instead
+		uint32_t computeTimer = isAsyncCompute ? UINT32_MAX : m_ProfilerManager->BeginTimer(commandBuffer, "Compute");
+
+		for (uint32_t i = 0; i < m_DrawNodes.size(); i++)
+		{
+			CDrawNode* drawNode = m_DrawNodes[i];
+			if (drawNode && drawNode->HasAsyncCompute())
+				drawNode->DispatchAsyncCompute(m_Context, &managers, commandBuffer);
+		}
+
+		m_ProfilerManager->EndTimer(commandBuffer, computeTimer);
+
+		EndMarker(m_VulkanInstance, commandBuffer);
+	}
+
+	void CVulkanGraphicsEngine::RecordDrawNodes(VkCommandBuffer earlyCommandBuffer, VkCommandBuffer commandBuffer)
 	{
 		SGraphicsContext context{};
 		context.m_VulkanInstance      = m_VulkanInstance;
@@ -917,20 +1259,39 @@ namespace NVulkanEngine
 		managers.m_InputManager      = m_InputManager;
 		managers.m_Modelmanager      = m_ModelManager;
 		managers.m_ResourceManager   = m_ResourceManager;
+		managers.m_LightManager      = m_LightManager;
+		managers.m_ProfilerManager   = m_ProfilerManager;
 		managers.m_PipelineManager   = m_PipelineManager;
 		managers.m_DebugManager      = m_DebugManager;
+		managers.m_RecordingManager  = m_RecordingManager;
+		managers.m_JobManager        = m_JobManager;
 
 		for (uint32_t i = 0; i < (uint32_t)EDrawNodes::Debug; i++)
 		{
 			CDrawNode* drawNode = m_DrawNodes[i];
 			if (drawNode)
+			{
+				// Everything before the first reader of the async compute results runs while async compute is still going
+				VkCommandBuffer drawNodeCommandBuffer = i < m_FirstAsyncComputeConsumer ? earlyCommandBuffer : commandBuffer;
+
+				m_ResourceManager->BeginDrawNode(i);
 				drawNode->UpdateBeforeDraw(m_VulkanDevice, &managers);
-				drawNode->Draw(m_Context, &managers, commandBuffer);
+
+				uint32_t drawNodeTimer = m_ProfilerManager->BeginTimer(drawNodeCommandBuffer, g_DrawNodeNames[i]);
+				drawNode->Draw(m_Context, &managers, drawNodeCommandBuffer);
+				m_ProfilerManager->EndTimer(drawNodeCommandBuffer, drawNodeTimer);
+			}
 		}
 
 		// Debug rendering happens after main rendering
 		m_DebugManager->Update(m_Context);
+		m_ResourceManager->BeginDrawNode((uint32_t)EDrawNodes::Debug);
+
+		uint32_t debugTimer = m_ProfilerManager->BeginTimer(commandBuffer, g_DrawNodeNames[(uint32_t)EDrawNodes::Debug]);
 		m_DrawNodes[(uint32_t)EDrawNodes::Debug]->Draw(m_Context, &managers, commandBuffer);
+		m_ProfilerManager->EndTimer(commandBuffer, debugTimer);
+
+		m_ResourceManager->BeginDrawNode((uint32_t)EDrawNodes::Count);
 	}
 
 	void CVulkanGraphicsEngine::DoImGuiViewport()
@@ -947,6 +1308,33 @@ namespace NVulkanEngine
 		if (ImGui::BeginMenu("Options"))
 		{
 			ImGui::InputFloat("Font Size", &g_ImGuiGlobalFontSize);
+
+			// Compare the Main Rendering GPU timing with this on and off
+			ImGui::BeginDisabled(!m_Context->HasAsyncComputeQueue());
+			ImGui::Checkbox("Async Compute", &g_AsyncCompute);
+			ImGui::EndDisabled();
+			if (!m_Context->HasAsyncComputeQueue())
+				ImGui::Text("No compute only queue. Compute is recorded on the graphics queue");
+
+			// Compare with g_UseDescriptorBuffers on and off
+			ImGui::Checkbox("Stream Bindless Textures", &g_StreamBindlessTextures);
+			if (g_StreamBindlessTextures)
+				ImGui::Text("%u descriptor writes: %.3f ms per frame (%s)", g_NumStreamedBindlessTextures, m_StreamingWriteTimeMs, m_Context->IsDescriptorBufferEnabled() ? "descriptor buffers" : "descriptor sets");
+
+			// Compare the Geometry and Shadows GPU timings with this on and off
+			ImGui::Checkbox("Vertex Pulling", &g_VertexPulling);
+			if (g_VertexPulling)
+				ImGui::Text("%u meshes in one indirect draw", m_ModelManager->GetNumDraws());
+
+			// Stalls the frame for a moment
+			if (ImGui::Button("Run Job Benchmark"))
+				m_JobBenchmarkResult = m_JobManager->RunBenchmark();
+			if (m_JobBenchmarkResult.m_NumThreads > 0)
+			{
+				ImGui::Text("%u threads: %.0f ns per job (%u empty jobs)", m_JobBenchmarkResult.m_NumThreads, m_JobBenchmarkResult.m_NanosecondsPerJob, m_JobBenchmarkResult.m_NumEmptyJobs);
+				ImGui::Text("ParallelFor: %.2f ms serial, %.2f ms parallel (%.1fx)", m_JobBenchmarkResult.m_SerialTimeMs, m_JobBenchmarkResult.m_ParallelTimeMs, m_JobBenchmarkResult.m_Speedup);
+			}
+
 			ImGui::EndMenu();
 		}
 
@@ -983,6 +1371,10 @@ namespace NVulkanEngine
 		static bool selected[(uint32_t)EResourceIndices::Count] = {};
 		static int selectedId = -1;
 
+		const float memorySizeMB                = m_ResourceManager->GetRenderResourceMemorySize() / (1024.0f * 1024.0f);
+		const float memorySizeWithoutAliasingMB = m_ResourceManager->GetRenderResourceMemorySizeWithoutAliasing() / (1024.0f * 1024.0f);
+		ImGui::Text("Render resource memory: %.1f MB (%.1f MB without aliasing)", memorySizeMB, memorySizeWithoutAliasingMB);
+
 		if (ImGui::CollapsingHeader("List", ImGuiTreeNodeFlags_DefaultOpen))
 		{
 			static char inputText[64] = "";
@@ -991,6 +1383,10 @@ namespace NVulkanEngine
 			{
 				SRenderResource attachment = m_ResourceManager->GetRenderResource((EResourceIndices)i);
 
+				// Optional resources that were never created
+				if (attachment.m_Image == VK_NULL_HANDLE)
+					continue;
+
 				ImGui::Selectable(attachment.m_DebugName, &selected[i]);
 				if (selected[i])
 					selectedId = i;
@@ -1004,6 +1400,8 @@ namespace NVulkanEngine
 			{
 				SRenderResource attachment = m_ResourceManager->GetRenderResource((EResourceIndices)selectedId);
 				ImGui::Text("Name: %s", attachment.m_DebugName);
+				if (m_ResourceManager->IsRenderResourceAliased((EResourceIndices)selectedId))
+					ImGui::Text("Memory is aliased. Contents might belong to another resource!");
 				static float brightness[3] = { 1.0f, 1.0f, 1.0f };
 				ImGui::SliderFloat3("Brightness", &brightness[0], 0.0f, 1.0f);
 				if (ImGui::Button("Remove Selection"))
@@ -1012,12 +1410,17 @@ namespace NVulkanEngine
 					selectedId = -1;
 				}
 
-				ImGui::Image((ImTextureID)attachment.m_ImguiDescriptor, ImVec2(ImGui::GetContentRegionAvail().x - 40.0f, ImGui::GetContentRegionAvail().y - 40.0f), ImVec2(0.0f , 0.0f), ImVec2(1.0f, 1.0f));
+				if (attachment.m_ImguiDescriptor == VK_NULL_HANDLE)
+					ImGui::Text("Transient attachment. Nothing to show!");
+				else
+					ImGui::Image((ImTextureID)attachment.m_ImguiDescriptor, ImVec2(ImGui::GetContentRegionAvail().x - 40.0f, ImGui::GetContentRegionAvail().y - 40.0f), ImVec2(0.0f , 0.0f), ImVec2(1.0f, 1.0f));
 			}
 		}
 
 		ImGui::End();
 
+		m_ProfilerManager->DrawTimings();
+
 		ImGuiIO& io = ImGui::GetIO();
 		io.FontGlobalScale = g_ImGuiGlobalFontSize;
 	}
@@ -1074,7 +1477,7 @@ namespace NVulkanEngine
 
 	void CVulkanGraphicsEngine::AddModelByFilepath(const std::string& modelpath)
 	{
-		m_ModelManager->AddModelByFilepath(modelpath);
+		m_ModelManager->AddModelFilepath(modelpath);
 	}
 
 	void CVulkanGraphicsEngine::SetModelTexture(const std::string& texturePath)
@@ -1104,6 +1507,11 @@ namespace NVulkanEngine
 		m_ModelManager->AddScaling(modelScaling);
 	}
 
+	void CVulkanGraphicsEngine::SetModelDynamic(bool isDynamic)
+	{
+		m_ModelManager->SetIsDynamic(isDynamic);
+	}
+
 	void CVulkanGraphicsEngine::PushModel()
 	{
 		m_ModelManager->PushModel();
@@ -1133,6 +1541,18 @@ namespace NVulkanEngine
 		m_LightManager->AddIntensity(intensity);
 	}
 
+	void CVulkanGraphicsEngine::SetLightColor(float r, float g, float b)
+	{
+		glm::vec3 lightColor = glm::vec3(r, g, b);
+
+		m_LightManager->AddColor(lightColor);
+	}
+
+	void CVulkanGraphicsEngine::SetLightRadius(float radius)
+	{
+		m_LightManager->AddRadius(radius);
+	}
+
 	void CVulkanGraphicsEngine::PushLight()
 	{
 		m_LightManager->PushLight();
@@ -1143,22 +1563,257 @@ namespace NVulkanEngine
 		return m_IsRunning;
 	}
 
-	static auto s_LastTime = std::chrono::high_resolution_clock::now();
+	static auto s_LastInputTime = std::chrono::high_resolution_clock::now();
 
-	void CVulkanGraphicsEngine::DrawFrame()
+	void CVulkanGraphicsEngine::StartRenderThread()
+	{
+		// Scene loading is not input time
+		s_LastInputTime = std::chrono::high_resolution_clock::now();
+
+		m_RenderThread = std::thread(&CVulkanGraphicsEngine::RenderThreadLoop, this);
+	}
+
+	void CVulkanGraphicsEngine::RenderThreadLoop()
+	{
+		// Own thread index so its per thread data, like the recording command pools, is never shared with another thread
+		m_JobManager->RegisterThread();
+
+		while (m_IsRunning)
+		{
+			DrawFrame();
+		}
+	}
+
+	void CVulkanGraphicsEngine::PollEvents()
 	{
+		// Wakes up for events or after the timeout so held keys keep moving the camera. A burst of events is handled
+		// in one go and only the state after it is published. Window drags block in here without stalling rendering
+		glfwWaitEventsTimeout(g_InputUpdateInterval);
+
 		if (glfwWindowShouldClose(m_Window))
 		{
 			m_IsRunning = false;
 			return;
 		}
-		glfwPollEvents();
+
+		// GLFW calls queued by jobs. Only allowed on the main thread
+		m_JobManager->ProcessMainThreadJobs();
+
+		auto newTime = std::chrono::high_resolution_clock::now();
+		float deltaTime = std::chrono::duration<float, std::chrono::seconds::period>(newTime - s_LastInputTime).count();
+		deltaTime       = std::min(deltaTime, g_MaxInputDeltaTime);
+		s_LastInputTime = newTime;
+
+		// What the ImGui GLFW backend would query in its NewFrame
+		int windowWidth  = 0;
+		int windowHeight = 0;
+		glfwGetWindowSize(m_Window, &windowWidth, &windowHeight);
+
+		bool hasGamepad = false;
+		{
+			std::lock_guard<std::mutex> lock(m_ImGuiInputMutex);
+			hasGamepad = AddImGuiGamepadEvents();
+		}
+
+		SFrameState& frameState = m_FrameStates.GetWriteBuffer();
+		frameState.m_CameraState      = m_InputManager->UpdateCameraState(m_Window, deltaTime);
+		frameState.m_WindowExtent     = m_WindowExtent;
+		frameState.m_DisplaySize      = glm::vec2((float)windowWidth, (float)windowHeight);
+		frameState.m_FramebufferScale = windowWidth > 0 && windowHeight > 0 ? glm::vec2((float)m_WindowExtent.width / windowWidth, (float)m_WindowExtent.height / windowHeight) : glm::vec2(1.0f, 1.0f);
+		frameState.m_HasGamepad       = hasGamepad;
+		m_FrameStates.Publish();
+	}
+
+	bool CVulkanGraphicsEngine::AddImGuiGamepadEvents()
+	{
+		ImGuiIO& io = ImGui::GetIO();
+		if ((io.ConfigFlags & ImGuiConfigFlags_NavEnableGamepad) == 0)
+			return false;
+
+		GLFWgamepadstate gamepad{};
+		if (!glfwGetGamepadState(GLFW_JOYSTICK_1, &gamepad))
+			return false;
+
+		// Same mapping as the ImGui GLFW backend. ImGui drops events that don't change anything
+		struct SGamepadButton { ImGuiKey m_Key; int m_Button; };
+		static const SGamepadButton s_Buttons[] =
+		{
+			{ ImGuiKey_GamepadStart,     GLFW_GAMEPAD_BUTTON_START        },
+			{ ImGuiKey_GamepadBack,      GLFW_GAMEPAD_BUTTON_BACK         },
+			{ ImGuiKey_GamepadFaceLeft,  GLFW_GAMEPAD_BUTTON_X            },
+			{ ImGuiKey_GamepadFaceRight, GLFW_GAMEPAD_BUTTON_B            },
+			{ ImGuiKey_GamepadFaceUp,    GLFW_GAMEPAD_BUTTON_Y            },
+			{ ImGuiKey_GamepadFaceDown,  GLFW_GAMEPAD_BUTTON_A            },
+			{ ImGuiKey_GamepadDpadLeft,  GLFW_GAMEPAD_BUTTON_DPAD_LEFT    },
+			{ ImGuiKey_GamepadDpadRight, GLFW_GAMEPAD_BUTTON_DPAD_RIGHT   },
+			{ ImGuiKey_GamepadDpadUp,    GLFW_GAMEPAD_BUTTON_DPAD_UP      },
+			{ ImGuiKey_GamepadDpadDown,  GLFW_GAMEPAD_BUTTON_DPAD_DOWN    },
+			{ ImGuiKey_GamepadL1,        GLFW_GAMEPAD_BUTTON_LEFT_BUMPER  },
+			{ ImGuiKey_GamepadR1,        GLFW_GAMEPAD_BUTTON_RIGHT_BUMPER },
+			{ ImGuiKey_GamepadL3,        GLFW_GAMEPAD_BUTTON_LEFT_THUMB   },
+			{ ImGuiKey_GamepadR3,        GLFW_GAMEPAD_BUTTON_RIGHT_THUMB  },
+		};
+
+		// Axis value from m_Start to m_End is mapped to 0 to 1
+		struct SGamepadAxis { ImGuiKey m_Key; int m_Axis; float m_Start; float m_End; };
+		static const SGamepadAxis s_Axes[] =
+		{
+			{ ImGuiKey_GamepadL2,             GLFW_GAMEPAD_AXIS_LEFT_TRIGGER,  -0.75f,  1.0f },
+			{ ImGuiKey_GamepadR2,             GLFW_GAMEPAD_AXIS_RIGHT_TRIGGER, -0.75f,  1.0f },
+			{ ImGuiKey_GamepadLStickLeft,     GLFW_GAMEPAD_AXIS_LEFT_X,        -0.25f, -1.0f },
+			{ ImGuiKey_GamepadLStickRight,    GLFW_GAMEPAD_AXIS_LEFT_X,         0.25f,  1.0f },
+			{ ImGuiKey_GamepadLStickUp,       GLFW_GAMEPAD_AXIS_LEFT_Y,        -0.25f, -1.0f },
+			{ ImGuiKey_GamepadLStickDown,     GLFW_GAMEPAD_AXIS_LEFT_Y,         0.25f,  1.0f },
+			{ ImGuiKey_GamepadRStickLeft,     GLFW_GAMEPAD_AXIS_RIGHT_X,       -0.25f, -1.0f },
+			{ ImGuiKey_GamepadRStickRight,    GLFW_GAMEPAD_AXIS_RIGHT_X,        0.25f,  1.0f },
+			{ ImGuiKey_GamepadRStickUp,       GLFW_GAMEPAD_AXIS_RIGHT_Y,       -0.25f, -1.0f },
+			{ ImGuiKey_GamepadRStickDown,     GLFW_GAMEPAD_AXIS_RIGHT_Y,        0.25f,  1.0f },
+		};
+
+		for (const SGamepadButton& button : s_Buttons)
+		{
+			io.AddKeyEvent(button.m_Key, gamepad.buttons[button.m_Button] != 0);
+		}
+
+		for (const SGamepadAxis& axis : s_Axes)
+		{
+			const float value = std::clamp((gamepad.axes[axis.m_Axis] - axis.m_Start) / (axis.m_End - axis.m_Start), 0.0f, 1.0f);
+			io.AddKeyAnalogEvent(axis.m_Key, value > 0.1f, value);
+		}
+
+		return true;
+	}
+
+	void CVulkanGraphicsEngine::SetGLFWMouseCursor(int mouseCursor)
+	{
+		// Camera or another user of the window has taken the cursor
+		if (glfwGetInputMode(m_Window, GLFW_CURSOR) == GLFW_CURSOR_DISABLED)
+			return;
+
+		if (mouseCursor == ImGuiMouseCursor_None)
+		{
+			glfwSetInputMode(m_Window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+			return;
+		}
+
+		GLFWcursor* cursor = m_MouseCursors[mouseCursor] ? m_MouseCursors[mouseCursor] : m_MouseCursors[ImGuiMouseCursor_Arrow];
+		glfwSetCursor(m_Window, cursor);
+		glfwSetInputMode(m_Window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+	}
+
+	static auto s_LastTime = std::chrono::high_resolution_clock::now();
+
+	void CVulkanGraphicsEngine::SubmitFrame()
+	{
+		m_FrameNumber++;
+
+		const bool isAsyncCompute = m_Context->IsAsyncComputeEnabled();
+
+		// Async compute overwrites its results so the previous frame has to be done reading them
+		if (isAsyncCompute)
+		{
+			const uint64_t previousFrameNumber = m_FrameNumber - 1;
+
+			VkTimelineSemaphoreSubmitInfo computeTimelineInfo{};
+			computeTimelineInfo.sType                     = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			computeTimelineInfo.waitSemaphoreValueCount   = 1;
+			computeTimelineInfo.pWaitSemaphoreValues      = &previousFrameNumber;
+			computeTimelineInfo.signalSemaphoreValueCount = 1;
+			computeTimelineInfo.pSignalSemaphoreValues    = &m_FrameNumber;
+
+			const VkPipelineStageFlags computeWaitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+			VkSubmitInfo computeSubmitInfo{};
+			computeSubmitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			computeSubmitInfo.pNext                = &computeTimelineInfo;
+			computeSubmitInfo.waitSemaphoreCount   = 1;
+			computeSubmitInfo.pWaitSemaphores      = &m_GraphicsTimeline;
+			computeSubmitInfo.pWaitDstStageMask    = &computeWaitStage;
+			computeSubmitInfo.commandBufferCount   = 1;
+			computeSubmitInfo.pCommandBuffers      = &m_ComputeCommandBuffers[m_FrameIndex];
+			computeSubmitInfo.signalSemaphoreCount = 1;
+			computeSubmitInfo.pSignalSemaphores    = &m_ComputeTimeline;
+
+			if (vkQueueSubmit(m_ComputeQueue, 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to submit commandbuffer on compute queue!");
+			}
+		}
+
+		// Early draw nodes neither touch the swapchain nor the async compute results so they can start right away
+		VkSubmitInfo earlySubmitInfo{};
+		earlySubmitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		earlySubmitInfo.commandBufferCount = 1;
+		earlySubmitInfo.pCommandBuffers    = &m_EarlyCommandBuffers[m_FrameIndex];
+
+		// Values for the binary semaphores are ignored
+		VkSemaphore          waitSemaphores[] = { m_ImageAvailableSemaphores[m_FrameIndex], m_ComputeTimeline };
+		VkPipelineStageFlags waitStages[]     = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT };
+		uint64_t             waitValues[]     = { 0, m_FrameNumber };
+
+		// Graphics timeline is signaled even without async compute so it never falls behind when async compute is turned on
+		VkSemaphore          signalSemaphores[] = { m_RenderFinishedSemaphores[m_FrameIndex], m_GraphicsTimeline };
+		uint64_t             signalValues[]     = { 0, m_FrameNumber };
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType                     = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount   = isAsyncCompute ? 2 : 1;
+		timelineInfo.pWaitSemaphoreValues      = waitValues;
+		timelineInfo.signalSemaphoreValueCount = 2;
+		timelineInfo.pSignalSemaphoreValues    = signalValues;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext                = &timelineInfo;
+		submitInfo.waitSemaphoreCount   = isAsyncCompute ? 2 : 1;
+		submitInfo.pWaitSemaphores      = waitSemaphores;
+		submitInfo.pWaitDstStageMask    = waitStages;
+		submitInfo.commandBufferCount   = 1;
+		submitInfo.pCommandBuffers      = &m_CommandBuffers[m_FrameIndex];
+		submitInfo.signalSemaphoreCount = 2;
+		submitInfo.pSignalSemaphores    = signalSemaphores;
+
+		const VkSubmitInfo submitInfos[] = { earlySubmitInfo, submitInfo };
+		VkResult result = vkQueueSubmit(m_GraphicsQueue, 2, submitInfos, m_InFlightFences[m_FrameIndex]);
+
+		if(result != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to submit commandbuffer on graphics queue!");
+		}
+	}
+
+	void CVulkanGraphicsEngine::DrawFrame()
+	{
+		// Newest state from the main thread. The previous one is used again if input has not caught up
+		m_FrameStates.Acquire();
+		const SFrameState& frameState = m_FrameStates.GetReadBuffer();
+
+		// Nothing to present to while minimized
+		if (frameState.m_WindowExtent.width == 0 || frameState.m_WindowExtent.height == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(16));
+			return;
+		}
+
+		if (frameState.m_WindowExtent.width != m_RenderWindowExtent.width || frameState.m_WindowExtent.height != m_RenderWindowExtent.height)
+		{
+			m_RenderWindowExtent  = frameState.m_WindowExtent;
+			m_NeedsResize         = true;
+			m_NewRenderResolution = frameState.m_WindowExtent;
+		}
 
 		vkWaitForFences(m_VulkanDevice, 1, &m_InFlightFences[m_FrameIndex], VK_TRUE, UINT64_MAX);
 
 		uint32_t imageIndex = 0;
 		VkResult swapchainResult = m_Swapchain->AcquireSwapchainImageIndex(m_Context, m_ImageAvailableSemaphores[m_FrameIndex], imageIndex);
 
+		// Same path as a resize but keeps the current resolution
+		if (m_ResourceManager->ConsumeResourceRecreationRequest() && !m_NeedsResize)
+		{
+			m_NeedsResize         = true;
+			m_NewRenderResolution = m_Context->GetRenderResolution();
+		}
+
 		if (m_NeedsResize)
 		{
 			ResizeFrame();
@@ -1172,77 +1827,98 @@ namespace NVulkanEngine
 		m_Context->SetDeltaTime(deltatIme);
 		m_Context->SetSwapchainImageIndex(imageIndex);
 
-		// Update camera matrix based on user input
-		m_InputManager->UpdateCameraTransforms(m_Context, deltatIme);
+		// Camera matrices from the input the main thread handled
+		m_InputManager->ApplyCameraState(m_Context, frameState.m_CameraState);
 
 		// Only reset the fence if we are clear to submit work
 		vkResetFences(m_VulkanDevice, 1, &m_InFlightFences[m_FrameIndex]);
 
-		vkResetCommandBuffer(m_CommandBuffers[m_FrameIndex], 0);
+		// Picked once per frame so all of it is recorded and submitted the same way
+		m_Context->SetAsyncComputeEnabled(g_AsyncCompute);
+		m_ModelManager->SetVertexPullingEnabled(g_VertexPulling);
+
+		VkCommandBuffer earlyCommandBuffer   = m_EarlyCommandBuffers[m_FrameIndex];
+		VkCommandBuffer commandBuffer        = m_CommandBuffers[m_FrameIndex];
+		VkCommandBuffer computeCommandBuffer = m_Context->IsAsyncComputeEnabled() ? m_ComputeCommandBuffers[m_FrameIndex] : earlyCommandBuffer;
+
+		BeginCommandBuffer(earlyCommandBuffer);
+		BeginCommandBuffer(commandBuffer);
+		if (computeCommandBuffer != earlyCommandBuffer)
+			BeginCommandBuffer(computeCommandBuffer);
 
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0; // Optional
-		beginInfo.pInheritanceInfo = nullptr; // Optional
+		// Timings from the last time this frame index was used are done since we waited for its fence
+		m_ProfilerManager->BeginFrame(m_Context, earlyCommandBuffer, m_FrameIndex);
+		m_DescriptorManager->BeginFrame(m_Context, m_FrameIndex);
+		m_RecordingManager->BeginFrame(m_Context, m_FrameIndex);
 
-		if (vkBeginCommandBuffer(m_CommandBuffers[m_FrameIndex], &beginInfo) != VK_SUCCESS)
+		if (g_StreamBindlessTextures)
 		{
-			throw std::runtime_error("failed to begin recording command buffer!");
+			// Smoothed so the number in the Options menu is readable
+			const float streamingWriteTimeMs = m_ResourceManager->StreamBindlessTextures(m_Context);
+			m_StreamingWriteTimeMs = m_StreamingWriteTimeMs * 0.95f + streamingWriteTimeMs * 0.05f;
 		}
 
-		SetViewportScissor(m_CommandBuffers[m_FrameIndex], m_Context->GetRenderResolution());
+		// Dynamic state doesn't carry over between command buffers
+		SetViewportScissor(earlyCommandBuffer, m_Context->GetRenderResolution());
+		SetViewportScissor(commandBuffer, m_Context->GetRenderResolution());
 
-		// Start the Dear ImGui frame
-		ImGui_ImplVulkan_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
+		// Start the Dear ImGui frame. Input events queued by the main thread are consumed in here. The rest of
+		// what the GLFW backend would query comes with the frame state so GLFW is never touched on this thread
+		{
+			std::lock_guard<std::mutex> lock(m_ImGuiInputMutex);
+
+			ImGuiIO& io = ImGui::GetIO();
+			io.DisplaySize             = ImVec2(frameState.m_DisplaySize.x, frameState.m_DisplaySize.y);
+			io.DisplayFramebufferScale = ImVec2(frameState.m_FramebufferScale.x, frameState.m_FramebufferScale.y);
+			io.DeltaTime               = deltatIme > 0.0f ? deltatIme : 1.0f / 60.0f;
+			if (frameState.m_HasGamepad)
+				io.BackendFlags |= ImGuiBackendFlags_HasGamepad;
+			else
+				io.BackendFlags &= ~ImGuiBackendFlags_HasGamepad;
+
+			ImGui_ImplVulkan_NewFrame();
+			ImGui::NewFrame();
+		}
 		ImGui::DockSpaceOverViewport(0, ImGui::GetMainViewport(), ImGuiDockNodeFlags_PassthruCentralNode);
 
 		// ---- Main Rendering ----
+		// Marker and timer span both graphics command buffers. They are submitted back to back on the same queue
 		const float mainRenderMarkerColor[4] = { 0.5f, 0.75f, 0.35f, 1.0f };
-		BeginMarker(m_VulkanInstance, m_CommandBuffers[m_FrameIndex], "Main Rendering", mainRenderMarkerColor);
+		BeginMarker(m_VulkanInstance, earlyCommandBuffer, "Main Rendering", mainRenderMarkerColor);
 
-		RecordDrawNodes(m_CommandBuffers[m_FrameIndex]);
+		uint32_t mainRenderTimer = m_ProfilerManager->BeginTimer(earlyCommandBuffer, "Main Rendering");
+		RecordAsyncCompute(computeCommandBuffer);
+		RecordDrawNodes(earlyCommandBuffer, commandBuffer);
+		m_ProfilerManager->EndTimer(commandBuffer, mainRenderTimer);
 
-		EndMarker(m_VulkanInstance, m_CommandBuffers[m_FrameIndex]);
+		EndMarker(m_VulkanInstance, commandBuffer);
 		// ---- Main Rendering End ----
 
 		const float ImGuiMarkerColor[4] = { 0.8f, 0.8f, 0.0f, 1.0f };
 
-		BeginMarker(m_VulkanInstance, m_CommandBuffers[m_FrameIndex], "ImGui Viewport", ImGuiMarkerColor);
+		BeginMarker(m_VulkanInstance, commandBuffer, "ImGui Viewport", ImGuiMarkerColor);
 
 		DoImGuiViewport();
 		RenderImGuiDrawData(imageIndex);
-		EndMarker(m_VulkanInstance, m_CommandBuffers[m_FrameIndex]);
 
-		if (vkEndCommandBuffer(m_CommandBuffers[m_FrameIndex]) != VK_SUCCESS)
+		// Cursor shape is a GLFW call so the main thread applies it
+		const ImGuiIO& io = ImGui::GetIO();
+		const int mouseCursor = io.MouseDrawCursor ? ImGuiMouseCursor_None : ImGui::GetMouseCursor();
+		if (mouseCursor != m_ImGuiMouseCursor && (io.ConfigFlags & ImGuiConfigFlags_NoMouseCursorChange) == 0)
 		{
-			throw std::runtime_error("failed to record command buffer!");
+			m_ImGuiMouseCursor = mouseCursor;
+			m_JobManager->RunOnMainThread([this, mouseCursor]() { SetGLFWMouseCursor(mouseCursor); });
 		}
+		EndMarker(m_VulkanInstance, commandBuffer);
 
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-		VkSemaphore waitSemaphores[] = { m_ImageAvailableSemaphores[m_FrameIndex] };
-		VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-		submitInfo.waitSemaphoreCount = 1;
-		submitInfo.pWaitSemaphores = waitSemaphores;
-		submitInfo.pWaitDstStageMask = waitStages;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &m_CommandBuffers[m_FrameIndex];
-
-		VkSemaphore signalSemaphores[] = { m_RenderFinishedSemaphores[m_FrameIndex] };
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = signalSemaphores;
-
-		VkResult result = vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, m_InFlightFences[m_FrameIndex]);
+		EndCommandBuffer(earlyCommandBuffer);
+		EndCommandBuffer(commandBuffer);
+		if (computeCommandBuffer != earlyCommandBuffer)
+			EndCommandBuffer(computeCommandBuffer);
 
-		if(result != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to submit commandbuffer on graphics queue!");
-		}
+		SubmitFrame();
 
-		m_Swapchain->Present(m_Context, signalSemaphores, imageIndex);
+		m_Swapchain->Present(m_Context, &m_RenderFinishedSemaphores[m_FrameIndex], imageIndex);
 
 		m_FrameIndex = (m_FrameIndex + 1) % g_MaxFramesInFlight;
 		m_Context->SetFrameIndex(m_FrameIndex);
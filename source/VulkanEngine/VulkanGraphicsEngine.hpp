@@ -7,6 +7,10 @@
 
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 #include <VulkanGraphicsEngineUtils.hpp>
 
 #include <DrawNodes/DrawNode.hpp>
@@ -14,11 +18,15 @@
 
 #include <GraphicsContext.hpp>
 #include <Swapchain.hpp>
+#include <TripleBuffer.hpp>
 
 #include <Managers/LightManager.hpp> // Need ELightType in header
 #include <Managers/DebugManager.hpp>
-
-#include <BindlessBuffer.hpp>
+#include <Managers/ProfilerManager.hpp>
+#include <Managers/DescriptorManager.hpp>
+#include <Managers/RecordingManager.hpp>
+#include <Managers/JobManager.hpp>
+#include <Managers/InputManager.hpp> // Need SCameraState in header
 
 class CModelManager;
 class CInputManager;
@@ -29,6 +37,18 @@ class CInputManager;
 
 namespace NVulkanEngine
 {
+    // Everything the render thread needs from the main thread for a frame. Handed over through a CTripleBuffer
+    struct SFrameState
+    {
+        SCameraState m_CameraState      = {};
+        VkExtent2D   m_WindowExtent     = { 0, 0 }; // Framebuffer size. Zero while minimized
+
+        // For ImGui. Its GLFW backend can't query these on the render thread
+        glm::vec2    m_DisplaySize      = glm::vec2(0.0f, 0.0f); // Window size in screen coordinates
+        glm::vec2    m_FramebufferScale = glm::vec2(1.0f, 1.0f);
+        bool         m_HasGamepad       = false;
+    };
+
     class CVulkanGraphicsEngine
     {
     public:
@@ -42,17 +62,25 @@ namespace NVulkanEngine
         void SetModelPosition(float x, float y, float z);
         void SetModelRotation(float x, float y, float z);
         void SetModelScaling(float x, float y, float z);
+        void SetModelDynamic(bool isDynamic);
         void PushModel();
 
         void AddLightSource(ELightType lightType);
         void SetLightPosition(float x, float y, float z);
         void SetLightDirection(float x, float y, float z);
         void SetLightIntensity(float intensity);
+        void SetLightColor(float r, float g, float b);
+        void SetLightRadius(float radius);
         void PushLight();
 
         void CreateScene();
 
-        void DrawFrame();
+        // Rendering runs on its own thread after this. The calling thread keeps GLFW and input
+        void StartRenderThread();
+
+        // Main thread. Handles window events and input and hands the result to the render thread
+        void PollEvents();
+
         bool IsRunning();
         void Cleanup();
 
@@ -79,6 +107,7 @@ namespace NVulkanEngine
 
         // Create scene
         void CreateModels();
+        void CreateDrawNodes();
         void InitDrawNodes();
         void InitManagers();
 
@@ -91,6 +120,10 @@ namespace NVulkanEngine
 
         void ResizeFrame();
 
+        // Render thread
+        void RenderThreadLoop();
+        void DrawFrame();
+
         bool CheckDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*> deviceExtensions);
         bool IsDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface, const std::vector<const char*> deviceExtensions);
 
@@ -102,16 +135,42 @@ namespace NVulkanEngine
         void     ProcessGLFWMouseInput(GLFWwindow* window, int button, int action, int mods);
         void     ResizeGLFWFrame(GLFWwindow* window, int newWidth, int newHeight);
 
-        void     RecordDrawNodes(VkCommandBuffer commandBuffer);
+        // Main thread. ImGui platform work the GLFW backend would otherwise do in its NewFrame
+        bool     AddImGuiGamepadEvents(); // Call with m_ImGuiInputMutex held. False if there is no gamepad
+        void     SetGLFWMouseCursor(int mouseCursor);
+
+        void     RecordAsyncCompute(VkCommandBuffer commandBuffer);
+        void     RecordDrawNodes(VkCommandBuffer earlyCommandBuffer, VkCommandBuffer commandBuffer);
+        void     SubmitFrame();
         void	 RenderImGuiDrawData(uint32_t imageIndex);
         void     DoImGuiViewport();
 
-        bool m_IsRunning = false;
+        std::atomic<bool> m_IsRunning = false; // Cleared by the main thread when the window closes
         bool m_NeedsResize = false;
 
+        // Main thread to render thread hand off. Input runs at its own rate so neither thread waits on the other
+        std::thread                 m_RenderThread;
+        CTripleBuffer<SFrameState>  m_FrameStates;
+        VkExtent2D                  m_WindowExtent       = { 0, 0 }; // Main thread. Set by the framebuffer size callback
+        VkExtent2D                  m_RenderWindowExtent = { 0, 0 }; // Render thread. Window size the last resize was done for
+
+        // GLFW callbacks feed ImGui input on the main thread while the render thread starts ImGui frames
+        std::mutex                  m_ImGuiInputMutex;
+        std::vector<GLFWcursor*>    m_MouseCursors       = {}; // Indexed by ImGuiMouseCursor. Created and used on the main thread
+        int                         m_ImGuiMouseCursor   = 0;  // Render thread. Last cursor sent to the main thread
+
         // Draw nodes specifies render order
         std::array<CDrawNode*, (uint32_t)EDrawNodes::Count> m_DrawNodes               = {};
 
+        // First draw node that reads async compute results. Draw nodes before it overlap the async compute work
+        uint32_t                            m_FirstAsyncComputeConsumer = (uint32_t)EDrawNodes::Count;
+
+        // Average CPU time of the bindless texture streaming test. See the Options menu
+        float                               m_StreamingWriteTimeMs      = 0.0f;
+
+        // Last result of the job benchmark in the Options menu
+        SJobBenchmarkResult                 m_JobBenchmarkResult        = {};
+
         CGraphicsContext* m_Context   = nullptr;
         CSwapchain*       m_Swapchain = nullptr;
 
@@ -122,6 +181,10 @@ namespace NVulkanEngine
         CDebugManager*                      m_DebugManager             = nullptr;
         CPipelineManager*                   m_PipelineManager          = nullptr;
         CResourceManager*                   m_ResourceManager          = nullptr;
+        CProfilerManager*                   m_ProfilerManager          = nullptr;
+        CDescriptorManager*                 m_DescriptorManager        = nullptr;
+        CRecordingManager*                  m_RecordingManager         = nullptr;
+        CJobManager*                        m_JobManager               = nullptr;
 
         /* Vulkan Primitives */
         // Device
@@ -129,15 +192,20 @@ namespace NVulkanEngine
         VkPhysicalDevice	                m_PhysicalDevice           = VK_NULL_HANDLE;
         VkDevice			                m_VulkanDevice             = VK_NULL_HANDLE;
         VkSurfaceKHR		                m_VulkanSurface            = VK_NULL_HANDLE;
+        bool                                m_IsDescriptorBufferEnabled = false; // VK_EXT_descriptor_buffer is enabled on the device
 
         // Queues
         SVulkanQueueFamilyIndices           m_QueueFamilies            = {};
         VkQueue				                m_GraphicsQueue            = VK_NULL_HANDLE;
         VkQueue				                m_PresentQueue             = VK_NULL_HANDLE;
+        VkQueue				                m_ComputeQueue             = VK_NULL_HANDLE; // Null if there is no compute only queue family
 
         // CommandBuffer
         VkCommandPool                       m_CommandPool              = VK_NULL_HANDLE;
         std::vector<VkCommandBuffer>        m_CommandBuffers           = {};
+        std::vector<VkCommandBuffer>        m_EarlyCommandBuffers      = {}; // Draw nodes before m_FirstAsyncComputeConsumer. Submitted before m_CommandBuffers
+        VkCommandPool                       m_ComputeCommandPool       = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer>        m_ComputeCommandBuffers    = {};
 
         VkSampler                           m_LinearClamp              = VK_NULL_HANDLE;
         VkSampler                           m_LinearRepeat             = VK_NULL_HANDLE;
@@ -153,7 +221,10 @@ namespace NVulkanEngine
         std::vector<VkSemaphore>            m_RenderFinishedSemaphores = {};
         std::vector<VkFence>                m_InFlightFences           = {};
 
-        CBindlessBuffer*                    m_BindlessBuffer            = nullptr;
+        // Timeline semaphores between the graphics and async compute queue. Both are signaled with the frame number
+        VkSemaphore                         m_GraphicsTimeline         = VK_NULL_HANDLE;
+        VkSemaphore                         m_ComputeTimeline          = VK_NULL_HANDLE;
+        uint64_t                            m_FrameNumber              = 0;
 
         // Misc
         VkDebugUtilsMessengerEXT            m_DebugMessenger           = VK_NULL_HANDLE;
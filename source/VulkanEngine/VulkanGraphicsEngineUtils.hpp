@@ -41,6 +41,11 @@ namespace NVulkanEngine
 		VkDeviceMemory            m_Memory               = VK_NULL_HANDLE;
 		VkDescriptorSet           m_ImguiDescriptor      = VK_NULL_HANDLE;
 		VkRenderingAttachmentInfo m_RenderAttachmentInfo = {};
+		VkExtent2D                m_Extent               = { 0, 0 };
+
+		// Array resources get a 2D array view in m_ImageView and one view per layer for rendering into
+		uint32_t                  m_LayerCount           = 1;
+		std::vector<VkImageView>  m_LayerImageViews      = {};
 	};
 
 	struct SUniformBufferResource
@@ -114,6 +119,7 @@ namespace NVulkanEngine
 	{
 		std::optional<uint32_t> m_GraphicsFamily;
 		std::optional<uint32_t> m_PresentFamily;
+		std::optional<uint32_t> m_ComputeFamily; // Compute only family for async compute. Not all devices have one
 
 		bool IsComplete()
 		{
@@ -137,16 +143,23 @@ namespace NVulkanEngine
 			VkBool32 presentSupport = false;
 			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 
-			if (presentSupport)
+			// Keep searching for a compute family once graphics and present are found but don't replace them
+			if (presentSupport && !indices.IsComplete())
 			{
 				indices.m_PresentFamily = i;
 			}
-			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.IsComplete())
 			{
 				indices.m_GraphicsFamily = i;
 			}
 
-			if (indices.IsComplete())
+			// A family without graphics support is usually backed by separate hardware queues that can run alongside rasterization
+			if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.m_ComputeFamily.has_value())
+			{
+				indices.m_ComputeFamily = i;
+			}
+
+			if (indices.IsComplete() && indices.m_ComputeFamily.has_value())
 			{
 				break;
 			}
@@ -366,19 +379,40 @@ namespace NVulkanEngine
 		vkFreeCommandBuffers(context->GetLogicalDevice(), context->GetCommandPool(), 1, &commandBuffer);
 	}
 
+	// Resources used on both the graphics and the async compute queue are shared concurrently so they never need queue ownership transfers
+	template<typename TCreateInfo>
+	static void SetSharingMode(CGraphicsContext* context, TCreateInfo& createInfo, bool isSharedWithCompute)
+	{
+		if (isSharedWithCompute && context->HasAsyncComputeQueue())
+		{
+			createInfo.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+			createInfo.queueFamilyIndexCount = 2;
+			createInfo.pQueueFamilyIndices   = context->GetQueueFamilyIndices();
+		}
+		else
+		{
+			createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		}
+	}
+
 	static VkBuffer CreateBuffer(
 		CGraphicsContext*     context,
 		VkDeviceMemory&       bufferMemory,
 		VkDeviceSize          size,
 		VkBufferUsageFlags    usage,
-		VkMemoryPropertyFlags properties)
+		VkMemoryPropertyFlags properties,
+		bool                  isSharedWithCompute = false)
 	{
+		// Descriptor buffers point at uniform and storage buffers by their address
+		if (usage & (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
+			usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
 		VkBufferCreateInfo bufferInfo{};
 
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferInfo.usage = usage;
 		bufferInfo.size = size;
-		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		SetSharingMode(context, bufferInfo, isSharedWithCompute);
 
 		VkBuffer buffer;
 
@@ -395,6 +429,12 @@ namespace NVulkanEngine
 		allocInfo.allocationSize = memoryRequirements.size;
 		allocInfo.memoryTypeIndex = FindMemoryType(context->GetPhysicalDevice(), memoryRequirements.memoryTypeBits, properties);
 
+		VkMemoryAllocateFlagsInfo allocFlagsInfo{};
+		allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+		allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+		if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
+			allocInfo.pNext = &allocFlagsInfo;
+
 		if (vkAllocateMemory(context->GetLogicalDevice(), &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
 		{
 			throw std::runtime_error("failed to allocate vertex buffer memory!");
@@ -405,6 +445,16 @@ namespace NVulkanEngine
 		return buffer;
 	}
 
+	// Buffer has to be created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+	static VkDeviceAddress GetBufferDeviceAddress(CGraphicsContext* context, VkBuffer buffer)
+	{
+		VkBufferDeviceAddressInfo addressInfo{};
+		addressInfo.sType  = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+		addressInfo.buffer = buffer;
+
+		return vkGetBufferDeviceAddress(context->GetLogicalDevice(), &addressInfo);
+	}
+
 	static void CopyBuffer(CGraphicsContext* context, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
 	{
 		VkCommandBuffer commandBuffer = BeginSingleTimeCommands(context);
@@ -448,14 +498,21 @@ namespace NVulkanEngine
 		CopyBuffer(context, genericStagingBuffer, genericBuffer, sizeOfData);
 	}
 
-	static VkBuffer CreateUniformBuffer(CGraphicsContext* context, VkDeviceMemory& bufferMemory, VkDeviceSize size)
+	static VkBuffer CreateUniformBuffer(CGraphicsContext* context, VkDeviceMemory& bufferMemory, VkDeviceSize size, bool isSharedWithCompute = false)
 	{
-		VkBuffer buffer = CreateBuffer(context, bufferMemory, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		VkBuffer buffer = CreateBuffer(context, bufferMemory, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, isSharedWithCompute);
 		return buffer;
 	}
 
-	static VkImage CreateImage(
-		CGraphicsContext* context,
+	static VkBuffer CreateStorageBuffer(CGraphicsContext* context, VkDeviceMemory& bufferMemory, VkDeviceSize size, VkMemoryPropertyFlags properties, bool isSharedWithCompute = false)
+	{
+		VkBuffer buffer = CreateBuffer(context, bufferMemory, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, properties, isSharedWithCompute);
+		return buffer;
+	}
+
+	// Creates the image without any memory backing it. Caller is responsible for binding memory before use
+	static VkImage CreateUnboundImage(
+		CGraphicsContext*     context,
 		uint32_t              width,
 		uint32_t              height,
 		uint32_t              mipLevels,
@@ -463,8 +520,8 @@ namespace NVulkanEngine
 		VkFormat              format,
 		VkImageTiling         tiling,
 		VkImageUsageFlags     usage,
-		VkMemoryPropertyFlags properties,
-		VkDeviceMemory& imageMemory)
+		uint32_t              arrayLayers = 1,
+		bool                  isSharedWithCompute = false)
 	{
 		VkImage image;
 
@@ -476,17 +533,35 @@ namespace NVulkanEngine
 		imageInfo.extent.depth = 1;
 		imageInfo.mipLevels = mipLevels;
 		imageInfo.samples = numSamples;
-		imageInfo.arrayLayers = 1;
+		imageInfo.arrayLayers = arrayLayers;
 		imageInfo.format = format;
 		imageInfo.tiling = tiling;
 		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		imageInfo.usage = usage;
-		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		SetSharingMode(context, imageInfo, isSharedWithCompute);
 
 		if (vkCreateImage(context->GetLogicalDevice(), &imageInfo, nullptr, &image) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create image!");
 		}
 
+		return image;
+	}
+
+	static VkImage CreateImage(
+		CGraphicsContext* context,
+		uint32_t              width,
+		uint32_t              height,
+		uint32_t              mipLevels,
+		VkSampleCountFlagBits numSamples,
+		VkFormat              format,
+		VkImageTiling         tiling,
+		VkImageUsageFlags     usage,
+		VkMemoryPropertyFlags properties,
+		VkDeviceMemory& imageMemory,
+		bool            isSharedWithCompute = false)
+	{
+		VkImage image = CreateUnboundImage(context, width, height, mipLevels, numSamples, format, tiling, usage, 1, isSharedWithCompute);
+
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(context->GetLogicalDevice(), image, &memRequirements);
 
@@ -532,18 +607,26 @@ namespace NVulkanEngine
 		EndSingleTimeCommands(context, commandBuffer);
 	}
 
-	static VkImageView CreateImageView(CGraphicsContext* context, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
+	static VkImageView CreateImageView(
+		CGraphicsContext*  context,
+		VkImage            image,
+		VkFormat           format,
+		VkImageAspectFlags aspectFlags,
+		uint32_t           mipLevels,
+		VkImageViewType    viewType       = VK_IMAGE_VIEW_TYPE_2D,
+		uint32_t           baseArrayLayer = 0,
+		uint32_t           layerCount     = 1)
 	{
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 		viewInfo.image = image;
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.viewType = viewType;
 		viewInfo.format = format;
 		viewInfo.subresourceRange.aspectMask = aspectFlags;
 		viewInfo.subresourceRange.baseMipLevel = 0;
 		viewInfo.subresourceRange.levelCount = mipLevels;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
-		viewInfo.subresourceRange.layerCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = baseArrayLayer;
+		viewInfo.subresourceRange.layerCount = layerCount;
 
 		VkImageView imageView;
 		if (vkCreateImageView(context->GetLogicalDevice(), &viewInfo, nullptr, &imageView) != VK_SUCCESS)
@@ -571,13 +654,14 @@ namespace NVulkanEngine
 		barrier.subresourceRange.baseMipLevel = 0;
 		barrier.subresourceRange.levelCount = mipLevels;
 		barrier.subresourceRange.baseArrayLayer = 0;
-		barrier.subresourceRange.layerCount = 1;
+		barrier.subresourceRange.layerCount = renderAttachment.m_LayerCount;
 
 		VkPipelineStageFlags sourceStage;
 		VkPipelineStageFlags destinationStage;
 
 		bool depthLayout = renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL ||
-			renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+			renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL ||
+			(renderAttachment.m_ImageUsage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT); // Transfer layouts don't say anything about the aspect
 
 		if (depthLayout)
 		{
@@ -695,11 +779,12 @@ namespace NVulkanEngine
 		else if ((renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
 				&& (newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL))
 		{
+			// Read only depth can still be used for depth testing
 			barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
 
-			sourceStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-			destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			sourceStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+			destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 		}
 		else if (renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
 		{
@@ -726,6 +811,24 @@ namespace NVulkanEngine
 			sourceStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 			destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
 		}
+		else if ((renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL || renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL)
+				&& (newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL))
+		{
+			barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+			sourceStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		}
+		else if ((renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL || renderAttachment.m_CurrentImageLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+				&& (newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL || newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL))
+		{
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+			sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+			destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+		}
 		else
 		{
 			std::cout << "Transition Image Layout failed due to unsupported layout transition!" << std::endl;
@@ -774,30 +877,25 @@ namespace NVulkanEngine
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 	}
 
+	// Image needs to be bound to memory already. Creates the view and attachment info and moves the image to its initial layout
 	static SRenderResource CreateRenderResource
 	(
 		CGraphicsContext* context,
+		VkImage           image,
+		VkDeviceMemory    memory,
 		VkFormat          format,
 		VkImageUsageFlags usage,
 		VkImageLayout     imageLayout,
-		uint32_t          width,
-		uint32_t          height
+		VkImageViewType   viewType   = VK_IMAGE_VIEW_TYPE_2D,
+		uint32_t          layerCount = 1
 	)
 	{
 		SRenderResource renderAttachment{};
 		renderAttachment.m_Format = format;
 		renderAttachment.m_ImageUsage = usage;
-		renderAttachment.m_Image = CreateImage(
-			context,
-			width,
-			height,
-			1,
-			VK_SAMPLE_COUNT_1_BIT,
-			format,
-			VK_IMAGE_TILING_OPTIMAL,
-			usage,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			renderAttachment.m_Memory);
+		renderAttachment.m_Image = image;
+		renderAttachment.m_Memory = memory;
+		renderAttachment.m_LayerCount = layerCount;
 
 		VkClearValue clearValue{};
 		VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_NONE_KHR;
@@ -818,7 +916,19 @@ namespace NVulkanEngine
 			renderAttachment.m_Image,
 			format,
 			aspectFlags,
-			1);
+			1,
+			viewType,
+			0,
+			layerCount);
+
+		// Can only render into one layer at a time
+		if (viewType == VK_IMAGE_VIEW_TYPE_2D_ARRAY)
+		{
+			for (uint32_t i = 0; i < layerCount; i++)
+			{
+				renderAttachment.m_LayerImageViews.push_back(CreateImageView(context, renderAttachment.m_Image, format, aspectFlags, 1, VK_IMAGE_VIEW_TYPE_2D, i, 1));
+			}
+		}
 
 		VkRenderingAttachmentInfo renderInfo{};
 		renderInfo.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;